@@ -90,30 +90,30 @@ int	channeldumper_Unload(int module_unload)
 	return MOD_SUCCESS;
 }
 
+static void channeldump_channel(aChannel *chptr, FILE *f)
+{
+	Member	*m;
+
+	if (SecretChannel(chptr))
+		return;
+ 	fprintf(f, "C %s %s\r\n", 
+ 		chptr->chname, chptr->topic ? chptr->topic : "");
+	for (m = chptr->members; m; m = m->next)
+		fprintf(f, "M %s\r\n",
+			m->cptr->name);   			
+}
+
 EVENT(e_channeldump)
 {
 	aChannel *chptr;
-	unsigned int hashnum;
-	Member	*m;
 	FILE	*f;
 	
 	f = fopen("ircd.channeldump", "w");
 	if (!f)
 		return;
-	for (hashnum = 0; hashnum < CH_MAX; hashnum++)
-	{
-		for (chptr = (aChannel *)hash_get_chan_bucket(hashnum); chptr; chptr
-			= chptr->hnextch)
-		{
-			if (SecretChannel(chptr))
-				continue;
-		 	fprintf(f, "C %s %s\r\n", 
-		 		chptr->chname, chptr->topic ? chptr->topic : "");
-			for (m = chptr->members; m; m = m->next)
-				fprintf(f, "M %s\r\n",
-					m->cptr->name);   			
-		}
-	}
+	for (chptr = chandir_find(CHANDIR_BYNAME, 0, "", 0); chptr;
+	     chptr = chandir_next(CHANDIR_BYNAME, chptr))
+		channeldump_channel(chptr, f);
 	fclose(f);
 	return;
 }
@@ -13,4 +13,20 @@
 #define PATTERN		"\\w*%s\\w*"
 #define REPLACEWORD	"<censored>"
 
+/*
+ * Multi-pattern badword matcher, see src/badwords.c.
+ *
+ * Words are added with badword_matcher_add() and compiled on first use
+ * (or explicitly with badword_matcher_build()); adding another word
+ * after that recompiles on the next use.
+ */
+typedef struct badword_matcher BadwordMatcher;
+
+extern BadwordMatcher *badword_matcher_new(void);
+extern void badword_matcher_free(BadwordMatcher *);
+extern void badword_matcher_add(BadwordMatcher *, const char *word, const char *replace);
+extern void badword_matcher_build(BadwordMatcher *);
+extern int badword_matcher_count(BadwordMatcher *);
+extern char *badword_matcher_replace(BadwordMatcher *, char *text, char *buf, size_t buflen);
+
 #endif
@@ -70,9 +70,13 @@
  * So, the way this works is we determine using the preprocessor
  * what polling backend to use for the eventloop.  We prefer epoll,
  * followed by kqueue, followed by poll, and then finally select.
+ * io_uring is only used when asked for (./configure --enable-io_uring).
  * Kind of ugly, but it gets the job done.  You can also fiddle with
  * this to determine what backend is used.
  */
+#ifdef HAVE_IO_URING
+# define BACKEND_IOURING
+#else
 # ifdef HAVE_EPOLL
 #  define BACKEND_EPOLL
 # else
@@ -86,6 +90,7 @@
 #   endif
 #  endif
 # endif
+#endif
 
 /* Define the ircd module suffix, should be .so */
 # define MODULE_SUFFIX	".so"
@@ -146,17 +151,14 @@
 #undef SOCALLEDSMARTBANNING
 
 /*
-** Freelinks garbage collector -Stskeeps
+** Memory pool garbage collector -Stskeeps
 **
 ** GARBAGE_COLLECT_EVERY - how many seconds between every garbage collect
-** HOW_MANY_FREELINKS_ALLOWED - how many freelinks allowed
 */
 #ifndef GARBAGE_COLLECT_EVERY
 #define GARBAGE_COLLECT_EVERY 		600	/* default: 600 (10 mins) */
 #endif
 
-#define HOW_MANY_FREELINKS_ALLOWED 	200	/* default: 200 */
-
 /*
  * MAXUNKNOWNCONNECTIONSPERIP
 */
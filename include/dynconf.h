@@ -115,6 +115,7 @@ struct zConfiguration {
 	OperStat *oper_only_stats_ext;
 	int  maxchannelsperuser;
 	int  maxdccallow;
+	int  whowas_history_length;
 	int  anti_spam_quit_message_time;
 	char *egd_path;
 	char *static_quit;
@@ -127,6 +128,10 @@ struct zConfiguration {
 	long ssl_options;
 	int ssl_renegotiate_bytes;
 	int ssl_renegotiate_timeout;
+	int ssl_session_cache_size;
+	long ssl_session_timeout;
+	char *ssl_ticket_key_file;
+	long ssl_ticket_key_rotate;
 	enum UHAllowed userhost_allowed;
 	char *restrict_usermodes;
 	char *restrict_channelmodes;
@@ -145,9 +150,13 @@ struct zConfiguration {
 	long nick_period;
 	int ident_connect_timeout;
 	int ident_read_timeout;
+	int ident_max_queries;
+	int ident_cache_time;
 	long default_bantime;
 	int who_limit;
 	int silence_limit;
+	int io_threads;
+	int intake_workers;
 	unsigned char modef_default_unsettime;
 	unsigned char modef_max_unsettime;
 	long ban_version_tkl_time;
@@ -192,6 +201,7 @@ extern MODVAR aConfiguration iConf;
 #define ALLOW_CHATOPS			iConf.allow_chatops
 #define MAXCHANNELSPERUSER		iConf.maxchannelsperuser
 #define MAXDCCALLOW			iConf.maxdccallow
+#define WHOWAS_HISTORY_LENGTH		iConf.whowas_history_length
 #define WEBTV_SUPPORT			iConf.webtv_support
 #define DONT_RESOLVE			iConf.dont_resolve
 #define AUTO_JOIN_CHANS			iConf.auto_join_chans
@@ -251,6 +261,8 @@ extern MODVAR aConfiguration iConf;
 
 #define IDENT_CONNECT_TIMEOUT	iConf.ident_connect_timeout
 #define IDENT_READ_TIMEOUT		iConf.ident_read_timeout
+#define IDENT_MAX_QUERIES		iConf.ident_max_queries
+#define IDENT_CACHE_TIME		iConf.ident_cache_time
 
 #define MKPASSWD_FOR_EVERYONE	iConf.mkpasswd_for_everyone
 #define ALLOW_INSANE_BANS		iConf.allow_insane_bans
@@ -258,6 +270,8 @@ extern MODVAR aConfiguration iConf;
 
 #define DEFAULT_BANTIME			iConf.default_bantime
 #define WHOLIMIT			iConf.who_limit
+#define IO_THREADS			iConf.io_threads
+#define INTAKE_WORKERS			iConf.intake_workers
 
 #define MODEF_DEFAULT_UNSETTIME	iConf.modef_default_unsettime
 #define MODEF_MAX_UNSETTIME		iConf.modef_max_unsettime
@@ -331,6 +345,7 @@ struct SetCheck {
 	unsigned has_oper_only_stats:1;
 	unsigned has_maxchannelsperuser:1;
 	unsigned has_maxdccallow:1;
+	unsigned has_whowas_history_length:1;
 	unsigned has_anti_spam_quit_message_time:1;
 	unsigned has_egd_path:1;
 	unsigned has_static_quit:1;
@@ -342,6 +357,10 @@ struct SetCheck {
 	unsigned has_ssl_dh:1;
 	unsigned has_renegotiate_timeout : 1;
 	unsigned has_renegotiate_bytes : 1;
+	unsigned has_ssl_session_cache_size:1;
+	unsigned has_ssl_session_timeout:1;
+	unsigned has_ssl_ticket_key_file:1;
+	unsigned has_ssl_ticket_key_rotate:1;
 	unsigned has_allow_userhost_change:1;
 	unsigned has_restrict_usermodes:1;
 	unsigned has_restrict_channelmodes:1;
@@ -359,11 +378,15 @@ struct SetCheck {
 	unsigned has_anti_flood_nick_flood:1;
 	unsigned has_ident_connect_timeout:1;
 	unsigned has_ident_read_timeout:1;
+	unsigned has_ident_max_queries:1;
+	unsigned has_ident_cache_time:1;
 	unsigned has_default_bantime:1;
 	unsigned has_who_limit:1;
 	unsigned has_maxbans:1;
 	unsigned has_maxbanlength:1;
 	unsigned has_silence_limit:1;
+	unsigned has_io_threads:1;
+	unsigned has_intake_workers:1;
 	unsigned has_modef_default_unsettime:1;
 	unsigned has_modef_max_unsettime:1;
 	unsigned has_ban_version_tkl_time:1;
@@ -6,6 +6,7 @@
 #define FD_DESC_SZ	(100)
 
 typedef void (*IOCallbackFunc)(int fd, int revents, void *data);
+typedef void (*IORecvFunc)(int fd, char *buf, int length, void *data);
 
 typedef struct fd_entry {
 	int fd;
@@ -14,27 +15,73 @@ typedef struct fd_entry {
 	unsigned char read_oneshot;
 	IOCallbackFunc write_callback;
 	unsigned char write_oneshot;
+	IORecvFunc recv_callback;	/* see fd_setrecv() */
 	void *data;
 	time_t deadline;
 	unsigned char is_open;
+	unsigned char type;
+	unsigned char edge;		/* FD_SELECT_EDGE was given */
 	unsigned int backend_flags;
 } FDEntry;
 
+/* What an fd is used for, only used to break down the loop statistics */
+#define FD_TYPE_OTHER		0
+#define FD_TYPE_LISTENER	1
+#define FD_TYPE_CLIENT		2
+#define FD_TYPE_SERVER		3
+#define FD_TYPE_DNS		4
+#define FD_TYPE_IDENT		5
+#define FD_TYPE_MAX		6
+
 extern MODVAR FDEntry fd_table[MAXCONNECTIONS + 1];
 
 extern int fd_open(int fd, const char *desc);
 extern void fd_close(int fd);
+extern void fd_unmap(int fd);
 extern int fd_socket(int family, int type, int protocol, const char *desc);
-extern int fd_accept(int sockfd);
+extern int fd_accept(int sockfd, struct SOCKADDR *addr, int *addrlen);
 extern void fd_desc(int fd, const char *desc);
+extern void fd_settype(int fd, int type);
 extern int fd_fileopen(const char *path, unsigned int flags);
 
 #define FD_SELECT_READ		0x1
 #define FD_SELECT_WRITE		0x2
 #define FD_SELECT_ONESHOT	0x4
+#define FD_SELECT_EDGE		0x8	/* the read callback reads until EAGAIN, edge triggered events are fine */
 
 extern void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data);
 extern void fd_select(time_t delay);		/* backend-specific */
 extern void fd_refresh(int fd);			/* backend-specific */
+extern int fd_setrecv(int fd, IORecvFunc rcb, void *data);	/* backend-specific */
+#ifdef BACKEND_IOURING
+struct msghdr;
+extern void fd_sendmsgs(int *fds, struct msghdr *msgs, int *res, int n);
+#endif
+
+/*
+ * Event loop statistics (/STATS z).  Bucket i of a histogram counts the
+ * values v with 2^(i-1) <= v < 2^i, bucket 0 counts zeroes and the last
+ * bucket everything that does not fit.  Times are in microseconds.
+ */
+#define LOOPHIST_BUCKETS	24
+
+typedef struct loop_histogram {
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long bucket[LOOPHIST_BUCKETS];
+} LoopHistogram;
+
+struct loop_stats {
+	LoopHistogram iteration;	/* one pass of the main loop, minus the wait */
+	LoopHistogram wait;		/* time blocked in select/poll/epoll_wait/kevent */
+	LoopHistogram ready;		/* fds returned by one wait */
+	LoopHistogram events;		/* time in DoEvents() */
+	LoopHistogram callback[FD_TYPE_MAX];	/* I/O callbacks, by fd type */
+	unsigned long long lastwait;	/* nsecs of the last wait, see ircd.c */
+};
+
+extern MODVAR struct loop_stats loopstats;
+extern void loophist_add(LoopHistogram *hist, unsigned long long value);
 
 #endif
@@ -34,11 +34,9 @@ extern MODVAR int tainted;
 extern char *getreply(int);
 #define rpl_str(x) getreply(x)
 #define err_str(x) getreply(x)
-extern MODVAR Member *freemember;
-extern MODVAR Membership *freemembership;
-extern MODVAR MembershipL *freemembershipL;
 extern MODVAR aClient me;
 extern MODVAR aChannel *channel;
+extern MODVAR unsigned long channel_member_changes;
 extern MODVAR struct stats *ircstp;
 extern MODVAR int bootopt;
 extern MODVAR time_t timeofday;
@@ -114,6 +112,7 @@ int match_ip(struct IN_ADDR addr, char *uhost, char *mask, struct irc_netmask *n
 #ifdef INET6
 int match_ipv6(struct IN_ADDR *addr, struct IN_ADDR *mask, int bits);
 #endif
+int match_ipv4(struct IN_ADDR *addr, struct IN_ADDR *mask, int bits);
 ConfigItem_ban  *Find_ban_ip(aClient *sptr);
 void add_ListItem(ListStruct *, ListStruct **);
 ListStruct *del_ListItem(ListStruct *, ListStruct **);
@@ -158,11 +157,14 @@ extern void check_tkls(void);
 extern void del_invite(aClient *, aChannel *);
 extern int add_silence(aClient *, char *, int);
 extern int del_silence(aClient *, char *);
+extern Link *find_silence(aClient *, aClient *);
+extern void free_silence_index(anUser *);
 extern void send_user_joins(aClient *, aClient *);
 extern void clean_channelname(char *);
 extern int do_nick_name(char *);
 extern int do_remote_nick_name(char *);
 extern int can_send(aClient *, aChannel *, char *, int);
+extern const char *cantsend_strerror(uint32_t);
 extern long get_access(aClient *, aChannel *);
 extern int is_chan_op(aClient *, aChannel *);
 extern int has_voice(aClient *, aChannel *);
@@ -208,7 +210,7 @@ extern int debuglevel, errno, h_errno;
 extern MODVAR int OpenFiles;  /* number of files currently open */
 extern MODVAR int debuglevel, portnum, debugtty, maxusersperchannel;
 extern MODVAR int readcalls, udpfd, resfd;
-extern aClient *add_connection(ConfigItem_listen *, int);
+extern aClient *add_connection(ConfigItem_listen *, int, struct SOCKADDR_IN *, IntakeLookup *);
 extern int add_listener(aConfItem *);
 extern void add_local_domain(char *, int);
 extern int check_client(aClient *, char *);
@@ -227,6 +229,11 @@ extern int verify_hostname(char *name);
 
 extern void report_error(char *, aClient *);
 extern void set_non_blocking(int, aClient *);
+extern void set_class_sock_opts(aClient *, ConfigItem_class *, ConfigItem_link *);
+extern void burst_begin(aClient *);
+extern void burst_end(aClient *);
+extern void burst_drained(aClient *);
+extern void metrics_accept(ConfigItem_listen *, int);
 extern int setup_ping();
 
 extern void start_auth(aClient *);
@@ -239,6 +246,24 @@ extern void terminate(), write_pidfile();
 extern void *MyMallocEx(size_t size);
 extern int advanced_check(char *userhost, int ipstat);
 extern int send_queued(aClient *);
+extern void send_queued_wait(aClient *);
+extern void send_queued_flush(void);
+extern int dead_link(aClient *, char *);
+extern int read_packet_data(aClient *, char *, int);
+extern void ioth_init(void);
+extern int ioth_attach(aClient *);
+extern int ioth_queue(aClient *, struct iovec *, int, int);
+extern void ioth_detach(aClient *);
+extern void ioth_release(aClient *, void (*)(aClient *));
+extern void ioth_flush(void);
+extern void stats_iothreads(aClient *);
+extern int check_peer_banip(struct SOCKADDR_IN *);
+extern void accept_connection(ConfigItem_listen *, int, struct SOCKADDR_IN *, IntakeLookup *);
+extern int intake_listener(ConfigItem_listen *);
+extern void intake_init(void);
+extern void intake_rehash(void);
+extern void stats_intake(aClient *);
+extern MODVAR int current_serial;
 /* i know this is naughty but :P --stskeeps */
 extern void sendto_locfailops(char *pattern, ...) __attribute__((format(printf,1,2)));
 extern void sendto_connectnotice(char *nick, anUser *user, aClient *sptr, int disconnect, char *comment);
@@ -264,6 +289,8 @@ extern void sendto_channel_butserv_butone(aChannel *chptr, aClient *from, aClien
 extern void sendto_common_channels(aClient *, char *, ...) __attribute__((format(printf,2,3)));
 extern void sendto_common_channels_local_butone(aClient *, int, char *, ...) __attribute__((format(printf,3,4)));
 extern void sendto_channel_butserv(aChannel *, aClient *, char *, ...) __attribute__((format(printf,3,4)));
+extern int channel_local_members(aChannel *, aClient ***, int *);
+extern void sendto_local_members(aClient **, int, aClient *, char *, ...) __attribute__((format(printf,4,5)));
 extern void sendto_match_servs(aChannel *, aClient *, char *, ...) __attribute__((format(printf,3,4)));
 extern void sendto_match_butone(aClient *, aClient *, char *, int,
     char *pattern, ...) __attribute__((format(printf,5,6)));
@@ -285,6 +312,8 @@ extern void sendnotice(aClient *to, char *pattern, ...) __attribute__((format(pr
 extern void sendto_server(aClient *one, unsigned long caps, unsigned long nocaps, const char *format, ...) __attribute__((format(printf, 4,5)));
 
 extern int deliver_it(aClient *, char *, int);
+extern int deliver_iov(aClient *, struct iovec *, int);
+extern void count_sent(aClient *, int);
 extern int  check_for_chan_flood(aClient *cptr, aClient *sptr, aChannel *chptr);
 extern int  check_for_target_limit(aClient *sptr, void *target, const char *name);
 extern char *canonize(char *buffer);
@@ -295,6 +324,7 @@ extern int check_registered_user(aClient *);
 extern char *get_client_name(aClient *, int);
 extern char *get_client_host(aClient *);
 extern char *myctime(time_t), *date(time_t);
+extern unsigned long long profile_clock(void);
 extern int exit_client(aClient *, aClient *, aClient *, char *);
 extern void initstats(), tstats(aClient *, char *);
 extern char *check_string(char *);
@@ -327,6 +357,9 @@ extern int find_str_match_link(Link *, char *);
 extern void free_str_list(Link *);
 extern Link *make_link();
 extern Ban *make_ban();
+extern aTKline *make_tkl(void);
+extern void free_tkl(aTKline *);
+extern void init_channel_pools(void);
 extern anUser *make_user(aClient *);
 extern aClass *make_class();
 extern aServer *make_server();
@@ -362,7 +395,38 @@ extern int hash_check_watch(aClient *, int);
 extern int hash_del_watch_list(aClient *);
 extern void count_watch_memory(int *, u_long *);
 extern aWatch *hash_get_watch(char *);
-extern aChannel *hash_get_chan_bucket(unsigned int);
+/* chandir.c */
+#define CHANDIR_BYNAME	0
+#define CHANDIR_BYUSERS	1
+extern void chandir_add(aChannel *);
+extern void chandir_del(aChannel *);
+extern void chandir_update(aChannel *);
+extern aChannel *chandir_find(int, unsigned short, const char *, int);
+extern aChannel *chandir_next(int, aChannel *);
+extern void count_chandir_memory(int *, u_long *);
+/* userindex.c */
+#define USERINDEX_NICK		0x01
+#define USERINDEX_USER		0x02
+#define USERINDEX_REALHOST	0x04
+#define USERINDEX_VIRTHOST	0x08
+#define USERINDEX_IP		0x10
+extern void userindex_add(aClient *);
+extern void userindex_del(aClient *);
+extern void userindex_update(aClient *);
+extern aClient **userindex_search(const char *, int, int *);
+extern aClient **userindex_search_ip(struct irc_netmask *, int, int *);
+extern void count_userindex_memory(int *, u_long *);
+/* msgtext.c */
+extern MODVAR MessageText *msgtext_current;
+extern void msgtext_init(MessageText *, char *);
+extern MessageText *msgtext_for(char *);
+extern MessageText *msgtext_enter(MessageText *, char *);
+extern void msgtext_restore(MessageText *);
+extern int msgtext_flags(MessageText *);
+extern char *msgtext_nocolors(MessageText *);
+extern char *msgtext_nocodes(MessageText *);
+extern MODVAR HashTable *hashtables[];
+extern void hashtable_chainstats(HashTable *, unsigned int *, unsigned int *);
 extern aClient *hash_find_client(const char *, aClient *);
 extern aClient *hash_find_id(const char *, aClient *);
 extern aClient *hash_find_nickserver(const char *, aClient *);
@@ -463,6 +527,8 @@ char	*Inet_ia2pNB(struct IN_ADDR *ia, int compressed);
 */
 extern MODVAR aCommand *CommandHash[256];
 extern void	init_CommandHash(void);
+extern MODVAR unsigned long commands_deleted;
+extern MODVAR unsigned long long sendq_bytes;
 extern aCommand *add_Command_backend(char *cmd, int (*func)(), unsigned char parameters, int flags);
 extern void	add_Command(char *cmd, int (*func)(), unsigned char parameters);
 extern void	add_Command_to_list(aCommand *item, aCommand **list);
@@ -540,6 +606,12 @@ extern u_int32_t getrandom32(void);
 extern void rejoin_doquits(aClient *sptr);
 extern void rejoin_dojoinandmode(aClient *sptr);
 extern void ident_failed(aClient *cptr);
+extern void free_identbuf(aClient *cptr);
+extern void ident_close(aClient *cptr);
+extern int ident_reply(char *buf, int count, int len, char *ruser);
+extern int ident_cached(struct IN_ADDR *addr);
+extern void identcache_add(struct IN_ADDR *addr);
+extern void ident_intake(aClient *cptr, IntakeLookup *lookup);
 
 extern MODVAR char extchmstr[4][64];
 extern MODVAR char extbanstr[EXTBANTABLESZ+1];
@@ -706,6 +778,9 @@ extern void inet6_to_inet4(const void *src, void *dst);
 extern void sendtxtnumeric(aClient *to, char *pattern, ...) __attribute__((format(printf,2,3)));;
 extern void unrealdns_gethostbyname_link(char *name, ConfigItem_link *conf);
 extern void unrealdns_delasyncconnects(void);
+extern void unrealdns_lookup(struct IN_ADDR *ip, void (*done)(void *, char *, int), void *arg);
+extern struct hostent *unrealdns_intake(aClient *cptr, IntakeLookup *lookup);
+extern int unrealdns_worker_init(void);
 extern int is_autojoin_chan(char *chname);
 extern void unreal_free_hostent(struct hostent *he);
 extern int match_esc(const char *mask, const char *name);
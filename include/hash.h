@@ -34,29 +34,28 @@ typedef struct hashentry {
 #define BITS_PER_COL_MASK 0x7
 #define MAX_SUB     (1<<BITS_PER_COL)
 
-/* Client hash table 
- * used in hash.c 
- */
-
-#define U_MAX_INITIAL 2048
-#define U_MAX_INITIAL_MASK (U_MAX_INITIAL-1)
-#define U_MAX (U_MAX_INITIAL*MAX_SUB)
-
-/* Channel hash table 
- * used in hash.c 
- */
-
-#define CH_MAX_INITIAL  2048
-#define CH_MAX_INITIAL_MASK (CH_MAX_INITIAL-1)
-#define CH_MAX (CH_MAX_INITIAL*MAX_SUB)
-
-/* Who was hash table 
- * used in whowas.c 
+/* Client, ID and channel hash tables
+ * used in hash.c
+ *
+ * Chained tables with a power of two number of buckets. They grow when
+ * there are more entries than buckets and shrink when less than one
+ * bucket in eight is needed, moving a few buckets at a time from the old
+ * to the new array on every insert and delete instead of all at once.
  */
 
-#define WW_MAX_INITIAL  16
-#define WW_MAX_INITIAL_MASK (WW_MAX_INITIAL-1)
-#define WW_MAX (WW_MAX_INITIAL*MAX_SUB)
+#define HASH_MIN_SIZE	1024	/* power of two */
+#define HASH_REHASH_STEP	8	/* buckets moved per insert/delete */
+
+typedef struct hashtable {
+	char *name;
+	struct list_head *bucket[2];	/* [1] only in use while rehashing */
+	unsigned int size[2];
+	unsigned int count;		/* entries in both arrays */
+	int  rehashidx;			/* next bucket of [0] to move, -1 if not rehashing */
+	size_t offset;			/* of the struct list_head in an entry */
+	const char *(*key)(void *);
+	unsigned long resizes;
+} HashTable;
 
 #define WATCHHASHSIZE  10007	/* prime number  */
 
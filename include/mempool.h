@@ -48,11 +48,14 @@ extern void mp_pool_init(void);
 extern void *mp_pool_get(mp_pool_t *);
 extern void mp_pool_release(void *);
 extern mp_pool_t *mp_pool_new(size_t, size_t);
+extern mp_pool_t *mp_pool_new_named(const char *, size_t, size_t);
 extern void mp_pool_clean(mp_pool_t *, int, int);
 extern void mp_pool_destroy(mp_pool_t *);
 extern void mp_pool_assert_ok(mp_pool_t *);
 extern void mp_pool_log_status(mp_pool_t *);
 extern void mp_pool_garbage_collect(void *);
+extern mp_pool_t *mp_pool_list(void);
+extern void mp_pool_get_usage(mp_pool_t *, uint64_t *, uint64_t *);
 
 #define MEMPOOL_STATS
 
@@ -60,6 +63,9 @@ struct mp_pool_t {
   /** Next pool. A pool is usually linked into the mp_allocated_pools list. */
   mp_pool_t *next;
 
+  /** What the pool is for, shown in /STATS Z and the metrics. */
+  const char *name;
+
   /** Doubly-linked list of chunks in which no items have been allocated.
    * The front of the list is the most recently emptied chunk. */
   struct mp_chunk_t *empty_chunks;
@@ -86,6 +92,12 @@ struct mp_pool_t {
   /** Size to allocate for each item, including overhead and alignment
    * padding. */
   size_t item_alloc_size;
+
+  /** Size of each item as asked for by the user of the pool. */
+  size_t item_size;
+
+  /** Number of items currently handed out. */
+  uint64_t n_items;
 #ifdef MEMPOOL_STATS
   /** Total number of items allocated ever. */
   uint64_t total_items_allocated;
@@ -100,7 +112,7 @@ struct mp_pool_t {
 
 static inline void *mp_pool_get0(mp_pool_t *pool) {
 	void *ptr = mp_pool_get(pool);
-	memset(ptr, 0, pool->item_alloc_size);
+	memset(ptr, 0, pool->item_size);
 	return ptr;
 }
 
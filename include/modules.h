@@ -57,6 +57,7 @@ typedef struct _event Event;
 typedef struct _eventinfo EventInfo;
 typedef struct _irchook Hook;
 typedef struct _hooktype Hooktype;
+typedef struct _hookstat HookStat;
 typedef struct _irccallback Callback;
 typedef struct _ircefunction Efunction;
 
@@ -395,6 +396,13 @@ struct _hooktype {
 	char *string;
 	ModuleChild *parents;
 };
+
+/* Time spent running the hooks of one hooktype, see /STATS p */
+struct _hookstat {
+	unsigned long count;
+	unsigned long long nsecs;
+	unsigned long long maxnsecs;
+};
 /*
  * What we use to keep track internally of the modules
 */
@@ -498,6 +506,7 @@ void	LockEventSystem(void);
 void	UnlockEventSystem(void);
 extern MODVAR Hook		*Hooks[MAXHOOKTYPES];
 extern MODVAR Hooktype		Hooktypes[MAXCUSTOMHOOKS];
+extern MODVAR HookStat		HookStats[MAXHOOKTYPES];
 extern MODVAR Callback *Callbacks[MAXCALLBACKS], *RCallbacks[MAXCALLBACKS];
 extern MODVAR Efunction *Efunctions[MAXEFUNCTIONS];
 
@@ -538,37 +547,48 @@ Hook	*HookDel(Hook *hook);
 Hooktype *HooktypeAdd(Module *module, char *string, int *type);
 void HooktypeDel(Hooktype *hooktype, Module *module);
 
-#define RunHook0(hooktype) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next)(*(h->func.intfunc))(); } while(0)
-#define RunHook(hooktype,x) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(x); } while(0)
-#define RunHookReturn(hooktype,x,ret) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) if((*(h->func.intfunc))(x) ret) return -1; } while(0)
+void hookstat_add(int hooktype, unsigned long long start);
+char *hooktype_name(int hooktype);
+
+/* Only look at the clock if there is something to run */
+#define HOOKSTAT_BEGIN(hooktype) unsigned long long hs_start = Hooks[hooktype] ? profile_clock() : 0
+#define HOOKSTAT_END(hooktype) do { if (hs_start) hookstat_add(hooktype, hs_start); } while(0)
+
+#define RunHook0(hooktype) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next)(*(h->func.intfunc))(); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook(hooktype,x) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(x); HOOKSTAT_END(hooktype); } while(0)
+#define RunHookReturn(hooktype,x,ret) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) if((*(h->func.intfunc))(x) ret) { HOOKSTAT_END(hooktype); return -1; } HOOKSTAT_END(hooktype); } while(0)
 #define RunHookReturnInt(hooktype,x,retchk) \
 { \
  int retval; \
  Hook *h; \
+ HOOKSTAT_BEGIN(hooktype); \
  for (h = Hooks[hooktype]; h; h = h->next) \
  { \
   retval = (*(h->func.intfunc))(x); \
-  if (retval retchk) return retval; \
+  if (retval retchk) { HOOKSTAT_END(hooktype); return retval; } \
  } \
+ HOOKSTAT_END(hooktype); \
 }
 #define RunHookReturnInt2(hooktype,x,y,retchk) \
 { \
  int retval; \
  Hook *h; \
+ HOOKSTAT_BEGIN(hooktype); \
  for (h = Hooks[hooktype]; h; h = h->next) \
  { \
   retval = (*(h->func.intfunc))(x,y); \
-  if (retval retchk) return retval; \
+  if (retval retchk) { HOOKSTAT_END(hooktype); return retval; } \
  } \
+ HOOKSTAT_END(hooktype); \
 }
 
-#define RunHookReturnVoid(hooktype,x,ret) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) if((*(h->func.intfunc))(x) ret) return; } while(0)
-#define RunHook2(hooktype,x,y) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(x,y); } while(0)
-#define RunHook3(hooktype,a,b,c) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c); } while(0)
-#define RunHook4(hooktype,a,b,c,d) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d); } while(0)
-#define RunHook5(hooktype,a,b,c,d,e) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e); } while(0)
-#define RunHook6(hooktype,a,b,c,d,e,f) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e,f); } while(0)
-#define RunHook7(hooktype,a,b,c,d,e,f,g) do { Hook *h; for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e,f,g); } while(0)
+#define RunHookReturnVoid(hooktype,x,ret) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) if((*(h->func.intfunc))(x) ret) { HOOKSTAT_END(hooktype); return; } HOOKSTAT_END(hooktype); } while(0)
+#define RunHook2(hooktype,x,y) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(x,y); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook3(hooktype,a,b,c) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook4(hooktype,a,b,c,d) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook5(hooktype,a,b,c,d,e) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook6(hooktype,a,b,c,d,e,f) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e,f); HOOKSTAT_END(hooktype); } while(0)
+#define RunHook7(hooktype,a,b,c,d,e,f,g) do { Hook *h; HOOKSTAT_BEGIN(hooktype); for (h = Hooks[hooktype]; h; h = h->next) (*(h->func.intfunc))(a,b,c,d,e,f,g); HOOKSTAT_END(hooktype); } while(0)
 
 #define CallbackAdd(cbtype, func) CallbackAddMain(NULL, cbtype, func, NULL, NULL)
 #define CallbackAddEx(module, cbtype, func) CallbackAddMain(module, cbtype, func, NULL, NULL)
@@ -595,7 +615,7 @@ Cmdoverride *CmdoverrideAdd(Module *module, char *cmd, iFP function);
 void CmdoverrideDel(Cmdoverride *ovr);
 int CallCmdoverride(Cmdoverride *ovr, aClient *cptr, aClient *sptr, int parc, char *parv[]);
 
-/* Hook types */
+/* Hook types, name them in hooktype_names[] (modules.c) too */
 #define HOOKTYPE_LOCAL_QUIT	1
 #define HOOKTYPE_LOCAL_NICKCHANGE 2
 #define HOOKTYPE_LOCAL_CONNECT 3
@@ -32,6 +32,9 @@ struct _dnsreq {
 	DNSReqType type; /**< DNS Request type (DNSREQ_*) */
 	aClient *cptr; /**< Client the request is for, NULL if client died OR unavailable */
 	ConfigItem_link *linkblock; /**< Linkblock */
+	struct IN_ADDR ip; /**< Address being resolved (DNSREQ_CLIENT) */
+	void (*done)(void *, char *, int); /**< If set, called with the result instead of proceed_normal_client_handshake() */
+	void *arg; /**< Argument for done() */
 };
 
 typedef struct _dnscache DNSCache;
@@ -52,6 +55,8 @@ struct _dnsstats {
 	unsigned int cache_adds;
 };
 
+extern DNSStats dnsstats;
+
 /** Time to keep cache records. */
 #define DNSCACHE_TTL			600
 
@@ -76,6 +76,7 @@ typedef struct ConfItem aConfItem;
 typedef struct t_kline aTKline;
 typedef struct _spamfilter Spamfilter;
 typedef struct _spamexcept SpamExcept;
+typedef struct MessageText MessageText;
 /* New Config Stuff */
 typedef struct _configentry ConfigEntry;
 typedef struct _configfile ConfigFile;
@@ -123,6 +124,7 @@ typedef struct liststruct ListStruct;
 
 typedef struct Watch aWatch;
 typedef struct Client aClient;
+typedef struct Whowas aWhowas;
 typedef struct Channel aChannel;
 typedef struct User anUser;
 typedef struct Server aServer;
@@ -170,6 +172,7 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #define	MAXKILLS	20
 #define	MAXSILELENGTH	NICKLEN+USERLEN+HOSTLEN+10
 #define IDLEN		10
+#define IDENTBUFLEN	BUFSIZE	/* ident replies, see s_auth.c */
 #define UMODETABLESZ (sizeof(long) * 8)
 /*
  * Watch it - Don't change this unless you also change the ERR_TOOMANYWATCH
@@ -263,7 +266,7 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #define IsSynched(x)	(x->serv->flags.synced)
 #define IsServerSent(x) (x->serv && x->serv->flags.server_sent)
 
-/* client->flags (32 bits): 28 used, 4 free */
+/* client->flags (32 bits): 30 used, 2 free */
 #define	FLAGS_PINGSENT   0x0001	/* Unreplied ping sent */
 #define	FLAGS_DEADSOCKET 0x0002	/* Local socket is dead--Exiting soon */
 #define	FLAGS_KILLED     0x0004	/* Prevents "QUIT" from being sent for this */
@@ -288,10 +291,12 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #define FLAGS_HYBNOTICE  0x400000
 #define FLAGS_QUARANTINE 0x800000
 //0x1000000 unused (was ziplinks)
+#define FLAGS_IOTHREAD   0x1000000 /* Socket is handled by an I/O thread (set::io-threads) */
 #define FLAGS_DCCNOTICE  0x2000000 /* Has the user seen a notice on how to use DCCALLOW already? */
 #define FLAGS_SHUNNED    0x4000000
 #define FLAGS_VIRUS      0x8000000 /* tagged by spamfilter */
 #define FLAGS_SSL        0x10000000
+#define FLAGS_KTLS       0x20000000 /* SSL records are done by the kernel (kTLS), write plaintext */
 #define FLAGS_DCCBLOCK   0x40000000 /* Block all DCC send requests */
 #define FLAGS_MAP        0x80000000	/* Show this entry in /map */
 /* Dec 26th, 1997 - added flags2 when I ran out of room in flags -DuffJ */
@@ -380,6 +385,8 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #define SetVirus(x)			((x)->flags |= FLAGS_VIRUS)
 #define ClearVirus(x)		((x)->flags &= ~FLAGS_VIRUS)
 #define IsSecure(x)		((x)->flags & FLAGS_SSL)
+#define IsKTLS(x)		((x)->flags & FLAGS_KTLS)
+#define IsIOThread(x)		((x)->flags & FLAGS_IOTHREAD)
 
 #define IsHybNotice(x)		((x)->flags & FLAGS_HYBNOTICE)
 #define SetHybNotice(x)         ((x)->flags |= FLAGS_HYBNOTICE)
@@ -659,30 +666,42 @@ struct aloopStruct {
 	int rehash_save_sig;
 };
 
-typedef struct Whowas {
-	int  hashv;
-	char *name;
-	char *username;
-	char *hostname;
-	char *virthost;
-	char *servername;
-	char *realname;
-	long umodes;
-	TS   logoff;
-	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
+/*
+ * A WHOWAS entry is one variable length record in the whowas arena
+ * (see whowas.c): the fixed part below followed by the nick, username,
+ * hostname, virthost and realname, use the WHOWAS_* macros to get them.
+ */
+struct Whowas {
 	struct Whowas *next;	/* for hash table... */
 	struct Whowas *prev;	/* for hash table... */
 	struct Whowas *cnext;	/* for client struct linked list */
 	struct Whowas *cprev;	/* for client struct linked list */
-} aWhowas;
+	struct Client *online;	/* Pointer to new nickname for chasing or NULL */
+	char *servername;	/* from scache */
+	long umodes;
+	TS   logoff;
+	u_short len;		/* of the whole record */
+	u_short username_off, hostname_off, virthost_off, realname_off;
+	char data[1];		/* the nick, followed by the other strings */
+};
+
+#define WHOWAS_NAME(w)		((w)->data)
+#define WHOWAS_USERNAME(w)	((w)->data + (w)->username_off)
+#define WHOWAS_HOSTNAME(w)	((w)->data + (w)->hostname_off)
+#define WHOWAS_VIRTHOST(w)	((w)->data + (w)->virthost_off)
+#define WHOWAS_REALNAME(w)	((w)->data + (w)->realname_off)
 
 /*
  * Client structures
  */
+#define USERINDEX_SLOTS	10
+
 struct User {
 	Membership *channel;		/* chain of channel pointer blocks */
 	Link *invited;		/* chain of invite pointer blocks */
 	Link *silence;		/* chain of silence pointer blocks */
+	struct SilenceIndex *silence_index; /* silence compiled for lookups, see s_user.c */
+	struct UserIndexNode *uindex[USERINDEX_SLOTS]; /* in the user index, see userindex.c */
 	Link *dccallow;		/* chain of dccallowed entries */
 	char *away;		/* pointer to away message */
 
@@ -738,7 +757,11 @@ struct Server {
 	struct {
 		unsigned synced:1;		/* Server linked? (3.2beta18+) */
 		unsigned server_sent:1;		/* SERVER message sent to this link? (for outgoing links) */
+		unsigned burst_queued:1;	/* our burst is queued, waiting for the sendQ to drain */
 	} flags;
+	/* Directly linked servers: how long the bursts took (ns), see burst_begin() */
+	unsigned long long burst_start, burst_sent, burst_received;
+	unsigned long burst_bytes;
 };
 
 #define M_UNREGISTERED	0x0001
@@ -788,6 +811,7 @@ struct _spamfilter {
 	regex_t expr;
 	char *tkl_reason; /* spamfilter reason field [escaped by unreal_encodespace()!] */
 	TS tkl_duration;
+	unsigned long hits; /* number of times the filter matched (excepted targets not included) */
 };
 
 struct t_kline {
@@ -808,6 +832,21 @@ struct _spamexcept {
 	char name[1];
 };
 
+/* What is known about the text of a PRIVMSG/NOTICE, see msgtext.c */
+#define MSGTEXT_COLOR		0x01	/* has color, RGB or reverse codes (what StripColors() removes) */
+#define MSGTEXT_ANSI		0x02	/* has ansi escapes */
+#define MSGTEXT_CODES		0x04	/* has bold, underline or plain codes */
+#define MSGTEXT_CTCP		0x08	/* is a CTCP other than ACTION */
+
+struct MessageText {
+	char *text;		/* the text as received */
+	unsigned int serial;	/* unique per message, for caches keyed on it */
+	char scanned;		/* flags are valid */
+	int  flags;		/* MSGTEXT_* */
+	char *nocolors, *nocodes;	/* made on first use, NULL until then */
+	char buf_nocolors[BUFSIZE], buf_nocodes[BUFSIZE];
+};
+
 typedef struct ircstatsx {
 	int  clients;		/* total */
 	int  invisible;		/* invisible */
@@ -856,6 +895,8 @@ typedef struct {
 #define LISTENER_SSL		0x000010
 #define LISTENER_BOUND		0x000020
 #define LISTENER_DEFER_ACCEPT	0x000040
+#define LISTENER_METRICS	0x000080
+#define LISTENER_KTLS		0x000100
 
 #define IsServersOnlyListener(x)	((x) && ((x)->options & LISTENER_SERVERSONLY))
 
@@ -865,6 +906,9 @@ typedef struct {
 #define CONNECT_QUARANTINE	0x000008
 #define CONNECT_NODNSCACHE	0x000010
 #define CONNECT_NOHOSTCHECK	0x000020
+#define CONNECT_KTLS		0x000040
+#define CONNECT_CORK		0x000080
+#define CONNECT_NODELAY		0x000100
 
 #define SSLFLAG_FAILIFNOCERT 	0x1
 #define SSLFLAG_VERIFYCERT 	0x2
@@ -872,24 +916,36 @@ typedef struct {
 #define SSLFLAG_NOSTARTTLS	0x8
 
 struct Client {
-	struct list_head client_node; 	/* for global client list (client_list) */
-	struct list_head client_hash;	/* for clientTable */
-	struct list_head id_hash;	/* for idTable */
-
-	anUser *user;		/* ...defined, if this is a User */
-	aServer *serv;		/* ...defined, if this is a server */
-	TS   lastnick;		/* TimeStamp on nick */
+	/*
+	   ** Hot fields: these are what routing and the send loops look at
+	   ** for every client they pass, keep them together in the first
+	   ** cache line.
+	 */
 	long flags;		/* client flags */
 	long umodes;		/* client usermodes */
 	aClient *from;		/* == &me, if Local Client, *NEVER* NULL! */
+	anUser *user;		/* ...defined, if this is a User */
+	aServer *serv;		/* ...defined, if this is a server */
+	aClient *srvptr;	/* Server introducing this.  May be &me */
 	int  fd;		/* >= 0, for local clients */
+	int  serial;		/* current serial for send.c functions */
+	short status;		/* client type */
 	unsigned char hopcount;		/* number of servers to this 0 = local */
+
+	/*
+	   ** Cold part, still kept for every client on the network. The
+	   ** strings go first so they fill the rest of the first cache line
+	   ** instead of padding.
+	 */
 	char name[HOSTLEN + 1];	/* Unique name of the client, nick or host */
 	char username[USERLEN + 1];	/* username here now for auth stuff */
-	char info[REALLEN + 1];	/* Free form additional client information */
 	char id[IDLEN + 1];	/* SID or UID */
-	aClient *srvptr;	/* Server introducing this.  May be &me */
-	short status;		/* client type */
+	char info[REALLEN + 1];	/* Free form additional client information */
+	TS   lastnick;		/* TimeStamp on nick */
+	struct list_head client_node; 	/* for global client list (client_list) */
+	struct list_head client_hash;	/* for clientTable */
+	struct list_head id_hash;	/* for idTable */
+
 	/*
 	   ** The following fields are allocated only for local clients
 	   ** (directly connected to *this* server with a socket.
@@ -897,46 +953,50 @@ struct Client {
 	   ** to which the allocation is tied to! *Never* refer to
 	   ** these fields, if (from != self).
 	 */
-	int  count;		/* Amount of data in buffer */
+	int  count;		/* Amount of data in identbuf */
 
 	struct list_head lclient_node;	/* for local client list (lclient_list) */
 	struct list_head special_node;	/* for special lists (server || unknown || oper) */
 
-#if 1
+	/* Used for every message to or from the client */
+	dbuf sendQ;		/* Outgoing message queue--if socket full */
+	dbuf recvQ;		/* Hold for data incoming yet to be parsed */
+	SSL		*ssl;
+	struct list_head flush_node;	/* SSL output waiting for the end of the loop, see send.c */
+	u_int ssl_burst;	/* bytes sent over SSL since the last idle time, see send_queued() */
+	TS   ssl_drained;	/* time the sendQ of an SSL connection ran empty, 0 if it has data */
+	int  sndbuf;		/* SO_SNDBUF we set, see sndbuf_grow() */
+	u_char sndbuf_full;	/* writes in a row that filled the socket buffer */
+	ConfigItem_class *class;		/* Configuration record associated */
+	int proto;		/* ProtoCtl options */
 	int  oflag;		/* oper access flags (removed from anUser for mem considerations) */
 	TS   since;		/* time they will next be allowed to send something */
-	TS   firsttime;		/* Time it was created */
 	TS   lasttime;		/* last time any message was received */
 	TS   last;		/* last time a RESETIDLE message was received */
-	TS   nexttarget;	/* next time that a new target will be allowed (msg/notice/invite) */
- 	TS   nextnick;		/* Time the next nick change will be allowed */
-	u_char targets[MAXTARGETS];	/* hash values of targets */
-#endif
-	char buffer[BUFSIZE];	/* Incoming message buffer */
-	short lastsq;		/* # of 2k blocks when sendqueued called last */
-	dbuf sendQ;		/* Outgoing message queue--if socket full */
-	dbuf recvQ;		/* Hold for data incoming yet to be parsed */
-	u_int32_t nospoof;	/* Anti-spoofing random number */
-	int proto;		/* ProtoCtl options */
 	long sendM;		/* Statistics: protocol messages send */
 	long sendK;		/* Statistics: total k-bytes send */
 	long receiveM;		/* Statistics: protocol messages received */
-	SSL		*ssl;
-#ifndef NO_FDLIST
-	long lastrecvM;		/* to check for activity --Mika */
-	int  priority;
-#endif
 	long receiveK;		/* Statistics: total k-bytes received */
 	u_short sendB;		/* counters to count upto 1-k lots of bytes */
 	u_short receiveB;	/* sent and received. */
+	short lastsq;		/* # of 2k blocks when sendqueued called last */
+
+	/* Everything else */
+	TS   firsttime;		/* Time it was created */
+	TS   nexttarget;	/* next time that a new target will be allowed (msg/notice/invite) */
+ 	TS   nextnick;		/* Time the next nick change will be allowed */
+	TS last_cmd_run;	/* last time a ratelimited command was run */
+	u_char targets[MAXTARGETS];	/* hash values of targets */
+	u_int32_t nospoof;	/* Anti-spoofing random number */
 	ConfigItem_listen *listener;
-	ConfigItem_class *class;		/* Configuration record associated */
 	int authfd;		/* fd for rfc931 authentication */
-        long serial;            /* current serial for send.c functions */
+	struct list_head ident_node;	/* On the list of running ident queries */
+	TS   ident_deadline;	/* When the running ident query times out */
+	char *identbuf;		/* Reply from the ident server, only while reading it */
 	struct IN_ADDR ip;	/* keep real ip# too */
 	u_short port;		/* and the remote port# too :-) */
-	struct hostent *hostp;
 	u_short watches;	/* Keep track of count of notifies */
+	struct hostent *hostp;
 	Link *watch;		/* Links to clients notify-structures */
 	char sockhost[HOSTLEN + 1];	/* This is the host name from the socket
 					   ** and after which the connection was
@@ -952,8 +1012,6 @@ struct Client {
 	unsigned char sasl_out;
 	unsigned char sasl_complete;
 	u_short sasl_cookie;
-
-	TS last_cmd_run;	/* last time a ratelimited command was run */
 };
 
 
@@ -1072,8 +1130,16 @@ struct _configitem_class {
 	                * link blocks also refer to classes so a 2nd ref. count was needed.
 	                */
 	unsigned int options;
+	int sndbuf, rcvbuf;	/* socket buffer sizes, 0 for SOCKBUF_DEFAULT, see set_class_sock_opts() */
+	int sndbuf_max;		/* grow sndbuf up to this if it keeps filling up, 0 to never grow */
+	int send_batch;		/* hold output back until this many bytes are queued */
 };
 
+#define CLASS_OPT_CORK		0x1
+#define CLASS_OPT_NODELAY	0x2
+
+#define SOCKBUF_DEFAULT		8192	/* socket buffers if the class doesn't say */
+
 struct _configflag_allow {
 	unsigned	noident :1;
 	unsigned	useip :1;
@@ -1148,6 +1214,24 @@ struct _configitem_listen {
 	int		fd;
 };
 
+/*
+ * What an intake worker (intake.c) found out about a connection before
+ * passing it on: which lookups it did, and their results.
+ */
+typedef struct {
+	char		host[HOSTLEN + 1];	/* verified hostname, empty if none */
+	char		username[USERLEN + 1];	/* from the ident reply, empty if none */
+	int		flags;			/* LOOKUP_* */
+} IntakeLookup;
+
+#define LOOKUP_DNS		0x01	/* the DNS lookup was done */
+#define LOOKUP_DNS_CACHED	0x02	/* ... and answered from the cache */
+#define LOOKUP_IDENT		0x04	/* the ident lookup was done (or skipped) */
+#define LOOKUP_IDENT_QUERIED	0x08	/* ... with a query to port 113 */
+#define LOOKUP_IDENT_CACHED	0x10	/* ... skipped, no ident server there last time */
+#define LOOKUP_IDENT_BUSY	0x20	/* ... skipped, set::ident::max-queries are running */
+#define LOOKUP_NO_IDENTD	0x40	/* nothing answered on port 113 */
+
 struct _configitem_vhost {
 	ConfigItem 	*prev, *next;
 	ConfigFlag 	flag;
@@ -1165,6 +1249,7 @@ struct _configitem_link {
 	unsigned char 	leafdepth;
 	int		refcount;
 	ConfigItem_class	*class;
+	int		sndbuf, rcvbuf;	/* override those of the class if set */
 	struct IN_ADDR 		ipnum;
 	time_t			hold;
 	char		*ciphers;
@@ -1360,8 +1445,15 @@ struct stats {
 	unsigned int is_fake;	/* MODE 'fakes' */
 	unsigned int is_asuc;	/* successful auth requests */
 	unsigned int is_abad;	/* bad auth requests */
+	unsigned int is_acache;	/* auth requests skipped, host cached as having no identd */
+	unsigned int is_abusy;	/* auth requests skipped, too many running */
 	unsigned int is_udp;	/* packets recv'd on udp port */
 	unsigned int is_loc;	/* local connections made */
+	unsigned int is_sslfull;	/* SSL handshakes accepted without resuming */
+	unsigned int is_sslresumed;	/* SSL sessions resumed, from the cache or a ticket */
+	unsigned int is_sslticket;	/* of those, resumed from a session ticket */
+	unsigned int is_sslktls;	/* SSL connections handed to kernel TLS */
+	unsigned int is_sslktlsfail;	/* kTLS wanted but not possible (cipher, kernel) */
 };
 
 typedef struct _MemoryInfo {
@@ -1372,7 +1464,11 @@ typedef struct _MemoryInfo {
 struct ListOptions {
 	LOpts *next;
 	Link *yeslist, *nolist;
-	unsigned int  starthash;
+	short int started;
+	short int index;		/* CHANDIR_BYNAME or CHANDIR_BYUSERS */
+	char prefix[CHANNELLEN + 1];	/* all wanted channels start with this */
+	unsigned short lastusers;	/* where to continue next time */
+	char lastname[CHANNELLEN + 1];
 	short int showall;
 	unsigned short usermin;
 	int  usermax;
@@ -1429,7 +1525,7 @@ struct Watch {
 	aWatch *hnext;
 	TS   lasttime;
 	Link *watch;
-	char nick[1];
+	char nick[NICKLEN + 1];
 };
 
 /* general link structure used for chains */
@@ -1442,7 +1538,6 @@ struct SLink {
 		aChannel *chptr;
 		ListStruct *aconf;
 		aWatch *wptr;
-		aName *whowas;
 		char *cp;
 		struct {
 			char *banstr;
@@ -1460,7 +1555,9 @@ struct SMember
 };
 
 struct Channel {
-	struct Channel *nextch, *prevch, *hnextch;
+	struct Channel *nextch, *prevch;
+	struct list_head chan_hash;	/* for channelTable */
+	struct ChanDirNode *dirnode[2];	/* in the channel directory, see chandir.c */
 	Mode mode;
 	TS   creationtime;
 	char *topic;
@@ -1688,6 +1785,9 @@ struct Command {
 	unsigned long 		rticks;
 #endif
 	TS			last_run;
+	unsigned long long	nsecs;		/* wall time spent in the handler */
+	unsigned long long	maxnsecs;	/* slowest single call */
+	unsigned long long	sentbytes;	/* bytes queued to clients by the handler */
 };
 
 struct _cmdoverride {
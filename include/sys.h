@@ -78,6 +78,7 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #endif
+#include <sys/uio.h>
 #ifndef GOT_STRCASECMP
 #define	strcasecmp	mycmp
 #define	strncasecmp	myncmp
@@ -35,19 +35,6 @@
 #ifndef	__whowas_include__
 #define __whowas_include__
 
-/*
-** WHOWAS structure moved here from whowas.c
-*/
-typedef struct aname {
-	anUser *ww_user;
-	aClient *ww_online;
-	time_t ww_logout;
-	long ww_umodes;
-	char ww_nick[NICKLEN + 1];
-	char ww_info[REALLEN + 1];
-} aName;
-
-
 /*
 ** add_history
 **	Add the currently defined name of the client to history.
@@ -77,8 +64,23 @@ aClient *get_history(char *, time_t);
 					/* Time limit in seconds */
 
 /*
-** for debugging...counts related structures stored in whowas array.
+** whowas_bucket
+**	Return the hash chain the given nickname is on, newest
+**	entry first. The chain holds other nicknames too.
+*/
+aWhowas *whowas_bucket(char *);
+
+/*
+** whowas_resize
+**	Change the number of entries kept, dropping the oldest
+**	ones if needed.
+*/
+void whowas_resize(int);
+
+/*
+** for debugging...counts the entries and the bytes used of / allocated
+** for the whowas arena and hash.
 */
-void count_whowas_memory(int *, u_long *);
+void count_whowas_memory(int *, u_long *, u_long *);
 
 #endif /* __whowas_include__ */
@@ -25,6 +25,7 @@
 #include <string.h>
 
 char *cmdstr = NULL;
+MODVAR unsigned long commands_deleted = 0; /* lets parse() know its aCommand may be gone */
 
 int CommandExists(char *name)
 {
@@ -88,6 +89,8 @@ Command *CommandAdd(Module *module, char *cmd, int (*func)(), unsigned char para
 void CommandDel(Command *command) {
 	Cmdoverride *ovr, *ovrnext;
 
+	commands_deleted++;
+
 	if (command->cmd->flags & M_ANNOUNCE)
 	{
 		char *tmp = MyMallocEx(strlen(cmdstr)+1);
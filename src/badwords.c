@@ -0,0 +1,323 @@
+/*
+ * RabbitIRCD, src/badwords.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Badword matching for +G, one pass over the text no matter how many
+ * words are configured.
+ *
+ * All words of a list are compiled into an Aho-Corasick automaton: a
+ * trie of the (lowercased) words where every state also knows where to
+ * go on a mismatch, flattened into a transition table so each input
+ * byte costs one lookup. To keep that table small, bytes are first
+ * mapped to an input class; every byte that occurs in no word shares
+ * class 0.
+ *
+ * A word matches case-insensitively and only as a whole word, unless it
+ * starts and/or ends with a '*': "*fuck*" matches any word containing
+ * "fuck", and the whole word is replaced. Several words may share a
+ * stem with different '*'s ("fuck" and "*fuck*"): they end in the same
+ * state and are all tried. Overlapping hits are resolved leftmost first,
+ * then longest.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include "badwords.h"
+
+#define BADWORD_WILD_LEFT	0x1
+#define BADWORD_WILD_RIGHT	0x2
+
+#define bw_lower(c)	(((c) >= 'A' && (c) <= 'Z') ? (c) - 'A' + 'a' : (c))
+#define bw_wordchar(c)	(((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || \
+			 ((c) >= '0' && (c) <= '9') || (c) == '_' || (c) >= 0x80)
+
+typedef struct {
+	char *word;		/* lowercased, without the '*'s */
+	char *replace;		/* NULL for REPLACEWORD */
+	int  len;
+	int  flags;
+} BadwordPattern;
+
+struct badword_matcher {
+	BadwordPattern *pat;
+	int  npat, maxpat;
+	int  built;
+	u_char class[256];	/* input byte -> class, 0 if in no word */
+	int  nclass;
+	int  nstates;
+	int  *next;		/* nstates * nclass transitions */
+	int  *match;		/* first pattern ending in this state, -1 if none */
+	int  *patnext;		/* next pattern ending in the same state, -1 if none */
+	int  *outlink;		/* longest proper suffix state with a match, 0 if none */
+};
+
+BadwordMatcher *badword_matcher_new(void)
+{
+	return MyMallocEx(sizeof(BadwordMatcher));
+}
+
+static void badword_matcher_reset(BadwordMatcher *m)
+{
+	if (m->next)
+		MyFree(m->next);
+	if (m->match)
+		MyFree(m->match);
+	if (m->outlink)
+		MyFree(m->outlink);
+	if (m->patnext)
+		MyFree(m->patnext);
+	m->next = m->match = m->outlink = m->patnext = NULL;
+	m->nstates = 0;
+	m->built = 0;
+}
+
+void badword_matcher_free(BadwordMatcher *m)
+{
+	int i;
+
+	if (!m)
+		return;
+	badword_matcher_reset(m);
+	for (i = 0; i < m->npat; i++)
+	{
+		MyFree(m->pat[i].word);
+		if (m->pat[i].replace)
+			MyFree(m->pat[i].replace);
+	}
+	if (m->pat)
+		MyFree(m->pat);
+	MyFree(m);
+}
+
+void badword_matcher_add(BadwordMatcher *m, const char *word, const char *replace)
+{
+	BadwordPattern *p;
+	int len, flags = 0;
+	char *s;
+
+	if (*word == '*')
+	{
+		flags |= BADWORD_WILD_LEFT;
+		word++;
+	}
+	len = strlen(word);
+	if (len && word[len - 1] == '*')
+	{
+		flags |= BADWORD_WILD_RIGHT;
+		len--;
+	}
+	if (len <= 0)
+		return;
+
+	if (m->npat == m->maxpat)
+	{
+		m->maxpat = m->maxpat ? m->maxpat * 2 : 16;
+		m->pat = MyRealloc(m->pat, sizeof(BadwordPattern) * m->maxpat);
+	}
+	p = &m->pat[m->npat++];
+	p->word = MyMalloc(len + 1);
+	for (s = p->word; len--; word++)
+		*s++ = bw_lower(*word);
+	*s = '\0';
+	p->len = s - p->word;
+	p->flags = flags;
+	p->replace = replace ? strdup(replace) : NULL;
+	m->built = 0;
+}
+
+int badword_matcher_count(BadwordMatcher *m)
+{
+	return m->npat;
+}
+
+void badword_matcher_build(BadwordMatcher *m)
+{
+	int *fail, *queue;
+	int i, c, s, t, maxstates, head, tail, *last;
+	const u_char *w;
+
+	badword_matcher_reset(m);
+	m->built = 1;
+	if (!m->npat)
+		return;
+
+	/* Input classes */
+	memset(m->class, 0, sizeof(m->class));
+	m->nclass = 1;
+	maxstates = 1;
+	for (i = 0; i < m->npat; i++)
+	{
+		for (w = (u_char *)m->pat[i].word; *w; w++)
+			if (!m->class[*w])
+				m->class[*w] = m->nclass++;
+		maxstates += m->pat[i].len;
+	}
+	for (c = 'A'; c <= 'Z'; c++)
+		m->class[c] = m->class[bw_lower(c)];
+
+	/* The trie. State 0 is the root, 0 in next[] means no edge yet. */
+	m->next = MyMallocEx(sizeof(int) * maxstates * m->nclass);
+	m->match = MyMalloc(sizeof(int) * maxstates);
+	m->outlink = MyMallocEx(sizeof(int) * maxstates);
+	m->patnext = MyMalloc(sizeof(int) * m->npat);
+	for (i = 0; i < maxstates; i++)
+		m->match[i] = -1;
+	m->nstates = 1;
+	for (i = 0; i < m->npat; i++)
+	{
+		s = 0;
+		for (w = (u_char *)m->pat[i].word; *w; w++)
+		{
+			int *edge = &m->next[s * m->nclass + m->class[*w]];
+
+			if (!*edge)
+				*edge = m->nstates++;
+			s = *edge;
+		}
+		/* Keep them in the order they were added */
+		m->patnext[i] = -1;
+		if (m->match[s] == -1)
+			m->match[s] = i;
+		else
+		{
+			for (last = &m->match[s]; *last != -1; last = &m->patnext[*last])
+				;
+			*last = i;
+		}
+	}
+
+	/*
+	 * Failure links, breadth first, and fill in the missing edges with
+	 * the edge of the failure state so matching never has to back up.
+	 */
+	fail = MyMallocEx(sizeof(int) * m->nstates);
+	queue = MyMalloc(sizeof(int) * m->nstates);
+	head = tail = 0;
+	for (c = 0; c < m->nclass; c++)
+		if ((t = m->next[c]))
+			queue[tail++] = t;
+	while (head < tail)
+	{
+		s = queue[head++];
+		for (c = 0; c < m->nclass; c++)
+		{
+			int *edge = &m->next[s * m->nclass + c];
+
+			if (!*edge)
+			{
+				*edge = m->next[fail[s] * m->nclass + c];
+				continue;
+			}
+			t = *edge;
+			fail[t] = m->next[fail[s] * m->nclass + c];
+			m->outlink[t] = (m->match[fail[t]] != -1) ? fail[t] : m->outlink[fail[t]];
+			queue[tail++] = t;
+		}
+	}
+	MyFree(fail);
+	MyFree(queue);
+
+	m->next = MyRealloc(m->next, sizeof(int) * m->nstates * m->nclass);
+	m->match = MyRealloc(m->match, sizeof(int) * m->nstates);
+	m->outlink = MyRealloc(m->outlink, sizeof(int) * m->nstates);
+}
+
+/*
+ * Replace all badwords in text. Returns text itself if there are none,
+ * otherwise the result in buf.
+ */
+char *badword_matcher_replace(BadwordMatcher *m, char *text, char *buf, size_t buflen)
+{
+	static int hitend[BUFSIZE], hitpat[BUFSIZE];
+	const u_char *in = (u_char *)text;
+	BadwordPattern *p;
+	int i, k, s, t, start, end, scanned, found = 0;
+	size_t o;
+	char *r;
+
+	if (!m->built)
+		badword_matcher_build(m);
+	if (!m->nstates)
+		return text;
+
+	/* Find every hit, remembering the longest one starting at each byte */
+	s = 0;
+	for (i = 0; in[i] && i < BUFSIZE; i++)
+	{
+		hitend[i] = -1;
+		s = m->next[s * m->nclass + m->class[in[i]]];
+		for (t = (m->match[s] != -1) ? s : m->outlink[s]; t; t = m->outlink[t])
+		{
+			for (k = m->match[t]; k != -1; k = m->patnext[k])
+			{
+				p = &m->pat[k];
+				start = i - p->len + 1;
+				end = i;
+				if (p->flags & BADWORD_WILD_LEFT)
+				{
+					while (start > 0 && bw_wordchar(in[start - 1]))
+						start--;
+				}
+				else if (start > 0 && bw_wordchar(in[start - 1]))
+					continue;
+				if (p->flags & BADWORD_WILD_RIGHT)
+				{
+					while (bw_wordchar(in[end + 1]))
+						end++;
+				}
+				else if (bw_wordchar(in[end + 1]))
+					continue;
+				if (end > hitend[start])
+				{
+					hitend[start] = end;
+					hitpat[start] = k;
+				}
+				found = 1;
+			}
+		}
+	}
+	scanned = i;
+
+	if (!found)
+		return text;
+
+	/* And copy, taking the leftmost hits */
+	o = 0;
+	for (i = 0; in[i]; )
+	{
+		if (i < scanned && hitend[i] != -1)
+		{
+			r = m->pat[hitpat[i]].replace;
+			if (!r)
+				r = REPLACEWORD;
+			while (*r && o < buflen - 1)
+				buf[o++] = *r++;
+			i = hitend[i] + 1;
+			continue;
+		}
+		if (o < buflen - 1)
+			buf[o++] = in[i];
+		i++;
+	}
+	buf[o] = '\0';
+
+	return buf;
+}
@@ -0,0 +1,208 @@
+/*
+ * RabbitIRCD, src/chandir.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The channel directory: every channel sorted by name and by user count
+ * (most users first, then by name), so /LIST can start right at the
+ * channels it wants and continue from the last one it sent instead of
+ * walking the whole channel table for every client.
+ *
+ * Both orders are skiplists. The user count index is updated whenever
+ * chptr->users changes (see channel.c), a node remembers the count it
+ * was sorted with so it can still be found after the change.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+
+#define CHANDIR_MAXLEVEL	16
+
+struct ChanDirNode {
+	aChannel *chptr;
+	unsigned short users;		/* sort key of the user count index */
+	int  level;
+	struct ChanDirNode *next[1];	/* level entries */
+};
+
+typedef struct {
+	struct ChanDirNode *head;
+	int  level;
+	int  count;
+} ChanDir;
+
+static ChanDir chandir[2];
+
+static int chandir_cmp(int index, struct ChanDirNode *n, unsigned short users, const char *name)
+{
+	if (index == CHANDIR_BYUSERS && n->users != users)
+		return (n->users > users) ? -1 : 1;
+	return strcasecmp(n->chptr->chname, name);
+}
+
+static int chandir_random_level(void)
+{
+	u_int32_t r = getrandom32();
+	int  level = 1;
+
+	/* p = 1/4 */
+	while ((r & 3) == 0 && level < CHANDIR_MAXLEVEL)
+	{
+		level++;
+		r >>= 2;
+	}
+	return level;
+}
+
+/*
+ * Find the last node before (users, name) on every level, or before or
+ * at it if 'after' is set.
+ */
+static struct ChanDirNode *chandir_seek(int index, unsigned short users, const char *name,
+    int after, struct ChanDirNode **update)
+{
+	ChanDir *d = &chandir[index];
+	struct ChanDirNode *x = d->head, *n;
+	int  i, c;
+
+	for (i = d->level - 1; i >= 0; i--)
+	{
+		while ((n = x->next[i]))
+		{
+			c = chandir_cmp(index, n, users, name);
+			if (c > 0 || (c == 0 && !after))
+				break;
+			x = n;
+		}
+		if (update)
+			update[i] = x;
+	}
+	return x->next[0];
+}
+
+static void chandir_insert(int index, aChannel *chptr)
+{
+	ChanDir *d = &chandir[index];
+	struct ChanDirNode *update[CHANDIR_MAXLEVEL], *n;
+	int  i, level;
+
+	if (!d->head)
+	{
+		d->head = MyMallocEx(sizeof(struct ChanDirNode) + sizeof(struct ChanDirNode *) * (CHANDIR_MAXLEVEL - 1));
+		d->head->level = CHANDIR_MAXLEVEL;
+		d->level = 1;
+	}
+
+	chandir_seek(index, chptr->users, chptr->chname, 0, update);
+	level = chandir_random_level();
+	for (i = d->level; i < level; i++)
+		update[i] = d->head;
+	if (level > d->level)
+		d->level = level;
+
+	n = MyMalloc(sizeof(struct ChanDirNode) + sizeof(struct ChanDirNode *) * (level - 1));
+	n->chptr = chptr;
+	n->users = chptr->users;
+	n->level = level;
+	for (i = 0; i < level; i++)
+	{
+		n->next[i] = update[i]->next[i];
+		update[i]->next[i] = n;
+	}
+	chptr->dirnode[index] = n;
+	d->count++;
+}
+
+static void chandir_remove(int index, aChannel *chptr)
+{
+	ChanDir *d = &chandir[index];
+	struct ChanDirNode *update[CHANDIR_MAXLEVEL], *n = chptr->dirnode[index];
+	int  i;
+
+	chandir_seek(index, n->users, chptr->chname, 0, update);
+	for (i = 0; i < n->level; i++)
+		update[i]->next[i] = n->next[i];
+	while (d->level > 1 && !d->head->next[d->level - 1])
+		d->level--;
+	MyFree(n);
+	chptr->dirnode[index] = NULL;
+	d->count--;
+}
+
+void chandir_add(aChannel *chptr)
+{
+	chandir_insert(CHANDIR_BYNAME, chptr);
+	chandir_insert(CHANDIR_BYUSERS, chptr);
+}
+
+void chandir_del(aChannel *chptr)
+{
+	chandir_remove(CHANDIR_BYNAME, chptr);
+	chandir_remove(CHANDIR_BYUSERS, chptr);
+}
+
+/** chptr->users changed, move it in the user count index */
+void chandir_update(aChannel *chptr)
+{
+	if (!chptr->dirnode[CHANDIR_BYUSERS] || chptr->dirnode[CHANDIR_BYUSERS]->users == chptr->users)
+		return;
+	chandir_remove(CHANDIR_BYUSERS, chptr);
+	chandir_insert(CHANDIR_BYUSERS, chptr);
+}
+
+/*
+ * The first channel at or after (users, name) in the given index, or
+ * strictly after it if 'after' is set. For CHANDIR_BYNAME users is
+ * ignored; for CHANDIR_BYUSERS (65535, "") is the start.
+ */
+aChannel *chandir_find(int index, unsigned short users, const char *name, int after)
+{
+	struct ChanDirNode *n;
+
+	if (!chandir[index].head)
+		return NULL;
+	n = chandir_seek(index, users, name, after, NULL);
+	return n ? n->chptr : NULL;
+}
+
+aChannel *chandir_next(int index, aChannel *chptr)
+{
+	struct ChanDirNode *n = chptr->dirnode[index]->next[0];
+
+	return n ? n->chptr : NULL;
+}
+
+void count_chandir_memory(int *count, u_long *memory)
+{
+	struct ChanDirNode *n;
+	int  index;
+
+	*count = 0;
+	*memory = 0;
+	for (index = 0; index < 2; index++)
+	{
+		if (!chandir[index].head)
+			continue;
+		*memory += sizeof(struct ChanDirNode) + sizeof(struct ChanDirNode *) * (CHANDIR_MAXLEVEL - 1);
+		for (n = chandir[index].head->next[0]; n; n = n->next[0])
+			*memory += sizeof(struct ChanDirNode) + sizeof(struct ChanDirNode *) * (n->level - 1);
+		*count += chandir[index].count;
+	}
+}
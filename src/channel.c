@@ -45,6 +45,7 @@
 #include "hash.h"		/* For CHANNELHASHSIZE */
 #include "h.h"
 #include "proto.h"
+#include "mempool.h"
 #include <string.h>
 
 ID_Copyright
@@ -52,6 +53,10 @@ ID_Copyright
 
 long opermode = 0;
 aChannel *channel = NullChn;
+/* Bumped on every join and part anywhere, so a cached view of some
+ * channel's members can tell whether it is still good.
+ */
+MODVAR unsigned long channel_member_changes = 0;
 extern char backupbuf[];
 extern ircstats IRCstats;
 
@@ -72,6 +77,15 @@ void chanfloodtimer_stopchantimers(aChannel *chptr);
  */
 static char nickbuf[BUFSIZE], buf[BUFSIZE];
 MODVAR char modebuf[BUFSIZE], parabuf[BUFSIZE];
+
+static mp_pool_t *member_pool = NULL, *membership_pool = NULL, *membershipL_pool = NULL;
+
+void init_channel_pools(void)
+{
+	member_pool = mp_pool_new_named("member", sizeof(Member), 64 * 1024);
+	membership_pool = mp_pool_new_named("membership", sizeof(Membership), 64 * 1024);
+	membershipL_pool = mp_pool_new_named("membership.local", sizeof(MembershipL), 64 * 1024);
+}
 #include "sjoin.h"
 
 #define MODESYS_LINKOK		/* We do this for a TEST  */
@@ -204,21 +218,10 @@ Membership *find_membership_link(Membership *lp, aChannel *ptr)
 Member	*make_member(void)
 {
 	Member *lp;
-	unsigned int	i;
 
-	if (freemember == NULL)
-	{
-		for (i = 1; i <= (4072/sizeof(Member)); ++i)		
-		{
-			lp = (Member *)MyMalloc(sizeof(Member));
-			lp->cptr = NULL;
-			lp->flags = 0;
-			lp->next = freemember;
-			freemember = lp;
-		}
-	}
-	lp = freemember;
-	freemember = freemember->next;
+	lp = mp_pool_get(member_pool);
+	lp->cptr = NULL;
+	lp->flags = 0;
 	lp->next = NULL;
 	return lp;
 }
@@ -226,12 +229,7 @@ Member	*make_member(void)
 void	free_member(Member *lp)
 {
 	if (lp)
-	{
-		lp->next = freemember;
-		lp->cptr = NULL;
-		lp->flags = 0;
-		freemember = lp;
-	}
+		mp_pool_release(lp);
 }
 
 /* 
@@ -239,75 +237,26 @@ void	free_member(Member *lp)
 */
 Membership	*make_membership(int local)
 {
-	Membership *lp = NULL;
-	MembershipL *lp2 = NULL;
-	unsigned int	i;
+	Membership *lp;
 
 	if (!local)
 	{
-		if (freemembership == NULL)
-		{
-			for (i = 1; i <= (4072/sizeof(Membership)); i++)
-			{
-				lp = (Membership *)MyMalloc(sizeof(Membership));
-				lp->next = freemembership;
-				freemembership = lp;
-			}
-			lp = freemembership;
-			freemembership = lp->next;
-		}
-		else
-		{
-			lp = freemembership;
-			freemembership = freemembership->next;
-		}
+		lp = mp_pool_get(membership_pool);
 		bzero(lp, sizeof(Membership));
 	}
 	else
 	{
-		if (freemembershipL == NULL)
-		{
-			for (i = 1; i <= (4072/sizeof(MembershipL)); i++)		
-			{
-				lp2 = (MembershipL *)MyMalloc(sizeof(MembershipL));
-				lp2->next = (Membership *) freemembershipL;
-				freemembershipL = lp2;
-			}
-			lp2 = freemembershipL;
-			freemembershipL = (MembershipL *) lp2->next;
-			Debug((DEBUG_ERROR, "floodmode::alloc gotone"));
-		}
-		else
-		{
-			lp2 = freemembershipL;
-			freemembershipL = (MembershipL *) freemembershipL->next;
-			Debug((DEBUG_ERROR, "floodmode::freelist gotone"));
-		}
-		Debug((DEBUG_ERROR, "floodmode:: bzeroing"));	
-		bzero(lp2, sizeof(MembershipL));
-	}
-	if (local)
-	{
-		return ((Membership *) lp2);
+		lp = mp_pool_get(membershipL_pool);
+		bzero(lp, sizeof(MembershipL));
 	}
 	return lp;
 }
 
+/* Both kinds go back to the pool they came from, 'local' is not needed anymore */
 void	free_membership(Membership *lp, int local)
 {
 	if (lp)
-	{
-		if (!local)
-		{
-			lp->next = freemembership;
-			freemembership = lp;
-		}
-		else
-		{
-			lp->next = (Membership *) freemembershipL;
-			freemembershipL = (MembershipL *) lp;
-		}
-	}
+		mp_pool_release(lp);
 }
 
 /*
@@ -598,6 +547,8 @@ void add_user_to_channel(aChannel *chptr, aClient *who, int flags)
 		ptr->next = chptr->members;
 		chptr->members = ptr;
 		chptr->users++;
+		chandir_update(chptr);
+		channel_member_changes++;
 
 		ptr2 = make_membership(MyClient(who));
 		/* we should make this more efficient --stskeeps 
@@ -806,16 +757,10 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 		return 0;
 	}
 
-	if (chptr->mode.mode & MODE_NOCOLOR)
-	{
-		/* A bit faster */
-		char *c;
-		for (c = msgtext; *c; c++)
-		{
-			if (*c == 3 || *c == 27 || *c == 4 || *c == 22) /* mirc color, ansi, rgb, reverse */
-				return (CANNOT_SEND_NOCOLOR);
-		}
-	}
+	/* mirc color, ansi, rgb, reverse */
+	if ((chptr->mode.mode & MODE_NOCOLOR) &&
+	    (msgtext_flags(msgtext_for(msgtext)) & (MSGTEXT_COLOR|MSGTEXT_ANSI)))
+		return (CANNOT_SEND_NOCOLOR);
 	member = IsMember(cptr, chptr);
 	if (chptr->mode.mode & MODE_NOPRIVMSGS && !member)
 		return (CANNOT_SEND_NOPRIVMSGS);
@@ -839,7 +784,7 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 	if (chptr->mode.mode & MODE_NOCTCP &&
 	    (!lp
 	    || !(lp->flags & (CHFL_CHANOP | CHFL_CHANOWNER | CHFL_CHANPROT))))
-		if (msgtext[0] == 1 && strncmp(&msgtext[1], "ACTION ", 7))
+		if (msgtext_flags(msgtext_for(msgtext)) & MSGTEXT_CTCP)
 			return (CANNOT_SEND_NOCTCP);
 
 	if (notice && (chptr->mode.extmode & EXTMODE_NONOTICE) &&
@@ -1275,6 +1220,7 @@ aChannel *get_channel(aClient *cptr, char *chname, int flag)
 		chptr->creationtime = MyClient(cptr) ? TStime() : (TS)0;
 		channel = chptr;
 		(void)add_to_channel_hash_table(chname, chptr);
+		chandir_add(chptr);
 		IRCstats.channels++;
 		RunHook2(HOOKTYPE_CHANNEL_CREATE, cptr, chptr);
 	}
@@ -1368,8 +1314,11 @@ void sub1_from_channel(aChannel *chptr)
 
 	--chptr->users;
 	if (chptr->users <= 0)
-	{
 		chptr->users = 0;
+	chandir_update(chptr);
+	channel_member_changes++;
+	if (chptr->users == 0)
+	{
 
 		/*
 		 * Now, find all invite links from channel structure
@@ -1430,6 +1379,7 @@ void sub1_from_channel(aChannel *chptr)
 		if (chptr->nextch)
 			chptr->nextch->prevch = chptr->prevch;
 		(void)del_from_channel_hash_table(chptr->chname, chptr);
+		chandir_del(chptr);
 		IRCstats.channels--;
 		MyFree((char *)chptr);
 	}
@@ -46,6 +46,7 @@ MODVAR Event *events = NULL;
 extern EVENT(cmodej_cleanup_structs);
 #endif
 extern EVENT(unrealdns_removeoldrecords);
+extern EVENT(ident_timeout);
 
 void	LockEventSystem(void)
 {
@@ -212,6 +213,7 @@ void	SetupEvents(void)
 #endif
 	EventAddEx(NULL, "unrealdns_removeoldrecords", 15, 0, unrealdns_removeoldrecords, NULL);
 	EventAddEx(NULL, "check_pings", 9, 0, check_pings, NULL);
+	EventAddEx(NULL, "ident_timeout", 1, 0, ident_timeout, NULL);
 	EventAddEx(NULL, "check_unknowns", 16, 0, check_unknowns, NULL);
 	EventAddEx(NULL, "try_connections", 15, 0, try_connections, NULL);
 
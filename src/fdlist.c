@@ -17,6 +17,7 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _GNU_SOURCE	/* accept4() */
 #include "struct.h"
 #include "common.h"
 #include "sys.h"
@@ -83,6 +84,7 @@ int fd_fileopen(const char *path, unsigned int flags)
 void fd_close(int fd)
 {
 	FDEntry *fde;
+	unsigned int backend_flags;
 
 	if ((fd < 0) || (fd >= MAXCONNECTIONS))
 	{
@@ -103,17 +105,41 @@ void fd_close(int fd)
 		return;
 	}
 
+	if (fde->recv_callback)
+		fd_setrecv(fd, NULL, NULL);
+	backend_flags = fde->backend_flags;
 	memset(fde, 0, sizeof(FDEntry));
 
 	fde->fd = fd;
 
 	/* only notify the backend if it is actively tracking the FD */
+	fde->backend_flags = backend_flags;
 	if (fde->backend_flags)
 		fd_refresh(fd);
 
 	CLOSE_SOCK(fd);
 }
 
+/* Forget about fd without closing it, someone else does that (I/O threads) */
+void fd_unmap(int fd)
+{
+	FDEntry *fde;
+	unsigned int backend_flags;
+
+	if ((fd < 0) || (fd >= MAXCONNECTIONS) || !fd_table[fd].is_open)
+		return;
+
+	fde = &fd_table[fd];
+	if (fde->recv_callback)
+		fd_setrecv(fd, NULL, NULL);
+	backend_flags = fde->backend_flags;
+	memset(fde, 0, sizeof(FDEntry));
+	fde->fd = fd;
+	fde->backend_flags = backend_flags;
+	if (fde->backend_flags)
+		fd_refresh(fd);
+}
+
 int fd_socket(int family, int type, int protocol, const char *desc)
 {
 	int fd;
@@ -125,16 +151,28 @@ int fd_socket(int family, int type, int protocol, const char *desc)
 	return fd_open(fd, desc);
 }
 
-int fd_accept(int sockfd)
+/*
+ * Accept a connection, and give the peer address in 'addr' if it is not
+ * NULL. Where accept4() exists the new socket is already non-blocking
+ * and close-on-exec, saving two fcntl()s per connection.
+ */
+int fd_accept(int sockfd, struct SOCKADDR *addr, int *addrlen)
 {
 	const char buf[] = "Incoming connection";
 	int fd;
 
-	fd = accept(sockfd, NULL, NULL);
+#ifdef HAVE_ACCEPT4
+	fd = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	fd = accept(sockfd, addr, addrlen);
+#endif
 	if (fd < 0)
 		return -1;
 
-	return fd_open(fd, buf);
+	fd = fd_open(fd, buf);
+	if (fd >= 0)
+		fd_table[fd].type = FD_TYPE_CLIENT;
+	return fd;
 }
 
 void fd_desc(int fd, const char *desc)
@@ -163,3 +201,11 @@ void fd_desc(int fd, const char *desc)
 	strlcpy(fde->desc, desc, FD_DESC_SZ);
 }
 
+void fd_settype(int fd, int type)
+{
+	if ((fd < 0) || (fd >= MAXCONNECTIONS) || !fd_table[fd].is_open)
+		return;
+
+	fd_table[fd].type = type;
+}
+
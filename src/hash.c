@@ -26,23 +26,22 @@
 #include "hash.h"
 #include "h.h"
 #include "proto.h"
+#include "mempool.h"
 
 ID_Copyright("(C) 1991 Darren Reed");
 ID_Notes("2.10 7/3/93");
 
-static struct list_head clientTable[U_MAX];
-static struct list_head idTable[U_MAX];
-static aHashEntry channelTable[CH_MAX];
+static HashTable clientTable, idTable, channelTable;
+
+MODVAR HashTable *hashtables[] = { &clientTable, &idTable, &channelTable, NULL };
 
-/*
- * look in whowas.c for the missing ...[WW_MAX]; entry - Dianora */
 /*
  * Hashing.
  * 
  * The server uses a chained hash table to provide quick and efficient
  * hash table mantainence (providing the hash function works evenly
- * over the input range).  The hash table is thus not susceptible to
- * problems of filling all the buckets or the need to rehash. It is
+ * over the input range).  The client, ID and channel tables grow and
+ * shrink with the number of entries, see hashtable_add(). It is
  * expected that the hash table would look somehting like this during
  * use: +-----+    +-----+    +-----+   +-----+ 
  *   ---| 224 |----| 225 |----| 226 |---| 227 |--- 
@@ -90,70 +89,258 @@ unsigned int hash_nn_name(const char *hname)
 }
 
 
+/*
+ * Client, ID and channel names are hashed with SipHash-1-3 keyed by a
+ * random seed picked at startup, folding case on the fly the same way
+ * smycmp() does. Unlike the old shift-and-add hash this spreads names
+ * like user12345 evenly, and nobody can precompute a set of nicks that
+ * all land in the same bucket.
+ */
+static uint64_t hash_seed[2];
+
+#define ROTL64(x, b)	(uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+static unsigned int hash_siphash(const char *str)
+{
+	const u_char *s = (const u_char *)str;
+	uint64_t v0 = 0x736f6d6570736575ULL ^ hash_seed[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ hash_seed[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ hash_seed[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ hash_seed[1];
+	uint64_t m;
+	unsigned int len = 0;
+	int  i;
+
+	for (;;)
+	{
+		m = 0;
+		for (i = 0; i < 8 && s[i]; i++)
+			m |= (uint64_t)(u_char)tolower(s[i]) << (8 * i);
+		len += i;
+		if (i < 8)
+			break;
+		v3 ^= m;
+		SIPROUND;
+		v0 ^= m;
+		s += 8;
+	}
+
+	m |= (uint64_t)(len & 0xff) << 56;
+	v3 ^= m;
+	SIPROUND;
+	v0 ^= m;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return (unsigned int)(v0 ^ v1 ^ v2 ^ v3);
+}
+
 unsigned hash_nick_name(const char *nname)
 {
-	unsigned hash = 0;
-	int  hash2 = 0;
-	int  ret;
-	char lower;
+	return hash_siphash(nname);
+}
 
-	while (*nname)
-	{
-		lower = tolower(*nname);
-		hash = (hash << 1) + lower;
-		hash2 = (hash2 >> 1) + lower;
-		nname++;
-	}
-	ret = ((hash & U_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	    (hash2 & BITS_PER_COL_MASK);
-	return ret;
+unsigned int  hash_channel_name(char *name)
+{
+	return hash_siphash(name);
 }
+
 /*
- * hash_channel_name
- * 
- * calculate a hash value on at most the first 30 characters of the
- * channel name. Most names are short than this or dissimilar in this
- * range. There is little or no point hashing on a full channel name
- * which maybe 255 chars long.
+ * Generic part of the client, ID and channel tables.
+ *
+ * While the table is being resized the entries live in two bucket
+ * arrays: [0] is the old one, [1] the new one. Every bucket of [0]
+ * below rehashidx has already been moved and is empty. New entries
+ * always go into the newest array, lookups check both.
  */
-unsigned int  hash_channel_name(char *name)
+#define hashtable_entry(ht, pos)	((void *)((char *)(pos) - (ht)->offset))
+
+static void hashtable_init(HashTable *ht, char *name, size_t offset,
+    const char *(*key)(void *))
+{
+	int i;
+
+	if (ht->bucket[0])
+		MyFree(ht->bucket[0]);
+	if (ht->bucket[1])
+		MyFree(ht->bucket[1]);
+	memset(ht, 0, sizeof(HashTable));
+	ht->name = name;
+	ht->offset = offset;
+	ht->key = key;
+	ht->rehashidx = -1;
+	ht->size[0] = HASH_MIN_SIZE;
+	ht->bucket[0] = MyMalloc(sizeof(struct list_head) * HASH_MIN_SIZE);
+	for (i = 0; i < HASH_MIN_SIZE; i++)
+		INIT_LIST_HEAD(&ht->bucket[0][i]);
+}
+
+/*
+ * Start moving everything over to a bucket array of the given size.
+ */
+static void hashtable_resize(HashTable *ht, unsigned int size)
 {
-	unsigned char *hname = (unsigned char *)name;
-	unsigned int hash = 0;
-	int  hash2 = 0;
-	char lower;
-	int  i = 30;
+	unsigned int i;
 
-	while (*hname && --i)
+	ht->size[1] = size;
+	ht->bucket[1] = MyMalloc(sizeof(struct list_head) * size);
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&ht->bucket[1][i]);
+	ht->rehashidx = 0;
+	ht->resizes++;
+}
+
+/*
+ * Move up to HASH_REHASH_STEP buckets from the old to the new array,
+ * skipping at most ten times that many empty ones, and swap the arrays
+ * once the old one is drained.
+ */
+static void hashtable_rehash_step(HashTable *ht)
+{
+	struct list_head *pos, *next;
+	int  n = HASH_REHASH_STEP, empty = HASH_REHASH_STEP * 10;
+
+	while (n-- && ht->rehashidx < (int)ht->size[0])
+	{
+		struct list_head *bucket = &ht->bucket[0][ht->rehashidx];
+
+		while (list_empty(bucket) && ++ht->rehashidx < (int)ht->size[0])
+		{
+			if (--empty == 0)
+				return;
+			bucket = &ht->bucket[0][ht->rehashidx];
+		}
+		if (ht->rehashidx == (int)ht->size[0])
+			break;
+		list_for_each_safe(pos, next, bucket)
+		{
+			unsigned int hashv = hash_siphash(ht->key(hashtable_entry(ht, pos)));
+
+			list_del(pos);
+			list_add(pos, &ht->bucket[1][hashv & (ht->size[1] - 1)]);
+		}
+		ht->rehashidx++;
+	}
+
+	if (ht->rehashidx == (int)ht->size[0])
 	{
-		lower = tolower(*hname);
-		hash = (hash << 1) + lower;
-		hash2 = (hash2 >> 1) + lower;
-		hname++;
+		MyFree(ht->bucket[0]);
+		ht->bucket[0] = ht->bucket[1];
+		ht->size[0] = ht->size[1];
+		ht->bucket[1] = NULL;
+		ht->size[1] = 0;
+		ht->rehashidx = -1;
 	}
-	return ((hash & CH_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	    (hash2 & BITS_PER_COL_MASK);
 }
 
-unsigned int hash_whowas_name(char *name)
+static void hashtable_add(HashTable *ht, unsigned int hashv, struct list_head *node)
 {
-	unsigned char *nname = (unsigned char *)name;
-	unsigned int hash = 0;
-	int  hash2 = 0;
-	int  ret;
-	char lower;
+	if (ht->rehashidx != -1)
+		hashtable_rehash_step(ht);
+	else if (ht->count >= ht->size[0])
+		hashtable_resize(ht, ht->size[0] * 2);
 
-	while (*nname)
+	if (ht->rehashidx != -1)
+		list_add(node, &ht->bucket[1][hashv & (ht->size[1] - 1)]);
+	else
+		list_add(node, &ht->bucket[0][hashv & (ht->size[0] - 1)]);
+	ht->count++;
+}
+
+static void hashtable_del(HashTable *ht, struct list_head *node)
+{
+	list_del(node);
+	INIT_LIST_HEAD(node);
+	ht->count--;
+
+	if (ht->rehashidx != -1)
+		hashtable_rehash_step(ht);
+	else if (ht->size[0] > HASH_MIN_SIZE && ht->count < ht->size[0] / 8)
+		hashtable_resize(ht, ht->size[0] / 2);
+}
+
+/*
+ * Fill in the bucket(s) that may hold an entry with the given hash value
+ * and return how many there are: two while the table is being resized
+ * and that bucket of the old array has not been moved yet.
+ */
+static inline int hashtable_buckets(HashTable *ht, unsigned int hashv,
+    struct list_head **b)
+{
+	unsigned int idx = hashv & (ht->size[0] - 1);
+
+	if (ht->rehashidx == -1)
 	{
-		lower = tolower(*nname);
-		hash = (hash << 1) + lower;
-		hash2 = (hash2 >> 1) + lower;
-		nname++;
+		b[0] = &ht->bucket[0][idx];
+		return 1;
 	}
-	ret = ((hash & WW_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	    (hash2 & BITS_PER_COL_MASK);
-	return ret;
+	b[0] = &ht->bucket[1][hashv & (ht->size[1] - 1)];
+	if ((int)idx < ht->rehashidx)
+		return 1;
+	b[1] = &ht->bucket[0][idx];
+	return 2;
 }
+
+/*
+ * Number of non-empty buckets and length of the longest chain, for
+ * /STATS. Walks the whole table.
+ */
+void hashtable_chainstats(HashTable *ht, unsigned int *used, unsigned int *longest)
+{
+	struct list_head *pos;
+	unsigned int i, len;
+	int  t;
+
+	*used = *longest = 0;
+	for (t = 0; t < 2; t++)
+		for (i = 0; i < ht->size[t]; i++)
+		{
+			if (list_empty(&ht->bucket[t][i]))
+				continue;
+			len = 0;
+			list_for_each(pos, &ht->bucket[t][i])
+				len++;
+			(*used)++;
+			if (len > *longest)
+				*longest = len;
+		}
+}
+
+static const char *client_hash_key(void *p)
+{
+	return ((aClient *)p)->name;
+}
+
+static const char *id_hash_key(void *p)
+{
+	return ((aClient *)p)->id;
+}
+
+static const char *channel_hash_key(void *p)
+{
+	return ((aChannel *)p)->chname;
+}
+
+static void hash_init_seed(void)
+{
+	static int seeded = 0;
+
+	if (seeded)
+		return;
+	hash_seed[0] = ((uint64_t)getrandom32() << 32) | getrandom32();
+	hash_seed[1] = ((uint64_t)getrandom32() << 32) | getrandom32();
+	seeded = 1;
+}
+
 /*
  * clear_*_hash_table
  * 
@@ -161,18 +348,18 @@ unsigned int hash_whowas_name(char *name)
  */
 void clear_client_hash_table(void)
 {
-	int i;
-
-	for (i = 0; i < U_MAX; i++)
-		INIT_LIST_HEAD(&clientTable[i]);
-
-	for (i = 0; i < U_MAX; i++)
-		INIT_LIST_HEAD(&idTable[i]);
+	hash_init_seed();
+	hashtable_init(&clientTable, "client", offsetof(aClient, client_hash),
+	    client_hash_key);
+	hashtable_init(&idTable, "id", offsetof(aClient, id_hash),
+	    id_hash_key);
 }
 
 void clear_channel_hash_table(void)
 {
-	memset((char *)channelTable, '\0', sizeof(aHashEntry) * CH_MAX);
+	hash_init_seed();
+	hashtable_init(&channelTable, "channel", offsetof(aChannel, chan_hash),
+	    channel_hash_key);
 }
 
 
@@ -181,21 +368,16 @@ void clear_channel_hash_table(void)
  */
 int  add_to_client_hash_table(char *name, aClient *cptr)
 {
-	unsigned int  hashv;
-
-	hashv = hash_nick_name(name);
-	list_add(&cptr->client_hash, &clientTable[hashv]);
+	hashtable_add(&clientTable, hash_nick_name(name), &cptr->client_hash);
 	return 0;
 }
 
 /*
- * add_to_client_hash_table
+ * add_to_id_hash_table
  */
 int  add_to_id_hash_table(char *name, aClient *cptr)
 {
-	unsigned int  hashv;
-	hashv = hash_nick_name(name);
-	list_add(&cptr->id_hash, &idTable[hashv]);
+	hashtable_add(&idTable, hash_nick_name(name), &cptr->id_hash);
 	return 0;
 }
 
@@ -204,13 +386,7 @@ int  add_to_id_hash_table(char *name, aClient *cptr)
  */
 int  add_to_channel_hash_table(char *name, aChannel *chptr)
 {
-	unsigned int  hashv;
-
-	hashv = hash_channel_name(name);
-	chptr->hnextch = (aChannel *)channelTable[hashv].list;
-	channelTable[hashv].list = (void *)chptr;
-	channelTable[hashv].links++;
-	channelTable[hashv].hits++;
+	hashtable_add(&channelTable, hash_channel_name(name), &chptr->chan_hash);
 	return 0;
 }
 /*
@@ -219,9 +395,7 @@ int  add_to_channel_hash_table(char *name, aChannel *chptr)
 int  del_from_client_hash_table(char *name, aClient *cptr)
 {
 	if (!list_empty(&cptr->client_hash))
-		list_del(&cptr->client_hash);
-
-	INIT_LIST_HEAD(&cptr->client_hash);
+		hashtable_del(&clientTable, &cptr->client_hash);
 
 	return 0;
 }
@@ -229,9 +403,7 @@ int  del_from_client_hash_table(char *name, aClient *cptr)
 int  del_from_id_hash_table(char *name, aClient *cptr)
 {
 	if (!list_empty(&cptr->id_hash))
-		list_del(&cptr->id_hash);
-
-	INIT_LIST_HEAD(&cptr->id_hash);
+		hashtable_del(&idTable, &cptr->id_hash);
 
 	return 0;
 }
@@ -241,31 +413,10 @@ int  del_from_id_hash_table(char *name, aClient *cptr)
  */
 int  del_from_channel_hash_table(char *name, aChannel *chptr)
 {
-	aChannel *tmp, *prev = NULL;
-	unsigned int  hashv;
-
-	hashv = hash_channel_name(name);
-	for (tmp = (aChannel *)channelTable[hashv].list; tmp;
-	    tmp = tmp->hnextch)
-	{
-		if (tmp == chptr)
-		{
-			if (prev)
-				prev->hnextch = tmp->hnextch;
-			else
-				channelTable[hashv].list = (void *)tmp->hnextch;
-			tmp->hnextch = NULL;
-			if (channelTable[hashv].links > 0)
-			{
-				channelTable[hashv].links--;
-				return 1;
-			}
-			else
-				return -1;
-		}
-		prev = tmp;
-	}
-	return 0;
+	if (list_empty(&chptr->chan_hash))
+		return 0;
+	hashtable_del(&channelTable, &chptr->chan_hash);
+	return 1;
 }
 
 /*
@@ -274,13 +425,17 @@ int  del_from_channel_hash_table(char *name, aChannel *chptr)
 aClient *hash_find_client(const char *name, aClient *cptr)
 {
 	aClient *tmp;
-	unsigned int  hashv;
+	struct list_head *b[2];
+	int  i, n;
 
-	hashv = hash_nick_name(name);
-	list_for_each_entry(tmp, &clientTable[hashv], client_hash)
+	n = hashtable_buckets(&clientTable, hash_nick_name(name), b);
+	for (i = 0; i < n; i++)
 	{
-		if (smycmp(name, tmp->name) == 0)
-			return (tmp);
+		list_for_each_entry(tmp, b[i], client_hash)
+		{
+			if (smycmp(name, tmp->name) == 0)
+				return (tmp);
+		}
 	}
 
 	return (cptr);
@@ -289,13 +444,17 @@ aClient *hash_find_client(const char *name, aClient *cptr)
 aClient *hash_find_id(const char *name, aClient *cptr)
 {
 	aClient *tmp;
-	unsigned int  hashv;
+	struct list_head *b[2];
+	int  i, n;
 
-	hashv = hash_nick_name(name);
-	list_for_each_entry(tmp, &idTable[hashv], id_hash)
+	n = hashtable_buckets(&idTable, hash_nick_name(name), b);
+	for (i = 0; i < n; i++)
 	{
-		if (smycmp(name, tmp->id) == 0)
-			return (tmp);
+		list_for_each_entry(tmp, b[i], id_hash)
+		{
+			if (smycmp(name, tmp->id) == 0)
+				return (tmp);
+		}
 	}
 
 	return (cptr);
@@ -307,23 +466,27 @@ aClient *hash_find_id(const char *name, aClient *cptr)
 aClient *hash_find_nickserver(const char *name, aClient *cptr)
 {
 	aClient *tmp;
-	unsigned int  hashv;
+	struct list_head *b[2];
+	int  i, n;
 	char *serv;
 
 	serv = (char *)strchr(name, '@');
 	*serv++ = '\0';
-	hashv = hash_nick_name(name);
+	n = hashtable_buckets(&clientTable, hash_nick_name(name), b);
 
 	/*
 	 * Got the bucket, now search the chain.
 	 */
-	list_for_each_entry(tmp, &clientTable[hashv], client_hash)
+	for (i = 0; i < n; i++)
 	{
-		if (smycmp(name, tmp->name) == 0 && tmp->user &&
-		    smycmp(serv, tmp->user->server) == 0)
+		list_for_each_entry(tmp, b[i], client_hash)
 		{
-			*--serv = '\0';
-			return (tmp);
+			if (smycmp(name, tmp->name) == 0 && tmp->user &&
+			    smycmp(serv, tmp->user->server) == 0)
+			{
+				*--serv = '\0';
+				return (tmp);
+			}
 		}
 	}
 
@@ -336,16 +499,20 @@ aClient *hash_find_nickserver(const char *name, aClient *cptr)
 aClient *hash_find_server(const char *server, aClient *cptr)
 {
 	aClient *tmp;
-	unsigned int  hashv;
+	struct list_head *b[2];
+	int  i, n;
 
-	hashv = hash_nick_name(server);
-	list_for_each_entry(tmp, &clientTable[hashv], client_hash)
+	n = hashtable_buckets(&clientTable, hash_nick_name(server), b);
+	for (i = 0; i < n; i++)
 	{
-		if (!IsServer(tmp) && !IsMe(tmp))
-			continue;
-		if (smycmp(server, tmp->name) == 0)
+		list_for_each_entry(tmp, b[i], client_hash)
 		{
-			return (tmp);
+			if (!IsServer(tmp) && !IsMe(tmp))
+				continue;
+			if (smycmp(server, tmp->name) == 0)
+			{
+				return (tmp);
+			}
 		}
 	}
 
@@ -357,26 +524,22 @@ aClient *hash_find_server(const char *server, aClient *cptr)
  */
 aChannel *hash_find_channel(char *name, aChannel *chptr)
 {
-	unsigned int  hashv;
 	aChannel *tmp;
-	aHashEntry *tmp3;
+	struct list_head *b[2];
+	int  i, n;
 
-	hashv = hash_channel_name(name);
-	tmp3 = &channelTable[hashv];
-
-	for (tmp = (aChannel *)tmp3->list; tmp; tmp = tmp->hnextch)
-		if (smycmp(name, tmp->chname) == 0)
+	n = hashtable_buckets(&channelTable, hash_channel_name(name), b);
+	for (i = 0; i < n; i++)
+	{
+		list_for_each_entry(tmp, b[i], chan_hash)
 		{
-			return (tmp);
+			if (smycmp(name, tmp->chname) == 0)
+				return (tmp);
 		}
+	}
+
 	return chptr;
 }
-aChannel *hash_get_chan_bucket(unsigned int hashv)
-{
-	if (hashv >= CH_MAX)
-		return NULL;
-	return (aChannel *)channelTable[hashv].list;
-}
 
 /*
  * Rough figure of the datastructures for notify:
@@ -398,6 +561,7 @@ aChannel *hash_get_chan_bucket(unsigned int hashv)
  */
 
 static   aWatch  *watchTable[WATCHHASHSIZE];
+static mp_pool_t *watch_pool = NULL;
 
 void  count_watch_memory(int *count, u_long *memory)
 {
@@ -409,7 +573,7 @@ void  count_watch_memory(int *count, u_long *memory)
 		anptr = watchTable[i];
 		while (anptr) {
 			(*count)++;
-			(*memory) += sizeof(aWatch)+strlen(anptr->nick);
+			(*memory) += sizeof(aWatch);
 			anptr = anptr->hnext;
 		}
 	}
@@ -418,6 +582,8 @@ void  count_watch_memory(int *count, u_long *memory)
 void  clear_watch_hash_table(void)
 {
 	memset((char *)watchTable, '\0', sizeof(watchTable));
+	if (!watch_pool)
+		watch_pool = mp_pool_new_named("watch", sizeof(aWatch), 64 * 1024);
 }
 
 /*
@@ -440,9 +606,9 @@ int   add_to_watch_hash_table(char *nick, aClient *cptr, int awaynotify)
 	
 	/* If found NULL (no header for this nick), make one... */
 	if (!anptr) {
-		anptr = (aWatch *)MyMalloc(sizeof(aWatch)+strlen(nick));
+		anptr = mp_pool_get(watch_pool);
 		anptr->lasttime = timeofday;
-		strcpy(anptr->nick, nick);
+		strlcpy(anptr->nick, nick, sizeof(anptr->nick));
 		
 		anptr->watch = NULL;
 		
@@ -624,7 +790,7 @@ int   del_from_watch_hash_table(char *nick, aClient *cptr)
 		  watchTable[hashv] = anptr->hnext;
 		else
 		  nlast->hnext = anptr->hnext;
-		MyFree(anptr);
+		mp_pool_release(anptr);
 	}
 	
 	/* Update count of notifies on nick */
@@ -689,7 +855,7 @@ int   hash_del_watch_list(aClient *cptr)
 				  nl->hnext = anptr->hnext;
 				else
 				  watchTable[hashv] = anptr->hnext;
-				MyFree(anptr);
+				mp_pool_release(anptr);
 			}
 		}
 		
@@ -0,0 +1,889 @@
+/*
+ * RabbitIRCD, src/intake.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Intake workers (set::intake-workers). A few forked processes share
+ * the plaintext listen ports with us through SO_REUSEPORT: each has
+ * its own socket bound to the address of every such listener, so the kernel
+ * spreads new connections over them and over our own socket, each with
+ * its own backlog.
+ *
+ * A worker accepts what comes in, refuses the addresses banned by
+ * ban ip { } right there, and does the DNS and ident lookups of the
+ * rest, telling the client how they go like we would. Connections that
+ * are done are passed to us in batches over a UNIX socket (SCM_RIGHTS),
+ * together with their peer addresses and what the lookups found. Here
+ * they go through accept_connection() like the ones we accepted
+ * ourselves, but without the lookups: Z:Lines, throttling and the
+ * unknown connections per IP are only checked here, the worker's copy
+ * of them would be out of date.
+ *
+ * A connect flood from addresses in ban ip { } is thus handled entirely
+ * by the workers, and the rest reaches us a batch at a time, with the
+ * waiting for DNS and ident behind it. A worker has its own resolver
+ * channel, and its own copy of the DNS and ident caches.
+ *
+ * The SSL handshake and registration stay here: an established SSL
+ * session can't be passed to another process (kTLS would carry the
+ * keys but not the session that certificate fingerprints, renegotiation
+ * and the close_notify need). SSL listeners are not shared with the
+ * workers.
+ *
+ * The SO_REUSEPORT sockets are made and kept open by us, the workers
+ * inherit them. Workers have a copy of the configuration from when they
+ * were forked, so they are replaced after every /REHASH: the new ones
+ * are started on the same sockets first, then the old ones are told to
+ * stop (by shutting down our end of their socket pair) and finish the
+ * batch they are on. The connections waiting in the backlog of a
+ * socket are never dropped that way, the socket itself stays. Only the
+ * sockets of a listener that is gone, or of a worker that died, are
+ * closed. Lookups still running when a worker is told to stop are left
+ * to us: the connection is passed without their results. fork() resets
+ * the malloc() locks in the child, so the worker can use it even with
+ * I/O threads running here (see iothread.c).
+ */
+
+#define _GNU_SOURCE	/* accept4() */
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "numeric.h"
+#include "h.h"
+#include "res.h"
+#include "proto.h"
+
+#if defined(SO_REUSEPORT) && defined(SCM_RIGHTS) && !defined(_WIN32)
+#define USE_INTAKE
+#endif
+
+#ifdef USE_INTAKE
+
+#include <signal.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#define INTAKE_BATCH		64	/* connections per message */
+#define INTAKE_MAXLISTEN	32	/* listeners a worker takes part in */
+#define INTAKE_READS		16	/* messages per intake_read() call */
+#define INTAKE_PENDING		256	/* connections a worker does the lookups for at a time */
+#define INTAKE_STOP_WAIT	2000	/* msec to wait for a worker to stop, before SIGKILL */
+
+extern char zlinebuf[];
+extern EVENT(unrealdns_removeoldrecords);
+
+typedef struct {
+	struct SOCKADDR_IN addr;
+	IntakeLookup lookup;
+} IntakeConn;
+
+typedef struct {
+	int  port;			/* the listener, by port and IP */
+	char ip[64];
+	int  refused;			/* connections refused since the last message */
+	int  count;			/* connections (and fds) passed */
+	IntakeConn conn[INTAKE_BATCH];
+} IntakeMsg;
+
+typedef struct {
+	int  port;			/* the listener, by port and IP */
+	char ip[64];
+	int  options;			/* and its options */
+	int  fd;			/* our SO_REUSEPORT socket for it, -1 if none */
+} IntakeSocket;
+
+typedef struct {
+	pid_t pid;
+	int  fd;			/* our end of the socket pair, -1 once the worker is gone */
+	char stopping;			/* told to stop, it exiting is no news */
+	unsigned long long passed, refused;
+	int  nsock;
+	IntakeSocket sock[INTAKE_MAXLISTEN];
+} IntakeWorker;
+
+/* A connection a worker is doing the lookups for */
+typedef struct {
+	int  fd;			/* the client, -1 if the slot is free */
+	IntakeSocket *sk;		/* where it came in */
+	struct IN_ADDR ip;
+	IntakeConn c;
+	char notices;			/* tell the client how the lookups go */
+	char dns;			/* the DNS lookup is running */
+	char ident;			/* IDENT_*, the ident lookup is running */
+	int  authfd;
+	time_t deadline;
+	int  count;			/* of the ident reply, in buf */
+	char buf[IDENTBUFLEN];
+} IntakePending;
+
+#define IDENT_CONNECTING	1
+#define IDENT_READING		2
+
+static IntakeWorker *intake = NULL;
+static int intake_count = 0;
+
+/* SSL and metrics listeners stay with us */
+int intake_listener(ConfigItem_listen *listener)
+{
+	return (INTAKE_WORKERS > 0) &&
+	    !(listener->options & (LISTENER_SSL | LISTENER_METRICS));
+}
+
+/*
+ * Worker side
+ */
+
+static IntakePending *pending;		/* INTAKE_PENDING of them */
+static int npending = 0, nident = 0, nodns = 0;
+
+static int intake_send(int chan, IntakeMsg *m, int *fds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * INTAKE_BATCH)];
+	} control;
+	int  r;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = m;
+	iov.iov_len = offsetof(IntakeMsg, conn) + m->count * sizeof(IntakeConn);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (m->count)
+	{
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * m->count);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * m->count);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * m->count);
+	}
+	/* Blocking: if we are ahead of the main process the backlog waits */
+	while ((r = sendmsg(chan, &msg, 0)) < 0 && errno == EINTR)
+		;
+	return r;
+}
+
+static void intake_notice(IntakePending *p, char *text)
+{
+	if (p->notices)
+		(void)send(p->fd, text, strlen(text), 0);
+}
+
+static void intake_dns_done(void *arg, char *name, int cached)
+{
+	IntakePending *p = arg;
+
+	p->dns = 0;
+	p->c.lookup.flags |= LOOKUP_DNS;
+	if (cached)
+		p->c.lookup.flags |= LOOKUP_DNS_CACHED;
+	if (name)
+		strlcpy(p->c.lookup.host, name, sizeof(p->c.lookup.host));
+	intake_notice(p, cached ? REPORT_FIN_DNSC : name ? REPORT_FIN_DNS : REPORT_FAIL_DNS);
+}
+
+/* The ident query of 'p' is over, 'ruser' is NULL if there was no reply */
+static void intake_ident_done(IntakePending *p, char *ruser, int noidentd)
+{
+	if (p->authfd >= 0)
+	{
+		close(p->authfd);
+		p->authfd = -1;
+		nident--;
+	}
+	p->ident = 0;
+	p->c.lookup.flags |= LOOKUP_IDENT | LOOKUP_IDENT_QUERIED;
+	if (noidentd)
+	{
+		p->c.lookup.flags |= LOOKUP_NO_IDENTD;
+		identcache_add(&p->ip);
+	}
+	if (ruser)
+		strlcpy(p->c.lookup.username, ruser, sizeof(p->c.lookup.username));
+	intake_notice(p, ruser ? REPORT_FIN_ID : REPORT_FAIL_ID);
+}
+
+/* Like start_auth() */
+static void intake_ident_start(IntakePending *p)
+{
+	struct SOCKADDR_IN sock, us;
+	int  len;
+
+	if (IDENT_CHECK == 0)
+	{
+		p->c.lookup.flags |= LOOKUP_IDENT;
+		return;
+	}
+	if (ident_cached(&p->ip))
+		p->c.lookup.flags |= LOOKUP_IDENT | LOOKUP_IDENT_CACHED;
+	else if (nident >= IDENT_MAX_QUERIES)
+		p->c.lookup.flags |= LOOKUP_IDENT | LOOKUP_IDENT_BUSY;
+	if (p->c.lookup.flags & LOOKUP_IDENT)
+	{
+		intake_notice(p, REPORT_FAIL_ID);
+		return;
+	}
+	if ((p->authfd = socket(AFINET, SOCK_STREAM, 0)) < 0)
+	{
+		intake_ident_done(p, NULL, 0);
+		return;
+	}
+	nident++;
+	p->ident = IDENT_CONNECTING;
+	p->deadline = TStime() + IDENT_CONNECT_TIMEOUT;
+#if defined(INET6) && defined(IPV6_V6ONLY)
+	{
+		int  opt = 0;
+
+		setsockopt(p->authfd, IPPROTO_IPV6, IPV6_V6ONLY, (OPT_TYPE *)&opt, sizeof(opt));
+	}
+#endif
+	intake_notice(p, REPORT_DO_ID);
+	set_non_blocking(p->authfd, NULL);
+
+	/* Bind to the IP the user got in */
+	memset(&sock, 0, sizeof(sock));
+	len = sizeof(us);
+	if (!getsockname(p->fd, (struct SOCKADDR *)&us, &len))
+	{
+		bcopy(&us.SIN_ADDR, &sock.SIN_ADDR, sizeof(struct IN_ADDR));
+		sock.SIN_FAMILY = AFINET;
+		(void)bind(p->authfd, (struct SOCKADDR *)&sock, sizeof(sock));
+	}
+	bcopy(&p->ip, &sock.SIN_ADDR, sizeof(struct IN_ADDR));
+	sock.SIN_PORT = htons(113);
+	sock.SIN_FAMILY = AFINET;
+	if (connect(p->authfd, (struct SOCKADDR *)&sock, sizeof(sock)) < 0 && errno != EINPROGRESS)
+		intake_ident_done(p, NULL, 1);
+}
+
+/* Like send_authports() and read_authports() */
+static void intake_ident_io(IntakePending *p)
+{
+	struct SOCKADDR_IN us;
+	char authbuf[32], ruser[USERLEN + 1];
+	int  len;
+
+	if (p->ident == IDENT_CONNECTING)
+	{
+		len = sizeof(us);
+		if (getsockname(p->fd, (struct SOCKADDR *)&us, &len))
+		{
+			intake_ident_done(p, NULL, 0);
+			return;
+		}
+		ircsnprintf(authbuf, sizeof(authbuf), "%u , %u\r\n",
+		    (unsigned int)ntohs(p->c.addr.SIN_PORT),
+		    (unsigned int)ntohs(us.SIN_PORT));
+		if (send(p->authfd, authbuf, strlen(authbuf), 0) != strlen(authbuf))
+		{
+			if (errno != EAGAIN)
+				intake_ident_done(p, NULL, 1);
+			return;
+		}
+		p->ident = IDENT_READING;
+		p->deadline = TStime() + IDENT_READ_TIMEOUT;
+		p->count = 0;
+		return;
+	}
+
+	len = recv(p->authfd, p->buf + p->count, IDENTBUFLEN - 1 - p->count, 0);
+	if (len < 0)
+	{
+		if (errno != EAGAIN && errno != EINTR)
+			intake_ident_done(p, NULL, 0);
+		return;
+	}
+	p->count += len;
+	p->buf[p->count] = '\0';
+	if (!ident_reply(p->buf, p->count, len, ruser))
+		return;
+	intake_ident_done(p, ruser, (len == 0) && (p->count == 0));
+}
+
+/* Take what is waiting on 'sk', and start the lookups for it */
+static void intake_accept(IntakeSocket *sk, int *refused)
+{
+	IntakePending *p;
+	struct SOCKADDR_IN addr;
+	int  cli_fd, len;
+
+	for (p = pending; npending < INTAKE_PENDING; )
+	{
+		len = sizeof(addr);
+#ifdef HAVE_ACCEPT4
+		cli_fd = accept4(sk->fd, (struct SOCKADDR *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		cli_fd = accept(sk->fd, (struct SOCKADDR *)&addr, &len);
+#endif
+		if (cli_fd < 0)
+		{
+			if (errno == ECONNABORTED || errno == EINTR)
+				continue;
+			break;
+		}
+#ifndef HAVE_ACCEPT4
+		set_non_blocking(cli_fd, NULL);
+#endif
+		if (!check_peer_banip(&addr))
+		{
+			(void)send(cli_fd, zlinebuf, strlen(zlinebuf), 0);
+			close(cli_fd);
+			(*refused)++;
+			continue;
+		}
+
+		while (p->fd >= 0)
+			p++;
+		memset(p, 0, offsetof(IntakePending, buf));
+		p->fd = cli_fd;
+		p->authfd = -1;
+		p->sk = sk;
+		p->c.addr = addr;
+		bcopy(&addr.SIN_ADDR, &p->ip, sizeof(struct IN_ADDR));
+		p->notices = SHOWCONNECTINFO && !(sk->options & LISTENER_SERVERSONLY);
+		npending++;
+
+		if (!DONT_RESOLVE && !nodns)
+		{
+			intake_notice(p, REPORT_DO_DNS);
+			p->dns = 1;
+			unrealdns_lookup(&p->ip, intake_dns_done, p);
+		}
+		intake_ident_start(p);
+	}
+}
+
+/*
+ * Pass on the connections that are done with their lookups, or all of
+ * them if 'all' is set: we are stopping, and the lookups still running
+ * are left to the main process.
+ */
+static int intake_flush(int chan, IntakeWorker *w, int *refused, int all)
+{
+	IntakeMsg m;
+	IntakePending *p;
+	int  fds[INTAKE_BATCH];
+	int  i, j;
+
+	for (i = 0; i < w->nsock; i++)
+	{
+		p = pending;
+		do {
+			memset(&m, 0, offsetof(IntakeMsg, conn));
+			m.port = w->sock[i].port;
+			strlcpy(m.ip, w->sock[i].ip, sizeof(m.ip));
+			for (; (p < pending + INTAKE_PENDING) && (m.count < INTAKE_BATCH); p++)
+			{
+				if ((p->fd < 0) || (p->sk != &w->sock[i]) || (!all && (p->dns || p->ident)))
+					continue;
+				if (p->authfd >= 0)
+				{
+					close(p->authfd);
+					nident--;
+				}
+				m.conn[m.count] = p->c;
+				fds[m.count++] = p->fd;
+				p->fd = -1;
+				npending--;
+			}
+			if (!m.count && !*refused)
+				break;
+			m.refused = *refused;
+			*refused = 0;
+			if (intake_send(chan, &m, fds) < 0)
+				return -1;
+			for (j = 0; j < m.count; j++)
+				close(fds[j]);
+		} while (p < pending + INTAKE_PENDING);
+	}
+	return 0;
+}
+
+static void intake_worker(IntakeWorker *w, int chan)
+{
+	struct pollfd pfd[INTAKE_MAXLISTEN + 1 + ARES_GETSOCK_MAXNUM + INTAKE_PENDING];
+	IntakePending *pp[INTAKE_PENDING];
+	ares_socket_t socks[ARES_GETSOCK_MAXNUM];
+	struct timeval maxtv, tv, *tvp;
+	time_t lastexpire = 0;
+	int  n = w->nsock, i, j, fd, nfds, nares, bits, timeout, refused = 0;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGALRM, SIG_IGN);
+#if defined(__linux__) && defined(PR_SET_PDEATHSIG)
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+	/* Everything else belongs to the main process */
+	for (fd = 0; fd < MAXCONNECTIONS; fd++)
+	{
+		for (i = 0; i < n && w->sock[i].fd != fd; i++)
+			;
+		if (i == n && fd != chan)
+			close(fd);
+	}
+
+	pending = MyMallocEx(sizeof(IntakePending) * INTAKE_PENDING);
+	for (i = 0; i < INTAKE_PENDING; i++)
+		pending[i].fd = -1;
+	/* Without a resolver the main process does the DNS lookups */
+	nodns = (unrealdns_worker_init() < 0);
+
+	for (;;)
+	{
+		timeofday = time(NULL);
+		if (timeofday != lastexpire)
+		{
+			unrealdns_removeoldrecords(NULL);
+			lastexpire = timeofday;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			pfd[i].fd = w->sock[i].fd;
+			pfd[i].events = (npending < INTAKE_PENDING) ? POLLIN : 0;
+		}
+		pfd[n].fd = chan;
+		pfd[n].events = POLLIN;
+		nfds = n + 1;
+
+		nares = 0;
+		timeout = -1;
+		if (npending)
+		{
+			bits = nodns ? 0 : ares_getsock(resolver_channel, socks, ARES_GETSOCK_MAXNUM);
+			for (i = 0; i < ARES_GETSOCK_MAXNUM; i++)
+			{
+				if (!ARES_GETSOCK_READABLE(bits, i) && !ARES_GETSOCK_WRITABLE(bits, i))
+					continue;
+				pfd[nfds].fd = socks[i];
+				pfd[nfds].events = (ARES_GETSOCK_READABLE(bits, i) ? POLLIN : 0) |
+				    (ARES_GETSOCK_WRITABLE(bits, i) ? POLLOUT : 0);
+				nfds++;
+			}
+			nares = nfds - n - 1;
+			for (i = j = 0; i < INTAKE_PENDING; i++)
+				if (pending[i].fd >= 0 && pending[i].ident)
+				{
+					pp[j++] = &pending[i];
+					pfd[nfds].fd = pending[i].authfd;
+					pfd[nfds].events = (pending[i].ident == IDENT_CONNECTING) ? POLLOUT : POLLIN;
+					nfds++;
+				}
+			/* Also wake up for the ident deadlines */
+			maxtv.tv_sec = 1;
+			maxtv.tv_usec = 0;
+			tvp = nodns ? &maxtv : ares_timeout(resolver_channel, &maxtv, &tv);
+			timeout = tvp->tv_sec * 1000 + tvp->tv_usec / 1000 + 1;
+		}
+
+		if (poll(pfd, nfds, timeout) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			_exit(1);
+		}
+		timeofday = time(NULL);
+
+		/* The main process went away, or wants us to stop. All we
+		 * accepted is passed on, the rest stays in the backlog for
+		 * whoever has the socket next.
+		 */
+		if (pfd[n].revents)
+		{
+			(void)intake_flush(chan, w, &refused, 1);
+			_exit(0);
+		}
+
+		for (i = n + 1; i < n + 1 + nares; i++)
+			if (pfd[i].revents)
+				ares_process_fd(resolver_channel,
+				    (pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) ? pfd[i].fd : ARES_SOCKET_BAD,
+				    (pfd[i].revents & (POLLOUT | POLLERR | POLLHUP)) ? pfd[i].fd : ARES_SOCKET_BAD);
+		if (npending && !nodns)
+			ares_process_fd(resolver_channel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+
+		for (i = n + 1 + nares, j = 0; i < nfds; i++, j++)
+		{
+			if (!pp[j]->ident)
+				continue;
+			if (pfd[i].revents)
+				intake_ident_io(pp[j]);
+			else if (pp[j]->deadline <= timeofday)
+				intake_ident_done(pp[j], NULL, 1);
+		}
+
+		for (i = 0; i < n; i++)
+			if (pfd[i].revents & POLLIN)
+				intake_accept(&w->sock[i], &refused);
+
+		if (intake_flush(chan, w, &refused, 0) < 0)
+			_exit(1);
+	}
+}
+
+/*
+ * Main process side
+ */
+
+static ConfigItem_listen *intake_find_listener(IntakeMsg *m)
+{
+	ConfigItem_listen *listener;
+
+	for (listener = conf_listen; listener; listener = (ConfigItem_listen *)listener->next)
+		if ((listener->port == m->port) && !strcmp(listener->ip ? listener->ip : "*", m->ip) &&
+		    (listener->options & LISTENER_BOUND))
+			return listener;
+	return NULL;
+}
+
+/* A socket of our own, bound where 'listener' is */
+static int intake_socket(ConfigItem_listen *listener)
+{
+	struct SOCKADDR_IN addr;
+	int  fd, opt = 1, len = sizeof(addr);
+
+	if (getsockname(listener->fd, (struct SOCKADDR *)&addr, &len) < 0)
+		return -1;
+	if ((fd = fd_socket(AFINET, SOCK_STREAM, 0, "Intake listener")) < 0)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (OPT_TYPE *)&opt, sizeof(opt)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (OPT_TYPE *)&opt, sizeof(opt)) < 0 ||
+	    bind(fd, (struct SOCKADDR *)&addr, len) < 0 ||
+	    listen(fd, SOMAXCONN) < 0)
+	{
+		opt = errno;
+		fd_close(fd);
+		errno = opt;
+		return -1;
+	}
+#ifdef TCP_DEFER_ACCEPT
+	if (listener->options & LISTENER_DEFER_ACCEPT)
+		setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (OPT_TYPE *)&opt, sizeof(opt));
+#endif
+	set_non_blocking(fd, NULL);
+	return fd;
+}
+
+/*
+ * Give 'w' a socket for every listener it takes part in: the one the
+ * worker it replaces had for it, if any, or a new one.
+ */
+static void intake_sockets(IntakeWorker *w, IntakeWorker *old)
+{
+	ConfigItem_listen *listener;
+	IntakeSocket *sk;
+	int  i;
+
+	w->nsock = 0;
+	for (listener = conf_listen; listener && w->nsock < INTAKE_MAXLISTEN;
+	     listener = (ConfigItem_listen *)listener->next)
+	{
+		if (!(listener->options & LISTENER_BOUND) || listener->fd < 0 ||
+		    !intake_listener(listener))
+			continue;
+		sk = &w->sock[w->nsock];
+		sk->port = listener->port;
+		strlcpy(sk->ip, listener->ip ? listener->ip : "*", sizeof(sk->ip));
+		sk->options = listener->options;
+		sk->fd = -1;
+		for (i = 0; old && i < old->nsock; i++)
+			if (old->sock[i].fd >= 0 && old->sock[i].port == sk->port &&
+			    !strcmp(old->sock[i].ip, sk->ip))
+			{
+				sk->fd = old->sock[i].fd;
+				old->sock[i].fd = -1;
+				break;
+			}
+		if (sk->fd < 0 && (sk->fd = intake_socket(listener)) < 0)
+		{
+			ircd_log(LOG_ERROR, "Intake worker %d: cannot listen on %s:%d: %s",
+			    (int)(w - intake), sk->ip, sk->port, STRERROR(ERRNO));
+			continue;
+		}
+		w->nsock++;
+	}
+}
+
+static void intake_close_sockets(IntakeWorker *w)
+{
+	int  i;
+
+	for (i = 0; i < w->nsock; i++)
+		if (w->sock[i].fd >= 0)
+		{
+			fd_close(w->sock[i].fd);
+			w->sock[i].fd = -1;
+		}
+}
+
+/* No one takes connections from the sockets of a worker that is gone */
+static void intake_gone(IntakeWorker *w)
+{
+	fd_close(w->fd);
+	w->fd = -1;
+	intake_close_sockets(w);
+	(void)waitpid(w->pid, NULL, WNOHANG);
+}
+
+/* Connections from a worker */
+static void intake_read(int fd, int revents, void *data)
+{
+	IntakeWorker *w = data;
+	ConfigItem_listen *listener;
+	IntakeMsg m;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * INTAKE_BATCH)];
+	} control;
+	int  fds[INTAKE_BATCH];
+	int  i, r, nfds, flags = 0, reads;
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags = MSG_CMSG_CLOEXEC;
+#endif
+
+	for (reads = 0; reads < INTAKE_READS; reads++)
+	{
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = &m;
+		iov.iov_len = sizeof(m);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		r = recvmsg(fd, &msg, flags);
+		if (r < 0)
+		{
+			if (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN || ERRNO == P_EINTR)
+				return;
+		}
+		if (r <= 0)
+		{
+			if (!w->stopping)
+				ircd_log(LOG_ERROR, "Intake worker %d (pid %d) exited, /REHASH starts it again",
+				    (int)(w - intake), (int)w->pid);
+			intake_gone(w);
+			return;
+		}
+
+		nfds = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+			}
+
+		w->refused += m.refused;
+		ircstp->is_ac += m.refused;
+		ircstp->is_ref += m.refused;
+
+		listener = intake_find_listener(&m);
+		for (i = 0; i < nfds; i++)
+		{
+			w->passed++;
+			if (!listener || (i >= m.count) || (fd_open(fds[i], "Incoming connection") < 0))
+			{
+				CLOSE_SOCK(fds[i]);
+				continue;
+			}
+			fd_table[fds[i]].type = FD_TYPE_CLIENT;
+			accept_connection(listener, fds[i], &m.conn[i].addr, &m.conn[i].lookup);
+		}
+	}
+}
+
+/* Start set::intake-workers workers, taking over the sockets of 'old' */
+static void intake_start(IntakeWorker *old, int oldcount)
+{
+	IntakeWorker *w;
+	int  sv[2], i;
+
+	intake = MyMallocEx(sizeof(IntakeWorker) * INTAKE_WORKERS);
+	for (i = 0; i < INTAKE_WORKERS; i++)
+	{
+		w = &intake[i];
+		w->fd = -1;
+		intake_sockets(w, (i < oldcount) ? &old[i] : NULL);
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+		{
+			ircd_log(LOG_ERROR, "Intake workers: socketpair failed: %s", STRERROR(ERRNO));
+			intake_close_sockets(w);
+			break;
+		}
+		w->pid = fork();
+		if (w->pid < 0)
+		{
+			ircd_log(LOG_ERROR, "Intake workers: fork failed: %s", STRERROR(ERRNO));
+			close(sv[0]);
+			close(sv[1]);
+			intake_close_sockets(w);
+			break;
+		}
+		if (w->pid == 0)
+		{
+			intake_worker(w, sv[1]);
+			_exit(0);
+		}
+		close(sv[1]);
+		if (fd_open(sv[0], "Intake worker") < 0)
+		{
+			close(sv[0]);
+			kill(w->pid, SIGTERM);
+			(void)waitpid(w->pid, NULL, 0);
+			intake_close_sockets(w);
+			break;
+		}
+		w->fd = sv[0];
+		set_non_blocking(w->fd, NULL);
+		fd_setselect(w->fd, FD_SELECT_READ, intake_read, w);
+	}
+	intake_count = i;
+	ircd_log(LOG_ERROR, "Using %d intake workers", intake_count);
+}
+
+/** Start the intake workers, if set::intake-workers asks for them */
+void intake_init(void)
+{
+	if (intake_count || INTAKE_WORKERS <= 0)
+		return;
+	intake_start(NULL, 0);
+}
+
+/*
+ * Stop the workers in 'ws', taking what they already passed on, and
+ * close the sockets no new worker took over.
+ */
+static void intake_stop(IntakeWorker *ws, int count)
+{
+	IntakeWorker *w;
+	struct pollfd pfd;
+	int  i, r, killed;
+
+	/* All at once, they stop in parallel */
+	for (i = 0; i < count; i++)
+	{
+		w = &ws[i];
+		w->stopping = 1;
+		if (w->fd >= 0)
+			shutdown(w->fd, SHUT_WR);
+	}
+	for (i = 0; i < count; i++)
+	{
+		w = &ws[i];
+		killed = 0;
+		while (w->fd >= 0)
+		{
+			pfd.fd = w->fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			r = poll(&pfd, 1, INTAKE_STOP_WAIT);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r > 0)
+			{
+				intake_read(w->fd, 0, w);
+				continue;
+			}
+			if (killed)
+			{
+				intake_gone(w);
+				break;
+			}
+			/* Stuck (or stopped), SIGTERM might wait forever */
+			ircd_log(LOG_ERROR, "Intake worker %d (pid %d) does not stop, killing it",
+			    i, (int)w->pid);
+			kill(w->pid, SIGKILL);
+			killed = 1;
+		}
+		intake_close_sockets(w);
+		(void)waitpid(w->pid, NULL, 0);
+	}
+	MyFree(ws);
+}
+
+/** After a rehash: new workers, with the new ban ip { } and listeners */
+void intake_rehash(void)
+{
+	IntakeWorker *old = intake;
+	int  oldcount = intake_count;
+
+	intake = NULL;
+	intake_count = 0;
+	if (INTAKE_WORKERS > 0)
+		intake_start(old, oldcount);
+	if (old)
+		intake_stop(old, oldcount);
+}
+
+void stats_intake(aClient *sptr)
+{
+	IntakeWorker *w;
+	int  i;
+
+	for (i = 0; i < intake_count; i++)
+	{
+		w = &intake[i];
+		sendto_one(sptr, ":%s %d %s :intake %d pid %d passed %llu refused %llu%s",
+		    me.name, RPL_STATSDEBUG, sptr->name, i, (int)w->pid,
+		    w->passed, w->refused, w->fd < 0 ? " (exited)" : "");
+	}
+}
+
+#else
+
+int intake_listener(ConfigItem_listen *listener)
+{
+	return 0;
+}
+
+void intake_init(void)
+{
+	if (INTAKE_WORKERS > 0)
+		ircd_log(LOG_ERROR, "set::intake-workers: SO_REUSEPORT is not available, not using intake workers");
+}
+
+void intake_rehash(void)
+{
+}
+
+void stats_intake(aClient *sptr)
+{
+}
+
+#endif
@@ -0,0 +1,807 @@
+/*
+ * RabbitIRCD, src/iothread.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * I/O threads (set::io-threads). Plaintext client sockets are handed to
+ * a small pool of threads, each with its own epoll set, which do the
+ * recv() and writev() calls. Everything else stays on the main thread:
+ * parse(), the recvQ and sendQ, flood checks and all IRC state.
+ *
+ * Each thread talks to the main thread through two single producer,
+ * single consumer rings:
+ *   to the thread	IOMSG_ATTACH, IOMSG_SEND, IOMSG_RELEASE, IOMSG_CLOSE
+ *   to the main thread	IOMSG_DATA, IOMSG_DRAINED, IOMSG_RELEASED,
+ *			IOMSG_READERR, IOMSG_WRITEERR
+ * and an eventfd to wake the other side up. The main thread only wakes
+ * a thread once per loop iteration (ioth_flush()), the threads wake the
+ * main thread once per batch of events.
+ *
+ * A thread only passes on complete lines (IOMSG_DATA), the start of a
+ * line stays with the thread until the rest arrives. Output is taken
+ * from the sendQ by send_queued() once per loop iteration, at most
+ * IOTH_WINDOW bytes until the thread says it wrote it all, so the sendQ
+ * still is where output piles up and its limits work as before.
+ *
+ * The main thread never waits for a thread: if a ring is full the
+ * messages wait in an overflow list until ioth_flush(). The threads do
+ * wait for the main thread, which always gets around to emptying the
+ * rings.
+ *
+ * Socket numbers are tied to a thread (fd % number of threads), so an
+ * IOMSG_ATTACH for a reused fd is always queued behind the IOMSG_CLOSE
+ * of its old owner; the thread closes the socket, so the number can't
+ * be reused before that. Messages to the main thread carry the serial
+ * given at IOMSG_ATTACH time, ones for a client that is gone are
+ * dropped.
+ *
+ * A socket can also go back to the main thread without closing it
+ * (ioth_release(), for a server link or STARTTLS): the thread stops
+ * reading, writes what it was given and answers IOMSG_RELEASED with the
+ * start of a line it still had. Until then the main thread keeps new
+ * output in the sendQ. An IOMSG_CLOSE that crosses the IOMSG_RELEASED
+ * finds no IOConn, the thread closes the bare socket then.
+ *
+ * Buffers handed between the threads come from plain malloc() and are
+ * freed by the other side.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "numeric.h"
+#include "h.h"
+#include "proto.h"
+
+#if defined(HAVE_EPOLL) && defined(HAVE_PTHREAD)
+#define USE_IO_THREADS
+#endif
+
+#ifdef USE_IO_THREADS
+
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define IOTH_RING	16384	/* messages per ring, a power of 2 */
+#define IOTH_WINDOW	65536	/* bytes handed to a thread before it has to report back */
+#define IOTH_PARTIAL	1024	/* longest incomplete line a thread keeps, longer ones go as they are */
+#define IOTH_READS	4	/* recv()s per socket per event, then it is someone else's turn */
+#define IOTH_EVENTS	256
+
+#define IOMSG_ATTACH	1	/* take this socket */
+#define IOMSG_SEND	2	/* write 'data' (an IOBuf) */
+#define IOMSG_CLOSE	3	/* write what is left and close the socket */
+#define IOMSG_DATA	4	/* complete lines that were read */
+#define IOMSG_DRAINED	5	/* everything handed over was written */
+#define IOMSG_READERR	6	/* EOF or read error, 'len' is errno */
+#define IOMSG_WRITEERR	7	/* write error, 'len' is errno */
+#define IOMSG_RELEASE	8	/* give the socket back once everything is written */
+#define IOMSG_RELEASED	9	/* here it is, with what was left of a line */
+
+typedef struct {
+	int  type;
+	int  fd;
+	unsigned int serial;
+	int  len;
+	void *data;
+} IOMsg;
+
+typedef struct {
+	unsigned int head;			/* consumer */
+	char pad1[64 - sizeof(unsigned int)];
+	unsigned int tail;			/* producer */
+	char pad2[64 - sizeof(unsigned int)];
+	IOMsg msg[IOTH_RING];
+} IORing;
+
+typedef struct IOBuf IOBuf;
+struct IOBuf {
+	IOBuf *next;
+	int  len;
+	int  off;
+	char data[1];
+};
+
+typedef struct IOOverflow IOOverflow;
+struct IOOverflow {
+	IOOverflow *next;
+	IOMsg msg;
+};
+
+typedef struct {
+	int  fd;
+	unsigned int serial;
+	int  dead;			/* read or write failed, waiting for IOMSG_CLOSE */
+	int  releasing;			/* IOMSG_RELEASE came, only writing now */
+	int  events;			/* registered with epoll */
+	IOBuf *sendq, *sendq_tail;
+	int  plen;
+	char partial[IOTH_PARTIAL];
+} IOConn;
+
+typedef struct {
+	pthread_t thread;
+	int  epfd;
+	int  efd;			/* wakes the thread */
+	IORing tothread;
+	IORing tocore;
+	/* main thread only */
+	int  wake;
+	IOOverflow *overflow, *overflow_tail;
+	int  clients;
+	/* thread only */
+	int  notify;
+	unsigned long long bytes_in, bytes_out, wakeups;
+} IOThread;
+
+static IOThread **ioth = NULL;
+static int ioth_count = 0;
+static int ioth_core_efd = -1;
+
+/* Main thread: who a socket belongs to */
+static aClient *ioth_client[MAXCONNECTIONS + 1];
+static unsigned int ioth_serial[MAXCONNECTIONS + 1];
+static int ioth_pending[MAXCONNECTIONS + 1];
+static char ioth_releasing[MAXCONNECTIONS + 1];
+static void (*ioth_released[MAXCONNECTIONS + 1])(aClient *);
+
+/* Threads: their side of it, each entry is only used by one thread */
+static IOConn *ioth_conn[MAXCONNECTIONS + 1];
+
+static void ioth_wake(int efd)
+{
+	uint64_t one = 1;
+
+	(void)write(efd, &one, sizeof(one));
+}
+
+static int ring_full(IORing *r)
+{
+	return r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= IOTH_RING;
+}
+
+static void ring_put(IORing *r, IOMsg *m)
+{
+	r->msg[r->tail & (IOTH_RING - 1)] = *m;
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Thread side
+ */
+
+static void ioth_tocore(IOThread *t, int type, IOConn *c, int len, void *data)
+{
+	IOMsg m;
+
+	m.type = type;
+	m.fd = c->fd;
+	m.serial = c->serial;
+	m.len = len;
+	m.data = data;
+	while (ring_full(&t->tocore))
+	{
+		ioth_wake(ioth_core_efd);
+		sched_yield();
+	}
+	ring_put(&t->tocore, &m);
+	t->notify = 1;
+}
+
+static void ioth_events(IOThread *t, IOConn *c, int events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return;
+	ev.events = events;
+	ev.data.ptr = c;
+	(void)epoll_ctl(t->epfd, c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev);
+	c->events = events;
+}
+
+static void ioth_dead(IOThread *t, IOConn *c, int type, int err)
+{
+	IOBuf *b;
+
+	if (c->events)
+		(void)epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	c->events = 0;
+	while ((b = c->sendq))
+	{
+		c->sendq = b->next;
+		free(b);
+	}
+	c->dead = 1;
+	ioth_tocore(t, type, c, err, NULL);
+}
+
+static void ioth_read(IOThread *t, IOConn *c)
+{
+	char buf[IOTH_PARTIAL + READBUF_SIZE], *p, *lines;
+	int  i, n, total, done;
+
+	memcpy(buf, c->partial, c->plen);
+	for (i = 0; i < IOTH_READS; i++)
+	{
+		n = recv(c->fd, buf + c->plen, sizeof(buf) - c->plen, 0);
+		if (n <= 0)
+		{
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+				return;
+			ioth_dead(t, c, IOMSG_READERR, n < 0 ? errno : 0);
+			return;
+		}
+		t->bytes_in += n;
+		total = c->plen + n;
+
+		/* Up to the end of the last complete line */
+		for (p = buf + total; p > buf && p[-1] != '\n' && p[-1] != '\r'; p--)
+			;
+		done = p - buf;
+		if (total - done >= IOTH_PARTIAL)
+			done = total;
+		if (done)
+		{
+			lines = malloc(done);
+			memcpy(lines, buf, done);
+			ioth_tocore(t, IOMSG_DATA, c, done, lines);
+		}
+		c->plen = total - done;
+		memmove(buf, buf + done, c->plen);
+		memcpy(c->partial, buf, c->plen);
+
+		if (total < sizeof(buf))
+			return;
+	}
+}
+
+/* Everything is written, the socket is the main thread's again */
+static void ioth_handback(IOThread *t, IOConn *c)
+{
+	char *partial = NULL;
+
+	if (c->events)
+		(void)epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	if (c->plen)
+	{
+		partial = malloc(c->plen);
+		memcpy(partial, c->partial, c->plen);
+	}
+	ioth_tocore(t, IOMSG_RELEASED, c, c->plen, partial);
+	ioth_conn[c->fd] = NULL;
+	free(c);
+}
+
+static void ioth_write(IOThread *t, IOConn *c)
+{
+	struct iovec iov[64];
+	IOBuf *b;
+	int  cnt, n;
+
+	while (c->sendq)
+	{
+		for (b = c->sendq, cnt = 0; b && cnt < 64; b = b->next, cnt++)
+		{
+			iov[cnt].iov_base = b->data + b->off;
+			iov[cnt].iov_len = b->len - b->off;
+		}
+		n = writev(c->fd, iov, cnt);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ENOBUFS)
+				break;
+			ioth_dead(t, c, IOMSG_WRITEERR, errno);
+			return;
+		}
+		t->bytes_out += n;
+		while (n > 0 && (b = c->sendq))
+		{
+			if (n < b->len - b->off)
+			{
+				b->off += n;
+				break;
+			}
+			n -= b->len - b->off;
+			c->sendq = b->next;
+			free(b);
+		}
+	}
+	if (c->sendq)
+	{
+		ioth_events(t, c, c->releasing ? EPOLLOUT : EPOLLIN | EPOLLOUT);
+		return;
+	}
+	c->sendq_tail = NULL;
+	if (c->releasing)
+	{
+		ioth_handback(t, c);
+		return;
+	}
+	ioth_events(t, c, EPOLLIN);
+	ioth_tocore(t, IOMSG_DRAINED, c, 0, NULL);
+}
+
+static void ioth_close(IOThread *t, IOConn *c)
+{
+	IOBuf *b;
+
+	/* One last try at what is still queued, like close_connection() does */
+	if (!c->dead && c->sendq)
+		ioth_write(t, c);
+	if (c->events)
+		(void)epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	while ((b = c->sendq))
+	{
+		c->sendq = b->next;
+		free(b);
+	}
+	CLOSE_SOCK(c->fd);
+	ioth_conn[c->fd] = NULL;
+	free(c);
+}
+
+/* Do what the main thread asked for */
+static void ioth_commands(IOThread *t)
+{
+	IORing *r = &t->tothread;
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	IOMsg *m;
+	IOConn *c;
+	IOBuf *b;
+
+	for (; r->head != tail; __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE))
+	{
+		m = &r->msg[r->head & (IOTH_RING - 1)];
+		c = ioth_conn[m->fd];
+		switch (m->type)
+		{
+		case IOMSG_ATTACH:
+			c = calloc(1, sizeof(IOConn));
+			c->fd = m->fd;
+			c->serial = m->serial;
+			ioth_conn[m->fd] = c;
+			ioth_events(t, c, EPOLLIN);
+			break;
+		case IOMSG_SEND:
+			b = m->data;
+			if (!c || c->dead)
+			{
+				free(b);
+				break;
+			}
+			b->next = NULL;
+			if (c->sendq)
+				c->sendq_tail->next = b;
+			else
+				c->sendq = b;
+			c->sendq_tail = b;
+			if (!(c->events & EPOLLOUT))
+				ioth_write(t, c);
+			break;
+		case IOMSG_RELEASE:
+			if (!c || c->dead)
+				break;
+			c->releasing = 1;
+			ioth_write(t, c);
+			break;
+		case IOMSG_CLOSE:
+			if (c)
+				ioth_close(t, c);
+			else
+				CLOSE_SOCK(m->fd); /* crossed an IOMSG_RELEASED */
+			break;
+		}
+	}
+}
+
+static void *ioth_main(void *arg)
+{
+	IOThread *t = arg;
+	struct epoll_event ev[IOTH_EVENTS];
+	uint64_t v;
+	IOConn *c;
+	int  i, n;
+
+	for (;;)
+	{
+		ioth_commands(t);
+		if (t->notify)
+		{
+			t->notify = 0;
+			ioth_wake(ioth_core_efd);
+		}
+
+		n = epoll_wait(t->epfd, ev, IOTH_EVENTS, -1);
+		for (i = 0; i < n; i++)
+		{
+			if (!(c = ev[i].data.ptr))
+			{
+				(void)read(t->efd, &v, sizeof(v));
+				t->wakeups++;
+				continue;
+			}
+			if (c->dead)
+				continue;
+			if (c->releasing)
+			{
+				/* Only writing, a hangup shows up there too */
+				ioth_write(t, c);
+				continue;
+			}
+			if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				ioth_read(t, c);
+			if (!c->dead && (ev[i].events & EPOLLOUT))
+				ioth_write(t, c);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Main thread side
+ */
+
+static void ioth_put(IOThread *t, int type, int fd, int len, void *data)
+{
+	IOOverflow *o;
+	IOMsg m;
+
+	m.type = type;
+	m.fd = fd;
+	m.serial = ioth_serial[fd];
+	m.len = len;
+	m.data = data;
+	t->wake = 1;
+	if (!t->overflow && !ring_full(&t->tothread))
+	{
+		ring_put(&t->tothread, &m);
+		return;
+	}
+	o = MyMalloc(sizeof(IOOverflow));
+	o->next = NULL;
+	o->msg = m;
+	if (t->overflow)
+		t->overflow_tail->next = o;
+	else
+		t->overflow = o;
+	t->overflow_tail = o;
+}
+
+static void ioth_dispatch(IOMsg *m)
+{
+	aClient *cptr = ioth_client[m->fd];
+	void (*released)(aClient *);
+	char buf[256];
+
+	if (!cptr || ioth_serial[m->fd] != m->serial)
+	{
+		free(m->data);
+		return;
+	}
+
+	switch (m->type)
+	{
+	case IOMSG_DATA:
+		/* Unless whoever is taking the socket back starts afresh */
+		if (!IsDead(cptr) && !ioth_released[m->fd])
+			(void)read_packet_data(cptr, m->data, m->len);
+		free(m->data);
+		break;
+	case IOMSG_RELEASED:
+		released = ioth_released[m->fd];
+		ioth_client[m->fd] = NULL;
+		ioth_pending[m->fd] = 0;
+		ioth_releasing[m->fd] = 0;
+		ioth_released[m->fd] = NULL;
+		cptr->flags &= ~FLAGS_IOTHREAD;
+		ioth[m->fd % ioth_count]->clients--;
+		if (IsDead(cptr))
+		{
+			free(m->data);
+			break;
+		}
+		fd_setselect(cptr->fd, FD_SELECT_READ | FD_SELECT_EDGE, read_packet, cptr);
+		if (released)
+			released(cptr);
+		else if (m->len && read_packet_data(cptr, m->data, m->len) < 0)
+		{
+			free(m->data);
+			break;
+		}
+		free(m->data);
+		if (!IsDead(cptr) && DBufLength(&cptr->sendQ) > 0)
+			send_queued(cptr);
+		break;
+	case IOMSG_DRAINED:
+		ioth_pending[m->fd] = 0;
+		if (IsDead(cptr))
+			break;
+		if (DBufLength(&cptr->sendQ) > 0)
+			send_queued(cptr);
+		/* Continue a /LIST in progress, as send_queued_write() does */
+		if (!IsDead(cptr) && DoList(cptr) && IsSendable(cptr))
+			send_list(cptr, 64);
+		break;
+	case IOMSG_READERR:
+		SET_ERRNO(m->len);
+		exit_client(cptr, cptr, cptr, "Read error");
+		break;
+	case IOMSG_WRITEERR:
+		if (IsDead(cptr))
+			break;
+		snprintf(buf, sizeof(buf), "Write error: %s", STRERROR(m->len));
+		dead_link(cptr, buf);
+		break;
+	}
+}
+
+/* What the threads have for us */
+static void ioth_core_read(int fd, int revents, void *data)
+{
+	IORing *r;
+	IOMsg *m;
+	unsigned int tail, pos;
+	uint64_t v;
+	int  i;
+
+	(void)read(fd, &v, sizeof(v));
+	for (i = 0; i < ioth_count; i++)
+	{
+		r = &ioth[i]->tocore;
+		tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+		/* Open the windows first, the lines read may well fill them up again */
+		for (pos = r->head; pos != tail; pos++)
+		{
+			m = &r->msg[pos & (IOTH_RING - 1)];
+			if (m->type == IOMSG_DRAINED)
+			{
+				ioth_dispatch(m);
+				m->type = 0;
+			}
+		}
+
+		for (; r->head != tail; __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE))
+			ioth_dispatch(&r->msg[r->head & (IOTH_RING - 1)]);
+	}
+}
+
+/** Start the I/O threads, if set::io-threads asks for them */
+void ioth_init(void)
+{
+	sigset_t all, old;
+	IOThread *t;
+	struct epoll_event ev;
+	int  i;
+
+	if (ioth_count || IO_THREADS <= 0)
+		return;
+
+	ioth_core_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ioth_core_efd < 0 || fd_open(ioth_core_efd, "I/O threads") < 0)
+	{
+		ircd_log(LOG_ERROR, "I/O threads: eventfd failed: %s, not using them", STRERROR(ERRNO));
+		return;
+	}
+	fd_setselect(ioth_core_efd, FD_SELECT_READ, ioth_core_read, NULL);
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	ioth = MyMallocEx(sizeof(IOThread *) * IO_THREADS);
+	for (i = 0; i < IO_THREADS; i++)
+	{
+		t = ioth[i] = MyMallocEx(sizeof(IOThread));
+		t->epfd = epoll_create(MAXCONNECTIONS);
+		t->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (t->epfd < 0 || t->efd < 0 || epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->efd, &ev) < 0 ||
+		    pthread_create(&t->thread, NULL, ioth_main, t) != 0)
+		{
+			ircd_log(LOG_ERROR, "I/O threads: could not start thread %d: %s", i, STRERROR(ERRNO));
+			if (t->epfd >= 0)
+				close(t->epfd);
+			if (t->efd >= 0)
+				close(t->efd);
+			MyFree(t);
+			break;
+		}
+	}
+	ioth_count = i;
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	ircd_log(LOG_ERROR, "Using %d I/O threads", ioth_count);
+}
+
+/*
+ * Give cptr's socket to an I/O thread instead of read_packet().
+ * Returns 0 if there are no I/O threads.
+ */
+int ioth_attach(aClient *cptr)
+{
+	IOThread *t;
+	int  fd = cptr->fd;
+
+	/* Server links stay here, a link on another port is
+	 * given back by m_server() (ioth_release())
+	 */
+	if (!ioth_count || fd < 0 || IsDead(cptr) || cptr->ssl ||
+	    IsServersOnlyListener(cptr->listener))
+		return 0;
+
+	/* Output that was waiting for the socket is the thread's job now */
+	if (fd_table[fd].write_callback)
+		fd_setselect(fd, FD_SELECT_WRITE, NULL, cptr);
+
+	t = ioth[fd % ioth_count];
+	ioth_client[fd] = cptr;
+	ioth_serial[fd]++;
+	ioth_pending[fd] = 0;
+	ioth_releasing[fd] = 0;
+	ioth_released[fd] = NULL;
+	cptr->flags |= FLAGS_IOTHREAD;
+	ioth_put(t, IOMSG_ATTACH, fd, 0, NULL);
+	t->clients++;
+	return 1;
+}
+
+/*
+ * Hand the output in 'iov' to the thread, unless it has IOTH_WINDOW
+ * bytes it did not report back on yet. A closing client gets all of
+ * it. Returns the number of bytes taken.
+ */
+int ioth_queue(aClient *cptr, struct iovec *iov, int cnt, int len)
+{
+	IOBuf *b;
+	char *p;
+	int  i, fd = cptr->fd;
+
+	if (ioth_releasing[fd])
+		return 0; /* for the main thread to write */
+	if (ioth_pending[fd] >= IOTH_WINDOW && !(cptr->flags & FLAGS_CLOSING))
+		return 0;
+
+	b = malloc(sizeof(IOBuf) + len);
+	b->len = len;
+	b->off = 0;
+	for (i = 0, p = b->data; i < cnt; p += iov[i].iov_len, i++)
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+	ioth_put(ioth[fd % ioth_count], IOMSG_SEND, fd, len, b);
+	ioth_pending[fd] += len;
+	count_sent(cptr, len);
+	return len;
+}
+
+/** The client goes away: the thread writes what it has and closes the socket */
+void ioth_detach(aClient *cptr)
+{
+	IOThread *t;
+	int  fd = cptr->fd;
+
+	/* Before the thread may close it */
+	fd_unmap(fd);
+
+	t = ioth[fd % ioth_count];
+	ioth_put(t, IOMSG_CLOSE, fd, 0, NULL);
+	ioth_client[fd] = NULL;
+	ioth_pending[fd] = 0;
+	ioth_releasing[fd] = 0;
+	ioth_released[fd] = NULL;
+	cptr->flags &= ~FLAGS_IOTHREAD;
+	t->clients--;
+}
+
+/*
+ * Take cptr's socket back from its thread without closing it: for a
+ * server link (m_server()) or STARTTLS, which the threads don't do.
+ * It stays IsIOThread() until the thread wrote what it was given; lines
+ * it read before it let go are still parsed, then read_packet() takes
+ * over. If 'released' is set it is called at that point instead, and
+ * input that comes in until then is thrown away (STARTTLS starts afresh).
+ */
+void ioth_release(aClient *cptr, void (*released)(aClient *))
+{
+	int  fd = cptr->fd;
+
+	if (!IsIOThread(cptr) || ioth_releasing[fd])
+		return;
+	ioth_releasing[fd] = 1;
+	ioth_released[fd] = released;
+	ioth_put(ioth[fd % ioth_count], IOMSG_RELEASE, fd, 0, NULL);
+}
+
+/** Called from the main loop before waiting: wake up the threads that got work */
+void ioth_flush(void)
+{
+	IOThread *t;
+	IOOverflow *o;
+	int  i;
+
+	for (i = 0; i < ioth_count; i++)
+	{
+		t = ioth[i];
+		while ((o = t->overflow) && !ring_full(&t->tothread))
+		{
+			ring_put(&t->tothread, &o->msg);
+			t->overflow = o->next;
+			MyFree(o);
+			t->wake = 1;
+		}
+		if (t->wake)
+		{
+			t->wake = 0;
+			ioth_wake(t->efd);
+		}
+	}
+}
+
+void stats_iothreads(aClient *sptr)
+{
+	IOThread *t;
+	int  i;
+
+	for (i = 0; i < ioth_count; i++)
+	{
+		t = ioth[i];
+		sendto_one(sptr, ":%s %d %s :iothread %d clients %d in %llu out %llu wakeups %llu%s",
+		    me.name, RPL_STATSDEBUG, sptr->name, i, t->clients,
+		    t->bytes_in, t->bytes_out, t->wakeups, t->overflow ? " overflow" : "");
+	}
+}
+
+#else
+
+void ioth_init(void)
+{
+	if (IO_THREADS > 0)
+		ircd_log(LOG_ERROR, "set::io-threads: I/O threads need epoll and pthreads, not using them");
+}
+
+int ioth_attach(aClient *cptr)
+{
+	return 0;
+}
+
+int ioth_queue(aClient *cptr, struct iovec *iov, int cnt, int len)
+{
+	return 0;
+}
+
+void ioth_detach(aClient *cptr)
+{
+}
+
+void ioth_release(aClient *cptr, void (*released)(aClient *))
+{
+}
+
+void ioth_flush(void)
+{
+}
+
+void stats_iothreads(aClient *sptr)
+{
+}
+
+#endif
@@ -0,0 +1,1086 @@
+/*
+ * RabbitIRCD, src/ircbench.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Microbenchmarks for the hot paths of the daemon.
+ *
+ * This is linked against the same objects as the ircd itself (with
+ * ircd.c's main() renamed out of the way), so what is measured here is
+ * exactly what runs in production.  Build with "make bench" and run
+ * src/ircbench.  Output is one line per benchmark, tab separated:
+ *
+ *	name	iterations	total_ns	ns_per_op
+ *
+ * Lines starting with '#' are comments.  Keep the benchmark names stable,
+ * scripts compare them between builds to catch regressions.
+ *
+ * Where a fast path replaced a slower one, its results are checked first;
+ * ircbench exits with 1 when they are wrong.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include "proto.h"
+#include "mempool.h"
+#include "patricia.h"
+#include "ircsprintf.h"
+#include "macros.h"
+#include "badwords.h"
+#include <time.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+extern unsigned hash_nick_name(const char *);
+extern unsigned int hash_channel_name(char *);
+
+#define NUM_NICKS	4096
+#define NUM_CHANS	2048
+
+static char nicks[NUM_NICKS][NICKLEN + 1];
+static char uids[NUM_NICKS][IDLEN + 1];
+static char chans[NUM_CHANS][CHANNELLEN + 1];
+static char nuhs[NUM_NICKS][NICKLEN + USERLEN + HOSTLEN + 3];
+
+static int iter_scale = 1;
+static char *tls_cert = "server.cert.pem";
+static char *tls_key = "server.key.pem";
+static volatile unsigned long sink;
+
+/* Building blocks for the corpora; these are taken from what shows up
+ * in /WHO and ban lists on real networks.
+ */
+static char *nick_stems[] = {
+	"user", "Guest", "john", "[AFK]Bob", "mIRC", "kiwi_", "anon", "Sarah|away",
+	"The_Doctor", "xX_gamer_Xx", "zzz", "NickServ", "bot", "webchat", "Laura`", "m0nk3y",
+};
+
+static char *user_stems[] = {
+	"~user", "ident", "~kiwi", "sid12345", "uid4242", "~androirc", "znc", "~quassel",
+};
+
+static char *host_fmts[] = {
+	"cpe-%d-%d-%d-%d.columbus.res.rr.com",
+	"static.%d.%d.%d.%d.clients.your-server.de",
+	"%d-%d-%d-%d.dyn.example.net",
+	"host%d-%d-%d-%d.range86-1.btcentralplus.com",
+	"Rabbit-%X%X.dsl.%d.%d.example.org",
+	"%d.%d.%d.%d",
+	"ip-%d-%d-%d-%d.eu-west-1.compute.internal",
+	"gateway/web/irccloud.com/x-%d%d%d%d",
+};
+
+static char *ban_masks[] = {
+	"*!*@*.rr.com",
+	"*!*@cpe-74-*.columbus.res.rr.com",
+	"*!~user*@*",
+	"Guest*!*@*",
+	"*!*@static.*.clients.your-server.de",
+	"*!*@192.168.*",
+	"*!*sid*@gateway/web/irccloud.com/*",
+	"*[AFK]*!*@*",
+	"bot?*!*@*.compute.internal",
+	"*!*@*.btcentralplus.com",
+	"*!znc@*",
+	"*xX*Xx*!*@*",
+	"*!*@Rabbit-*.dsl.*.example.org",
+	"m0nk3y*!*@*",
+	"*!*@10.*",
+	"*!*@*.dyn.example.net",
+};
+
+static char *irc_lines[] = {
+	":%s PRIVMSG #rabbit :hey, has anyone seen the new release notes yet?",
+	":%s NOTICE #help :\001ACTION waves\001",
+	":%s JOIN #linux,#rabbit,#help",
+	":%s MODE #rabbit +ov %s %s",
+	":%s PRIVMSG %s :\001VERSION\001",
+	":%s PART #help :Leaving",
+	":%s TOPIC #rabbit :Welcome to #rabbit | Rules: be nice | Logs: https://example.org/logs",
+	":%s AWAY :Gone to lunch, back in 20 minutes",
+	":%s NICK %s 1400000000",
+	":%s PRIVMSG #linux :does anyone know why my kernel panics after the last update? it just says VFS: unable to mount root fs",
+};
+
+/* badwords.channel.conf as shipped */
+static char *badword_list[] = {
+	"pussy", "fuck", "whore", "slut", "shit", "asshole", "bitch", "cunt",
+	"vagina", "penis", "jackass", "*fucker*", "faggot", "fag", "horny", "gay",
+	"dickhead", "sonuvabitch", "*fuck*", "tits",
+};
+
+static char *chat_lines[] = {
+	"hey, has anyone seen the new release notes yet?",
+	"lol that is some bullshit right there, who wrote this",
+	"does anyone know why my kernel panics after the last update? it just says VFS: unable to mount root fs",
+	"brb, gotta walk the dog",
+	"what the fuck is wrong with this motherfucking build",
+	"Welcome to #rabbit | Rules: be nice | Logs: https://example.org/logs",
+};
+
+static void build_corpora(void)
+{
+	int  i;
+
+	srandom(1);
+	for (i = 0; i < NUM_NICKS; i++)
+	{
+		int  r = random();
+
+		if (i % 4 == 0)
+			ircsnprintf(nicks[i], sizeof(nicks[i]), "user%d", i * 7 + 10000);
+		else
+			ircsnprintf(nicks[i], sizeof(nicks[i]), "%s%d",
+			    nick_stems[r % ARRAY_SIZEOF(nick_stems)], r % 10000);
+		ircsnprintf(uids[i], sizeof(uids[i]), "001%06d", i);
+		ircsnprintf(nuhs[i], sizeof(nuhs[i]), "%s!%s@", nicks[i],
+		    user_stems[(r >> 4) % ARRAY_SIZEOF(user_stems)]);
+		ircsnprintf(nuhs[i] + strlen(nuhs[i]), sizeof(nuhs[i]) - strlen(nuhs[i]),
+		    host_fmts[(r >> 8) % ARRAY_SIZEOF(host_fmts)],
+		    (r >> 3) & 0xff, (r >> 11) & 0xff, (r >> 17) & 0xff, (r >> 23) & 0xff);
+	}
+	for (i = 0; i < NUM_CHANS; i++)
+	{
+		if (i % 3 == 0)
+			ircsnprintf(chans[i], sizeof(chans[i]), "#chan%d", i);
+		else
+			ircsnprintf(chans[i], sizeof(chans[i]), "#%s-%d",
+			    nick_stems[random() % ARRAY_SIZEOF(nick_stems)], i);
+	}
+}
+
+static unsigned long long nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(char *name, unsigned long iters, unsigned long long start)
+{
+	unsigned long long total = nsec() - start;
+
+	printf("%s\t%lu\t%llu\t%.2f\n", name, iters, total,
+	    iters ? (double)total / iters : 0.0);
+	fflush(stdout);
+}
+
+static void bench_match(void)
+{
+	unsigned long n = 0, rounds = 20 * iter_scale;
+	unsigned long long start;
+	int  i, j, r;
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++)
+			for (j = 0; j < ARRAY_SIZEOF(ban_masks); j++, n++)
+				sink += match(ban_masks[j], nuhs[i]);
+	report("match_banmask", n, start);
+}
+
+static void bench_hash(void)
+{
+	unsigned long n = 0, rounds = 200 * iter_scale;
+	unsigned long long start;
+	int  i, r;
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+			sink += hash_nick_name(nicks[i]);
+	report("hash_nick_name", n, start);
+
+	n = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_CHANS; i++, n++)
+			sink += hash_channel_name(chans[i]);
+	report("hash_channel_name", n, start);
+}
+
+static void bench_hash_lookup(void)
+{
+	unsigned long n = 0, rounds = 100 * iter_scale;
+	unsigned long long start;
+	char missing[NICKLEN + 1];
+	int  i, r;
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+			sink += (unsigned long)hash_find_client(nicks[i], NULL);
+	report("hash_find_client_hit", n, start);
+
+	n = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+		{
+			ircsnprintf(missing, sizeof(missing), "x%s", nicks[i]);
+			sink += (unsigned long)hash_find_client(missing, NULL);
+		}
+	report("hash_find_client_miss", n, start);
+}
+
+static void bench_dbuf(void)
+{
+	unsigned long n = 0, rounds = 500 * iter_scale;
+	unsigned long long start;
+	char line[BUFSIZE], buf[BUFSIZE];
+	int  lens[ARRAY_SIZEOF(irc_lines)];
+	dbuf q;
+	int  i, r;
+
+	for (i = 0; i < ARRAY_SIZEOF(irc_lines); i++)
+	{
+		ircsnprintf(line, sizeof(line), irc_lines[i], nicks[i], nicks[i + 1], nicks[i + 2]);
+		strlcat(line, "\r\n", sizeof(line));
+		lens[i] = strlen(line);
+	}
+
+	dbuf_queue_init(&q);
+	q.length = q.offset = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = 0; i < ARRAY_SIZEOF(irc_lines); i++, n++)
+		{
+			ircsnprintf(line, sizeof(line), irc_lines[i], nicks[i], nicks[i + 1], nicks[i + 2]);
+			strlcat(line, "\r\n", sizeof(line));
+			dbuf_put(&q, line, lens[i]);
+		}
+		while (dbuf_getmsg(&q, buf) > 0)
+			sink += buf[0];
+	}
+	report("dbuf_put_getmsg", n, start);
+}
+
+static char *bench_vsnprintf(char *str, size_t size, const char *format, ...)
+{
+	va_list vl;
+	char *ret;
+
+	va_start(vl, format);
+	ret = ircvsnprintf(str, size, format, vl);
+	va_end(vl);
+	return ret;
+}
+
+static void bench_sprintf(void)
+{
+	unsigned long n = 0, rounds = 100 * iter_scale;
+	unsigned long long start;
+	char buf[BUFSIZE];
+	int  i, r;
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+		{
+			bench_vsnprintf(buf, sizeof(buf), ":%s PRIVMSG %s :%s", nuhs[i],
+			    chans[i % NUM_CHANS], "hello there, how is everybody doing today?");
+			sink += buf[1];
+		}
+	report("ircvsnprintf_privmsg", n, start);
+
+	n = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+		{
+			bench_vsnprintf(buf, sizeof(buf), ":%s %d %s %s %s %s %s H :%d %s",
+			    "irc.example.org", 352, nicks[i], chans[i % NUM_CHANS],
+			    "~user", "host.example.org", "irc.example.org", i % 10, "Real Name");
+			sink += buf[1];
+		}
+	report("ircvsnprintf_numeric", n, start);
+}
+
+static void bench_mempool(void)
+{
+	static void *items[NUM_NICKS];
+	unsigned long n = 0, rounds = 100 * iter_scale;
+	unsigned long long start;
+	mp_pool_t *pool;
+	int  i, r;
+
+	pool = mp_pool_new(sizeof(anUser), 512 * 1024);
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = 0; i < NUM_NICKS; i++, n++)
+			items[i] = mp_pool_get(pool);
+		/* release in a different order than we allocated */
+		for (i = 0; i < NUM_NICKS; i += 2)
+			mp_pool_release(items[i]);
+		for (i = 1; i < NUM_NICKS; i += 2)
+			mp_pool_release(items[i]);
+	}
+	report("mp_pool_get_release", n, start);
+	mp_pool_clean(pool, 0, 0);
+}
+
+static void bench_patricia(void)
+{
+	unsigned long n = 0, rounds = 20 * iter_scale;
+	unsigned long long start;
+	struct patricia_tree *tree;
+	int  i, r;
+
+	tree = patricia_create(patricia_strcasecanon);
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = 0; i < NUM_NICKS; i++, n++)
+			patricia_add(tree, nicks[i], nicks[i]);
+		for (i = 0; i < NUM_NICKS; i++)
+			patricia_delete(tree, nicks[i]);
+	}
+	report("patricia_add_delete", n, start);
+
+	for (i = 0; i < NUM_NICKS; i++)
+		patricia_add(tree, nicks[i], nicks[i]);
+	n = 0;
+	start = nsec();
+	for (r = 0; r < 5 * rounds; r++)
+		for (i = 0; i < NUM_NICKS; i++, n++)
+			sink += (unsigned long)patricia_retrieve(tree, nicks[i]);
+	report("patricia_retrieve", n, start);
+	patricia_destroy(tree, NULL, NULL);
+}
+
+/* What chm_badwords did before the automaton: one pass per word */
+static void loop_replace_one_word(const char *origstr, char *outstr, size_t outlen,
+	const char *search, const char *replacement)
+{
+	const char *source_p;
+	char *target_p;
+	int slen, dlen;
+
+	if (replacement == NULL)
+		replacement = "<censored>";
+
+	outstr[0] = '\0';
+	source_p = origstr;
+	target_p = outstr;
+	slen = strlen(search);
+	dlen = strlen(replacement);
+
+	while (*source_p != '\0')
+	{
+		if (strncasecmp(source_p, search, slen) == 0)
+		{
+			memcpy(target_p, replacement, MIN(dlen, outlen - (ptrdiff_t)(target_p - outstr)));
+			target_p += dlen;
+			source_p += slen;
+		}
+		else if ((target_p - outstr) < outlen)
+		{
+			*target_p = *source_p;
+			target_p++;
+			source_p++;
+		}
+		else
+			break;
+	}
+
+	*target_p = '\0';
+}
+
+static void bench_badwords_one(char *name, char **words, int nwords)
+{
+	unsigned long n = 0, rounds = 2000 * iter_scale;
+	unsigned long long start;
+	char buf[BUFSIZE], workbuf[BUFSIZE];
+	BadwordMatcher *m;
+	int  i, j, r;
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < ARRAY_SIZEOF(chat_lines); i++, n++)
+		{
+			strlcpy(workbuf, chat_lines[i], sizeof(workbuf));
+			for (j = 0; j < nwords; j++)
+				loop_replace_one_word(workbuf, buf, sizeof(buf), words[j], NULL);
+			sink += buf[0];
+		}
+	ircsnprintf(buf, sizeof(buf), "badwords_loop_%s", name);
+	report(buf, n, start);
+
+	m = badword_matcher_new();
+	for (j = 0; j < nwords; j++)
+		badword_matcher_add(m, words[j], NULL);
+	badword_matcher_build(m);
+	n = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < ARRAY_SIZEOF(chat_lines); i++, n++)
+			sink += badword_matcher_replace(m, chat_lines[i], workbuf, sizeof(workbuf))[0];
+	ircsnprintf(buf, sizeof(buf), "badwords_automaton_%s", name);
+	report(buf, n, start);
+	badword_matcher_free(m);
+}
+
+/*
+ * Not a benchmark: make sure the automaton censors what the per-word
+ * loop did, in particular words that share a stem with different '*'s.
+ * Returns the number of failures.
+ */
+static int check_badwords_one(char **words, int nwords, char *in, char *want)
+{
+	char buf[BUFSIZE];
+	BadwordMatcher *m;
+	char *out;
+	int  j, ok;
+
+	m = badword_matcher_new();
+	for (j = 0; j < nwords; j += 2)
+		badword_matcher_add(m, words[j], words[j + 1]);
+	out = badword_matcher_replace(m, in, buf, sizeof(buf));
+	ok = !strcmp(out, want);
+	if (!ok)
+		fprintf(stderr, "badwords: \"%s\" gave \"%s\", expected \"%s\"\n", in, out, want);
+	badword_matcher_free(m);
+	return !ok;
+}
+
+static int check_badwords(void)
+{
+	/* pairs of word, replacement */
+	static char *stem_first[] = { "fuck", NULL, "*fuck*", NULL };
+	static char *wild_first[] = { "*fuck*", NULL, "fuck", NULL };
+	static char *suffix[] = { "shit", NULL, "shit*", NULL };
+	static char *replaced[] = { "damn", "darn", "*damn*", NULL };
+	char *shipped[2 * ARRAY_SIZEOF(badword_list)];
+	int  i, fails = 0;
+
+	fails += check_badwords_one(stem_first, 4, "what the fuck", "what the <censored>");
+	fails += check_badwords_one(stem_first, 4, "motherfucking build", "<censored> build");
+	fails += check_badwords_one(stem_first, 4, "FUCKED up", "<censored> up");
+	fails += check_badwords_one(wild_first, 4, "motherfucking build", "<censored> build");
+	fails += check_badwords_one(wild_first, 4, "what the fuck", "what the <censored>");
+	fails += check_badwords_one(suffix, 4, "shitty shit", "<censored> <censored>");
+	fails += check_badwords_one(suffix, 4, "bullshit", "bullshit");
+	fails += check_badwords_one(replaced, 4, "damn it", "darn it");
+	fails += check_badwords_one(replaced, 4, "goddamn it", "<censored> it");
+
+	for (i = 0; i < ARRAY_SIZEOF(badword_list); i++)
+	{
+		shipped[2 * i] = badword_list[i];
+		shipped[2 * i + 1] = NULL;
+	}
+	fails += check_badwords_one(shipped, ARRAY_SIZEOF(shipped), chat_lines[4],
+	    "what the <censored> is wrong with this <censored> build");
+	fails += check_badwords_one(shipped, ARRAY_SIZEOF(shipped), chat_lines[1],
+	    chat_lines[1]);
+	return fails;
+}
+
+static void bench_badwords(void)
+{
+	static char words[400][NICKLEN + 8];
+	char *wordp[ARRAY_SIZEOF(words)];
+	int  i;
+
+	bench_badwords_one("shipped", badword_list, ARRAY_SIZEOF(badword_list));
+
+	/* A list the size some networks run with */
+	for (i = 0; i < ARRAY_SIZEOF(words); i++)
+	{
+		if (i < ARRAY_SIZEOF(badword_list))
+			strlcpy(words[i], badword_list[i], sizeof(words[i]));
+		else
+			ircsnprintf(words[i], sizeof(words[i]), "%s%s", (i & 1) ? "*" : "",
+			    nicks[i]);
+		wordp[i] = words[i];
+	}
+	bench_badwords_one("400", wordp, ARRAY_SIZEOF(words));
+}
+
+static int bench_cmd(aClient *cptr, aClient *sptr, int parc, char *parv[])
+{
+	sink += parc;
+	return 0;
+}
+
+static void bench_parse(aClient *link)
+{
+	static char lines[640][BUFSIZE];
+	unsigned long n = 0, rounds = 500 * iter_scale;
+	unsigned long long start;
+	char buf[BUFSIZE];
+	int  i, r, nlines = ARRAY_SIZEOF(lines);
+
+	add_CommandX("PRIVMSG", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("NOTICE", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("JOIN", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("MODE", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("PART", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("TOPIC", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("AWAY", bench_cmd, MAXPARA, M_USER|M_SERVER);
+	add_CommandX("NICK", bench_cmd, MAXPARA, M_USER|M_SERVER);
+
+	/* Half of the lines use a nick prefix, half a UID prefix */
+	for (i = 0; i < nlines; i++)
+		ircsnprintf(lines[i], sizeof(lines[i]), irc_lines[i % ARRAY_SIZEOF(irc_lines)],
+		    (i & 1) ? uids[i] : nicks[i], nicks[i + 1], nicks[i + 2]);
+
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < nlines; i++, n++)
+		{
+			int len = strlcpy(buf, lines[i], sizeof(buf));
+			parse(link, buf, buf + len);
+		}
+	report("parse_server_lines", n, start);
+}
+
+/*
+ * Large output to one client (think /LIST, /WHO on a big channel or a
+ * netburst) over a loopback TCP connection, through the real
+ * send_queued(): plaintext, SSL in user space, and SSL handed to the
+ * kernel (kTLS) if this OpenSSL and kernel can do that. The time
+ * includes the receiving end reading (and for SSL decrypting) it all,
+ * iterations are megabytes.
+ */
+#define TLS_BENCH_MB	32
+
+static int tls_socketpair(int *srv, int *cli)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int  l, one = 1;
+
+	if ((l = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	bzero(&sin, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(l, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(l, 1) < 0 ||
+	    getsockname(l, (struct sockaddr *)&sin, &len) < 0 ||
+	    (*cli = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		close(l);
+		return -1;
+	}
+	if (connect(*cli, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    (*srv = accept(l, NULL, NULL)) < 0)
+	{
+		close(*cli);
+		close(l);
+		return -1;
+	}
+	close(l);
+	setsockopt(*srv, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(*srv, F_SETFL, O_NONBLOCK);
+	fcntl(*cli, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static int tls_retry(SSL *ssl, int ret)
+{
+	int  err = SSL_get_error(ssl, ret);
+
+	return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+}
+
+/* Read whatever arrived at the client end, returns plaintext bytes */
+static unsigned long tls_drain(int fd, SSL *ssl)
+{
+	static char buf[65536];
+	unsigned long total = 0;
+	int  n;
+
+	for (;;)
+	{
+		n = ssl ? SSL_read(ssl, buf, sizeof(buf)) : read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			return total;
+		total += n;
+	}
+}
+
+static void bench_tls_one(char *name, SSL_CTX *sctx, SSL_CTX *cctx, int ktls)
+{
+	unsigned long long start;
+	unsigned long want = (unsigned long)TLS_BENCH_MB * iter_scale << 20, got = 0, queued = 0;
+	char line[BUFSIZE];
+	aClient *cptr;
+	SSL *cssl = NULL;
+	int  srv, cli, len, r1 = 0, r2 = 0;
+
+	if (tls_socketpair(&srv, &cli) < 0)
+	{
+		printf("# %s: could not set up a loopback connection: %s\n", name, strerror(errno));
+		return;
+	}
+	cptr = make_client(NULL, NULL);
+	cptr->fd = srv;
+	if (sctx)
+	{
+		cptr->ssl = SSL_new(sctx);
+		cptr->flags |= FLAGS_SSL;
+		SSL_set_fd(cptr->ssl, srv);
+		SSL_set_accept_state(cptr->ssl);
+#ifdef SSL_OP_ENABLE_KTLS
+		if (ktls)
+			SSL_set_options(cptr->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+		cssl = SSL_new(cctx);
+		SSL_set_fd(cssl, cli);
+		SSL_set_connect_state(cssl);
+		while (r1 != 1 || r2 != 1)
+		{
+			if (r1 != 1 && (r1 = SSL_do_handshake(cptr->ssl)) <= 0 && !tls_retry(cptr->ssl, r1))
+				break;
+			if (r2 != 1 && (r2 = SSL_do_handshake(cssl)) <= 0 && !tls_retry(cssl, r2))
+				break;
+		}
+		if (r1 != 1 || r2 != 1)
+		{
+			printf("# %s: SSL handshake failed\n", name);
+			goto out;
+		}
+		if (ktls)
+		{
+#ifdef SSL_OP_ENABLE_KTLS
+			if (BIO_get_ktls_send(SSL_get_wbio(cptr->ssl)))
+				cptr->flags |= FLAGS_KTLS;
+#endif
+			if (!IsKTLS(cptr))
+			{
+				printf("# %s: skipped, no kernel TLS for %s (OpenSSL or kernel lacks it)\n",
+				    name, SSL_get_cipher(cptr->ssl));
+				goto out;
+			}
+		}
+	}
+
+	ircsnprintf(line, sizeof(line), ":irc.example.org 322 %s %s 42 :[+nt] %s\r\n",
+	    nicks[0], chans[0], "Welcome! Rules: no spam, no flooding, be nice. Logs at https://example.org/logs");
+	len = strlen(line);
+	start = nsec();
+	while (got < want)
+	{
+		while (queued < want && DBufLength(&cptr->sendQ) < 65536)
+		{
+			dbuf_put(&cptr->sendQ, line, len);
+			queued += len;
+		}
+		if (send_queued(cptr) < 0)
+		{
+			printf("# %s: write error\n", name);
+			goto out;
+		}
+		got += tls_drain(cli, cssl);
+	}
+	report(name, want >> 20, start);
+out:
+	DBufClear(&cptr->sendQ);
+	if (cssl)
+		SSL_free(cssl);
+	if (cptr->ssl)
+		SSL_free(cptr->ssl);
+	close(srv);
+	close(cli);
+}
+
+static void bench_tls(void)
+{
+	SSL_CTX *sctx, *cctx;
+
+	bench_tls_one("sendq_plain_mb", NULL, NULL, 0);
+
+	SSL_library_init();
+	sctx = SSL_CTX_new(SSLv23_server_method());
+	cctx = SSL_CTX_new(SSLv23_client_method());
+	if (!sctx || !cctx ||
+	    SSL_CTX_use_certificate_chain_file(sctx, tls_cert) <= 0 ||
+	    SSL_CTX_use_PrivateKey_file(sctx, tls_key, SSL_FILETYPE_PEM) <= 0)
+	{
+		printf("# sendq_tls: skipped, could not load %s / %s (see -c and -k)\n", tls_cert, tls_key);
+		return;
+	}
+	SSL_CTX_set_mode(sctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	bench_tls_one("sendq_tls_mb", sctx, cctx, 0);
+	bench_tls_one("sendq_ktls_mb", sctx, cctx, 1);
+	SSL_CTX_free(sctx);
+	SSL_CTX_free(cctx);
+}
+
+/*
+ * The event loop backend with many idle connections and some busy
+ * ones: each round every busy connection becomes readable, its read
+ * callback asks for a oneshot write callback (as a reply waiting in
+ * the sendQ would), and the round ends when all of those ran. The
+ * connections are eventfds, so one fd each and no socket buffers in
+ * the way. Iterations are callbacks. Build with and without
+ * --enable-io_uring to compare the backends.
+ */
+#define LOOP_IDLE	50000
+#define LOOP_ACTIVE	5000
+
+static unsigned long loop_calls;
+
+static void loop_write_cb(int fd, int revents, void *data)
+{
+	loop_calls++;
+}
+
+static void loop_read_cb(int fd, int revents, void *data)
+{
+	unsigned long long v;
+
+	if (read(fd, &v, sizeof(v)) == sizeof(v))
+	{
+		loop_calls++;
+		fd_setselect(fd, FD_SELECT_WRITE | FD_SELECT_ONESHOT, loop_write_cb, data);
+	}
+}
+
+static void bench_loop(void)
+{
+#ifdef __linux__
+	unsigned long long start, one = 1;
+	unsigned long rounds = 50 * iter_scale, r, want;
+	struct rlimit rl;
+	int  fds[LOOP_IDLE + LOOP_ACTIVE];
+	int  nidle = LOOP_IDLE, nactive = LOOP_ACTIVE, max, n = 0, i, fd;
+	char *backend =
+#if defined(BACKEND_IOURING)
+	    "io_uring";
+#elif defined(BACKEND_EPOLL)
+	    "epoll";
+#elif defined(BACKEND_KQUEUE)
+	    "kqueue";
+#elif defined(BACKEND_POLL)
+	    "poll";
+#else
+	    "select";
+#endif
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	max = MIN((long)MAXCONNECTIONS, (long)rl.rlim_cur) - 32;
+	if (nidle + nactive > max)
+	{
+		nactive = max / 11;
+		nidle = max - nactive;
+	}
+	printf("# loop_idle_active: %s backend, %d idle and %d active fds%s\n", backend, nidle, nactive,
+	    (nidle < LOOP_IDLE) ? " (limited by MAXCONNECTIONS or the fd limit)" : "");
+
+	for (n = 0; n < nidle + nactive; n++)
+	{
+		if ((fd = eventfd(0, EFD_NONBLOCK)) < 0 || fd >= MAXCONNECTIONS)
+		{
+			printf("# loop_idle_active: could not set up fd %d: %s\n", n, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			goto out;
+		}
+		fd_open(fd, "ircbench");
+		fd_setselect(fd, FD_SELECT_READ, loop_read_cb, NULL);
+		fds[n] = fd;
+	}
+	fd_select(0);
+
+	want = rounds * nactive * 2;
+	loop_calls = 0;
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = nidle; i < n; i++)
+			sink += write(fds[i], &one, sizeof(one));
+		while (loop_calls < (r + 1) * nactive * 2)
+			fd_select(0);
+	}
+	report("loop_idle_active", want, start);
+out:
+	for (i = 0; i < n; i++)
+		fd_close(fds[i]);
+	fd_select(0);
+#else
+	printf("# loop_idle_active: skipped, needs eventfd\n");
+#endif
+}
+
+/*
+ * The same with sockets, read the way client connections are: each
+ * round every busy connection gets a line from its peer, and once that
+ * was read, a reply.  Lines are read on readiness (recv() in the read
+ * callback) and, where the backend can, with completions (fd_setrecv(),
+ * io_uring); replies go out with a write() each or, with io_uring, all
+ * together (fd_sendmsgs()).  Iterations are lines.  A connection takes
+ * two fds here (socketpair()), so the fd limit allows half as many.
+ */
+static unsigned long sock_bytes;
+static char sock_line[] = ":nick!user@host PRIVMSG #rabbit :hey, has anyone seen the new release notes yet?\r\n";
+static char sock_reply[] = ":irc.example.org NOTICE nick :that was quick\r\n";
+static int sock_fds[LOOP_IDLE + LOOP_ACTIVE], sock_peers[LOOP_IDLE + LOOP_ACTIVE];
+
+static void sock_recv_cb(int fd, char *buf, int length, void *data)
+{
+	if (length > 0)
+		sock_bytes += length;
+}
+
+static void sock_read_cb(int fd, int revents, void *data)
+{
+	char buf[2048];
+	int  length;
+
+	while ((length = recv(fd, buf, sizeof(buf), 0)) > 0)
+		sock_bytes += length;
+}
+
+#ifdef BACKEND_IOURING
+#define SOCK_BATCH	256
+
+static void sock_send_batch(int from, int to)
+{
+	static struct iovec iov[SOCK_BATCH];
+	static struct msghdr msg[SOCK_BATCH];
+	static int res[SOCK_BATCH];
+	int  i, n;
+
+	for (; from < to; from += n)
+	{
+		n = MIN(to - from, SOCK_BATCH);
+		for (i = 0; i < n; i++)
+		{
+			iov[i].iov_base = sock_reply;
+			iov[i].iov_len = sizeof(sock_reply) - 1;
+			bzero(&msg[i], sizeof(msg[i]));
+			msg[i].msg_iov = &iov[i];
+			msg[i].msg_iovlen = 1;
+		}
+		fd_sendmsgs(&sock_fds[from], msg, res, n);
+	}
+}
+#endif
+
+static void bench_sock_one(char *name, int nidle, int n, int completions, int batch)
+{
+	unsigned long long start;
+	unsigned long rounds = 50 * iter_scale, r, want;
+	char buf[512];
+	int  i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (!completions)
+			fd_setselect(sock_fds[i], FD_SELECT_READ, sock_read_cb, NULL);
+		else if (!fd_setrecv(sock_fds[i], sock_recv_cb, NULL))
+		{
+			printf("# %s: skipped, the backend can't receive with completions\n", name);
+			return;
+		}
+	}
+	fd_select(0);
+
+	sock_bytes = 0;
+	want = (sizeof(sock_line) - 1) * (n - nidle);
+	start = nsec();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = nidle; i < n; i++)
+			sink += write(sock_peers[i], sock_line, sizeof(sock_line) - 1);
+		while (sock_bytes < (r + 1) * want)
+			fd_select(0);
+#ifdef BACKEND_IOURING
+		if (batch)
+			sock_send_batch(nidle, n);
+		else
+#endif
+		for (i = nidle; i < n; i++)
+			sink += write(sock_fds[i], sock_reply, sizeof(sock_reply) - 1);
+		for (i = nidle; i < n; i++)
+			sink += recv(sock_peers[i], buf, sizeof(buf), MSG_DONTWAIT);
+	}
+	report(name, rounds * (n - nidle), start);
+
+	for (i = 0; i < n; i++)
+	{
+		if (completions)
+			fd_setrecv(sock_fds[i], NULL, NULL);
+		else
+			fd_setselect(sock_fds[i], FD_SELECT_READ, NULL, NULL);
+	}
+	fd_select(0);
+}
+
+static void bench_sock(void)
+{
+	struct rlimit rl;
+	int  nidle = LOOP_IDLE, nactive = LOOP_ACTIVE, max, n, i, sv[2];
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		rl.rlim_cur = MAXCONNECTIONS;
+	max = (MIN((long)MAXCONNECTIONS, (long)rl.rlim_cur) - 32) / 2;
+	if (nidle + nactive > max)
+	{
+		nactive = max / 11;
+		nidle = max - nactive;
+	}
+	printf("# sock_*: %d idle and %d active connections%s\n", nidle, nactive,
+	    (nidle < LOOP_IDLE) ? " (limited by MAXCONNECTIONS or the fd limit)" : "");
+
+	for (n = 0; n < nidle + nactive; n++)
+	{
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 || sv[0] >= MAXCONNECTIONS)
+		{
+			printf("# sock_*: could not set up connection %d: %s\n", n, strerror(errno));
+			goto out;
+		}
+		set_non_blocking(sv[0], NULL);
+		fd_open(sock_fds[n] = sv[0], "ircbench");
+		sock_peers[n] = sv[1];
+	}
+
+	bench_sock_one("sock_ready_write", nidle, n, 0, 0);
+#ifdef BACKEND_IOURING
+	bench_sock_one("sock_ready_batch", nidle, n, 0, 1);
+	bench_sock_one("sock_completion_batch", nidle, n, 1, 1);
+#endif
+out:
+	for (i = 0; i < n; i++)
+	{
+		fd_close(sock_fds[i]);
+		close(sock_peers[i]);
+	}
+	fd_select(0);
+}
+
+static aClient *make_fake_link(void)
+{
+	aClient *link = make_client(NULL, &me);
+
+	strlcpy(link->name, "hub.example.org", sizeof(link->name));
+	strlcpy(link->id, "001", sizeof(link->id));
+	make_server(link);
+	SetServer(link);
+	return link;
+}
+
+static void make_fake_users(aClient *link)
+{
+	int  i;
+
+	for (i = 0; i < NUM_NICKS; i++)
+	{
+		aClient *acptr = make_client(link, link);
+
+		strlcpy(acptr->name, nicks[i], sizeof(acptr->name));
+		strlcpy(acptr->id, uids[i], sizeof(acptr->id));
+		make_user(acptr);
+		SetClient(acptr);
+		add_to_client_hash_table(acptr->name, acptr);
+		add_to_id_hash_table(acptr->id, acptr);
+	}
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s scale] [-c certificate] [-k key]\n", prog);
+	fprintf(stderr, "  -s scale   multiply the number of iterations (default 1)\n");
+	fprintf(stderr, "  -c file    SSL certificate for the sendq_tls benchmarks (default server.cert.pem)\n");
+	fprintf(stderr, "  -k file    SSL private key (default server.key.pem)\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	aClient *link;
+	int  c;
+
+	while ((c = getopt(argc, argv, "s:c:k:")) != -1)
+	{
+		switch (c)
+		{
+		  case 's':
+			  if ((iter_scale = atoi(optarg)) < 1)
+				  usage(argv[0]);
+			  break;
+		  case 'c':
+			  tls_cert = optarg;
+			  break;
+		  case 'k':
+			  tls_key = optarg;
+			  break;
+		  default:
+			  usage(argv[0]);
+		}
+	}
+
+	timeofday = time(NULL);
+	bzero(&me, sizeof(me));
+	strlcpy(me.name, "irc.example.org", sizeof(me.name));
+	me.from = &me;
+	me.fd = -1;
+	SetMe(&me);
+
+	SetupEvents();
+	mp_pool_init();
+	dbuf_init();
+	initlists();
+	clear_client_hash_table();
+	clear_channel_hash_table();
+	init_CommandHash();
+
+	build_corpora();
+	link = make_fake_link();
+	make_fake_users(link);
+
+	printf("# rabbitircd microbenchmarks, scale %d\n", iter_scale);
+	printf("# name\titerations\ttotal_ns\tns_per_op\n");
+	bench_match();
+	bench_hash();
+	bench_hash_lookup();
+	bench_dbuf();
+	bench_sprintf();
+	bench_mempool();
+	bench_patricia();
+	if (check_badwords())
+	{
+		fprintf(stderr, "badwords: automaton gives wrong results, not benchmarking it\n");
+		return 1;
+	}
+	bench_badwords();
+	bench_parse(link);
+	bench_tls();
+	bench_loop();
+	bench_sock();
+
+	return 0;
+}
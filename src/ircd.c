@@ -47,6 +47,9 @@ Computing Center and Jarkko Oikarinen";
 #undef _KERNEL
 #endif
 #include <errno.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #ifdef HAVE_PSSTRINGS
 #include <sys/exec.h>
 #endif
@@ -272,31 +275,32 @@ EVENT(loop_event)
 	}
 }
 
+/*
+ * Give all empty chunks of the memory pools back (/REHASH -garbage).
+ * The periodic collect, which keeps chunks that were in use recently,
+ * is mp_pool_garbage_collect(), an event of its own (see mp_pool_init()).
+ */
 EVENT(garbage_collect)
 {
-	extern int freelinks;
-	extern Link *freelink;
-	Link p;
-	int  ii;
-
-	if (loop.do_garbage_collect == 1)
-		sendto_realops("Doing garbage collection ..");
-	if (freelinks > HOW_MANY_FREELINKS_ALLOWED) {
-		ii = freelinks;
-		while (freelink && (freelinks > HOW_MANY_FREELINKS_ALLOWED)) {
-			freelinks--;
-			p.next = freelink;
-			freelink = freelink->next;
-			MyFree(p.next);
-		}
-		if (loop.do_garbage_collect == 1) {
-			loop.do_garbage_collect = 0;
-			sendto_realops
-			    ("Cleaned up %i garbage blocks", (ii - freelinks));
-		}
+	mp_pool_t *pool;
+	uint64_t freed = 0;
+
+	if (loop.do_garbage_collect != 1)
+		return;
+
+	sendto_realops("Doing garbage collection ..");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		freed -= pool->total_chunks_freed;
+		mp_pool_clean(pool, 0, 0);
+		freed += pool->total_chunks_freed;
 	}
-	if (loop.do_garbage_collect == 1)
-		loop.do_garbage_collect = 0;
+#ifdef __GLIBC__
+	if (freed)
+		malloc_trim(0);
+#endif
+	loop.do_garbage_collect = 0;
+	sendto_realops("Cleaned up %llu garbage blocks", (unsigned long long)freed);
 }
 
 /*
@@ -522,13 +526,8 @@ EVENT(check_pings)
 				/* if it's registered and doing dns/auth, timeout */
 				if (!IsRegistered(cptr) && (DoingDNS(cptr) || DoingAuth(cptr)))
 				{
-					if (cptr->authfd >= 0) {
-						fd_close(cptr->authfd);
-						--OpenFiles;
-						cptr->authfd = -1;
-						cptr->count = 0;
-						*cptr->buffer = '\0';
-					}
+					if (cptr->authfd >= 0)
+						ident_close(cptr);
 					if (SHOWCONNECTINFO && !cptr->serv) {
 						if (DoingDNS(cptr))
 							sendto_one(cptr, "%s", REPORT_FAIL_DNS);
@@ -800,6 +799,7 @@ int main(int argc, char *argv[])
 	uid_t uid, euid;
 	gid_t gid, egid;
 	TS   delay = 0;
+	unsigned long long loop_start, events_start;
 	struct passwd *pw;
 	struct group *gr;
 #ifdef HAVE_PSTAT
@@ -1267,6 +1267,8 @@ int main(int argc, char *argv[])
 	Debug((DEBUG_NOTICE, "Server ready..."));
 	init_throttling_hash();
 	init_modef();
+	intake_init();	/* forks, so before the I/O threads */
+	ioth_init();
 	loop.ircd_booted = 1;
 #if defined(HAVE_SETPROCTITLE)
 	setproctitle("%s", me.name);
@@ -1288,6 +1290,7 @@ int main(int argc, char *argv[])
 #define NEGATIVE_SHIFT_WARN	-15
 #define POSITIVE_SHIFT_WARN	20
 
+		loop_start = profile_clock();
 		timeofday = time(NULL);
 		if (oldtimeofday == 0)
 			oldtimeofday = timeofday; /* pretend everything is ok the first time.. */
@@ -1344,9 +1347,11 @@ int main(int argc, char *argv[])
 			highesttimeofday = timeofday;
 		}
 		oldtimeofday = timeofday;
+		events_start = profile_clock();
 		LockEventSystem();
 		DoEvents();
 		UnlockEventSystem();
+		loophist_add(&loopstats.events, (profile_clock() - events_start) / 1000);
 
 		/*
 		 * ** Run through the hashes and check lusers every
@@ -1372,6 +1377,8 @@ int main(int argc, char *argv[])
 		else
 			delay = MIN(delay, TIMESEC);
 
+		send_queued_flush();
+		ioth_flush();
 		fd_select(delay * 1000);
 		timeofday = time(NULL);
 
@@ -1395,6 +1402,8 @@ int main(int argc, char *argv[])
 		{
 			server_reboot("SIGINT");
 		}
+		loophist_add(&loopstats.iteration,
+		    (profile_clock() - loop_start - loopstats.lastwait) / 1000);
 	}
 }
 
@@ -65,18 +65,14 @@ static struct liststats {
 
 void outofmemory();
 
-MODVAR int  flinks = 0;
-MODVAR int  freelinks = 0;
-MODVAR Link *freelink = NULL;
-MODVAR Member *freemember = NULL;
-MODVAR Membership *freemembership = NULL;
-MODVAR MembershipL *freemembershipL = NULL;
 MODVAR int  numclients = 0;
 
 /* unless documented otherwise, these are all local-only, except client_list. */
 MODVAR struct list_head client_list, lclient_list, server_list, oper_list, unknown_list, global_server_list;
 
 static mp_pool_t *user_pool = NULL;
+static mp_pool_t *client_local_pool = NULL, *client_remote_pool = NULL;
+static mp_pool_t *link_pool = NULL, *ban_pool = NULL, *tkl_pool = NULL;
 
 void initlists(void)
 {
@@ -96,7 +92,13 @@ void initlists(void)
 	INIT_LIST_HEAD(&unknown_list);
 	INIT_LIST_HEAD(&global_server_list);
 
-	user_pool = mp_pool_new(sizeof(anUser), 512 * 1024);
+	user_pool = mp_pool_new_named("user", sizeof(anUser), 512 * 1024);
+	client_local_pool = mp_pool_new_named("client.local", CLIENT_LOCAL_SIZE, 512 * 1024);
+	client_remote_pool = mp_pool_new_named("client.remote", CLIENT_REMOTE_SIZE, 512 * 1024);
+	link_pool = mp_pool_new_named("link", sizeof(Link), 64 * 1024);
+	ban_pool = mp_pool_new_named("ban", sizeof(Ban), 64 * 1024);
+	tkl_pool = mp_pool_new_named("tkl", sizeof(aTKline), 16 * 1024);
+	init_channel_pools();
 }
 
 void outofmemory(void)
@@ -122,14 +124,16 @@ aClient *make_client(aClient *from, aClient *servr)
 	unsigned size = CLIENT_REMOTE_SIZE;
 
 	/*
-	 * Check freelists first to see if we can grab a client without
-	 * having to call malloc.
+	 * Remote clients only get the part of aClient up to 'count', and
+	 * both kinds come from their own pool.
 	 */
 	if (!from)
+	{
 		size = CLIENT_LOCAL_SIZE;
-
-	if (!(cptr = (aClient *)MyMalloc(size)))
-		outofmemory();
+		cptr = mp_pool_get(client_local_pool);
+	}
+	else
+		cptr = mp_pool_get(client_remote_pool);
 	bzero((char *)cptr, (int)size);
 
 #ifdef	DEBUGMODE
@@ -155,13 +159,14 @@ aClient *make_client(aClient *from, aClient *servr)
 	{
 		INIT_LIST_HEAD(&cptr->lclient_node);
 		INIT_LIST_HEAD(&cptr->special_node);
+		INIT_LIST_HEAD(&cptr->flush_node);
+		INIT_LIST_HEAD(&cptr->ident_node);
 
 		cptr->since = cptr->lasttime =
 		    cptr->lastnick = cptr->firsttime = TStime();
 		cptr->class = NULL;
 		cptr->passwd = NULL;
 		cptr->sockhost[0] = '\0';
-		cptr->buffer[0] = '\0';
 		cptr->authfd = -1;
 		cptr->fd = -1;
 
@@ -183,6 +188,8 @@ void free_client(aClient *cptr)
 			list_del(&cptr->lclient_node);
 		if (!list_empty(&cptr->special_node))
 			list_del(&cptr->special_node);
+		if (!list_empty(&cptr->flush_node))
+			list_del(&cptr->flush_node);
 
 		if (cptr->passwd)
 			MyFree((char *)cptr->passwd);
@@ -190,12 +197,13 @@ void free_client(aClient *cptr)
 			MyFree(cptr->error_str);
 		if (cptr->hostp)
 			unreal_free_hostent(cptr->hostp);
+		free_identbuf(cptr);
 
 		assert(list_empty(&cptr->lclient_node));
 		assert(list_empty(&cptr->special_node));
 	}
 
-	MyFree((char *)cptr);
+	mp_pool_release(cptr);
 }
 
 /*
@@ -226,6 +234,8 @@ anUser *make_user(aClient *cptr)
 		user->channel = NULL;
 		user->invited = NULL;
 		user->silence = NULL;
+		user->silence_index = NULL;
+		memset(user->uindex, 0, sizeof(user->uindex));
 		user->server = NULL;
 		strlcpy(user->svid, "0", sizeof(user->svid));
 		user->lopt = NULL;
@@ -279,6 +289,8 @@ void free_user(anUser *user, aClient *cptr)
 			MyFree(user->ip_str);
 		if (user->operlogin)
 			MyFree(user->operlogin);
+		if (user->silence_index)
+			free_silence_index(user);
 		mp_pool_release(user);
 #ifdef	DEBUGMODE
 		users.inuse--;
@@ -322,7 +334,10 @@ void remove_client_from_list(aClient *cptr)
 	}
 	
 	if (cptr->user)
+	{
+		userindex_del(cptr);
 		(void)free_user(cptr->user, cptr);
+	}
 	if (cptr->serv)
 	{
 		if (cptr->serv->user)
@@ -402,40 +417,11 @@ void free_str_list(Link *lp)
 }
 
 
-#define	LINKSIZE	(4072/sizeof(Link))
-
 Link *make_link(void)
 {
 	Link *lp;
-	int  i;
-
-	/* "caching" slab-allocator... ie. we're allocating one pages
-	   (hopefully - upped to the Linux default, not dbuf.c) worth of 
-	   link-structures at time to avoid all the malloc overhead.
-	   All links left free from this process or separately freed 
-	   by a call to free_link() are moved over to freelink-list.
-	   Impact? Let's see... -Donwulff */
-	/* Impact is a huge memory leak -Stskeeps
-	   hope this implementation works a little bit better */
-	if (freelink == NULL)
-	{
-		for (i = 1; i <= LINKSIZE; i++)
-		{
-			lp = (Link *)MyMalloc(sizeof(Link));
-			lp->next = freelink;
-			freelink = lp;
-		}
-		freelinks = freelinks + LINKSIZE;
-		lp = freelink;
-		freelink = lp->next;
-		freelinks--;
-	}
-	else
-	{
-		lp = freelink;
-		freelink = freelink->next;
-		freelinks--;
-	}
+
+	lp = mp_pool_get(link_pool);
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
@@ -444,10 +430,7 @@ Link *make_link(void)
 
 void free_link(Link *lp)
 {
-	lp->next = freelink;
-	freelink = lp;
-	freelinks++;
-
+	mp_pool_release(lp);
 #ifdef	DEBUGMODE
 	links.inuse--;
 #endif
@@ -457,7 +440,7 @@ Ban *make_ban(void)
 {
 	Ban *lp;
 
-	lp = (Ban *) MyMalloc(sizeof(Ban));
+	lp = mp_pool_get(ban_pool);
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
@@ -466,12 +449,23 @@ Ban *make_ban(void)
 
 void free_ban(Ban *lp)
 {
-	MyFree((char *)lp);
+	mp_pool_release(lp);
 #ifdef	DEBUGMODE
 	links.inuse--;
 #endif
 }
 
+/* TKL entries, zeroed */
+aTKline *make_tkl(void)
+{
+	return mp_pool_get0(tkl_pool);
+}
+
+void free_tkl(aTKline *tkl)
+{
+	mp_pool_release(tkl);
+}
+
 aClass *make_class(void)
 {
 	aClass *tmp;
@@ -44,6 +44,9 @@
 #include "numeric.h"
 #include "mempool.h"
 #include <assert.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 /** Returns floor(log2(u64)).  If u64 is 0, (incorrectly) returns 0. */
 static int
@@ -330,6 +333,7 @@ mp_pool_get(mp_pool_t *pool)
   }
 
   ++chunk->n_allocated;
+  ++pool->n_items;
 #ifdef MEMPOOL_STATS
   ++pool->total_items_allocated;
 #endif
@@ -365,6 +369,7 @@ mp_pool_release(void *item)
   assert(chunk->magic == MP_CHUNK_MAGIC);
   assert(chunk->n_allocated > 0);
 
+  --chunk->pool->n_items;
   allocated->u.next_free = chunk->first_free;
   chunk->first_free = allocated;
 
@@ -419,6 +424,14 @@ mp_pool_release(void *item)
  * try to fit about <b>chunk_capacity</b> bytes in each chunk. */
 mp_pool_t *
 mp_pool_new(size_t item_size, size_t chunk_capacity)
+{
+  return mp_pool_new_named(NULL, item_size, chunk_capacity);
+}
+
+/** Like mp_pool_new(), but give the pool a <b>name</b> for the statistics.
+ * The name is not copied. */
+mp_pool_t *
+mp_pool_new_named(const char *name, size_t item_size, size_t chunk_capacity)
 {
   mp_pool_t *pool;
   size_t alloc_size, new_chunk_cap;
@@ -471,12 +484,14 @@ mp_pool_new(size_t item_size, size_t chunk_capacity)
   pool->new_chunk_capacity = (int)new_chunk_cap;
 
   pool->item_alloc_size = alloc_size;
+  pool->item_size = item_size;
+  pool->name = name ? name : "unnamed";
 
   pool->next = mp_allocated_pools;
   mp_allocated_pools = pool;
 
-  ircd_log(LOG_DEBUG, "Capacity is %lu, item size is %lu, alloc size is %lu",
-       (unsigned long)pool->new_chunk_capacity,
+  ircd_log(LOG_DEBUG, "Pool %s: capacity is %lu, item size is %lu, alloc size is %lu",
+       pool->name, (unsigned long)pool->new_chunk_capacity,
        (unsigned long)pool->item_alloc_size,
        (unsigned long)(pool->new_chunk_capacity*pool->item_alloc_size));
 
@@ -646,13 +661,54 @@ mp_pool_assert_ok(mp_pool_t *pool)
   assert(pool->n_empty_chunks == n_empty);
 }
 
+/** Free the chunks that have been empty since the last run in every pool,
+ * and hand the memory back to the OS if that freed anything. */
 void
 mp_pool_garbage_collect(void *arg)
 {
   mp_pool_t *pool = mp_allocated_pools;
+  uint64_t freed = 0;
 
-  for (; pool; pool = pool->next)
+  for (; pool; pool = pool->next) {
+    freed -= pool->total_chunks_freed;
     mp_pool_clean(pool, 0, 1);
+    freed += pool->total_chunks_freed;
+  }
+
+#ifdef __GLIBC__
+  /* Freed chunks are big enough that glibc keeps them on its heap
+   * instead of unmapping them. */
+  if (freed)
+    malloc_trim(0);
+#endif
+}
+
+/** Return the first of all pools created with mp_pool_new(); the others
+ * can be found by following <b>next</b>. */
+mp_pool_t *
+mp_pool_list(void)
+{
+  return mp_allocated_pools;
+}
+
+/** Count the bytes handed out to callers and the bytes allocated for chunks
+ * in <b>pool</b>, storing them in *<b>used</b> and *<b>allocated</b>. */
+void
+mp_pool_get_usage(mp_pool_t *pool, uint64_t *used, uint64_t *allocated)
+{
+  mp_chunk_t *chunk;
+
+  *used = *allocated = 0;
+  for (chunk = pool->empty_chunks; chunk; chunk = chunk->next)
+    *allocated += chunk->mem_size;
+  for (chunk = pool->used_chunks; chunk; chunk = chunk->next) {
+    *used += chunk->n_allocated * pool->item_alloc_size;
+    *allocated += chunk->mem_size;
+  }
+  for (chunk = pool->full_chunks; chunk; chunk = chunk->next) {
+    *used += chunk->n_allocated * pool->item_alloc_size;
+    *allocated += chunk->mem_size;
+  }
 }
 
 /** Dump information about <b>pool</b>'s memory usage to the Tor log at level
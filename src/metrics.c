@@ -0,0 +1,381 @@
+/*
+ * RabbitIRCD, src/metrics.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Plaintext metrics over HTTP, in the Prometheus exposition format.
+ *
+ * Enabled with a listen block with the 'metrics' option, eg:
+ *   listen 127.0.0.1:6060 { options { metrics; }; };
+ *
+ * Connections on such a listener never become clients.  We read the
+ * request, render the page into a dbuf in one go (everything on it is a
+ * counter that is already kept somewhere, the only loop over clients is
+ * the one for the per-class sendQ totals) and then write it out as the
+ * socket drains, so a slow scraper never holds up the event loop.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "numeric.h"
+#include "h.h"
+#include "proto.h"
+#include "res.h"
+#include "mempool.h"
+#include "macros.h"
+#include <string.h>
+#include <stdarg.h>
+
+#define METRICS_MAXREQUEST	2048	/* we only need the request line */
+#define METRICS_TIMEOUT		15	/* seconds to send the request and read the reply */
+
+typedef struct _metricsconn MetricsConn;
+
+struct _metricsconn {
+	MetricsConn *prev, *next;
+	int fd;
+	TS started;
+	int reqlen;
+	char request[METRICS_MAXREQUEST];
+	dbuf sendQ;
+};
+
+static MetricsConn *metrics_conns = NULL;
+static Event *metrics_timeout_event = NULL;
+
+static void metrics_read(int fd, int revents, void *data);
+static void metrics_write(int fd, int revents, void *data);
+
+static void metrics_close(MetricsConn *mc)
+{
+	DBufClear(&mc->sendQ);
+	fd_close(mc->fd);
+	--OpenFiles;
+	DelListItem(mc, metrics_conns);
+	MyFree(mc);
+}
+
+EVENT(metrics_timeout)
+{
+	MetricsConn *mc, *next;
+
+	for (mc = metrics_conns; mc; mc = next)
+	{
+		next = mc->next;
+		if (TStime() - mc->started > METRICS_TIMEOUT)
+			metrics_close(mc);
+	}
+}
+
+void metrics_accept(ConfigItem_listen *listener, int fd)
+{
+	MetricsConn *mc;
+
+	set_non_blocking(fd, NULL);
+	fd_desc(fd, "Metrics request");
+	fd_settype(fd, FD_TYPE_OTHER);
+
+	mc = MyMallocEx(sizeof(MetricsConn));
+	mc->fd = fd;
+	mc->started = TStime();
+	dbuf_queue_init(&mc->sendQ);
+	AddListItem(mc, metrics_conns);
+
+	if (!metrics_timeout_event)
+		metrics_timeout_event = EventAddEx(NULL, "metrics_timeout", 5, 0, metrics_timeout, NULL);
+
+	fd_setselect(fd, FD_SELECT_READ, metrics_read, mc);
+}
+
+static void metrics_printf(MetricsConn *mc, char *pattern, ...)
+{
+	va_list vl;
+	char buf[1024];
+	int len;
+
+	va_start(vl, pattern);
+	ircvsnprintf(buf, sizeof(buf), pattern, vl);
+	va_end(vl);
+	len = strlen(buf);
+	dbuf_put(&mc->sendQ, buf, len);
+}
+
+/* Label values may not contain '\', '"' or newlines unescaped */
+static char *metrics_escape(char *str)
+{
+	static char buf[512];
+	char *o = buf;
+
+	for (; *str && o < buf + sizeof(buf) - 3; str++)
+	{
+		if (*str == '\\' || *str == '"')
+		{
+			*o++ = '\\';
+			*o++ = *str;
+		}
+		else if (*str == '\n')
+		{
+			*o++ = '\\';
+			*o++ = 'n';
+		}
+		else
+			*o++ = *str;
+	}
+	*o = '\0';
+	return buf;
+}
+
+static void metrics_header(MetricsConn *mc, char *name, char *type, char *help)
+{
+	metrics_printf(mc, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_render_lusers(MetricsConn *mc)
+{
+	metrics_header(mc, "ircd_users", "gauge", "Users on the network");
+	metrics_printf(mc, "ircd_users %d\n", IRCstats.clients);
+	metrics_header(mc, "ircd_users_invisible", "gauge", "Invisible users on the network");
+	metrics_printf(mc, "ircd_users_invisible %d\n", IRCstats.invisible);
+	metrics_header(mc, "ircd_servers", "gauge", "Servers on the network");
+	metrics_printf(mc, "ircd_servers %d\n", IRCstats.servers);
+	metrics_header(mc, "ircd_operators", "gauge", "IRC operators on the network");
+	metrics_printf(mc, "ircd_operators %d\n", IRCstats.operators);
+	metrics_header(mc, "ircd_channels", "gauge", "Channels on the network");
+	metrics_printf(mc, "ircd_channels %d\n", IRCstats.channels);
+	metrics_header(mc, "ircd_local_users", "gauge", "Users on this server");
+	metrics_printf(mc, "ircd_local_users %d\n", IRCstats.me_clients);
+	metrics_header(mc, "ircd_local_servers", "gauge", "Servers linked to this server");
+	metrics_printf(mc, "ircd_local_servers %d\n", IRCstats.me_servers);
+	metrics_header(mc, "ircd_local_unknown", "gauge", "Unregistered connections");
+	metrics_printf(mc, "ircd_local_unknown %d\n", IRCstats.unknown);
+	metrics_header(mc, "ircd_local_users_max", "gauge", "Highest number of local users");
+	metrics_printf(mc, "ircd_local_users_max %d\n", IRCstats.me_max);
+	metrics_header(mc, "ircd_users_max", "gauge", "Highest number of users on the network");
+	metrics_printf(mc, "ircd_users_max %d\n", IRCstats.global_max);
+}
+
+static void metrics_render_traffic(MetricsConn *mc)
+{
+	metrics_header(mc, "ircd_connections_accepted_total", "counter", "Connections accepted");
+	metrics_printf(mc, "ircd_connections_accepted_total %u\n", ircstp->is_ac);
+	metrics_header(mc, "ircd_connections_refused_total", "counter", "Connections refused");
+	metrics_printf(mc, "ircd_connections_refused_total %u\n", ircstp->is_ref);
+	metrics_header(mc, "ircd_connections_closed_total", "counter", "Closed connections, by type");
+	metrics_printf(mc, "ircd_connections_closed_total{type=\"client\"} %u\n", ircstp->is_cl);
+	metrics_printf(mc, "ircd_connections_closed_total{type=\"server\"} %u\n", ircstp->is_sv);
+	metrics_printf(mc, "ircd_connections_closed_total{type=\"unknown\"} %u\n", ircstp->is_ni);
+	metrics_header(mc, "ircd_closed_kbytes_total", "counter", "Traffic of closed connections in kB");
+	metrics_printf(mc, "ircd_closed_kbytes_total{type=\"client\",dir=\"sent\"} %llu\n", (unsigned long long)ircstp->is_cks);
+	metrics_printf(mc, "ircd_closed_kbytes_total{type=\"client\",dir=\"received\"} %llu\n", (unsigned long long)ircstp->is_ckr);
+	metrics_printf(mc, "ircd_closed_kbytes_total{type=\"server\",dir=\"sent\"} %llu\n", (unsigned long long)ircstp->is_sks);
+	metrics_printf(mc, "ircd_closed_kbytes_total{type=\"server\",dir=\"received\"} %llu\n", (unsigned long long)ircstp->is_skr);
+	metrics_header(mc, "ircd_messages_total", "counter", "Odd messages received, by kind");
+	metrics_printf(mc, "ircd_messages_total{kind=\"unknown_command\"} %u\n", ircstp->is_unco);
+	metrics_printf(mc, "ircd_messages_total{kind=\"unknown_prefix\"} %u\n", ircstp->is_unpf);
+	metrics_printf(mc, "ircd_messages_total{kind=\"wrong_direction\"} %u\n", ircstp->is_wrdi);
+	metrics_printf(mc, "ircd_messages_total{kind=\"empty\"} %u\n", ircstp->is_empt);
+	metrics_printf(mc, "ircd_messages_total{kind=\"numeric\"} %u\n", ircstp->is_num);
+	metrics_header(mc, "ircd_collision_kills_total", "counter", "Kills caused by nick collisions");
+	metrics_printf(mc, "ircd_collision_kills_total %u\n", ircstp->is_kill);
+	metrics_header(mc, "ircd_sendq_bytes_total", "counter", "Bytes queued for sending");
+	metrics_printf(mc, "ircd_sendq_bytes_total %llu\n", sendq_bytes);
+}
+
+static void metrics_render_mempools(MetricsConn *mc)
+{
+	mp_pool_t *pool;
+	uint64_t used, allocated;
+
+	metrics_header(mc, "ircd_mempool_bytes", "gauge", "Memory pool usage");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		mp_pool_get_usage(pool, &used, &allocated);
+		metrics_printf(mc, "ircd_mempool_bytes{pool=\"%s\",kind=\"used\"} %llu\n",
+			pool->name, (unsigned long long)used);
+		metrics_printf(mc, "ircd_mempool_bytes{pool=\"%s\",kind=\"allocated\"} %llu\n",
+			pool->name, (unsigned long long)allocated);
+	}
+	metrics_header(mc, "ircd_mempool_items", "gauge", "Memory pool items in use");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+		metrics_printf(mc, "ircd_mempool_items{pool=\"%s\"} %llu\n",
+			pool->name, (unsigned long long)pool->n_items);
+	metrics_header(mc, "ircd_mempool_items_allocated_total", "counter", "Memory pool allocations");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+		metrics_printf(mc, "ircd_mempool_items_allocated_total{pool=\"%s\"} %llu\n",
+			pool->name, (unsigned long long)pool->total_items_allocated);
+	metrics_header(mc, "ircd_mempool_chunks_freed_total", "counter", "Memory pool chunks given back");
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+		metrics_printf(mc, "ircd_mempool_chunks_freed_total{pool=\"%s\"} %llu\n",
+			pool->name, (unsigned long long)pool->total_chunks_freed);
+}
+
+static void metrics_render_dns(MetricsConn *mc)
+{
+	metrics_header(mc, "ircd_dns_cache_total", "counter", "DNS cache lookups and additions");
+	metrics_printf(mc, "ircd_dns_cache_total{result=\"hit\"} %u\n", dnsstats.cache_hits);
+	metrics_printf(mc, "ircd_dns_cache_total{result=\"miss\"} %u\n", dnsstats.cache_misses);
+	metrics_printf(mc, "ircd_dns_cache_total{result=\"add\"} %u\n", dnsstats.cache_adds);
+}
+
+static void metrics_render_classes(MetricsConn *mc)
+{
+	ConfigItem_class *class;
+	ConfigItem_class **classes;
+	unsigned long *sendq;
+	aClient *acptr;
+	int nclasses = 0, i;
+
+	metrics_header(mc, "ircd_class_clients", "gauge", "Connections in each class");
+	for (class = conf_class; class; class = (ConfigItem_class *)class->next, nclasses++)
+		metrics_printf(mc, "ircd_class_clients{class=\"%s\"} %d\n",
+			metrics_escape(class->name), class->clients);
+
+	/* This is the only place where we walk all local connections, there
+	 * are only a handful of classes so a linear search per client is fine.
+	 */
+	classes = MyMallocEx(sizeof(ConfigItem_class *) * (nclasses + 1));
+	sendq = MyMallocEx(sizeof(unsigned long) * (nclasses + 1));
+	for (class = conf_class, i = 0; class; class = (ConfigItem_class *)class->next, i++)
+		classes[i] = class;
+	list_for_each_entry(acptr, &lclient_list, lclient_node)
+	{
+		for (i = 0; i < nclasses && classes[i] != acptr->class; i++)
+			;
+		sendq[i] += DBufLength(&acptr->sendQ);
+	}
+	list_for_each_entry(acptr, &server_list, special_node)
+	{
+		for (i = 0; i < nclasses && classes[i] != acptr->class; i++)
+			;
+		sendq[i] += DBufLength(&acptr->sendQ);
+	}
+
+	metrics_header(mc, "ircd_class_sendq_bytes", "gauge", "Bytes queued for connections in each class");
+	for (i = 0; i < nclasses; i++)
+		metrics_printf(mc, "ircd_class_sendq_bytes{class=\"%s\"} %llu\n",
+			metrics_escape(classes[i]->name), (unsigned long long)sendq[i]);
+	MyFree(classes);
+	MyFree(sendq);
+}
+
+static void metrics_render_tkl(MetricsConn *mc)
+{
+	aTKline *tk;
+	int i;
+	static char *types[] = { "gline", "kline", "gzline", "zline", "shun", "qline", "spamfilter", "other" };
+	int typecount[ARRAY_SIZEOF(types)];
+
+	memset(typecount, 0, sizeof(typecount));
+	for (i = 0; i < TKLISTLEN; i++)
+		for (tk = tklines[i]; tk; tk = tk->next)
+		{
+			if (tk->type & TKL_SPAMF)
+				typecount[6]++;
+			else if (tk->type & TKL_NICK)
+				typecount[5]++;
+			else if (tk->type & TKL_SHUN)
+				typecount[4]++;
+			else if (tk->type & TKL_ZAP)
+				typecount[(tk->type & TKL_GLOBAL) ? 2 : 3]++;
+			else if (tk->type & TKL_KILL)
+				typecount[(tk->type & TKL_GLOBAL) ? 0 : 1]++;
+			else
+				typecount[7]++;
+		}
+
+	metrics_header(mc, "ircd_tkl_entries", "gauge", "Server bans, by type");
+	for (i = 0; i < ARRAY_SIZEOF(types); i++)
+		metrics_printf(mc, "ircd_tkl_entries{type=\"%s\"} %d\n", types[i], typecount[i]);
+
+	if (!tkl_hash)
+		return;
+	metrics_header(mc, "ircd_spamfilter_hits_total", "counter", "Matches of each spamfilter");
+	for (tk = tklines[tkl_hash('F')]; tk; tk = tk->next)
+		metrics_printf(mc, "ircd_spamfilter_hits_total{targets=\"%s\",action=\"%s\",filter=\"%s\"} %llu\n",
+			spamfilter_target_inttostring(tk->subtype),
+			banact_valtostring(tk->ptr.spamf->action),
+			metrics_escape(tk->reason), (unsigned long long)tk->ptr.spamf->hits);
+}
+
+static void metrics_render(MetricsConn *mc)
+{
+	metrics_printf(mc, "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Connection: close\r\n\r\n");
+	metrics_render_lusers(mc);
+	metrics_render_traffic(mc);
+	metrics_render_mempools(mc);
+	metrics_render_dns(mc);
+	metrics_render_classes(mc);
+	metrics_render_tkl(mc);
+}
+
+static void metrics_read(int fd, int revents, void *data)
+{
+	MetricsConn *mc = data;
+	int n;
+
+	n = recv(fd, mc->request + mc->reqlen, sizeof(mc->request) - mc->reqlen - 1, 0);
+	if (n <= 0)
+	{
+		if (n < 0 && (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN))
+			return;
+		metrics_close(mc);
+		return;
+	}
+	mc->reqlen += n;
+	mc->request[mc->reqlen] = '\0';
+
+	/* Wait for the end of the headers, unless the buffer is full */
+	if (!strstr(mc->request, "\r\n\r\n") && !strstr(mc->request, "\n\n") &&
+	    (mc->reqlen < sizeof(mc->request) - 1))
+		return;
+
+	if (strncmp(mc->request, "GET ", 4))
+		metrics_printf(mc, "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+	else
+		metrics_render(mc);
+
+	fd_setselect(fd, FD_SELECT_READ, NULL, mc);
+	fd_setselect(fd, FD_SELECT_WRITE, metrics_write, mc);
+	metrics_write(fd, 0, mc);
+}
+
+static void metrics_write(int fd, int revents, void *data)
+{
+	MetricsConn *mc = data;
+	dbufbuf *block;
+	int n;
+
+	while (DBufLength(&mc->sendQ) > 0)
+	{
+		block = container_of(mc->sendQ.dbuf_list.next, dbufbuf, dbuf_node);
+		n = send(fd, block->data, block->size, 0);
+		if (n < 0)
+		{
+			if (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN)
+				return;
+			break;
+		}
+		dbuf_delete(&mc->sendQ, n);
+		if (n < block->size)
+			return;
+	}
+	metrics_close(mc);
+}
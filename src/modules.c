@@ -53,6 +53,7 @@
 
 Hook	   	*Hooks[MAXHOOKTYPES];
 Hooktype	Hooktypes[MAXCUSTOMHOOKS];
+HookStat	HookStats[MAXHOOKTYPES];
 Callback	*Callbacks[MAXCALLBACKS];	/* Callback objects for modules, used for rehashing etc (can be multiple) */
 Callback	*RCallbacks[MAXCALLBACKS];	/* 'Real' callback function, used for callback function calls */
 Efunction	*Efunctions[MAXEFUNCTIONS];	/* Efunction objects (used for rehashing) */
@@ -1264,6 +1265,92 @@ Hook	*HookAddMain(Module *module, int hooktype, int (*func)(), void (*vfunc)(),
 	return p;
 }
 
+/*
+ * Account one run of all hooks of a hooktype, called by the RunHook*
+ * macros (HOOKSTAT_END) with the profile_clock() value from before the run.
+ */
+void hookstat_add(int hooktype, unsigned long long start)
+{
+	HookStat *hs = &HookStats[hooktype];
+	unsigned long long elapsed = profile_clock() - start;
+
+	hs->count++;
+	hs->nsecs += elapsed;
+	if (elapsed > hs->maxnsecs)
+		hs->maxnsecs = elapsed;
+}
+
+static struct {
+	int  type;
+	char *name;
+} hooktype_names[] = {
+	{ HOOKTYPE_LOCAL_QUIT, "LOCAL_QUIT" },
+	{ HOOKTYPE_LOCAL_NICKCHANGE, "LOCAL_NICKCHANGE" },
+	{ HOOKTYPE_LOCAL_CONNECT, "LOCAL_CONNECT" },
+	{ HOOKTYPE_REHASHFLAG, "REHASHFLAG" },
+	{ HOOKTYPE_PRE_LOCAL_PART, "PRE_LOCAL_PART" },
+	{ HOOKTYPE_CONFIGPOSTTEST, "CONFIGPOSTTEST" },
+	{ HOOKTYPE_REHASH, "REHASH" },
+	{ HOOKTYPE_PRE_LOCAL_CONNECT, "PRE_LOCAL_CONNECT" },
+	{ HOOKTYPE_PRE_LOCAL_QUIT, "PRE_LOCAL_QUIT" },
+	{ HOOKTYPE_GUEST, "GUEST" },
+	{ HOOKTYPE_SERVER_CONNECT, "SERVER_CONNECT" },
+	{ HOOKTYPE_SERVER_QUIT, "SERVER_QUIT" },
+	{ HOOKTYPE_STATS, "STATS" },
+	{ HOOKTYPE_LOCAL_JOIN, "LOCAL_JOIN" },
+	{ HOOKTYPE_USERMSG, "USERMSG" },
+	{ HOOKTYPE_CHANMSG, "CHANMSG" },
+	{ HOOKTYPE_LOCAL_PART, "LOCAL_PART" },
+	{ HOOKTYPE_LOCAL_KICK, "LOCAL_KICK" },
+	{ HOOKTYPE_LOCAL_CHANMODE, "LOCAL_CHANMODE" },
+	{ HOOKTYPE_LOCAL_TOPIC, "LOCAL_TOPIC" },
+	{ HOOKTYPE_LOCAL_OPER, "LOCAL_OPER" },
+	{ HOOKTYPE_UNKUSER_QUIT, "UNKUSER_QUIT" },
+	{ HOOKTYPE_LOCAL_PASS, "LOCAL_PASS" },
+	{ HOOKTYPE_REMOTE_CONNECT, "REMOTE_CONNECT" },
+	{ HOOKTYPE_REMOTE_QUIT, "REMOTE_QUIT" },
+	{ HOOKTYPE_PRE_LOCAL_JOIN, "PRE_LOCAL_JOIN" },
+	{ HOOKTYPE_PRE_LOCAL_KICK, "PRE_LOCAL_KICK" },
+	{ HOOKTYPE_PRE_LOCAL_TOPIC, "PRE_LOCAL_TOPIC" },
+	{ HOOKTYPE_REMOTE_NICKCHANGE, "REMOTE_NICKCHANGE" },
+	{ HOOKTYPE_CHANNEL_CREATE, "CHANNEL_CREATE" },
+	{ HOOKTYPE_CHANNEL_DESTROY, "CHANNEL_DESTROY" },
+	{ HOOKTYPE_REMOTE_CHANMODE, "REMOTE_CHANMODE" },
+	{ HOOKTYPE_TKL_EXCEPT, "TKL_EXCEPT" },
+	{ HOOKTYPE_UMODE_CHANGE, "UMODE_CHANGE" },
+	{ HOOKTYPE_TOPIC, "TOPIC" },
+	{ HOOKTYPE_REHASH_COMPLETE, "REHASH_COMPLETE" },
+	{ HOOKTYPE_TKL_ADD, "TKL_ADD" },
+	{ HOOKTYPE_TKL_DEL, "TKL_DEL" },
+	{ HOOKTYPE_LOCAL_KILL, "LOCAL_KILL" },
+	{ HOOKTYPE_LOG, "LOG" },
+	{ HOOKTYPE_REMOTE_JOIN, "REMOTE_JOIN" },
+	{ HOOKTYPE_REMOTE_PART, "REMOTE_PART" },
+	{ HOOKTYPE_REMOTE_KICK, "REMOTE_KICK" },
+	{ HOOKTYPE_LOCAL_SPAMFILTER, "LOCAL_SPAMFILTER" },
+	{ HOOKTYPE_SILENCED, "SILENCED" },
+	{ HOOKTYPE_POST_SERVER_CONNECT, "POST_SERVER_CONNECT" },
+	{ HOOKTYPE_RAWPACKET_IN, "RAWPACKET_IN" },
+	{ HOOKTYPE_LOCAL_NICKPASS, "LOCAL_NICKPASS" },
+	{ HOOKTYPE_PACKET, "PACKET" },
+	{ HOOKTYPE_HANDSHAKE, "HANDSHAKE" },
+	{ HOOKTYPE_AWAY, "AWAY" },
+	{ HOOKTYPE_CAPLIST, "CAPLIST" },
+	{ HOOKTYPE_INVITE, "INVITE" },
+	{ 0, NULL }
+};
+
+/** The name of a hooktype, as in its HOOKTYPE_ define, or NULL if unknown */
+char *hooktype_name(int hooktype)
+{
+	int  i;
+
+	for (i = 0; hooktype_names[i].name; i++)
+		if (hooktype_names[i].type == hooktype)
+			return hooktype_names[i].name;
+	return NULL;
+}
+
 Hook *HookDel(Hook *hook)
 {
 	Hook *p, *q;
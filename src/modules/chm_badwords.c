@@ -26,6 +26,7 @@
 #include "numeric.h"
 #include "sys.h"
 #include "h.h"
+#include "badwords.h"
 
 ModuleHeader MOD_HEADER(chm_badwords)
   = {
@@ -36,16 +37,9 @@ ModuleHeader MOD_HEADER(chm_badwords)
         NULL 
     };
 
-struct _configitem_badword {
-        ConfigItem      *prev, *next;
-        ConfigFlag      flag;
-        char            *word, *replace;
-};
-typedef struct _configitem_badword ConfigItem_badword;
-
-static ConfigItem_badword *conf_badword_channel = NULL;
-static ConfigItem_badword *conf_badword_message = NULL;
-static ConfigItem_badword *conf_badword_quit = NULL;
+static BadwordMatcher *badwords_channel = NULL;
+static BadwordMatcher *badwords_message = NULL;
+static BadwordMatcher *badwords_quit = NULL;
 
 static Cmode_t EXTMODE_BADWORDS = 0L;
 static long UMODE_STRIPBADWORDS = 0L;
@@ -65,107 +59,60 @@ static int chm_badwords_is_ok(aClient *cptr, aChannel *chptr, char *para, int ch
  * stripbadwords()                                                                  *
  ************************************************************************************/
 
-static bool replace_one_word(const char *origstr, char *outstr, size_t outlen,
-	const char *search, const char *replacement)
-{
-	const char *source_p;
-	char *target_p;
-	int slen, dlen;
-
-	/* Check for NULL */
-	if (search == NULL)
-		return false;
-	if (replacement == NULL)
-		replacement = "<censored>";
-
-	outstr[0] = '\0';
-	source_p = origstr;
-	target_p = outstr;
-	slen = strlen(search);
-	dlen = strlen(replacement);
-
-	while (*source_p != '\0')
-	{
-		if (strncasecmp(source_p, search, slen) == 0)
-		{
-			*target_p = '\0';
-			memcpy(target_p, replacement, MIN(dlen, outlen - (ptrdiff_t)(target_p - outstr)));
-			target_p += dlen;
-			source_p += slen;
-		}
-		else if ((target_p - outstr) < outlen)
-		{
-			*target_p = *source_p;
-			target_p++;
-			source_p++;
-		}
-		else
-			break;
-	}
-
-	*target_p = '\0';
-	return true;
-}
-
-static inline char *stripbadwords(char *str, ConfigItem_badword *start_bw)
+/* A message to several +G channels is only censored once: the result
+ * is remembered for the current message text (see msgtext.c).
+ */
+static inline char *stripbadwords(char *str, BadwordMatcher *m)
 {
-	static char workbuf[BUFSIZE], outbuf[BUFSIZE];
-
-	strlcpy(workbuf, str, sizeof workbuf);
-	memset(outbuf, 0, sizeof outbuf);
-
-	for (; start_bw != NULL; start_bw = (ConfigItem_badword *) start_bw->next)
-	{
-		replace_one_word(workbuf, outbuf, sizeof outbuf, start_bw->word, start_bw->replace);
-	}
-
-	return outbuf;
+	static char outbuf[BUFSIZE];
+	static unsigned int last_serial = 0;
+	static BadwordMatcher *last_m = NULL;
+	static char *last_result = NULL;
+	int current;
+
+	if (!m)
+		return str;
+
+	current = msgtext_current && (msgtext_current->text == str);
+	if (current && (msgtext_current->serial == last_serial) && (m == last_m))
+		return last_result;
+
+	last_result = badword_matcher_replace(m, str, outbuf, sizeof outbuf);
+	last_serial = current ? msgtext_current->serial : 0;
+	last_m = m;
+	return last_result;
 }
 
 /************************************************************************************
  * config management                                                                *
  ************************************************************************************/
 
-static ConfigItem_badword *copy_badword_struct(ConfigItem_badword *ca)
+static void add_badword(BadwordMatcher **m, char *word, char *replace)
 {
-	ConfigItem_badword *out = MyMalloc(sizeof(ConfigItem_badword));
-
-	memcpy(out, ca, sizeof(ConfigItem_badword));
-	out->word = strdup(ca->word);
-
-	if (ca->replace)
-		out->replace = strdup(ca->replace);
-
-	return out;
+	if (!*m)
+		*m = badword_matcher_new();
+	badword_matcher_add(*m, word, replace);
 }
 
 static int chm_badwords_config_badword_run(struct config_ops *ops, ConfigFile *cf, ConfigEntry *ce)
 {
-	ConfigItem_badword *ca;
 	ConfigEntry *cep;
-
-	ca = MyMallocEx(sizeof(ConfigItem_badword));
+	char *word = NULL, *replace = NULL;
 
 	for (cep = ce->ce_entries; cep != NULL; cep = cep->ce_next)
 	{
 		if (!strcasecmp(cep->ce_varname, "replace"))
-			ca->replace = strdup(cep->ce_vardata);
+			replace = cep->ce_vardata;
 		else if (!strcasecmp(cep->ce_varname, "word"))
-			ca->word = strdup(cep->ce_vardata);
+			word = cep->ce_vardata;
 	}
 
-	if (!strcasecmp(ce->ce_vardata, "channel"))
-		AddListItem(ca, conf_badword_channel);
-	else if (!strcasecmp(ce->ce_vardata, "message"))
-		AddListItem(ca, conf_badword_message);
-	else if (!strcasecmp(ce->ce_vardata, "quit"))
-		AddListItem(ca, conf_badword_quit);
-	else if (!strcasecmp(ce->ce_vardata, "all"))
-	{
-		AddListItem(ca, conf_badword_channel);
-		AddListItem(copy_badword_struct(ca), conf_badword_message);
-		AddListItem(copy_badword_struct(ca), conf_badword_quit);
-	}
+	if (!strcasecmp(ce->ce_vardata, "channel") || !strcasecmp(ce->ce_vardata, "all"))
+		add_badword(&badwords_channel, word, replace);
+	if (!strcasecmp(ce->ce_vardata, "message") || !strcasecmp(ce->ce_vardata, "all"))
+		add_badword(&badwords_message, word, replace);
+	if (!strcasecmp(ce->ce_vardata, "quit") || !strcasecmp(ce->ce_vardata, "all"))
+		add_badword(&badwords_quit, word, replace);
 
 	return 1;
 }
@@ -220,7 +167,7 @@ char *chm_badwords_usermsg(aClient *cptr, aClient *sptr, aClient *acptr, char *t
 	if (!(acptr->umodes & UMODE_STRIPBADWORDS))
 		return text;
 
-	return stripbadwords(text, conf_badword_message);
+	return stripbadwords(text, badwords_message);
 }
 
 char *chm_badwords_chanmsg(aClient *cptr, aClient *sptr, aChannel *chptr, char *text, int notice)
@@ -228,7 +175,7 @@ char *chm_badwords_chanmsg(aClient *cptr, aClient *sptr, aChannel *chptr, char *
 	if (!(chptr->mode.extmode & EXTMODE_BADWORDS))
 		return text;
 
-	return stripbadwords(text, conf_badword_channel);
+	return stripbadwords(text, badwords_channel);
 }
 
 char *chm_badwords_pre_local_part(aClient *cptr, aChannel *chptr, char *text)
@@ -236,7 +183,7 @@ char *chm_badwords_pre_local_part(aClient *cptr, aChannel *chptr, char *text)
 	if (!(chptr->mode.extmode & EXTMODE_BADWORDS))
 		return text;
 
-	return stripbadwords(text, conf_badword_channel);
+	return stripbadwords(text, badwords_channel);
 }
 
 char *chm_badwords_pre_local_quit(aClient *cptr, char *text)
@@ -246,7 +193,7 @@ char *chm_badwords_pre_local_quit(aClient *cptr, char *text)
 	for (lp = cptr->user->channel; lp; lp = lp->next)
 	{
 		if ((lp->chptr->mode.extmode & EXTMODE_BADWORDS))
-			return stripbadwords(text, conf_badword_quit);
+			return stripbadwords(text, badwords_quit);
 	}
 
 	return text;
@@ -286,12 +233,25 @@ DLLFUNC int MOD_INIT(chm_badwords)(ModuleInfo *modinfo)
 /* Is first run when server is 100% ready */
 DLLFUNC int MOD_LOAD(chm_badwords)(int module_load)
 {
+	/* The badword blocks have been read by now, compile them. */
+	if (badwords_channel)
+		badword_matcher_build(badwords_channel);
+	if (badwords_message)
+		badword_matcher_build(badwords_message);
+	if (badwords_quit)
+		badword_matcher_build(badwords_quit);
+
         return MOD_SUCCESS;
 }
 
 /* Called when module is unloaded */
 DLLFUNC int MOD_UNLOAD(chm_badwords)(int module_unload)
 {
+	badword_matcher_free(badwords_channel);
+	badword_matcher_free(badwords_message);
+	badword_matcher_free(badwords_quit);
+	badwords_channel = badwords_message = badwords_quit = NULL;
+
         return MOD_SUCCESS;
 }
 
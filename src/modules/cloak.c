@@ -57,6 +57,41 @@ static char *hidehost_ipv6(char *host);
 static char *hidehost_normalhost(char *host);
 static inline unsigned int downsample(char *i);
 
+/*
+ * Cloaking costs two MD5's per segment, but BETA and GAMMA only depend
+ * on the /24 and /16 (the first 7 and 4 words for IPv6) so during a
+ * connect storm from a few ranges they're the same over and over again.
+ * Those segments are kept in a small LRU cache keyed by the prefix, and
+ * so are complete cloaks of normal hosts. Both are flushed when the
+ * keys change.
+ */
+#define CLOAK_CACHE_SIZE	4096	/* entries per cache, power of 2 */
+#define CLOAK_KEYLEN		48	/* fits the longest IPv6 prefix */
+
+typedef struct CloakCacheEntry {
+	struct list_head lru;
+	struct list_head hash;
+	char key[HOSTLEN + 1];
+	union {
+		unsigned int segment;
+		char host[HOSTLEN + 1];
+	} v;
+} CloakCacheEntry;
+
+typedef struct {
+	struct list_head lru;		/* most recently used first */
+	struct list_head *table;
+	size_t entrysize;
+	int  count;
+} CloakCache;
+
+static CloakCache segment_cache = { .entrysize = offsetof(CloakCacheEntry, v) + sizeof(unsigned int) };
+static CloakCache host_cache = { .entrysize = sizeof(CloakCacheEntry) };
+
+unsigned hash_nick_name(const char *);	/* defined in hash.c */
+
+static void cloak_cache_flush(CloakCache *c);
+
 Callback *cloak = NULL, *cloak_csum = NULL;
 
 ModuleHeader MOD_HEADER(cloak)
@@ -108,6 +143,8 @@ DLLFUNC int MOD_LOAD(cloak)(int module_load)
 
 DLLFUNC int MOD_UNLOAD(cloak)(int module_unload)
 {
+	cloak_cache_flush(&segment_cache);
+	cloak_cache_flush(&host_cache);
 	if (cloak_key1)
 	{
 		MyFree(cloak_key1);
@@ -210,6 +247,10 @@ char buf[512], result[MD5_DIGEST_LENGTH];
 	cep = cep->ce_next;
 	cloak_key3 = strdup(cep->ce_varname);
 
+	/* Anything cached was cloaked with the old keys */
+	cloak_cache_flush(&segment_cache);
+	cloak_cache_flush(&host_cache);
+
 	/* Calculate checksum */
 	ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY1, KEY2, KEY3);
 	MD5(buf, strlen(buf), result);
@@ -274,10 +315,74 @@ char r[4];
 	         (unsigned int)r[3]);
 }
 
+static void cloak_cache_flush(CloakCache *c)
+{
+	CloakCacheEntry *e, *next;
+
+	if (!c->table)
+		return;
+	list_for_each_entry_safe(e, next, &c->lru, lru)
+		MyFree(e);
+	MyFree(c->table);
+	c->table = NULL;
+	c->count = 0;
+}
+
+/** Look up key, moving it to the front of the LRU on a hit */
+static CloakCacheEntry *cloak_cache_find(CloakCache *c, char *key)
+{
+	CloakCacheEntry *e;
+	struct list_head *bucket;
+
+	if (!c->table)
+		return NULL;
+	bucket = &c->table[hash_nick_name(key) & (CLOAK_CACHE_SIZE - 1)];
+	list_for_each_entry(e, bucket, hash)
+	{
+		if (!strcmp(e->key, key))
+		{
+			list_move(&e->lru, &c->lru);
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/** Add key (which is not in the cache yet), the caller fills in the value */
+static CloakCacheEntry *cloak_cache_add(CloakCache *c, char *key)
+{
+	CloakCacheEntry *e;
+	int  i;
+
+	if (!c->table)
+	{
+		INIT_LIST_HEAD(&c->lru);
+		c->table = MyMalloc(sizeof(struct list_head) * CLOAK_CACHE_SIZE);
+		for (i = 0; i < CLOAK_CACHE_SIZE; i++)
+			INIT_LIST_HEAD(&c->table[i]);
+	}
+	if (c->count < CLOAK_CACHE_SIZE)
+	{
+		e = MyMalloc(c->entrysize);
+		c->count++;
+	} else {
+		/* Full, recycle the least recently used one */
+		e = list_entry(c->lru.prev, CloakCacheEntry, lru);
+		list_del(&e->lru);
+		list_del(&e->hash);
+	}
+	strlcpy(e->key, key, sizeof(e->key));
+	list_add(&e->lru, &c->lru);
+	list_add(&e->hash, &c->table[hash_nick_name(key) & (CLOAK_CACHE_SIZE - 1)]);
+	return e;
+}
+
 static char *hidehost_ipv4(char *host)
 {
 unsigned int a, b, c, d;
 static char buf[512], res[512], res2[512], result[128];
+char key[CLOAK_KEYLEN];
+CloakCacheEntry *e;
 unsigned long n;
 unsigned int alpha, beta, gamma;
 
@@ -302,20 +407,34 @@ unsigned int alpha, beta, gamma;
 	alpha = downsample(res2);
 
 	/* BETA... */
-	ircsnprintf(buf, sizeof(buf), "%s:%d.%d.%d:%s", KEY3, a, b, c, KEY1);
-	MD5(buf, strlen(buf), res);
-	strlcpy(res+16, KEY2, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
-	n = strlen(res+16) + 16;
-	MD5(res, n, res2);
-	beta = downsample(res2);
+	ircsnprintf(key, sizeof(key), "%d.%d.%d", a, b, c);
+	if ((e = cloak_cache_find(&segment_cache, key)))
+		beta = e->v.segment;
+	else
+	{
+		ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY3, key, KEY1);
+		MD5(buf, strlen(buf), res);
+		strlcpy(res+16, KEY2, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
+		n = strlen(res+16) + 16;
+		MD5(res, n, res2);
+		beta = downsample(res2);
+		cloak_cache_add(&segment_cache, key)->v.segment = beta;
+	}
 
 	/* GAMMA... */
-	ircsnprintf(buf, sizeof(buf), "%s:%d.%d:%s", KEY1, a, b, KEY2);
-	MD5(buf, strlen(buf), res);
-	strlcpy(res+16, KEY3, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
-	n = strlen(res+16) + 16;
-	MD5(res, n, res2);
-	gamma = downsample(res2);
+	ircsnprintf(key, sizeof(key), "%d.%d", a, b);
+	if ((e = cloak_cache_find(&segment_cache, key)))
+		gamma = e->v.segment;
+	else
+	{
+		ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY1, key, KEY2);
+		MD5(buf, strlen(buf), res);
+		strlcpy(res+16, KEY3, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
+		n = strlen(res+16) + 16;
+		MD5(res, n, res2);
+		gamma = downsample(res2);
+		cloak_cache_add(&segment_cache, key)->v.segment = gamma;
+	}
 
 	ircsnprintf(result, sizeof(result), "%X.%X.%X.IP", alpha, beta, gamma);
 	return result;
@@ -325,6 +444,8 @@ static char *hidehost_ipv6(char *host)
 {
 unsigned int a, b, c, d, e, f, g, h;
 static char buf[512], res[512], res2[512], result[128];
+char key[CLOAK_KEYLEN];
+CloakCacheEntry *ce;
 unsigned long n;
 unsigned int alpha, beta, gamma;
 
@@ -350,20 +471,34 @@ unsigned int alpha, beta, gamma;
 	alpha = downsample(res2);
 
 	/* BETA... */
-	ircsnprintf(buf, sizeof(buf), "%s:%x:%x:%x:%x:%x:%x:%x:%s", KEY3, a, b, c, d, e, f, g, KEY1);
-	MD5(buf, strlen(buf), res);
-	strlcpy(res+16, KEY2, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
-	n = strlen(res+16) + 16;
-	MD5(res, n, res2);
-	beta = downsample(res2);
+	ircsnprintf(key, sizeof(key), "%x:%x:%x:%x:%x:%x:%x", a, b, c, d, e, f, g);
+	if ((ce = cloak_cache_find(&segment_cache, key)))
+		beta = ce->v.segment;
+	else
+	{
+		ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY3, key, KEY1);
+		MD5(buf, strlen(buf), res);
+		strlcpy(res+16, KEY2, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
+		n = strlen(res+16) + 16;
+		MD5(res, n, res2);
+		beta = downsample(res2);
+		cloak_cache_add(&segment_cache, key)->v.segment = beta;
+	}
 
 	/* GAMMA... */
-	ircsnprintf(buf, sizeof(buf), "%s:%x:%x:%x:%x:%s", KEY1, a, b, c, d, KEY2);
-	MD5(buf, strlen(buf), res);
-	strlcpy(res+16, KEY3, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
-	n = strlen(res+16) + 16;
-	MD5(res, n, res2);
-	gamma = downsample(res2);
+	ircsnprintf(key, sizeof(key), "%x:%x:%x:%x", a, b, c, d);
+	if ((ce = cloak_cache_find(&segment_cache, key)))
+		gamma = ce->v.segment;
+	else
+	{
+		ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY1, key, KEY2);
+		MD5(buf, strlen(buf), res);
+		strlcpy(res+16, KEY3, sizeof(res)-16); /* first 16 bytes are filled, append our key.. */
+		n = strlen(res+16) + 16;
+		MD5(res, n, res2);
+		gamma = downsample(res2);
+		cloak_cache_add(&segment_cache, key)->v.segment = gamma;
+	}
 
 	ircsnprintf(result, sizeof(result), "%X:%X:%X:IP", alpha, beta, gamma);
 	return result;
@@ -374,6 +509,13 @@ static char *hidehost_normalhost(char *host)
 char *p;
 static char buf[512], res[512], res2[512], result[HOSTLEN+1];
 unsigned int alpha, n;
+CloakCacheEntry *e;
+
+	if ((e = cloak_cache_find(&host_cache, host)))
+	{
+		strlcpy(result, e->v.host, sizeof(result));
+		return result;
+	}
 
 	ircsnprintf(buf, sizeof(buf), "%s:%s:%s", KEY1, host, KEY2);
 	MD5(buf, strlen(buf), res);
@@ -400,5 +542,7 @@ unsigned int alpha, n;
 	} else
 		ircsnprintf(result, sizeof(result),  "%s-%X", hidden_host, alpha);
 
+	if (strlen(host) <= HOSTLEN)
+		strlcpy(cloak_cache_add(&host_cache, host)->v.host, result, HOSTLEN + 1);
 	return result;
 }
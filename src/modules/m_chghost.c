@@ -190,6 +190,7 @@ DLLFUNC int m_chghost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			acptr->user->virthost = 0;
 		}
 		acptr->user->virthost = strdup(parv[2]);
+		userindex_update(acptr);
 		if (UHOST_ALLOWED == UHALLOW_REJOIN)
 			rejoin_dojoinandmode(acptr);
 		return 0;
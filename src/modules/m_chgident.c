@@ -192,6 +192,7 @@ int  legalident = 1;
 		sendto_server(cptr, 0, 0, ":%s CHGIDENT %s %s",
 		    sptr->name, acptr->name, parv[2]);
 		ircsnprintf(acptr->user->username, sizeof(acptr->user->username), "%s", parv[2]);
+		userindex_update(acptr);
 		if (UHOST_ALLOWED == UHALLOW_REJOIN)
 			rejoin_dojoinandmode(acptr);
 		return 0;
@@ -80,6 +80,8 @@ DLLFUNC CMD_FUNC(m_eos)
 	if (!IsServer(sptr))
 		return 0;
 	sptr->serv->flags.synced = 1;
+	if ((sptr == cptr) && sptr->serv->burst_start)
+		sptr->serv->burst_received = profile_clock() - sptr->serv->burst_start;
 	/* pass it on ^_- */
 #ifdef DEBUGMODE
 	ircd_log(LOG_ERROR, "[EOSDBG] m_eos: got sync from %s (path:%s)", sptr->name, cptr->name);
@@ -519,7 +519,7 @@ DLLFUNC CMD_FUNC(_do_join)
 	parv[2] = NULL;		/* for m_names call later, parv[parc] must == NULL */
 	for (name = strtok_r(jbuf, ",", &p); name;
 	    key = (key) ? strtok_r(NULL, ",", &p2) : NULL,
-	    name = strtok_r(NULL, ",", &p2))
+	    name = strtok_r(NULL, ",", &p))
 	{
 		/*
 		   ** JOIN 0 sends out a part for all channels a user
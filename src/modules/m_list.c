@@ -136,6 +136,7 @@ DLLFUNC CMD_FUNC(m_list)
 		memset(lopt, '\0', sizeof(LOpts));
 
 		lopt->showall = 1;
+		lopt->index = CHANDIR_BYNAME;
 
 		if (DBufLength(&cptr->sendQ) < 2048)
 			send_list(cptr, 64);
@@ -282,6 +283,20 @@ DLLFUNC CMD_FUNC(m_list)
 		lopt->nolist = nolist;
 		lopt->yeslist = yeslist;
 
+		/*
+		 * Pick where to look: a single mask like #foo* only needs the
+		 * channels starting with #foo, a user count limit only those
+		 * with that many users, otherwise go through them all by name.
+		 */
+		lopt->index = CHANDIR_BYNAME;
+		if (yeslist && !yeslist->next)
+		{
+			strlcpy(lopt->prefix, yeslist->value.cp, sizeof(lopt->prefix));
+			lopt->prefix[strcspn(lopt->prefix, "*?\\")] = '\0';
+		}
+		if (!*lopt->prefix && (usermin > 1 || usermax >= 0))
+			lopt->index = CHANDIR_BYUSERS;
+
 		if (DBufLength(&cptr->sendQ) < 2048)
 			send_list(cptr, 64);
 		return 0;
@@ -293,28 +308,107 @@ DLLFUNC CMD_FUNC(m_list)
 }
 /*
  * The function which sends the actual channel list back to the user.
- * Operates by stepping through the hashtable, sending the entries back if
- * they match the criteria.
+ * Operates by walking the channel directory (see chandir.c) in the
+ * order picked by m_list, sending the entries back if they match the
+ * criteria.
  * cptr = Local client to send the output back to.
- * numsend = Number (roughly) of lines to send back. Once this number has
- * been exceeded, send_list will finish with the current hash bucket,
- * and record that number as the number to start next time send_list
- * is called for this user. So, this function will almost always send
- * back more lines than specified by numsend (though not by much,
- * assuming CH_MAX is was well picked). So be conservative in your choice
- * of numsend. -Rak
+ * numsend = Number of lines to send back. Once this number has been
+ * reached, send_list remembers the last channel it looked at and
+ * continues after it the next time it is called for this user, so
+ * channels created or removed in between don't upset it.
  */
 
 /* Taken from bahamut, modified for Unreal by codemastr */
 
+struct list_ctx {
+	aClient *cptr;
+	LOpts *lopt;
+	int  numsend;
+};
+
+static void send_list_channel(aChannel *chptr, struct list_ctx *ctx)
+{
+	aClient *cptr = ctx->cptr;
+	LOpts *lopt = ctx->lopt;
+
+	if (SecretChannel(chptr)
+	    && !IsMember(cptr, chptr)
+	    && !OPCanSeeSecret(cptr))
+		return;
+
+	/* Much more readable like this -- codemastr */
+	if ((!lopt->showall))
+	{
+		/* User count must be in range */
+		if ((chptr->users < lopt->usermin) || 
+		    ((lopt->usermax >= 0) && (chptr->users > 
+		    lopt->usermax)))
+			return;
+
+		/* Creation time must be in range */
+		if ((chptr->creationtime && (chptr->creationtime <
+		    lopt->chantimemin)) || (chptr->creationtime >
+		    lopt->chantimemax))
+			return;
+
+		/* Topic time must be in range */
+		if ((chptr->topic_time < lopt->topictimemin) ||
+		    (chptr->topic_time > lopt->topictimemax))
+			return;
+
+		/* Must not be on nolist (if it exists) */
+		if (lopt->nolist && find_str_match_link(lopt->nolist,
+		    chptr->chname))
+			return;
+
+		/* Must be on yeslist (if it exists) */
+		if (lopt->yeslist && !find_str_match_link(lopt->yeslist,
+		    chptr->chname))
+			return;
+	}
+#ifdef LIST_SHOW_MODES
+	modebuf[0] = '[';
+	channel_modes(cptr, modebuf+1, parabuf, sizeof(modebuf)-1, sizeof(parabuf), chptr);
+	if (modebuf[2] == '\0')
+		modebuf[0] = '\0';
+	else
+		strlcat(modebuf, "]", sizeof modebuf);
+#endif
+	if (!OPCanSeeSecret(cptr))
+		sendto_one(cptr,
+		    rpl_str(RPL_LIST), me.name,
+		    cptr->name,
+		    ShowChannel(cptr,
+		    chptr) ? chptr->chname :
+		    "*", chptr->users,
+#ifdef LIST_SHOW_MODES
+		    ShowChannel(cptr, chptr) ?
+		    modebuf : "",
+#endif
+		    ShowChannel(cptr,
+		    chptr) ? (chptr->topic ?
+		    chptr->topic : "") : "");
+	else
+		sendto_one(cptr,
+		    rpl_str(RPL_LIST), me.name,
+		    cptr->name, chptr->chname,
+		    chptr->users,
+#ifdef LIST_SHOW_MODES
+		    modebuf,
+#endif					    
+		    (chptr->topic ? chptr->topic : ""));
+	ctx->numsend--;
+}
+
 void _send_list(aClient *cptr, int numsend)
 {
-	aChannel *chptr;
 	LOpts *lopt = cptr->user->lopt;
-	unsigned int  hashnum;
+	struct list_ctx ctx;
+	aChannel *chptr;
+	size_t prefixlen = strlen(lopt->prefix);
 
 	/* Begin of /list? then send official channels. */
-	if ((lopt->starthash == 0) && conf_offchans)
+	if (!lopt->started && conf_offchans)
 	{
 		ConfigItem_offchans *x;
 		for (x = conf_offchans; x; x = (ConfigItem_offchans *)x->next)
@@ -332,87 +426,42 @@ void _send_list(aClient *cptr, int numsend)
 		}
 	}
 
-	for (hashnum = lopt->starthash; hashnum < CH_MAX; hashnum++)
+	ctx.cptr = cptr;
+	ctx.lopt = lopt;
+	ctx.numsend = numsend;
+
+	if (!lopt->started)
 	{
-		if (numsend > 0)
-			for (chptr =
-			    (aChannel *)hash_get_chan_bucket(hashnum);
-			    chptr; chptr = chptr->hnextch)
-			{
-				if (SecretChannel(chptr)
-				    && !IsMember(cptr, chptr)
-				    && !OPCanSeeSecret(cptr))
-					continue;
-
-				/* Much more readable like this -- codemastr */
-				if ((!lopt->showall))
-				{
-					/* User count must be in range */
-					if ((chptr->users < lopt->usermin) || 
-					    ((lopt->usermax >= 0) && (chptr->users > 
-					    lopt->usermax)))
-						continue;
-
-					/* Creation time must be in range */
-					if ((chptr->creationtime && (chptr->creationtime <
-					    lopt->chantimemin)) || (chptr->creationtime >
-					    lopt->chantimemax))
-						continue;
-
-					/* Topic time must be in range */
-					if ((chptr->topic_time < lopt->topictimemin) ||
-					    (chptr->topic_time > lopt->topictimemax))
-						continue;
-
-					/* Must not be on nolist (if it exists) */
-					if (lopt->nolist && find_str_match_link(lopt->nolist,
-					    chptr->chname))
-						continue;
-
-					/* Must be on yeslist (if it exists) */
-					if (lopt->yeslist && !find_str_match_link(lopt->yeslist,
-					    chptr->chname))
-						continue;
-				}
-#ifdef LIST_SHOW_MODES
-				modebuf[0] = '[';
-				channel_modes(cptr, modebuf+1, parabuf, sizeof(modebuf)-1, sizeof(parabuf), chptr);
-				if (modebuf[2] == '\0')
-					modebuf[0] = '\0';
-				else
-					strlcat(modebuf, "]", sizeof modebuf);
-#endif
-				if (!OPCanSeeSecret(cptr))
-					sendto_one(cptr,
-					    rpl_str(RPL_LIST), me.name,
-					    cptr->name,
-					    ShowChannel(cptr,
-					    chptr) ? chptr->chname :
-					    "*", chptr->users,
-#ifdef LIST_SHOW_MODES
-					    ShowChannel(cptr, chptr) ?
-					    modebuf : "",
-#endif
-					    ShowChannel(cptr,
-					    chptr) ? (chptr->topic ?
-					    chptr->topic : "") : "");
-				else
-					sendto_one(cptr,
-					    rpl_str(RPL_LIST), me.name,
-					    cptr->name, chptr->chname,
-					    chptr->users,
-#ifdef LIST_SHOW_MODES
-					    modebuf,
-#endif					    
-					    (chptr->topic ? chptr->topic : ""));
-				numsend--;
-			}
+		lopt->started = 1;
+		if (lopt->index == CHANDIR_BYUSERS)
+			chptr = chandir_find(CHANDIR_BYUSERS,
+			    (lopt->usermax >= 0 && lopt->usermax < USHRT_MAX) ?
+			    lopt->usermax : USHRT_MAX, "", 0);
 		else
+			chptr = chandir_find(CHANDIR_BYNAME, 0, lopt->prefix, 0);
+	} else
+		chptr = chandir_find(lopt->index, lopt->lastusers, lopt->lastname, 1);
+
+	for (; chptr && ctx.numsend > 0; chptr = chandir_next(lopt->index, chptr))
+	{
+		/* Past the wanted range? */
+		if (lopt->index == CHANDIR_BYUSERS && chptr->users < lopt->usermin)
+		{
+			chptr = NULL;
 			break;
+		}
+		if (prefixlen && strncasecmp(chptr->chname, lopt->prefix, prefixlen))
+		{
+			chptr = NULL;
+			break;
+		}
+		send_list_channel(chptr, &ctx);
+		lopt->lastusers = chptr->users;
+		strlcpy(lopt->lastname, chptr->chname, sizeof(lopt->lastname));
 	}
 
 	/* All done */
-	if (hashnum == CH_MAX)
+	if (!chptr)
 	{
 		sendto_one(cptr, rpl_str(RPL_LISTEND), me.name, cptr->name);
 		free_str_list(cptr->user->lopt->yeslist);
@@ -424,8 +473,8 @@ void _send_list(aClient *cptr, int numsend)
 
 	/* 
 	 * We've exceeded the limit on the number of channels to send back
-	 * at once.
+	 * at once, lastusers/lastname say where to continue once the
+	 * client has taken this batch.
 	 */
-	lopt->starthash = hashnum;
-	return;
+	send_queued_wait(cptr);
 }
@@ -163,10 +163,14 @@ int ret;
 				return ret;
 		}
 
-		for (tmphook = Hooks[HOOKTYPE_USERMSG]; tmphook; tmphook = tmphook->next) {
-			*text = (*(tmphook->func.pcharfunc))(cptr, sptr, acptr, *text, notice);
-			if (!*text)
-				break;
+		{
+			HOOKSTAT_BEGIN(HOOKTYPE_USERMSG);
+			for (tmphook = Hooks[HOOKTYPE_USERMSG]; tmphook; tmphook = tmphook->next) {
+				*text = (*(tmphook->func.pcharfunc))(cptr, sptr, acptr, *text, notice);
+				if (!*text)
+					break;
+			}
+			HOOKSTAT_END(HOOKTYPE_USERMSG);
 		}
 		if (!*text)
 			return CANPRIVMSG_CONTINUE;
@@ -193,7 +197,24 @@ int ret;
 */
 
 static int recursive_webtv = 0;
+static int do_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int notice);
+
+/* Everything looking at the text of this message shares one MessageText */
 DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int notice)
+{
+	MessageText mt, *prev;
+	int ret;
+
+	if (parc < 3 || !parv[2])
+		return do_message(cptr, sptr, parc, parv, notice);
+
+	prev = msgtext_enter(&mt, parv[2]);
+	ret = do_message(cptr, sptr, parc, parv, notice);
+	msgtext_restore(prev);
+	return ret;
+}
+
+static int do_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int notice)
 {
 	aClient *acptr, *srvptr;
 	char *s;
@@ -392,7 +413,7 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 				sendanyways = (strchr(CHANCMDPFX,parv[2][0]) ? 1 : 0);
 				text = parv[2];
 				if (MyClient(sptr) && (chptr->mode.mode & MODE_STRIP))
-					text = StripColors(parv[2]);
+					text = msgtext_nocolors(msgtext_for(parv[2]));
 
 				if (MyClient(sptr))
 				{
@@ -401,10 +422,14 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 						return ret;
 				}
 
-				for (tmphook = Hooks[HOOKTYPE_CHANMSG]; tmphook; tmphook = tmphook->next) {
-					text = (*(tmphook->func.pcharfunc))(cptr, sptr, chptr, text, notice);
-					if (!text)
-						break;
+				{
+					HOOKSTAT_BEGIN(HOOKTYPE_CHANMSG);
+					for (tmphook = Hooks[HOOKTYPE_CHANMSG]; tmphook; tmphook = tmphook->next) {
+						text = (*(tmphook->func.pcharfunc))(cptr, sptr, chptr, text, notice);
+						if (!text)
+							break;
+					}
+					HOOKSTAT_END(HOOKTYPE_CHANMSG);
 				}
 				
 				if (!text)
@@ -560,42 +585,25 @@ DLLFUNC int  m_notice(aClient *cptr, aClient *sptr, int parc, char *parv[])
 int _is_silenced(aClient *sptr, aClient *acptr)
 {
 	Link *lp;
-	anUser *user;
-	static char sender[HOSTLEN + NICKLEN + USERLEN + 5];
-	static char senderx[HOSTLEN + NICKLEN + USERLEN + 5];
-	char checkv = 0;
-	
-	if (!(acptr->user) || !(lp = acptr->user->silence) ||
-	    !(user = sptr->user)) return 0;
 
-	ircsnprintf(sender, sizeof(sender), "%s!%s@%s", sptr->name, user->username,
-	    user->realhost);
+	if (!(acptr->user) || !acptr->user->silence || !sptr->user)
+		return 0;
+
 	/* We also check for matches against sptr->user->virthost if present,
 	 * this is checked regardless of mode +x so you can't do tricks like:
 	 * evil has +x and msgs, victim places silence on +x host, evil does -x
 	 * and can msg again. -- Syzop
 	 */
-	if (sptr->user->virthost)
-	{
-		ircsnprintf(senderx, sizeof(senderx), "%s!%s@%s", sptr->name, user->username,
-		    sptr->user->virthost);
-		checkv = 1;
-	}
+	if (!(lp = find_silence(acptr, sptr)))
+		return 0;
 
-	for (; lp; lp = lp->next)
+	if (!MyConnect(sptr))
 	{
-		if (!match(lp->value.cp, sender) || (checkv && !match(lp->value.cp, senderx)))
-		{
-			if (!MyConnect(sptr))
-			{
-				sendto_one(sptr->from, ":%s SILENCE %s :%s",
-				    acptr->name, sptr->name, lp->value.cp);
-				lp->flags = 1;
-			}
-			return 1;
-		}
+		sendto_one(sptr->from, ":%s SILENCE %s :%s",
+		    acptr->name, sptr->name, lp->value.cp);
+		lp->flags = 1;
 	}
-	return 0;
+	return 1;
 }
 
 /** Make a viewable dcc filename.
@@ -2258,6 +2258,7 @@ DLLFUNC CMD_FUNC(_m_umode)
 			sptr->user->virthost = NULL;
 		}
 		sptr->user->virthost = strdup(sptr->user->cloakedhost);
+		userindex_update(sptr);
 		if (!dontspread)
 			sendto_server(cptr, PROTO_VHP, 0, ":%s SETHOST :%s",
 				sptr->name, sptr->user->virthost);
@@ -2291,6 +2292,7 @@ DLLFUNC CMD_FUNC(_m_umode)
 		 * been a vhost for example. -- Syzop
 		 */
 		sptr->user->virthost = strdup(sptr->user->cloakedhost);
+		userindex_update(sptr);
 	}
 	/*
 	 * If I understand what this code is doing correctly...
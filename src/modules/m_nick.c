@@ -1058,6 +1058,7 @@ DLLFUNC CMD_FUNC(m_nick)
 
 	(void)strcpy(sptr->name, nick);
 	(void)add_to_client_hash_table(nick, sptr);
+	userindex_update(sptr);
 	if (IsServer(cptr) && parc > 7)
 	{
 		parv[3] = nick;
@@ -1462,6 +1463,7 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 			sptr->user->ip_str = strdup(decode_ip(ip));
 	}
 
+	userindex_add(sptr);
 	hash_check_watch(sptr, RPL_LOGON);	/* Uglier hack */
 	send_umode(NULL, sptr, 0, SEND_UMODES|UMODE_SERVNOTICE, buf);
 
@@ -291,6 +291,7 @@ DLLFUNC int  m_oper(aClient *cptr, aClient *sptr, int parc, char *parv[]) {
 		if (IsHidden(sptr) && !sptr->user->virthost) {
 			/* +x has just been set by modes-on-oper and iNAH is off */
 			sptr->user->virthost = strdup(sptr->user->cloakedhost);
+			userindex_update(sptr);
 		}
 
 		if (!IsOper(sptr))
@@ -302,6 +303,7 @@ DLLFUNC int  m_oper(aClient *cptr, aClient *sptr, int parc, char *parv[]) {
 			if (IsHidden(sptr) && !sptr->user->virthost) {
 				 /* +x has just been set by modes-on-oper and iNAH is off */
 				  sptr->user->virthost = strdup(sptr->user->cloakedhost);
+				  userindex_update(sptr);
 			}
 			sendto_snomask(SNO_OPER, "%s (%s@%s) is now a local operator (o)",
 				       parv[0], sptr->user->username, sptr->sockhost);
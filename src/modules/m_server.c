@@ -331,6 +331,10 @@ DLLFUNC CMD_FUNC(m_server)
 		    "This port is for clients only");
 	}
 
+	/* Server links live on the main thread, see set::io-threads */
+	if (IsIOThread(cptr))
+		ioth_release(cptr, NULL);
+
 	/* Now, let us take a look at the parameters we got
 	 * Passes here:
 	 *    Check for bogus server name
@@ -485,6 +489,7 @@ DLLFUNC CMD_FUNC(m_server)
 
 		ircsnprintf(descbuf, sizeof descbuf, "Server: %s", servername);
 		fd_desc(cptr->fd, descbuf);
+		fd_settype(cptr->fd, FD_TYPE_SERVER);
 
 		/* Start synch now */
 		if (m_server_synch(cptr, aconf) == FLUSH_BUFFER)
@@ -687,6 +692,9 @@ int	m_server_synch(aClient *cptr, ConfigItem_link *aconf)
 	}
 	cptr->serv->conf->class->clients++;
 	cptr->class = cptr->serv->conf->class;
+	if (incoming)
+		set_class_sock_opts(cptr, cptr->class, cptr->serv->conf); /* outgoing: done in connect_server() */
+	burst_begin(cptr);
 	RunHook(HOOKTYPE_SERVER_CONNECT, cptr);
 
 	if (*cptr->id)
@@ -803,6 +811,7 @@ int	m_server_synch(aClient *cptr, ConfigItem_link *aconf)
 	ircd_log(LOG_ERROR, "[EOSDBG] m_server_synch: sending to justlinked '%s' with src ME...",
 			cptr->name);
 #endif
+	burst_end(cptr);
 	RunHook(HOOKTYPE_POST_SERVER_CONNECT, cptr);
 	return 0;
 }
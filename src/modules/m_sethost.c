@@ -214,6 +214,7 @@ DLLFUNC int m_sethost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			sptr->user->virthost = NULL;
 		}
 		sptr->user->virthost = strdup(vhost);
+		userindex_update(sptr);
 		/* spread it out */
 		sendto_server(cptr, 0, 0, ":%s SETHOST %s", sptr->name, parv[1]);
 
@@ -206,6 +206,7 @@ DLLFUNC int m_setident(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 		/* get it in */
 		ircsnprintf(sptr->user->username, sizeof(sptr->user->username), "%s", vident);
+		userindex_update(sptr);
 		/* spread it out */
 		sendto_server(cptr, 0, 0, ":%s SETIDENT %s", sptr->name, parv[1]);
 
@@ -40,6 +40,25 @@
 
 DLLFUNC int m_sjoin(aClient *cptr, aClient *sptr, int parc, char *parv[]);
 
+/*
+ * Scratch space reused by every SJOIN: the local members of the channel
+ * (the only ones that need to see the JOINs and MODEs, so we find them
+ * once instead of walking the whole member list for every line) and an
+ * open addressing hash set of everyone on the channel, so checking
+ * whether an incoming nick is already there does not walk its
+ * membership list.
+ * A burst sends a big channel as many SJOIN lines in a row, so both are
+ * kept for the next line as long as it is for the same channel and
+ * nobody joined or left anywhere but through the SJOIN itself
+ * (channel_member_changes tells).
+ */
+static aClient **sjoin_local = NULL;
+static int sjoin_local_max = 0, sjoin_nlocal = 0;
+static aClient **sjoin_members = NULL;
+static unsigned int sjoin_members_max = 0, sjoin_members_mask = 0;
+static aChannel *sjoin_chptr = NULL;
+static unsigned long sjoin_changes = 0;
+
 #define MSG_SJOIN 	"SJOIN"	
 
 ModuleHeader MOD_HEADER(m_sjoin)
@@ -65,6 +84,11 @@ DLLFUNC int MOD_LOAD(m_sjoin)(int module_load)
 
 DLLFUNC int MOD_UNLOAD(m_sjoin)(int module_unload)
 {
+	if (sjoin_local)
+		MyFree(sjoin_local);
+	if (sjoin_members)
+		MyFree(sjoin_members);
+	sjoin_chptr = NULL;
 	return MOD_SUCCESS;
 }
 
@@ -109,6 +133,63 @@ static int compare_floodprot_modes(ChanFloodProt *a, ChanFloodProt *b)
 		return 0;
 }
 
+#define sjoin_hash(p)	((unsigned int)(((unsigned long)(p) >> 4) * 2654435761U))
+
+static int sjoin_is_member(aClient *acptr)
+{
+	unsigned int i;
+
+	for (i = sjoin_hash(acptr) & sjoin_members_mask; sjoin_members[i];
+	    i = (i + 1) & sjoin_members_mask)
+		if (sjoin_members[i] == acptr)
+			return 1;
+	return 0;
+}
+
+static void sjoin_add_member(aClient *acptr)
+{
+	unsigned int i;
+
+	for (i = sjoin_hash(acptr) & sjoin_members_mask; sjoin_members[i];
+	    i = (i + 1) & sjoin_members_mask)
+		if (sjoin_members[i] == acptr)
+			return;
+	sjoin_members[i] = acptr;
+}
+
+/*
+ * Set up the local member list and the member set for a channel that is
+ * about to get (at most) incoming new members, reusing what the previous
+ * SJOIN left if it is still good. The set is kept at most half full.
+ * Returns the number of local members.
+ */
+static int sjoin_setup(aChannel *chptr, int incoming)
+{
+	Member *lp;
+	unsigned int size = 64;
+
+	while (size < 2 * ((unsigned int)chptr->users + incoming))
+		size <<= 1;
+	if ((chptr == sjoin_chptr) && (sjoin_changes == channel_member_changes) &&
+	    (size <= sjoin_members_mask + 1))
+		return sjoin_nlocal;
+	if (size > sjoin_members_max)
+	{
+		if (sjoin_members)
+			MyFree(sjoin_members);
+		sjoin_members = MyMalloc(sizeof(aClient *) * size);
+		sjoin_members_max = size;
+	}
+	sjoin_members_mask = size - 1;
+	memset(sjoin_members, 0, sizeof(aClient *) * size);
+	for (lp = chptr->members; lp; lp = lp->next)
+		sjoin_add_member(lp->cptr);
+	sjoin_nlocal = channel_local_members(chptr, &sjoin_local, &sjoin_local_max);
+	sjoin_chptr = chptr;
+	sjoin_changes = channel_member_changes;
+	return sjoin_nlocal;
+}
+
 /*
    **      m_sjoin  
    **
@@ -140,7 +221,7 @@ static int compare_floodprot_modes(ChanFloodProt *a, ChanFloodProt *b)
  */
 
 /* Some ugly macros, but useful */
-#define Addit(mode,param) if ((strlen(parabuf) + strlen(param) + 11 < MODEBUFLEN) && (b <= MAXMODEPARAMS)) { \
+#define Addit(mode,param) if ((strlen(parabuf) + strlen(param) + modelinelen < BUFSIZE) && (b <= MAXMODEPARAMS)) { \
 	if (*parabuf) \
 		strcat(parabuf, " ");\
 	strcat(parabuf, param);\
@@ -150,7 +231,7 @@ static int compare_floodprot_modes(ChanFloodProt *a, ChanFloodProt *b)
 else {\
 	sendto_server(cptr, 0, PROTO_SJOIN, ":%s MODE %s %s %s %lu", sptr->name, chptr->chname,\
 		modebuf, parabuf, chptr->creationtime); \
-	sendto_channel_butserv(chptr, sptr, ":%s MODE %s %s %s", sptr->name, chptr->chname,\
+	sendto_local_members(sjoin_local, nlocal, sptr, ":%s MODE %s %s %s", sptr->name, chptr->chname,\
 		modebuf, parabuf);\
 	strcpy(parabuf,param);\
 	/* modebuf[0] should stay what it was ('+' or '-') */ \
@@ -191,6 +272,7 @@ CMD_FUNC(m_sjoin)
 	Membership *lp2;
 	aParv *ap;
 	int pcount, i, f;
+	int nlocal, modelinelen;
 	time_t ts, oldts;
 	unsigned short b=0,c;
 	Mode oldmode;
@@ -228,6 +310,14 @@ CMD_FUNC(m_sjoin)
 			nomode = 1;
 	}
 	chptr = get_channel(cptr, parv[2], CREATE);
+	for (i = 0, t = parv[parc - 1]; *t; t++)
+		if (*t == ' ')
+			i++;
+	nlocal = sjoin_setup(chptr, i + 1);
+	/* MODE lines are filled up to MAXMODEPARAMS or the line length:
+	 * ":<server> MODE <channel> <modes> <params> <ts>\r\n"
+	 */
+	modelinelen = strlen(sptr->name) + strlen(chptr->chname) + MAXMODEPARAMS + 24;
 
 	ts = (time_t)atol(parv[1]);
 
@@ -477,7 +567,7 @@ CMD_FUNC(m_sjoin)
 			}
 			if (acptr->from != sptr->from)
 			{
-				if (IsMember(acptr, chptr))
+				if (sjoin_is_member(acptr))
 				{
 					/* Nick collision, don't kick or it desynchs -Griever*/
 					continue;
@@ -505,8 +595,10 @@ CMD_FUNC(m_sjoin)
 			 * locally (dont send a join to the chan) but propagate it to the other servers.
 			 * I'm not sure if the propagation is needed however -- Syzop.
 			 */
-			if (!IsMember(acptr, chptr)) {
+			if (!sjoin_is_member(acptr)) {
 				add_user_to_channel(chptr, acptr, modeflags);
+				sjoin_add_member(acptr);
+				sjoin_changes = channel_member_changes;
 				RunHook4(HOOKTYPE_REMOTE_JOIN, cptr, acptr, chptr, NULL);
 				if (chptr->mode.mode & MODE_AUDITORIUM)
 				{
@@ -516,7 +608,7 @@ CMD_FUNC(m_sjoin)
 						sendto_chanops_butone(NULL, chptr, ":%s!%s@%s JOIN :%s",
 							acptr->name, acptr->user->username, GetHost(acptr), chptr->chname);
 				} else
-					sendto_channel_butserv(chptr, acptr, ":%s JOIN :%s", nick, chptr->chname);
+					sendto_local_members(sjoin_local, nlocal, acptr, ":%s JOIN :%s", nick, chptr->chname);
 
 				if (chptr->mode.floodprot && sptr->serv->flags.synced && !IsULine(sptr))
 				        do_chanflood(chptr->mode.floodprot, FLD_JOIN);
@@ -616,7 +708,7 @@ CMD_FUNC(m_sjoin)
 		    ":%s MODE %s %s %s %lu",
 		    sptr->name, chptr->chname, modebuf, parabuf,
 		    chptr->creationtime);
-		sendto_channel_butserv(chptr, sptr, ":%s MODE %s %s %s",
+		sendto_local_members(sjoin_local, nlocal, sptr, ":%s MODE %s %s %s",
 		    sptr->name, chptr->chname, modebuf, parabuf);
 	}
 	
@@ -640,7 +732,10 @@ CMD_FUNC(m_sjoin)
 		sendto_channel_butserv(chptr, sptr, ":%s MODE %s %s %s",
 		    sptr->name, chptr->chname, modebuf, paraback);
 		if (chptr->mode.mode & MODE_ONLYSECURE)
+		{
 			kick_insecure_users(chptr);
+			nlocal = sjoin_setup(chptr, 0);
+		}
 	}
 	if (merge && !nomode)
 	{
@@ -732,7 +827,10 @@ CMD_FUNC(m_sjoin)
 			queue_c = 1;
 		}
 		if (!(oldmode.mode & MODE_ONLYSECURE) && (chptr->mode.mode & MODE_ONLYSECURE))
+		{
 			kick_insecure_users(chptr);
+			nlocal = sjoin_setup(chptr, 0);
+		}
 		/* Add single char modes... */
 		for (acp = cFlagTab; acp->mode; acp++)
 		{
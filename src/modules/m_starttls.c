@@ -53,6 +53,7 @@ ModuleHeader MOD_HEADER(m_starttls)
     };
 
 static void m_starttls_caplist(struct list_head *head);
+static void starttls_begin(aClient *sptr);
 
 DLLFUNC int MOD_INIT(m_starttls)(ModuleInfo *modinfo)
 {
@@ -98,7 +99,21 @@ DLLFUNC CMD_FUNC(m_starttls)
 		sendto_one(sptr, err_str(ERR_STARTTLS), me.name, !BadPtr(sptr->name) ? sptr->name : "*", "STARTTLS failed. Already using TLS.");
 		return 0;
 	}
-	dbuf_delete(&sptr->recvQ, 1000000); /* Clear up any remaining plaintext commands */
+	DBufClear(&sptr->recvQ); /* Clear up any remaining plaintext commands */
+	if (IsIOThread(sptr))
+	{
+		/* The handshake is done on the main thread, once the
+		 * I/O thread (set::io-threads) let go of the socket.
+		 */
+		ioth_release(sptr, starttls_begin);
+		return 0;
+	}
+	starttls_begin(sptr);
+	return 0;
+}
+
+static void starttls_begin(aClient *sptr)
+{
 	sendto_one(sptr, rpl_str(RPL_STARTTLS), me.name, !BadPtr(sptr->name) ? sptr->name : "*");
 	send_queued(sptr);
 
@@ -109,6 +124,7 @@ DLLFUNC CMD_FUNC(m_starttls)
 	sptr->flags |= FLAGS_SSL;
 	SSL_set_fd(sptr->ssl, sptr->fd);
 	SSL_set_nonblocking(sptr->ssl);
+	ssl_want_ktls(sptr);
 	if (!ircd_SSL_accept(sptr, sptr->fd)) {
 		Debug((DEBUG_DEBUG, "Failed SSL accept handshake in instance 1: %s", sptr->sockhost));
 		SSL_set_shutdown(sptr->ssl, SSL_RECEIVED_SHUTDOWN);
@@ -118,12 +134,11 @@ DLLFUNC CMD_FUNC(m_starttls)
 	}
 
 	/* HANDSHAKE IN PROGRESS */
-	return 0;
+	return;
 fail:
 	/* Failure */
 	sendto_one(sptr, err_str(ERR_STARTTLS), me.name, !BadPtr(sptr->name) ? sptr->name : "*", "STARTTLS failed");
 	sptr->ssl = NULL;
 	sptr->flags &= ~FLAGS_SSL;
 	SetUnknown(sptr);
-	return 0;
 }
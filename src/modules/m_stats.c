@@ -37,6 +37,7 @@
 #ifdef STRIPBADWORDS
 #include "badwords.h"
 #endif
+#include "mempool.h"
 
 DLLFUNC int m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[]);
 
@@ -107,6 +108,9 @@ int stats_class(aClient *, char *);
 int stats_officialchannels(aClient *, char *);
 int stats_spamfilter(aClient *, char *);
 int stats_fdtable(aClient *, char *);
+int stats_profile(aClient *, char *);
+int stats_eventloop(aClient *, char *);
+int stats_hash(aClient *, char *);
 
 #define SERVER_AS_PARA 0x1
 #define FLAGS_AS_PARA 0x2
@@ -121,6 +125,7 @@ struct statstab {
 /* Must be listed lexicographically */
 /* Long flags must be lowercase */
 struct statstab StatsTable[] = {
+	{ 'A', "hash",		stats_hash,		0		},
 	{ 'B', "banversion",	stats_banversion,	0		},
 	{ 'C', "link", 		stats_links,		0 		},
 	{ 'D', "denylinkall",	stats_denylinkall,	0		},
@@ -157,6 +162,7 @@ struct statstab StatsTable[] = {
 	{ 'm', "command",	stats_command,		0 		},
 	{ 'n', "banrealname",	stats_banrealname,	0 		},
 	{ 'o', "oper",		stats_oper,		0 		},
+	{ 'p', "profile",	stats_profile,		0 		},
 	{ 'q', "bannick",	stats_bannick,		FLAGS_AS_PARA	},
 	{ 'r', "chanrestrict",	stats_chanrestrict,	0 		},
 	{ 's', "shun",		stats_shun,		FLAGS_AS_PARA	},
@@ -165,6 +171,7 @@ struct statstab StatsTable[] = {
 	{ 'v', "denyver",	stats_denyver,		0 		},
 	{ 'x', "notlink",	stats_notlink,		0 		},	
 	{ 'y', "class",		stats_class,		0 		},
+	{ 'z', "eventloop",	stats_eventloop,	0 		},
 	{ 0, 	NULL, 		NULL, 			0		}
 };
 
@@ -215,6 +222,8 @@ inline char *stats_combine_parv(char *p1, char *p2)
 inline void stats_help(aClient *sptr)
 {
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name, "/Stats flags:");
+	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
+		"A - hash - Send hash table sizes, load factors and chain lengths");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
 		"B - banversion - Send the ban version list");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
@@ -261,6 +270,8 @@ inline void stats_help(aClient *sptr)
 		"O - oper - Send the oper block list");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
 		"P - port - Send information about ports");
+	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
+		"p - profile - Send time spent per command and per hook type");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
 		"q - bannick - Send the ban nick block list");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
@@ -302,7 +313,9 @@ inline void stats_help(aClient *sptr)
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
 		"Y - class - Send the class block list");
 	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
-		"Z - mem - Send memory usage information");
+		"z - eventloop - Send event loop timing histograms");
+	sendto_one(sptr, rpl_str(RPL_STATSHELP), me.name, sptr->name,
+		"Z - mem - Send memory usage information, including every memory pool");
 }
 
 inline int stats_operonly_short(char c)
@@ -487,13 +500,14 @@ int stats_links(aClient *sptr, char *para)
 #endif
 	for (link_p = conf_link; link_p; link_p = (ConfigItem_link *) link_p->next)
 	{
-		sendto_one(sptr, ":%s 213 %s C %s@%s * %s %i %s %s%s%s%s%s",
+		sendto_one(sptr, ":%s 213 %s C %s@%s * %s %i %s %s%s%s%s%s%s",
 			me.name, sptr->name, IsOper(sptr) ? link_p->username : "*",
 			IsOper(sptr) ? link_p->hostname : "*", link_p->servername,
 			link_p->port,
 			link_p->class->name,
 			(link_p->options & CONNECT_AUTO) ? "a" : "",
 			(link_p->options & CONNECT_SSL) ? "S" : "",
+			(link_p->options & CONNECT_KTLS) ? "k" : "",
 			(link_p->options & CONNECT_NODNSCACHE) ? "d" : "",
 			(link_p->options & CONNECT_NOHOSTCHECK) ? "h" : "",
 			(link_p->flag.temporary == 1) ? "T" : "");
@@ -630,11 +644,13 @@ static char *stats_port_helper(ConfigItem_listen *listener)
 {
 	static char buf[256];
 
-	ircsnprintf(buf, sizeof(buf), "%s%s%s%s",
+	ircsnprintf(buf, sizeof(buf), "%s%s%s%s%s%s",
 	    (listener->options & LISTENER_CLIENTSONLY)? "clientsonly ": "",
 	    (listener->options & LISTENER_SERVERSONLY)? "serversonly ": "",
 	    (listener->options & LISTENER_JAVACLIENT)?  "java ": "",
-	    (listener->options & LISTENER_SSL)?         "ssl ": "");
+	    (listener->options & LISTENER_SSL)?         "ssl ": "",
+	    (listener->options & LISTENER_KTLS)?        "ktls ": "",
+	    (listener->options & LISTENER_METRICS)?     "metrics ": "");
 	return buf;
 }
 
@@ -674,6 +690,113 @@ int stats_usage(aClient *sptr, char *para)
 	return 0;
 }
 
+/*
+ * One line per command or hooktype that has been run, in a fixed
+ * format so it can be scraped by scripts.  The counters only ever go
+ * up, so compare two snapshots to see where the time went in between:
+ *   command <name> <calls> <usec> <max usec> <bytes in> <bytes out>
+ *   hook <type> <runs> <usec> <max usec>
+ * where <type> is the HOOKTYPE_ name without the prefix (the number if
+ * the type has none).
+ */
+int stats_profile(aClient *sptr, char *para)
+{
+	int i;
+	aCommand *mptr;
+	HookStat *hs;
+	char num[16], *name;
+
+	for (i = 0; i < 256; i++)
+		for (mptr = CommandHash[i]; mptr; mptr = mptr->next)
+			if (mptr->count)
+				sendto_one(sptr, ":%s %d %s :command %s %u %llu %llu %llu %llu",
+				    me.name, RPL_STATSDEBUG, sptr->name, mptr->cmd, mptr->count,
+				    mptr->nsecs / 1000, mptr->maxnsecs / 1000,
+				    (unsigned long long)mptr->bytes, mptr->sentbytes);
+
+	for (i = 0; i < MAXHOOKTYPES; i++)
+	{
+		hs = &HookStats[i];
+		if (!hs->count)
+			continue;
+		if (!(name = hooktype_name(i)))
+		{
+			ircsnprintf(num, sizeof(num), "%d", i);
+			name = num;
+		}
+		sendto_one(sptr, ":%s %d %s :hook %s %llu %llu %llu",
+		    me.name, RPL_STATSDEBUG, sptr->name, name, (unsigned long long)hs->count,
+		    hs->nsecs / 1000, hs->maxnsecs / 1000);
+	}
+	return 0;
+}
+
+static void stats_loophist(aClient *sptr, char *name, LoopHistogram *hist)
+{
+	char buf[BUFSIZE], *p = buf;
+	int i, last;
+
+	for (last = LOOPHIST_BUCKETS - 1; last > 0 && !hist->bucket[last]; last--)
+		;
+	*p = '\0';
+	for (i = 0; i <= last; i++)
+	{
+		ircsnprintf(p, sizeof(buf) - (p - buf), " %llu", (unsigned long long)hist->bucket[i]);
+		p += strlen(p);
+	}
+	sendto_one(sptr, ":%s %d %s :%s %llu %llu %llu%s",
+	    me.name, RPL_STATSDEBUG, sptr->name, name,
+	    (unsigned long long)hist->count, hist->sum, hist->max, buf);
+}
+
+/*
+ * Event loop histograms, one per line:
+ *   <name> <count> <sum> <max> <bucket 0> <bucket 1> ...
+ * Bucket 0 holds zeroes, bucket i values in [2^(i-1), 2^i).  All
+ * values are in microseconds except for "ready" which counts fds.
+ */
+int stats_eventloop(aClient *sptr, char *para)
+{
+	static char *typenames[FD_TYPE_MAX] = {
+		"callback_other", "callback_listener", "callback_client",
+		"callback_server", "callback_dns", "callback_ident"
+	};
+	int i;
+
+	stats_loophist(sptr, "iteration", &loopstats.iteration);
+	stats_loophist(sptr, "wait", &loopstats.wait);
+	stats_loophist(sptr, "ready", &loopstats.ready);
+	stats_loophist(sptr, "events", &loopstats.events);
+	for (i = 0; i < FD_TYPE_MAX; i++)
+		stats_loophist(sptr, typenames[i], &loopstats.callback[i]);
+	stats_iothreads(sptr);
+	stats_intake(sptr);
+	return 0;
+}
+
+/*
+ * Client, ID and channel hash tables. Load is entries per 100 buckets,
+ * used is the number of non-empty buckets.
+ */
+int stats_hash(aClient *sptr, char *para)
+{
+	HashTable **ht;
+	unsigned int buckets, used, longest;
+
+	for (ht = hashtables; *ht; ht++)
+	{
+		buckets = (*ht)->size[0] + (*ht)->size[1];
+		hashtable_chainstats(*ht, &used, &longest);
+		sendto_one(sptr, ":%s %d %s :%s buckets %u entries %u load %u used %u longest %u resizes %llu%s",
+		    me.name, RPL_STATSDEBUG, sptr->name, (*ht)->name,
+		    buckets, (*ht)->count,
+		    (unsigned int)((unsigned long long)(*ht)->count * 100 / buckets),
+		    used, longest, (unsigned long long)(*ht)->resizes,
+		    (*ht)->rehashidx != -1 ? " (resizing)" : "");
+	}
+	return 0;
+}
+
 int stats_traffic(aClient *sptr, char *para)
 {
 	aClient *acptr;
@@ -741,6 +864,8 @@ int stats_traffic(aClient *sptr, char *para)
 	    me.name, RPL_STATSDEBUG, sptr->name, sp->is_num, sp->is_fake);
 	sendto_one(sptr, ":%s %d %s :auth successes %u fails %u",
 	    me.name, RPL_STATSDEBUG, sptr->name, sp->is_asuc, sp->is_abad);
+	sendto_one(sptr, ":%s %d %s :auth skipped cached %u busy %u",
+	    me.name, RPL_STATSDEBUG, sptr->name, sp->is_acache, sp->is_abusy);
 	sendto_one(sptr, ":%s %d %s :local connections %u udp packets %u",
 	    me.name, RPL_STATSDEBUG, sptr->name, sp->is_loc, sp->is_udp);
 	sendto_one(sptr, ":%s %d %s :Client Server",
@@ -755,6 +880,21 @@ int stats_traffic(aClient *sptr, char *para)
 	    sp->is_ckr, sp->is_cbr, sp->is_skr, sp->is_sbr);
 	sendto_one(sptr, ":%s %d %s :time connected %ld %ld",
 	    me.name, RPL_STATSDEBUG, sptr->name, sp->is_cti, sp->is_sti);
+	{
+		unsigned int total = sp->is_sslfull + sp->is_sslresumed;
+		TS keytime;
+		int keys = ssl_ticket_keys_info(&keytime);
+
+		sendto_one(sptr, ":%s %d %s :ssl handshakes %u resumed %u (%u%%) tickets %u",
+		    me.name, RPL_STATSDEBUG, sptr->name, total, sp->is_sslresumed,
+		    total ? sp->is_sslresumed * 100 / total : 0, sp->is_sslticket);
+		sendto_one(sptr, ":%s %d %s :ssl session cache %ld/%d ticket keys %d (current one is %ld seconds old)",
+		    me.name, RPL_STATSDEBUG, sptr->name,
+		    ctx_server ? SSL_CTX_sess_number(ctx_server) : 0L, iConf.ssl_session_cache_size,
+		    keys, keys ? (long)(TStime() - keytime) : 0L);
+		sendto_one(sptr, ":%s %d %s :ssl ktls %u fallback %u",
+		    me.name, RPL_STATSDEBUG, sptr->name, sp->is_sslktls, sp->is_sslktlsfail);
+	}
 
 	return 0;
 }
@@ -803,14 +943,16 @@ int stats_vhost(aClient *sptr, char *para)
 
 int stats_mem(aClient *sptr, char *para)
 {
-	extern MODVAR int flinks;
-	extern MODVAR Link *freelink;
 	extern MODVAR MemoryInfo StatsZ;
 
 	aClient *acptr;
 	Ban *ban;
 	Link *link;
 	aChannel *chptr;
+	HashTable **ht;
+	unsigned int hb;
+	mp_pool_t *pool;
+	uint64_t pu, pa;
 
 	int  lc = 0,		/* local clients */
 	     ch = 0,		/* channels */
@@ -820,15 +962,15 @@ int stats_mem(aClient *sptr, char *para)
 	     chu = 0,		/* channel users */
 	     chi = 0,		/* channel invites */
 	     chb = 0,		/* channel bans */
-	     wwu = 0,		/* whowas users */
-	     fl = 0,		/* free links */
+	     wwu = 0,		/* whowas entries */
+	     cdn = 0,		/* channel directory nodes */
+	     uin = 0,		/* user index nodes */
 	     cl = 0,		/* classes */
 	     co = 0;		/* conf lines */
 
 	int  usi = 0,		/* users invited */
 	     usc = 0,		/* users in channels */
 	     aw = 0,		/* aways set */
-	     wwa = 0,		/* whowas aways */
 	     wlh = 0,		/* watchlist headers */
 	     wle = 0;		/* watchlist entries */
 
@@ -837,12 +979,16 @@ int stats_mem(aClient *sptr, char *para)
 	     lcm = 0,		/* memory used by local clients */
 	     rcm = 0,		/* memory used by remote clients */
 	     awm = 0,		/* memory used by aways */
-	     wwam = 0,		/* whowas away memory used */
-	     wwm = 0,		/* whowas array memory used */
+	     wwum = 0,		/* whowas arena memory used */
+	     wwm = 0,		/* whowas arena and hash memory */
+	     cdm = 0,		/* channel directory memory */
+	     uim = 0,		/* user index memory */
 	     com = 0,		/* memory used by conf lines */
 	     wlhm = 0,		/* watchlist memory used */
 	     db = 0,		/* memory used by dbufs */
 	     rm = 0,		/* res memory used */
+	     hm = 0,		/* hash table memory used */
+	     pf = 0,		/* memory held free by the pools */
 	     totcl = 0, totch = 0, totww = 0, tot = 0;
 
 	if (!IsAnOper(sptr))
@@ -851,9 +997,10 @@ int stats_mem(aClient *sptr, char *para)
 		return 0;
 	}
 
-	count_whowas_memory(&wwu, &wwam);
+	count_whowas_memory(&wwu, &wwum, &wwm);
+	count_chandir_memory(&cdn, &cdm);
+	count_userindex_memory(&uin, &uim);
 	count_watch_memory(&wlh, &wlhm);
-	wwm = sizeof(aName) * NICKNAMEHISTORYLENGTH;
 
 	list_for_each_entry(acptr, &client_list, client_node)
 	{
@@ -928,10 +1075,12 @@ int stats_mem(aClient *sptr, char *para)
 	    me.name, RPL_STATSDEBUG, sptr->name, wlh, wlhm, wle, (long)(wle * sizeof(Link)));
 	sendto_one(sptr, ":%s %d %s :Attached confs %d(%ld)",
 	    me.name, RPL_STATSDEBUG, sptr->name, lcc, (long)(lcc * sizeof(Link)));
+	sendto_one(sptr, ":%s %d %s :User index %d(%ld)",
+	    me.name, RPL_STATSDEBUG, sptr->name, uin, uim);
 
 	totcl = lcm + rcm + us * sizeof(anUser) + usc * sizeof(Link) + awm;
 	totcl += lcc * sizeof(Link) + usi * sizeof(Link) + wlhm;
-	totcl += wle * sizeof(Link);
+	totcl += wle * sizeof(Link) + uim;
 
 	sendto_one(sptr, ":%s %d %s :Conflines %d(%ld)",
 	    me.name, RPL_STATSDEBUG, sptr->name, co, com);
@@ -945,38 +1094,48 @@ int stats_mem(aClient *sptr, char *para)
 	    me.name, RPL_STATSDEBUG, sptr->name, chu, (long)(chu * sizeof(Link)),
 	    chi, (long)(chi * sizeof(Link)));
 
-	totch = chm + chbm + chu * sizeof(Link) + chi * sizeof(Link);
+	sendto_one(sptr, ":%s %d %s :Channel directory %d(%ld)",
+	    me.name, RPL_STATSDEBUG, sptr->name, cdn, cdm);
 
-	sendto_one(sptr, ":%s %d %s :Whowas users %d(%ld) away %d(%ld)",
-	    me.name, RPL_STATSDEBUG, sptr->name, 
-	    wwu, (long)(wwu * sizeof(anUser)),
-	    wwa, wwam);
-	sendto_one(sptr, ":%s %d %s :Whowas array %d(%ld)",
-	    me.name, RPL_STATSDEBUG, sptr->name, NICKNAMEHISTORYLENGTH, wwm);
+	totch = chm + chbm + chu * sizeof(Link) + chi * sizeof(Link) + cdm;
 
-	totww = wwu * sizeof(anUser) + wwam + wwm;
+	sendto_one(sptr, ":%s %d %s :Whowas entries %d(%ld)",
+	    me.name, RPL_STATSDEBUG, sptr->name, wwu, wwum);
+	sendto_one(sptr, ":%s %d %s :Whowas arena %d(%ld)",
+	    me.name, RPL_STATSDEBUG, sptr->name, WHOWAS_HISTORY_LENGTH, wwm);
 
+	totww = wwm;
+
+	for (ht = hashtables; *ht; ht++)
+	{
+		hb = (*ht)->size[0] + (*ht)->size[1];
+		hm += (long)(sizeof(struct list_head) * hb);
+		sendto_one(sptr, ":%s %d %s :Hash: %s %u(%ld)", me.name,
+		    RPL_STATSDEBUG, sptr->name, (*ht)->name,
+		    hb, (long)(sizeof(struct list_head) * hb));
+	}
 	sendto_one(sptr,
-	    ":%s %d %s :Hash: client %d(%ld) chan %d(%ld) watch %d(%ld)", me.name,
-	    RPL_STATSDEBUG, sptr->name, U_MAX,
-	    (long)(sizeof(aHashEntry) * U_MAX), CH_MAX,
-	    (long)(sizeof(aHashEntry) * CH_MAX), WATCHHASHSIZE,
+	    ":%s %d %s :Hash: watch %d(%ld)", me.name,
+	    RPL_STATSDEBUG, sptr->name, WATCHHASHSIZE,
 	    (long)(sizeof(aWatch *) * WATCHHASHSIZE));
 
-	for (link = freelink; link; link = link->next)
-		fl++;
-	sendto_one(sptr, ":%s %d %s :Link blocks free %d(%ld) total %d(%ld)",
-	    me.name, RPL_STATSDEBUG, sptr->name,
-	    fl, (long)(fl * sizeof(Link)),
-	    flinks, (long)(flinks * sizeof(Link)));
+	for (pool = mp_pool_list(); pool; pool = pool->next)
+	{
+		mp_pool_get_usage(pool, &pu, &pa);
+		pf += pa - pu;
+		sendto_one(sptr, ":%s %d %s :Pool: %s size %u items %llu(%llu) allocated %llu chunks freed %llu",
+		    me.name, RPL_STATSDEBUG, sptr->name, pool->name,
+		    (unsigned int)pool->item_size, (unsigned long long)pool->n_items,
+		    (unsigned long long)pu, (unsigned long long)pa,
+		    (unsigned long long)pool->total_chunks_freed);
+	}
 
 /*	rm = cres_mem(sptr,sptr->name); */
 	rm = 0; /* syzop: todo ?????????? */
 
 	tot = totww + totch + totcl + com + cl * sizeof(aClass) + db + rm;
-	tot += fl * sizeof(Link);
-	tot += sizeof(aHashEntry) * U_MAX;
-	tot += sizeof(aHashEntry) * CH_MAX;
+	tot += pf;
+	tot += hm;
 	tot += sizeof(aWatch *) * WATCHHASHSIZE;
 
 	sendto_one(sptr, ":%s %d %s :Total: ww %ld ch %ld cl %ld co %ld db %ld",
@@ -1263,6 +1422,14 @@ int stats_set(aClient *sptr, char *para)
 		sptr->name, SSL_SERVER_KEY_PEM);
 	sendto_one(sptr, ":%s %i %s :ssl::trusted-ca-file: %s", me.name, RPL_TEXT, sptr->name,
 	 iConf.trusted_ca_file ? iConf.trusted_ca_file : "<none>");
+	sendto_one(sptr, ":%s %i %s :ssl::session-cache-size: %d", me.name, RPL_TEXT, sptr->name,
+	 iConf.ssl_session_cache_size);
+	sendto_one(sptr, ":%s %i %s :ssl::session-timeout: %s", me.name, RPL_TEXT, sptr->name,
+	 pretty_time_val(iConf.ssl_session_timeout));
+	sendto_one(sptr, ":%s %i %s :ssl::ticket-key-file: %s", me.name, RPL_TEXT, sptr->name,
+	 (iConf.ssl_ticket_key_file && *iConf.ssl_ticket_key_file) ? iConf.ssl_ticket_key_file : "<none>");
+	sendto_one(sptr, ":%s %i %s :ssl::ticket-key-rotate: %s", me.name, RPL_TEXT, sptr->name,
+	 pretty_time_val(iConf.ssl_ticket_key_rotate));
 	sendto_one(sptr, ":%s %i %s :ssl::options: %s %s %s", me.name, RPL_TEXT, sptr->name,
 		iConf.ssl_options & SSLFLAG_FAILIFNOCERT ? "FAILIFNOCERT" : "",
 		iConf.ssl_options & SSLFLAG_VERIFYCERT ? "VERIFYCERT" : "",
@@ -1288,6 +1455,8 @@ int stats_set(aClient *sptr, char *para)
 	    sptr->name, ALLOW_PART_IF_SHUNNED);
 	sendto_one(sptr, ":%s %i %s :maxchannelsperuser: %i", me.name, RPL_TEXT,
 	    sptr->name, MAXCHANNELSPERUSER);
+	sendto_one(sptr, ":%s %i %s :whowas-history-length: %i", me.name, RPL_TEXT,
+	    sptr->name, WHOWAS_HISTORY_LENGTH);
 	sendto_one(sptr, ":%s %i %s :auto-join: %s", me.name, RPL_TEXT,
 	    sptr->name, AUTO_JOIN_CHANS ? AUTO_JOIN_CHANS : "0");
 	sendto_one(sptr, ":%s %i %s :oper-auto-join: %s", me.name,
@@ -1300,6 +1469,10 @@ int stats_set(aClient *sptr, char *para)
 		sptr->name, WHOLIMIT);
 	sendto_one(sptr, ":%s %i %s :silence-limit: %d", me.name, RPL_TEXT,
 		sptr->name, SILENCE_LIMIT);
+	sendto_one(sptr, ":%s %i %s :io-threads: %d", me.name, RPL_TEXT,
+		sptr->name, IO_THREADS);
+	sendto_one(sptr, ":%s %i %s :intake-workers: %d", me.name, RPL_TEXT,
+		sptr->name, INTAKE_WORKERS);
 	sendto_one(sptr, ":%s %i %s :dns::timeout: %s", me.name, RPL_TEXT,
 	    sptr->name, pretty_time_val(HOST_TIMEOUT));
 	sendto_one(sptr, ":%s %i %s :dns::retries: %d", me.name, RPL_TEXT,
@@ -1332,6 +1505,10 @@ int stats_set(aClient *sptr, char *para)
 			sptr->name, pretty_time_val(IDENT_CONNECT_TIMEOUT));
 	sendto_one(sptr, ":%s %i %s :ident::read-timeout: %s", me.name, RPL_TEXT,
 			sptr->name, pretty_time_val(IDENT_READ_TIMEOUT));
+	sendto_one(sptr, ":%s %i %s :ident::max-queries: %d", me.name, RPL_TEXT,
+			sptr->name, IDENT_MAX_QUERIES);
+	sendto_one(sptr, ":%s %i %s :ident::cache-time: %s", me.name, RPL_TEXT,
+			sptr->name, pretty_time_val(IDENT_CACHE_TIME));
 	sendto_one(sptr, ":%s %i %s :modef-default-unsettime: %hd", me.name, RPL_TEXT,
 			sptr->name, (unsigned short)MODEF_DEFAULT_UNSETTIME);
 	sendto_one(sptr, ":%s %i %s :modef-max-unsettime: %hd", me.name, RPL_TEXT,
@@ -1437,6 +1614,24 @@ int stats_linkinfoall(aClient *sptr, char *para)
 	return stats_linkinfoint(sptr, para, 1);
 }
 
+/* How long the burst with a directly linked server took, see burst_begin() */
+static void stats_burst(aClient *sptr, aClient *acptr)
+{
+	char sent[64], received[32];
+
+	if (acptr->serv->burst_sent)
+		ircsnprintf(sent, sizeof(sent), "%llu bytes in %llu ms", (unsigned long long)acptr->serv->burst_bytes,
+			acptr->serv->burst_sent / 1000000);
+	else
+		strlcpy(sent, "in progress", sizeof(sent));
+	if (acptr->serv->burst_received)
+		ircsnprintf(received, sizeof(received), "%llu ms", acptr->serv->burst_received / 1000000);
+	else
+		strlcpy(received, "in progress", sizeof(received));
+	sendto_one(sptr, ":%s %d %s :burst %s sent %s, received %s, sndbuf %d",
+		me.name, RPL_STATSDEBUG, sptr->name, acptr->name, sent, received, acptr->sndbuf);
+}
+
 int stats_linkinfoint(aClient *sptr, char *para, int all)
 {
 #ifndef DEBUGMODE
@@ -1519,6 +1714,8 @@ int stats_linkinfoint(aClient *sptr, char *para, int all)
 #else
 				pbuf);
 #endif
+			if (IsServer(acptr) && acptr->serv->burst_start)
+				stats_burst(sptr, acptr);
 			if (!IsServer(acptr) && !IsMe(acptr) && IsAnOper(acptr) && sptr != acptr)
 				sendto_one(acptr,
 					":%s NOTICE %s :*** %s did a /stats L on you! IP may have been shown",
@@ -504,6 +504,7 @@ int  what, setflags;
 						/* Removing mode +x and virthost set... recalculate host then (but don't activate it!) */
 						MyFree(acptr->user->virthost);
 						acptr->user->virthost = strdup(acptr->user->cloakedhost);
+						userindex_update(acptr);
 					}
 				} else
 				{
@@ -514,6 +515,7 @@ int  what, setflags;
 						 * Not sure if this could ever happen, but just in case... -- Syzop
 						 */
 						acptr->user->virthost = strdup(acptr->user->cloakedhost);
+						userindex_update(acptr);
 					}
 					/* Announce the new host to VHP servers if we're setting the virthost to the cloakedhost.
 					 * In other cases, we can assume that the host has been broadcasted already (after all,
@@ -467,6 +467,51 @@ DLLFUNC int m_tzline(aClient *cptr, aClient *sptr, int parc, char *parv[])
 ** parv[3] = reason
 */
 
+/* Would a ban on usermask@hostmask hit acptr? Same rules as find_tkline_match() */
+static int tkl_user_matches(aClient *acptr, char *usermask, char *hostmask, int type, struct irc_netmask *nm)
+{
+	struct irc_netmask addr;
+	char *ip = GetIP(acptr);
+
+	if (match(usermask, acptr->user->username))
+		return 0;
+	if (type == HM_HOST)
+		return !match(hostmask, acptr->user->realhost) || !match(hostmask, ip);
+	if (parse_netmask(ip, &addr) != type)
+		return 0;
+#ifdef INET6
+	if (type == HM_IPV6)
+		return match_ipv6(&addr.mask, &nm->mask, nm->bits);
+#endif
+	return match_ipv4(&addr.mask, &nm->mask, nm->bits);
+}
+
+/* Number of users on the network a ban on usermask@hostmask would hit */
+static int tkl_count_users(char *usermask, char *hostmask)
+{
+	struct irc_netmask nm;
+	aClient *acptr, **found;
+	int  type, n, count, matches = 0;
+
+	type = parse_netmask(hostmask, &nm);
+	if (type != HM_HOST)
+		found = userindex_search_ip(&nm, type, &count);
+	else
+		found = userindex_search(hostmask, USERINDEX_REALHOST|USERINDEX_IP, &count);
+
+	if (found)
+	{
+		for (n = 0; n < count; n++)
+			if (tkl_user_matches(found[n], usermask, hostmask, type, &nm))
+				matches++;
+		return matches;
+	}
+	list_for_each_entry(acptr, &client_list, client_node)
+		if (IsPerson(acptr) && tkl_user_matches(acptr, usermask, hostmask, type, &nm))
+			matches++;
+	return matches;
+}
+
 DLLFUNC int  m_tkl_line(aClient *cptr, aClient *sptr, int parc, char *parv[], char* type)
 {
 	TS   secs;
@@ -507,6 +552,12 @@ DLLFUNC int  m_tkl_line(aClient *cptr, aClient *sptr, int parc, char *parv[], ch
 		whattodo = 0;
 		mask++;
 	}
+	else if (*mask == '?')
+	{
+		/* only tell how many users it would hit */
+		whattodo = 2;
+		mask++;
+	}
 
 	if (strchr(mask, '!'))
 	{
@@ -644,6 +695,13 @@ DLLFUNC int  m_tkl_line(aClient *cptr, aClient *sptr, int parc, char *parv[], ch
 		}
 	}
 
+	if (whattodo == 2)
+	{
+		sendnotice(sptr, "*** %s@%s matches %d user(s)", usermask, hostmask,
+			tkl_count_users(usermask, hostmask));
+		return 0;
+	}
+
 	tkl_check_expire(NULL);
 
 	secs = 0;
@@ -937,10 +995,7 @@ aTKline *_tkl_add_line(int type, char *usermask, char *hostmask, char *reason, c
 		}
 	}
 
-	nl = (aTKline *) MyMallocEx(sizeof(aTKline));
-
-	if (!nl)
-		return NULL;
+	nl = make_tkl();
 
 	nl->type = type;
 	nl->expire_at = expire_at;
@@ -1005,7 +1060,7 @@ aTKline *_tkl_del_line(aTKline *tkl)
 			     && p->ptr.netmask)
 				MyFree(p->ptr.netmask);
 			DelListItem(p, tklines[index]);
-			MyFree(p);
+			free_tkl(p);
 			return q;
 		}
 	}
@@ -2466,17 +2521,17 @@ long ms_past;
 	if (rettk)
 		*rettk = NULL; /* initialize to NULL */
 
-	if (type == SPAMF_USER)
-		str = str_in;
-	else
-		str = (char *)StripControlCodes(str_in);
-
 	/* (note: using sptr->user check here instead of IsPerson()
 	 * due to SPAMF_USER where user isn't marked as client/person yet.
 	 */
 	if (!sptr->user || IsAnOper(sptr) || IsULine(sptr))
 		return 0;
 
+	if (type == SPAMF_USER)
+		str = str_in;
+	else
+		str = msgtext_nocodes(msgtext_for(str_in));
+
 	for (tk = tklines[tkl_hash('F')]; tk; tk = tk->next)
 	{
 		if (!(tk->subtype & type))
@@ -2526,6 +2581,8 @@ long ms_past;
 			if (target && target_is_spamexcept(target))
 				return 0; /* No problem! */
 
+			tk->ptr.spamf->hits++;
+
 			ircsnprintf(buf, sizeof(buf), "[Spamfilter] %s!%s@%s matches filter '%s': [%s%s: '%s'] [%s]",
 				sptr->name, sptr->user->username, sptr->user->realhost,
 				tk->reason,
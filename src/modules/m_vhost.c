@@ -164,6 +164,7 @@ int  m_vhost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			sendto_server(cptr, 0, 0, ":%s SETIDENT %s", sptr->name,
 			    sptr->user->username);
 		}
+		userindex_update(sptr);
 		sptr->umodes |= UMODE_HIDE;
 		sptr->umodes |= UMODE_SETHOST;
 		sendto_server(cptr, 0, 0, ":%s SETHOST %s", sptr->name, sptr->user->virthost);
@@ -663,56 +663,75 @@ int i = 0;
 	status[i] = '\0';
 }
 
+/** Matches one user against a wildcard mask, returns -1 when WHOLIMIT is hit */
+static int do_other_who_one(aClient *sptr, aClient *acptr, char *mask, int oper, int *i)
+{
+int cansee;
+char status[20];
+char *channel;
+int flg;
+
+	if (!IsPerson(acptr))
+		return 0;
+	if (!oper) {
+		/* non-opers can only search on nick here */
+		if (match(mask, acptr->name))
+			return 0;
+	} else {
+		/* opers can search on name, ident, virthost, ip and realhost.
+		 * Yes, I like readable if's -- Syzop.
+		 */
+		if (!match(mask, acptr->name) || !match(mask, acptr->user->realhost) ||
+		    !match(mask, acptr->user->username))
+			goto matchok;
+		if (IsHidden(acptr) && !match(mask, acptr->user->virthost))
+			goto matchok;
+		if (acptr->user->ip_str && !match(mask, acptr->user->ip_str))
+			goto matchok;
+		/* nothing matched... */
+		return 0;
+	}
+matchok:
+	if ((cansee = can_see(sptr, acptr, NULL)) & WHO_CANTSEE)
+		return 0;
+	if (WHOLIMIT && !IsAnOper(sptr) && ++(*i) > WHOLIMIT)
+	{
+		sendto_one(sptr, rpl_str(ERR_WHOLIMEXCEED), me.name, sptr->name, WHOLIMIT);
+		return -1;
+	}
+
+	channel = first_visible_channel(sptr, acptr, &flg);
+	make_who_status(sptr, acptr, NULL, NULL, status, cansee);
+	send_who_reply(sptr, acptr, channel, status, (flg & FVC_HIDDEN) ? "~" : "");
+	return 0;
+}
+
 static void do_other_who(aClient *sptr, char *mask)
 {
 int oper = IsAnOper(sptr);
 
 	if (strchr(mask, '*') || strchr(mask, '?'))
 	{
-		int i = 0;
-		/* go through all users.. */
-		aClient *acptr;
+		int i = 0, n, count;
+		aClient *acptr, **found;
 		who_flags |= WF_WILDCARD;
 
-		list_for_each_entry(acptr, &client_list, client_node)
+		/* only look at the users the mask can match, if the user index can tell */
+		found = userindex_search(mask, oper ? (USERINDEX_NICK|USERINDEX_USER|
+		    USERINDEX_REALHOST|USERINDEX_VIRTHOST|USERINDEX_IP) : USERINDEX_NICK, &count);
+		if (found)
 		{
-		int cansee;
-		char status[20];
-		char *channel;
-		int flg;
+			for (n = 0; n < count; n++)
+				if (do_other_who_one(sptr, found[n], mask, oper, &i) < 0)
+					return;
+			return;
+		}
 
-			if (!IsPerson(acptr))
-				continue;
-			if (!oper) {
-				/* non-opers can only search on nick here */
-				if (match(mask, acptr->name))
-					continue;
-			} else {
-				/* opers can search on name, ident, virthost, ip and realhost.
-				 * Yes, I like readable if's -- Syzop.
-				 */
-				if (!match(mask, acptr->name) || !match(mask, acptr->user->realhost) ||
-				    !match(mask, acptr->user->username))
-					goto matchok;
-				if (IsHidden(acptr) && !match(mask, acptr->user->virthost))
-					goto matchok;
-				if (acptr->user->ip_str && !match(mask, acptr->user->ip_str))
-					goto matchok;
-				/* nothing matched... */
-				continue;
-			}
-matchok:
-			if ((cansee = can_see(sptr, acptr, NULL)) & WHO_CANTSEE)
-				continue;
-			if (WHOLIMIT && !IsAnOper(sptr) && ++i > WHOLIMIT)
-			{
-				sendto_one(sptr, rpl_str(ERR_WHOLIMEXCEED), me.name, sptr->name, WHOLIMIT);
+		/* go through all users.. */
+		list_for_each_entry(acptr, &client_list, client_node)
+		{
+			if (do_other_who_one(sptr, acptr, mask, oper, &i) < 0)
 				return;
-			}
-
-			channel = first_visible_channel(sptr, acptr, &flg);
-			make_who_status(sptr, acptr, NULL, NULL, status, cansee);
-			send_who_reply(sptr, acptr, channel, status, (flg & FVC_HIDDEN) ? "~" : "");
 		}
 	}
 	else
@@ -69,11 +69,6 @@ DLLFUNC int MOD_UNLOAD(m_whowas)(int module_unload)
 	return MOD_SUCCESS;
 }
 
-/* externally defined functions */
-extern unsigned int hash_whowas_name(char *);
-extern MODVAR aWhowas WHOWAS[NICKNAMEHISTORYLENGTH];
-extern MODVAR aWhowas *WHOWASHASH[WW_MAX];
-
 /*
 ** m_whowas
 **      parv[0] = sender prefix
@@ -105,22 +100,21 @@ DLLFUNC CMD_FUNC(m_whowas)
 	if (p)
 		*p = '\0';
 	nick = parv[1];
-	temp = WHOWASHASH[hash_whowas_name(nick)];
 	found = 0;
-	for (; temp; temp = temp->next)
+	for (temp = whowas_bucket(nick); temp; temp = temp->next)
 	{
-		if (!mycmp(nick, temp->name))
+		if (!mycmp(nick, WHOWAS_NAME(temp)))
 		{
 			sendto_one(sptr, rpl_str(RPL_WHOWASUSER),
-			    me.name, parv[0], temp->name,
-			    temp->username,
-			    (IsOper(sptr) ? temp->hostname :
-			    (*temp->virthost !=
-			    '\0') ? temp->virthost : temp->hostname),
-			    temp->realname);
+			    me.name, parv[0], WHOWAS_NAME(temp),
+			    WHOWAS_USERNAME(temp),
+			    (IsOper(sptr) ? WHOWAS_HOSTNAME(temp) :
+			    (*WHOWAS_VIRTHOST(temp) !=
+			    '\0') ? WHOWAS_VIRTHOST(temp) : WHOWAS_HOSTNAME(temp)),
+			    WHOWAS_REALNAME(temp));
                 	if (!((Find_uline(temp->servername)) && !IsOper(sptr) && HIDE_ULINES))
 				sendto_one(sptr, rpl_str(RPL_WHOISSERVER), me.name,
-				    parv[0], temp->name, temp->servername,
+				    parv[0], WHOWAS_NAME(temp), temp->servername,
 				    myctime(temp->logoff));
 			cur++;
 			found++;
@@ -0,0 +1,137 @@
+/*
+ * RabbitIRCD, src/msgtext.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Per-message text context. A PRIVMSG/NOTICE is looked at by several
+ * parties (channel modes +c/+C/+S, spamfilter, badwords, hooks), often
+ * once per target, and each used to strip or scan the text itself.
+ * m_message sets up one MessageText for the text it received and
+ * everyone asks it instead: the scan for control codes is done once,
+ * and the stripped forms are made at most once, and only if someone
+ * wants them. If there is nothing to strip, the stripped form is the
+ * text itself and no copy is made at all.
+ *
+ * Code that is handed a text pointer (hooks, dospamfilter) uses
+ * msgtext_for(), which gives the current context if that is the text
+ * it describes, or a scratch context for anything else (eg. a text
+ * already rewritten by an earlier hook).
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+
+MODVAR MessageText *msgtext_current = NULL;
+static unsigned int msgtext_serial = 0;
+static MessageText msgtext_scratch;
+
+void msgtext_init(MessageText *m, char *text)
+{
+	m->text = text;
+	m->scanned = 0;
+	m->nocolors = m->nocodes = NULL;
+	if (++msgtext_serial == 0)
+		msgtext_serial = 1;
+	m->serial = msgtext_serial;
+}
+
+/** Give the context describing 'text' */
+MessageText *msgtext_for(char *text)
+{
+	if (msgtext_current && msgtext_current->text == text)
+		return msgtext_current;
+	msgtext_init(&msgtext_scratch, text);
+	return &msgtext_scratch;
+}
+
+/** Make 'm' the current context, returns the previous one for msgtext_restore() */
+MessageText *msgtext_enter(MessageText *m, char *text)
+{
+	MessageText *prev = msgtext_current;
+
+	msgtext_init(m, text);
+	msgtext_current = m;
+	return prev;
+}
+
+void msgtext_restore(MessageText *prev)
+{
+	msgtext_current = prev;
+}
+
+static void msgtext_scan(MessageText *m)
+{
+	u_char *p;
+	int  flags = 0;
+
+	for (p = (u_char *)m->text; *p; p++)
+	{
+		switch (*p)
+		{
+		case 3:		/* color */
+		case 4:		/* RGB */
+		case 22:	/* reverse */
+			flags |= MSGTEXT_COLOR;
+			break;
+		case 27:	/* ansi */
+			flags |= MSGTEXT_ANSI;
+			break;
+		case 2:		/* bold */
+		case 15:	/* plain */
+		case 31:	/* underline */
+			flags |= MSGTEXT_CODES;
+			break;
+		}
+	}
+	if (m->text[0] == 1 && strncmp(m->text + 1, "ACTION ", 7))
+		flags |= MSGTEXT_CTCP;
+	m->flags = flags;
+	m->scanned = 1;
+}
+
+/** MSGTEXT_* flags describing the text */
+int msgtext_flags(MessageText *m)
+{
+	if (!m->scanned)
+		msgtext_scan(m);
+	return m->flags;
+}
+
+/** The text as StripColors() would give it */
+char *msgtext_nocolors(MessageText *m)
+{
+	if (m->nocolors)
+		return m->nocolors;
+	if (!(msgtext_flags(m) & MSGTEXT_COLOR))
+		return (m->nocolors = m->text);
+	strlcpy(m->buf_nocolors, StripColors(m->text), sizeof(m->buf_nocolors));
+	return (m->nocolors = m->buf_nocolors);
+}
+
+/** The text as StripControlCodes() would give it */
+char *msgtext_nocodes(MessageText *m)
+{
+	if (m->nocodes)
+		return m->nocodes;
+	if (!(msgtext_flags(m) & (MSGTEXT_COLOR|MSGTEXT_CODES)))
+		return (m->nocodes = m->text);
+	strlcpy(m->buf_nocodes, StripControlCodes(m->text), sizeof(m->buf_nocodes));
+	return (m->nocodes = m->buf_nocodes);
+}
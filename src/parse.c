@@ -170,18 +170,26 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 	aClient *from = cptr;
 	char *ch, *s;
 	int  len, i, numeric = 0, paramcount;
+	int  retval;
+	unsigned long long start, sent;
+	unsigned long deleted;
 #ifdef DEBUGMODE
 	time_t then, ticks;
-	int  retval;
 #endif
 	aCommand *cmptr = NULL;
+	HOOKSTAT_BEGIN(HOOKTYPE_PACKET);
 
 	for(h = Hooks[HOOKTYPE_PACKET]; h; h = h->next) {
 		buf_len = (int)(bufend - buffer);
 		(*(h->func.intfunc))(from, &me, &buffer, &buf_len);
-		if(!buffer) return 0;
+		if(!buffer)
+		{
+			HOOKSTAT_END(HOOKTYPE_PACKET);
+			return 0;
+		}
 		bufend = buffer + buf_len;
 	}
+	HOOKSTAT_END(HOOKTYPE_PACKET);
 
 	Debug((DEBUG_ERROR, "Parsing: %s (from %s)", buffer,
 	    (*cptr->name ? cptr->name : "*")));
@@ -443,17 +451,15 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 	if (IsRegisteredUser(cptr) && (cmptr->flags & M_RESETIDLE))
 		cptr->last = TStime();
 
-#ifndef DEBUGMODE
-	if (cmptr->flags & M_ALIAS)
-		return (*cmptr->func) (cptr, from, i, para, cmptr->cmd);
-	else
-	{
-		if (!cmptr->overriders)
-			return (*cmptr->func) (cptr, from, i, para);
-		return (*cmptr->overridetail->func) (cmptr->overridetail, cptr, from, i, para);
-	}
-#else
+	/* The handler may unload modules (REHASH), in which case cmptr
+	 * could be gone afterwards: only touch it if no command was deleted.
+	 */
+	deleted = commands_deleted;
+	sent = sendq_bytes;
+	start = profile_clock();
+#ifdef DEBUGMODE
 	then = clock();
+#endif
 	if (cmptr->flags & M_ALIAS)
 		retval = (*cmptr->func) (cptr, from, i, para, cmptr->cmd);
 	else 
@@ -463,6 +469,15 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 		else
 			retval = (*cmptr->overridetail->func) (cmptr->overridetail, cptr, from, i, para);
 	}
+	if (deleted == commands_deleted)
+	{
+		start = profile_clock() - start;
+		cmptr->nsecs += start;
+		if (start > cmptr->maxnsecs)
+			cmptr->maxnsecs = start;
+		cmptr->sentbytes += sendq_bytes - sent;
+	}
+#ifdef DEBUGMODE
 	if (retval != FLUSH_BUFFER)
 	{
 		ticks = (clock() - then);
@@ -472,9 +487,8 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 			cmptr->lticks += ticks;
 		cptr->cputime += ticks;
 	}
-
-	return retval;
 #endif
+	return retval;
 }
 
 static int cancel_clients(aClient *cptr, aClient *sptr, char *cmd)
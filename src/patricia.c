@@ -172,10 +172,10 @@ patricia_create(void (*canonize_cb)(char *key))
 	dtree->canonize_cb = canonize_cb;
 
 	if (!leaf_heap)
-		leaf_heap = mp_pool_new(sizeof(struct patricia_leaf), 1024);
+		leaf_heap = mp_pool_new_named("patricia.leaf", sizeof(struct patricia_leaf), 1024);
 
 	if (!node_heap)
-		node_heap = mp_pool_new(sizeof(struct patricia_node), 128);
+		node_heap = mp_pool_new_named("patricia.node", sizeof(struct patricia_node), 128);
 
 	dtree->root = NULL;
 
@@ -210,10 +210,10 @@ patricia_create_named(const char *name, void (*canonize_cb)(char *key))
 	dtree->id = strdup(name);
 
 	if (!leaf_heap)
-		leaf_heap = mp_pool_new(sizeof(struct patricia_leaf), 1024);
+		leaf_heap = mp_pool_new_named("patricia.leaf", sizeof(struct patricia_leaf), 1024);
 
 	if (!node_heap)
-		node_heap = mp_pool_new(sizeof(struct patricia_node), 128);
+		node_heap = mp_pool_new_named("patricia.node", sizeof(struct patricia_node), 128);
 
 	dtree->root = NULL;
 
@@ -58,6 +58,7 @@ void unrealdns_delasyncconnects(void);
 static unsigned int unrealdns_haship(void *binaryip, int length);
 static void unrealdns_addtocache(char *name, void *binaryip, int length);
 static char *unrealdns_findcache_byaddr(struct IN_ADDR *addr);
+static void unrealdns_iptoname(DNSReq *r);
 struct hostent *unreal_create_hostent(char *name, struct IN_ADDR *addr);
 static void unrealdns_freeandremovereq(DNSReq *r);
 void unrealdns_removecacherecord(DNSCache *c);
@@ -120,6 +121,7 @@ static void unrealdns_sock_state_cb(void *data, ares_socket_t fd, int read, int
 static int unrealdns_sock_create_cb(ares_socket_t fd, int type, void *data)
 {
 	fd_open(fd, "DNS Resolver Socket");
+	fd_settype(fd, FD_TYPE_DNS);
 	return ARES_SUCCESS;
 }
 
@@ -229,11 +231,7 @@ void unrealdns_addreqtolist(DNSReq *r)
 struct hostent *unrealdns_doclient(aClient *cptr)
 {
 DNSReq *r;
-#ifdef INET6
-char ipv4[4];
-#endif
-static struct hostent *he;
-char *cache_name, ipv6;
+char *cache_name;
 
 	cache_name = unrealdns_findcache_byaddr(&cptr->ip);
 	if (cache_name)
@@ -242,24 +240,101 @@ char *cache_name, ipv6;
 	/* Create a request */
 	r = MyMallocEx(sizeof(DNSReq));
 	r->cptr = cptr;
+	memcpy(&r->ip, &cptr->ip, sizeof(struct IN_ADDR));
 	r->ipv6 = isipv6(&cptr->ip);
 	unrealdns_addreqtolist(r);
 
-	/* Execute it */
+	unrealdns_iptoname(r);
+	return NULL;
+}
+
+/** The same for an intake worker (intake.c), which has no client yet:
+ * done(arg, name, cached) gets the verified host, or NULL. It may be
+ * called before this returns.
+ */
+void unrealdns_lookup(struct IN_ADDR *ip, void (*done)(void *, char *, int), void *arg)
+{
+DNSReq *r;
+char *cache_name;
+
+	cache_name = unrealdns_findcache_byaddr(ip);
+	if (cache_name)
+	{
+		done(arg, cache_name, 1);
+		return;
+	}
+
+	r = MyMallocEx(sizeof(DNSReq));
+	memcpy(&r->ip, ip, sizeof(struct IN_ADDR));
+	r->ipv6 = isipv6(ip);
+	r->done = done;
+	r->arg = arg;
+	unrealdns_addreqtolist(r);
+
+	unrealdns_iptoname(r);
+}
+
+/** Start the ip->name part of a client request */
+static void unrealdns_iptoname(DNSReq *r)
+{
+#ifdef INET6
+char ipv4[4];
+#endif
+
 #ifndef INET6
 	/* easy */
-	ares_gethostbyaddr(resolver_channel, &cptr->ip, 4, AF_INET, unrealdns_cb_iptoname, r);
+	ares_gethostbyaddr(resolver_channel, &r->ip, 4, AF_INET, unrealdns_cb_iptoname, r);
 #else
 	if (r->ipv6)
-		ares_gethostbyaddr(resolver_channel, &cptr->ip, 16, AF_INET6, unrealdns_cb_iptoname, r);
+		ares_gethostbyaddr(resolver_channel, &r->ip, 16, AF_INET6, unrealdns_cb_iptoname, r);
 	else {
 		/* This is slightly more tricky: convert it to an IPv4 presentation and issue the request with that */
-		memcpy(ipv4, ((char *)&cptr->ip) + 12, 4);
+		memcpy(ipv4, ((char *)&r->ip) + 12, 4);
 		ares_gethostbyaddr(resolver_channel, ipv4, 4, AF_INET, unrealdns_cb_iptoname, r);
 	}
 #endif
+}
 
-	return NULL;
+/** A client request is done: 'name' is the verified host, or NULL */
+static void unrealdns_done(DNSReq *r, char *name)
+{
+	if (r->done)
+		r->done(r->arg, name, 0);
+	else
+		proceed_normal_client_handshake(r->cptr, name ? unreal_create_hostent(name, &r->ip) : NULL);
+}
+
+/** The host an intake worker found for 'cptr', taken as if we looked it
+ * up ourselves (and cached it).
+ */
+struct hostent *unrealdns_intake(aClient *cptr, IntakeLookup *lookup)
+{
+	if (lookup->flags & LOOKUP_DNS_CACHED)
+		dnsstats.cache_hits++;
+	else
+		dnsstats.cache_misses++;
+	if (!*lookup->host)
+		return NULL;
+	unrealdns_addtocache(lookup->host, &cptr->ip, sizeof(cptr->ip));
+	return unreal_create_hostent(lookup->host, &cptr->ip);
+}
+
+/** In a new intake worker: a channel of its own, which the worker
+ * polls itself (the one we inherited is run by the event loop of the
+ * main process, and its sockets are closed).
+ */
+int unrealdns_worker_init(void)
+{
+struct ares_options options;
+int optmask, n;
+
+	requests = NULL;
+	if (ares_save_options(resolver_channel, &options, &optmask) != ARES_SUCCESS)
+		return -1;
+	optmask &= ~ARES_OPT_SOCK_STATE_CB;
+	n = ares_init_options(&resolver_channel, &options, optmask);
+	ares_destroy_options(&options);
+	return (n == ARES_SUCCESS) ? 0 : -1;
 }
 
 /** Resolve a name to an IP, for a link block.
@@ -295,33 +370,37 @@ void unrealdns_cb_iptoname(void *arg, int status, int timeouts, struct hostent *
 {
 DNSReq *r = (DNSReq *)arg;
 DNSReq *newr;
-aClient *acptr = r->cptr;
-char ipv6 = r->ipv6;
-
-	unrealdns_freeandremovereq(r);
 
-	if (!acptr)
+	if (!r->cptr && !r->done)
+	{
+		unrealdns_freeandremovereq(r);
 		return; 
+	}
 	
 	/* Check for status and null name (yes, we must) */
 	if ((status != 0) || !he->h_name || !*he->h_name)
 	{
 		/* Failed */
-		proceed_normal_client_handshake(acptr, NULL);
+		unrealdns_done(r, NULL);
+		unrealdns_freeandremovereq(r);
 		return;
 	}
 
 	/* Good, we got a valid response, now prepare for name -> ip */
 	newr = MyMallocEx(sizeof(DNSReq));
-	newr->cptr = acptr;
-	newr->ipv6 = ipv6;
+	newr->cptr = r->cptr;
+	newr->ipv6 = r->ipv6;
+	memcpy(&newr->ip, &r->ip, sizeof(struct IN_ADDR));
+	newr->done = r->done;
+	newr->arg = r->arg;
 	newr->name = strdup(he->h_name);
 	unrealdns_addreqtolist(newr);
+	unrealdns_freeandremovereq(r);
 
 #ifndef INET6
-	ares_gethostbyname(resolver_channel, he->h_name, AF_INET, unrealdns_cb_nametoip_verify, newr);
+	ares_gethostbyname(resolver_channel, newr->name, AF_INET, unrealdns_cb_nametoip_verify, newr);
 #else
-	ares_gethostbyname(resolver_channel, he->h_name, ipv6 ? AF_INET6 : AF_INET, unrealdns_cb_nametoip_verify, newr);
+	ares_gethostbyname(resolver_channel, newr->name, newr->ipv6 ? AF_INET6 : AF_INET, unrealdns_cb_nametoip_verify, newr);
 #endif
 }
 
@@ -349,13 +428,11 @@ char *p;
 void unrealdns_cb_nametoip_verify(void *arg, int status, int timeouts, struct hostent *he)
 {
 DNSReq *r = (DNSReq *)arg;
-aClient *acptr = r->cptr;
 char ipv6 = r->ipv6;
 int i;
-struct hostent *he2;
 u_int32_t ipv4_addr;
 
-	if (!acptr)
+	if (!r->cptr && !r->done)
 		goto bad;
 
 	if ((status != 0) ||
@@ -366,15 +443,15 @@ u_int32_t ipv4_addr;
 #endif
 	{
 		/* Failed: error code, or data length is not 4 (nor 16) */
-		proceed_normal_client_handshake(acptr, NULL);
+		unrealdns_done(r, NULL);
 		goto bad;
 	}
 
 	if (!ipv6)
 #ifndef INET6
-		ipv4_addr = acptr->ip.S_ADDR;
+		ipv4_addr = r->ip.S_ADDR;
 #else
-		inet6_to_inet4(&acptr->ip, &ipv4_addr);
+		inet6_to_inet4(&r->ip, &ipv4_addr);
 #endif
 
 	/* Verify ip->name and name->ip mapping... */
@@ -386,7 +463,7 @@ u_int32_t ipv4_addr;
 #else
 		if (ipv6)
 		{
-			if ((he->h_length == 16) && !memcmp(he->h_addr_list[i], &acptr->ip, 16))
+			if ((he->h_length == 16) && !memcmp(he->h_addr_list[i], &r->ip, 16))
 				break;
 		} else {
 			if ((he->h_length == 4) && !memcmp(he->h_addr_list[i], &ipv4_addr, 4))
@@ -398,22 +475,21 @@ u_int32_t ipv4_addr;
 	if (!he->h_addr_list[i])
 	{
 		/* Failed name <-> IP mapping */
-		proceed_normal_client_handshake(acptr, NULL);
+		unrealdns_done(r, NULL);
 		goto bad;
 	}
 
 	if (!verify_hostname(r->name))
 	{
 		/* Hostname is bad, don't cache and consider unresolved */
-		proceed_normal_client_handshake(acptr, NULL);
+		unrealdns_done(r, NULL);
 		goto bad;
 	}
 
 	/* Entry was found, verified, and can be added to cache */
-	unrealdns_addtocache(r->name, &acptr->ip, sizeof(acptr->ip));
+	unrealdns_addtocache(r->name, &r->ip, sizeof(r->ip));
 	
-	he2 = unreal_create_hostent(r->name, &acptr->ip);
-	proceed_normal_client_handshake(acptr, he2);
+	unrealdns_done(r, r->name);
 
 bad:
 	unrealdns_freeandremovereq(r);
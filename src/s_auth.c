@@ -43,16 +43,224 @@ static char sccsid[] = "@(#)s_auth.c	1.18 4/18/94 (C) 1992 Darren Reed";
 static void send_authports(int fd, int revents, void *data);
 static void read_authports(int fd, int revents, void *data);
 
-void ident_failed(aClient *cptr)
+/*
+ * Running ident queries are kept on ident_list so that their deadline
+ * (set::ident::connect-timeout, then set::ident::read-timeout) can be
+ * enforced every second, and so that no more than set::ident::max-queries
+ * sockets are open for them at any time.
+ */
+static LIST_HEAD(ident_list);
+static int ident_count = 0;
+
+/*
+ * Hosts that did not answer on port 113 (refused, unreachable or timed
+ * out) are remembered for set::ident::cache-time, so a client reconnecting
+ * from the same IP does not wait for the same failure again.  Only the
+ * failure is cached: a username is only valid for the connection it was
+ * given for.  The list is kept newest first, which is also expiry order.
+ */
+typedef struct _identcache IdentCache;
+struct _identcache {
+	IdentCache *prev, *next;	/* newest first */
+	IdentCache *hprev, *hnext;	/* hash bucket */
+	struct IN_ADDR addr;
+	TS expires;
+};
+
+#define IDENT_HASH_SIZE		1021	/* prime */
+#define IDENT_CACHE_MAX		4096
+
+static IdentCache *identcache_hashtbl[IDENT_HASH_SIZE];
+static IdentCache *identcache_head = NULL, *identcache_tail = NULL;
+static int identcache_num = 0;
+
+static unsigned int ident_haship(struct IN_ADDR *addr)
 {
-	Debug((DEBUG_NOTICE, "ident_failed() for %x", cptr));
-	ircstp->is_abad++;
-	if (cptr->authfd != -1)
+	unsigned char *p = (unsigned char *)addr;
+	unsigned int i, hashv = 0;
+
+	for (i = 0; i < sizeof(struct IN_ADDR); i++)
+		hashv = (hashv * 31) + p[i];
+	return hashv % IDENT_HASH_SIZE;
+}
+
+static IdentCache *identcache_find(struct IN_ADDR *addr)
+{
+	IdentCache *c;
+
+	for (c = identcache_hashtbl[ident_haship(addr)]; c; c = c->hnext)
+		if (!memcmp(addr, &c->addr, sizeof(struct IN_ADDR)))
+			return c;
+	return NULL;
+}
+
+static void identcache_del(IdentCache *c)
+{
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		identcache_head = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	else
+		identcache_tail = c->prev;
+
+	if (c->hprev)
+		c->hprev->hnext = c->hnext;
+	else
+		identcache_hashtbl[ident_haship(&c->addr)] = c->hnext;
+	if (c->hnext)
+		c->hnext->hprev = c->hprev;
+
+	MyFree(c);
+	identcache_num--;
+}
+
+void identcache_add(struct IN_ADDR *addr)
+{
+	IdentCache *c;
+	unsigned int hashv;
+
+	if (!IDENT_CACHE_TIME)
+		return;
+
+	/* Re-adding moves the entry to the front with a new expiry */
+	if ((c = identcache_find(addr)))
+		identcache_del(c);
+	else if (identcache_num >= IDENT_CACHE_MAX)
+		identcache_del(identcache_tail);
+
+	c = MyMallocEx(sizeof(IdentCache));
+	memcpy(&c->addr, addr, sizeof(struct IN_ADDR));
+	c->expires = TStime() + IDENT_CACHE_TIME;
+
+	hashv = ident_haship(addr);
+	if (identcache_hashtbl[hashv])
+	{
+		identcache_hashtbl[hashv]->hprev = c;
+		c->hnext = identcache_hashtbl[hashv];
+	}
+	identcache_hashtbl[hashv] = c;
+
+	if (identcache_head)
+	{
+		identcache_head->prev = c;
+		c->next = identcache_head;
+	}
+	else
+		identcache_tail = c;
+	identcache_head = c;
+	identcache_num++;
+}
+
+/*
+ * For the intake workers (intake.c), which have a copy of the cache but
+ * do not run ident_timeout(): is 'addr' cached, and not expired.
+ */
+int ident_cached(struct IN_ADDR *addr)
+{
+	IdentCache *c;
+
+	return IDENT_CACHE_TIME && (c = identcache_find(addr)) && (c->expires > TStime());
+}
+
+/*
+ * An intake worker did the ident lookup for cptr, and told the client
+ * how it went: take the result as if it was ours.
+ */
+void ident_intake(aClient *cptr, IntakeLookup *lookup)
+{
+	if (lookup->flags & LOOKUP_NO_IDENTD)
+		identcache_add(&cptr->ip);
+	if (lookup->flags & LOOKUP_IDENT_CACHED)
+		ircstp->is_acache++;
+	else if (lookup->flags & LOOKUP_IDENT_BUSY)
+		ircstp->is_abusy++;
+	else if (*lookup->username)
+	{
+		ircstp->is_asuc++;
+		strlcpy(cptr->username, lookup->username, USERLEN + 1);
+		cptr->flags |= FLAGS_GOTID;
+	}
+	else if (lookup->flags & LOOKUP_IDENT_QUERIED)
+		ircstp->is_abad++;
+	cptr->flags &= ~(FLAGS_WRAUTH | FLAGS_AUTH);
+	if (!DoingDNS(cptr))
+		finish_auth(cptr);
+}
+
+/*
+ * Close the ident socket of cptr, if it has one, and take it off the
+ * list of running queries.
+ */
+void ident_close(aClient *cptr)
+{
+	if (cptr->authfd >= 0)
 	{
 		fd_close(cptr->authfd);
 		--OpenFiles;
 		cptr->authfd = -1;
+		list_del_init(&cptr->ident_node);
+		ident_count--;
 	}
+	free_identbuf(cptr);
+}
+
+/*
+ * The client goes on without an ident lookup: nothing was tried, so
+ * this is not counted as a failed one.
+ */
+static void ident_skip(aClient *cptr)
+{
+	cptr->flags &= ~(FLAGS_WRAUTH | FLAGS_AUTH);
+	if (!DoingDNS(cptr))
+		finish_auth(cptr);
+	if (SHOWCONNECTINFO && !cptr->serv && !IsServersOnlyListener(cptr->listener))
+		sendto_one(cptr, "%s", REPORT_FAIL_ID);
+}
+
+/*
+ * Time out ident queries that ran past their deadline, and drop
+ * expired entries from the cache.
+ */
+EVENT(ident_timeout)
+{
+	aClient *cptr, *next;
+	TS now = TStime();
+
+	list_for_each_entry_safe(cptr, next, &ident_list, ident_node)
+	{
+		if (cptr->ident_deadline > now)
+			continue;
+		Debug((DEBUG_NOTICE, "ident timeout for %s", get_client_name(cptr, TRUE)));
+		identcache_add(&cptr->ip);
+		ident_failed(cptr);
+	}
+
+	while (identcache_tail && (identcache_tail->expires <= now))
+		identcache_del(identcache_tail);
+}
+
+/*
+ * The ident reply is buffered in cptr->identbuf, which only exists
+ * while we are reading it: there is no need to carry it around in
+ * every local client.
+ */
+void free_identbuf(aClient *cptr)
+{
+	if (cptr->identbuf)
+	{
+		MyFree(cptr->identbuf);
+		cptr->identbuf = NULL;
+	}
+	cptr->count = 0;
+}
+
+void ident_failed(aClient *cptr)
+{
+	Debug((DEBUG_NOTICE, "ident_failed() for %x", cptr));
+	ircstp->is_abad++;
+	ident_close(cptr);
 	cptr->flags &= ~(FLAGS_WRAUTH | FLAGS_AUTH);
 	if (!DoingDNS(cptr))
 		finish_auth(cptr);
@@ -68,6 +276,8 @@ void ident_failed(aClient *cptr)
  * into 'non-blocking' mode.  Should the connect or any later phase of the
  * identifing process fail, it is aborted and the user is given a username
  * of "unknown".
+ * No query is made if the host is cached as having no ident server, or
+ * if set::ident::max-queries are already running.
  */
 void start_auth(aClient *cptr)
 {
@@ -83,6 +293,18 @@ void start_auth(aClient *cptr)
 	}
 	Debug((DEBUG_NOTICE, "start_auth(%x) fd=%d, status=%d",
 	    cptr, cptr->fd, cptr->status));
+	if (IDENT_CACHE_TIME && identcache_find(&cptr->ip))
+	{
+		ircstp->is_acache++;
+		ident_skip(cptr);
+		return;
+	}
+	if (ident_count >= IDENT_MAX_QUERIES)
+	{
+		ircstp->is_abusy++;
+		ident_skip(cptr);
+		return;
+	}
 	snprintf(buf, sizeof buf, "identd: %s", get_client_name(cptr, TRUE));
 	if ((cptr->authfd = fd_socket(AFINET, SOCK_STREAM, 0, buf)) == -1)
 	{
@@ -91,12 +313,15 @@ void start_auth(aClient *cptr)
 		ident_failed(cptr);
 		return;
 	}
-	if (++OpenFiles >= (MAXCONNECTIONS - 2))
+	fd_settype(cptr->authfd, FD_TYPE_IDENT);
+	++OpenFiles;
+	list_add_tail(&cptr->ident_node, &ident_list);
+	ident_count++;
+	cptr->ident_deadline = TStime() + IDENT_CONNECT_TIMEOUT;
+	if (OpenFiles >= (MAXCONNECTIONS - 2))
 	{
 		sendto_ops("Can't allocate fd, too many connections.");
-		fd_close(cptr->authfd);
-		--OpenFiles;
-		cptr->authfd = -1;
+		ident_failed(cptr);
 		return;
 	}
 
@@ -133,6 +358,7 @@ void start_auth(aClient *cptr)
 
 	if (connect(cptr->authfd, (struct sockaddr *)&sock, sizeof(sock)) == -1 && !(ERRNO == P_EWORKING))
 	{
+		identcache_add(&cptr->ip);
 		ident_failed(cptr);
 		return;
 	}
@@ -178,60 +404,49 @@ static void send_authports(int fd, int revents, void *data)
 	{
 		if (ERRNO == P_EAGAIN)
 			return; /* Not connected yet, try again later */
+		/* Connect failed: refused, unreachable, ... */
+		identcache_add(&cptr->ip);
 authsenderr:
 		ident_failed(cptr);
+		return;
 	}
 	cptr->flags &= ~FLAGS_WRAUTH;
+	cptr->ident_deadline = TStime() + IDENT_READ_TIMEOUT;
 
+	/* The query is sent once, stop asking for writability */
+	fd_setselect(cptr->authfd, FD_SELECT_WRITE, NULL, cptr);
 	fd_setselect(cptr->authfd, FD_SELECT_READ, read_authports, cptr);
 
 	return;
 }
 
 /*
- * read_authports
+ * ident_reply
  *
- * read the reply (if any) from the ident server we connected to.
- * The actual read processijng here is pretty weak - no handling of the reply
- * if it is fragmented by IP.
+ * Parse what was read so far of an ident reply: 'count' bytes in buf,
+ * which has room for IDENTBUFLEN, 'len' from the last read (0 if the
+ * server closed). Returns 0 if the reply isn't complete yet, 1 if it is,
+ * with the username in ruser, or an empty one.
+ * Also used by the intake workers (intake.c).
  */
-static void read_authports(int fd, int revents, void *userdata)
+int  ident_reply(char *buf, int count, int len, char *ruser)
 {
 	char *s, *t;
-	int  len;
-	char ruser[USERLEN + 1], system[8];
+	char system[8];
 	u_short remp = 0, locp = 0;
-	aClient *cptr = userdata;
 
 	*system = *ruser = '\0';
-	Debug((DEBUG_NOTICE, "read_authports(%x) fd %d authfd %d stat %d",
-	    cptr, cptr->fd, cptr->authfd, cptr->status));
-	/*
-	 * Nasty.  Cant allow any other reads from client fd while we're
-	 * waiting on the authfd to return a full valid string.  Use the
-	 * client's input buffer to buffer the authd reply.
-	 * Oh. this is needed because an authd reply may come back in more
-	 * than 1 read! -avalon
-	 */
-	  if ((len = READ_SOCK(cptr->authfd, cptr->buffer + cptr->count,
-		  sizeof(cptr->buffer) - 1 - cptr->count)) >= 0)
-	{
-		cptr->count += len;
-		cptr->buffer[cptr->count] = '\0';
-	}
-
-	cptr->lasttime = TStime();
-	if ((len > 0) && (cptr->count != (sizeof(cptr->buffer) - 1)) &&
-	    (sscanf(cptr->buffer, "%hd , %hd : USERID : %*[^:]: %10s",
+	if ((len > 0) && (count != (IDENTBUFLEN - 1)) &&
+	    (sscanf(buf, "%hd , %hd : USERID : %*[^:]: %10s",
 	    &remp, &locp, ruser) == 3))
 	{
-		s = rindex(cptr->buffer, ':');
+		s = rindex(buf, ':');
 		*s++ = '\0';
-		for (t = (rindex(cptr->buffer, ':') + 1); *t; t++)
+		for (t = (rindex(buf, ':') + 1); *t; t++)
 			if (!isspace(*t))
 				break;
 		strlcpy(system, t, sizeof(system));
-		for (t = ruser; *s && *s != '@' && (t < ruser + sizeof(ruser));
+		for (t = ruser; *s && *s != '@' && (t < ruser + USERLEN);
 		    s++)
 			if (!isspace(*s) && *s != ':')
 				*t++ = *s;
@@ -240,26 +455,67 @@ static void read_authports(int fd, int revents, void *userdata)
 	}
 	else if (len != 0)
 	{
-		if (!index(cptr->buffer, '\n') && !index(cptr->buffer, '\r'))
-			return;
+		if (!index(buf, '\n') && !index(buf, '\r'))
+			return 0;
 		Debug((DEBUG_ERROR, "local %d remote %d", locp, remp));
-		Debug((DEBUG_ERROR, "bad auth reply in [%s]", cptr->buffer));
+		Debug((DEBUG_ERROR, "bad auth reply in [%s]", buf));
 		*ruser = '\0';
 	}
-    fd_close(cptr->authfd);
-    --OpenFiles;
-    cptr->authfd = -1;
-	cptr->count = 0;
+	if (!locp || !remp)
+		*ruser = '\0';
+	return 1;
+}
+
+/*
+ * read_authports
+ *
+ * read the reply (if any) from the ident server we connected to.
+ * The actual read processijng here is pretty weak - no handling of the reply
+ * if it is fragmented by IP.
+ */
+static void read_authports(int fd, int revents, void *userdata)
+{
+	int  len;
+	char ruser[USERLEN + 1];
+	aClient *cptr = userdata;
+
+	Debug((DEBUG_NOTICE, "read_authports(%x) fd %d authfd %d stat %d",
+	    cptr, cptr->fd, cptr->authfd, cptr->status));
+	/*
+	 * Nasty.  Cant allow any other reads from client fd while we're
+	 * waiting on the authfd to return a full valid string.  Buffer
+	 * the authd reply, this is needed because an authd reply may come
+	 * back in more than 1 read! -avalon
+	 */
+	if (!cptr->identbuf)
+	{
+		cptr->identbuf = MyMalloc(IDENTBUFLEN);
+		cptr->count = 0;
+	}
+	if ((len = READ_SOCK(cptr->authfd, cptr->identbuf + cptr->count,
+	    IDENTBUFLEN - 1 - cptr->count)) >= 0)
+	{
+		cptr->count += len;
+		cptr->identbuf[cptr->count] = '\0';
+	}
+
+	cptr->lasttime = TStime();
+	if (!ident_reply(cptr->identbuf, cptr->count, len, ruser))
+		return;
+	/* Closed without a word: there is no ident server listening */
+	if ((len == 0) && (cptr->count == 0))
+		identcache_add(&cptr->ip);
+	if (len > 0)
+		Debug((DEBUG_INFO, "ident reply: [%s]", cptr->identbuf));
+	ident_close(cptr);
 	ClearAuth(cptr);
 	if (!DoingDNS(cptr))
 		finish_auth(cptr);
-	if (len > 0)
-		Debug((DEBUG_INFO, "ident reply: [%s]", cptr->buffer));
 
 	if (SHOWCONNECTINFO && !cptr->serv && !IsServersOnlyListener(cptr->listener))
 		sendto_one(cptr, "%s", REPORT_FIN_ID);
 
-	if (!locp || !remp || !*ruser)
+	if (!*ruser)
 	{
 		ircstp->is_abad++;
 		return;
@@ -115,7 +115,7 @@ MODVAR TS last_allinuse = 0;
 # endif
 #endif
 
-void start_of_normal_client_handshake(aClient *acptr);
+void start_of_normal_client_handshake(aClient *acptr, IntakeLookup *lookup);
 void proceed_normal_client_handshake(aClient *acptr, struct hostent *he);
 
 /* winlocal */
@@ -274,21 +274,113 @@ void report_baderror(char *text, aClient *cptr)
  * depending on the IP# mask given by 'name'.  Returns the fd of the
  * socket created or -1 on error.
  */
-static void listener_accept(int fd, int revents, void *data)
+/* At most this many connections are taken per listener_accept() call */
+#define ACCEPT_BATCH	64
+
+/*
+ * The checks that only need the peer address: unknown connections per
+ * IP, ban ip { }, Z:Lines and throttling. They are done right after
+ * accept(), so a connection we refuse costs no client, DNS or ident
+ * lookup. The checks want an aClient, they get 'probe', which has
+ * nothing but the address filled in.
+ * Returns 1 if the connection may go on, 0 if it is refused, in which
+ * case the error to send is in zlinebuf.
+ */
+static aClient probe;
+
+static void set_probe(struct SOCKADDR_IN *addr)
 {
-	ConfigItem_listen *cptr = data;
-	int cli_fd;
+	if (!probe.from)
+	{
+		probe.from = &probe;
+		probe.status = STAT_UNKNOWN;
+		probe.fd = -1;
+		probe.authfd = -1;
+		strcpy(probe.username, "unknown");
+	}
+	bcopy((char *)&addr->SIN_ADDR, (char *)&probe.ip, sizeof(struct IN_ADDR));
+	get_sockhost(&probe, Inet_si2p(addr));
+}
 
-	if ((cli_fd = fd_accept(cptr->fd)) < 0)
+/*
+ * Only ban ip { }: it comes from the configuration file, so an intake
+ * worker's copy of it is as good as ours until the next /REHASH, which
+ * replaces the workers (intake.c). Z:Lines come and go at any time and
+ * are only checked here.
+ */
+int  check_peer_banip(struct SOCKADDR_IN *addr)
+{
+	ConfigItem_ban *bconf;
+
+	set_probe(addr);
+	if ((bconf = Find_ban(&probe, Inet_ia2p(&probe.ip), CONF_BAN_IP)))
 	{
-	        if ((ERRNO != P_EWOULDBLOCK) && (ERRNO != P_ECONNABORTED))
-			report_baderror("Cannot accept connections %s:%s", NULL);
-		return;
+		ircsnprintf(zlinebuf, sizeof(zlinebuf),
+			"ERROR :Closing Link: [%s] (You are not welcome on "
+			"this server: %s. Email %s for more information.)\r\n",
+			Inet_ia2p(&probe.ip),
+			bconf->reason ? bconf->reason : "no reason",
+			KLINE_ADDRESS);
+		return 0;
 	}
+	return 1;
+}
+
+static int check_peer_address(struct SOCKADDR_IN *addr)
+{
+	aClient *acptr;
+	int  j = 1, val;
+
+	set_probe(addr);
+	list_for_each_entry(acptr, &unknown_list, lclient_node)
+#ifndef INET6
+		if (acptr->ip.S_ADDR == probe.ip.S_ADDR)
+#else
+		if (!bcmp(acptr->ip.S_ADDR, probe.ip.S_ADDR, sizeof(probe.ip.S_ADDR)))
+#endif
+		{
+			j++;
+			if (j > MAXUNKNOWNCONNECTIONSPERIP)
+			{
+				ircsnprintf(zlinebuf, sizeof(zlinebuf),
+					"ERROR :Closing Link: [%s] (Too many unknown connections from your IP)"
+					"\r\n",
+					Inet_ia2p(&probe.ip));
+				return 0;
+			}
+		}
 
+	if (!check_peer_banip(addr))
+		return 0;
+
+	if (find_tkline_match_zap(&probe) != -1)
+		return 0;
+
+	if (!(val = throttle_can_connect(&probe, &probe.ip)))
+	{
+		ircsnprintf(zlinebuf, sizeof(zlinebuf),
+			"ERROR :Closing Link: [%s] (Throttled: Reconnecting too fast) -"
+				"Email %s for more information.\r\n",
+				Inet_ia2p(&probe.ip),
+				KLINE_ADDRESS);
+		return 0;
+	}
+	else if (val == 1)
+		add_throttling_bucket(&probe.ip);
+
+	return 1;
+}
+
+/*
+ * A connection was accepted on 'cptr' (by us, or by an intake worker,
+ * which passes what it looked up in 'lookup'), check it and make a
+ * client of it.
+ */
+void accept_connection(ConfigItem_listen *cptr, int cli_fd, struct SOCKADDR_IN *addr, IntakeLookup *lookup)
+{
 	ircstp->is_ac++;
 
-	if ((++OpenFiles >= MAXCLIENTS) || (fd >= MAXCLIENTS))
+	if ((++OpenFiles >= MAXCLIENTS) || (cli_fd >= MAXCLIENTS))
 	{
 		ircstp->is_ref++;
 		if (last_allinuse < TStime() - 15)
@@ -304,10 +396,54 @@ static void listener_accept(int fd, int revents, void *data)
 		return;
 	}
 
-	 /*
-	  * Use of add_connection (which never fails :) meLazy
-	  */
-	(void) add_connection(cptr, cli_fd);
+	if (cptr->options & LISTENER_METRICS)
+	{
+		metrics_accept(cptr, cli_fd);
+		return;
+	}
+
+	if (!check_peer_address(addr))
+	{
+		ircstp->is_ref++;
+#ifndef HAVE_ACCEPT4
+		set_non_blocking(cli_fd, NULL);
+#endif
+		(void)send(cli_fd, zlinebuf, strlen(zlinebuf), 0);
+		fd_close(cli_fd);
+		--OpenFiles;
+		return;
+	}
+
+	/*
+	 * Use of add_connection (which never fails :) meLazy
+	 */
+	(void) add_connection(cptr, cli_fd, addr, lookup);
+}
+
+static void listener_accept(int fd, int revents, void *data)
+{
+	ConfigItem_listen *cptr = data;
+	struct SOCKADDR_IN addr;
+	int  cli_fd, len, i;
+
+	/*
+	 * Take what is waiting in the backlog, but not more than
+	 * ACCEPT_BATCH at a time, so a connect flood does not keep
+	 * everyone else waiting. The rest comes next time around.
+	 */
+	for (i = 0; i < ACCEPT_BATCH; i++)
+	{
+		len = sizeof(addr);
+		if ((cli_fd = fd_accept(cptr->fd, (struct SOCKADDR *)&addr, &len)) < 0)
+		{
+			if (ERRNO == P_ECONNABORTED)
+				continue;
+			if (ERRNO != P_EWOULDBLOCK)
+				report_baderror("Cannot accept connections %s:%s", NULL);
+			return;
+		}
+		accept_connection(cptr, cli_fd, &addr, NULL);
+	}
 }
 
 int  inetport(ConfigItem_listen *listener, char *name, int port)
@@ -341,6 +477,7 @@ int  inetport(ConfigItem_listen *listener, char *name, int port)
 	if (listener->fd == -1)
 	{
 		listener->fd = fd_socket(AFINET, SOCK_STREAM, 0, "Listener socket");
+		fd_settype(listener->fd, FD_TYPE_LISTENER);
 	}
 	if (listener->fd < 0)
 	{
@@ -359,6 +496,17 @@ int  inetport(ConfigItem_listen *listener, char *name, int port)
 	set_sock_opts(listener->fd, NULL);
 	set_non_blocking(listener->fd, NULL);
 
+#ifdef SO_REUSEPORT
+	/* The intake workers bind their own sockets to the same address */
+	if (intake_listener(listener))
+	{
+		int opt = 1;
+
+		if (setsockopt(listener->fd, SOL_SOCKET, SO_REUSEPORT, (OPT_TYPE *)&opt, sizeof(opt)) < 0)
+			report_error("setsockopt(SO_REUSEPORT) %s:%s", NULL);
+	}
+#endif
+
 	/*
 	 * Bind a port to listen for new connections if port is non-null,
 	 * else assume it is already open and try get something from it.
@@ -803,7 +951,7 @@ void completed_connection(int fd, int revents, void *data)
 	if (!IsDead(cptr))
 		start_auth(cptr);
 
-	fd_setselect(fd, FD_SELECT_READ, read_packet, cptr);
+	fd_setselect(fd, FD_SELECT_READ | FD_SELECT_EDGE, read_packet, cptr);
 }
 
 /*
@@ -889,12 +1037,7 @@ void close_connection(aClient *cptr)
 		    HANGONRETRYDELAY : aconf->class->connfreq;
 	}
 
-	if (cptr->authfd >= 0)
-	{
-		fd_close(cptr->authfd);
-		cptr->authfd = -1;
-		--OpenFiles;
-	}
+	ident_close(cptr);
 
 	if (cptr->fd >= 0)
 	{
@@ -906,7 +1049,10 @@ void close_connection(aClient *cptr)
 			cptr->ssl = NULL;
 		}
 
-		fd_close(cptr->fd);
+		if (IsIOThread(cptr))
+			ioth_detach(cptr);
+		else
+			fd_close(cptr->fd);
 		cptr->fd = -2;
 		--OpenFiles;
 		DBufClear(&cptr->sendQ);
@@ -919,6 +1065,109 @@ void close_connection(aClient *cptr)
 	return;
 }
 
+static void set_sock_bufs(int fd, aClient *cptr, int sndbuf, int rcvbuf)
+{
+#ifdef	SO_RCVBUF
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (OPT_TYPE *)&rcvbuf, sizeof(rcvbuf)) < 0)
+		report_error("setsockopt(SO_RCVBUF) %s:%s", cptr);
+#endif
+#ifdef	SO_SNDBUF
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (OPT_TYPE *)&sndbuf, sizeof(sndbuf)) < 0)
+		report_error("setsockopt(SO_SNDBUF) %s:%s", cptr);
+#endif
+	cptr->sndbuf = sndbuf;
+	cptr->sndbuf_full = 0;
+}
+
+/*
+** set_class_sock_opts
+**	Socket options from the class (and link block, for servers) of
+**	a connection, once we know which one that is. For an outgoing
+**	server link this is done before connect(), so that a big receive
+**	buffer also gets a big enough window scale.
+*/
+void set_class_sock_opts(aClient *cptr, ConfigItem_class *class, ConfigItem_link *link)
+{
+	int  sndbuf = SOCKBUF_DEFAULT, rcvbuf = SOCKBUF_DEFAULT, opt;
+
+	if (cptr->fd < 0 || !class)
+		return;
+
+	if (class->sndbuf)
+		sndbuf = class->sndbuf;
+	if (class->rcvbuf)
+		rcvbuf = class->rcvbuf;
+	if (link && link->sndbuf)
+		sndbuf = link->sndbuf;
+	if (link && link->rcvbuf)
+		rcvbuf = link->rcvbuf;
+	if ((sndbuf != cptr->sndbuf) || (rcvbuf != SOCKBUF_DEFAULT))
+		set_sock_bufs(cptr->fd, cptr, sndbuf, rcvbuf);
+
+#ifdef TCP_NODELAY
+	if ((class->options & CLASS_OPT_NODELAY) || (link && (link->options & CONNECT_NODELAY)))
+	{
+		opt = 1;
+		if (setsockopt(cptr->fd, IPPROTO_TCP, TCP_NODELAY, (OPT_TYPE *)&opt, sizeof(opt)) < 0)
+			report_error("setsockopt(TCP_NODELAY) %s:%s", cptr);
+	}
+#endif
+}
+
+#if defined(TCP_CORK)
+# define SOCK_CORK	TCP_CORK
+#elif defined(TCP_NOPUSH)
+# define SOCK_CORK	TCP_NOPUSH
+#endif
+
+static void set_cork(aClient *cptr, int on)
+{
+#ifdef SOCK_CORK
+	ConfigItem_link *link = cptr->serv ? cptr->serv->conf : NULL;
+
+	if (cptr->fd < 0)
+		return;
+	if ((cptr->class && (cptr->class->options & CLASS_OPT_CORK)) ||
+	    (link && (link->options & CONNECT_CORK)))
+		(void)setsockopt(cptr->fd, IPPROTO_TCP, SOCK_CORK, (OPT_TYPE *)&on, sizeof(on));
+#endif
+}
+
+/*
+** burst_begin, burst_end, burst_drained
+**	Keep track of how long the burst to and from a directly linked
+**	server takes (/STATS l). Ours is sent when it left our sendQ,
+**	theirs is received when their EOS arrives (m_eos). With the cork
+**	option the socket only sends full segments while we burst.
+*/
+static unsigned long sent_bytes(aClient *cptr)
+{
+	return (unsigned long)cptr->sendK * 1024 + cptr->sendB;
+}
+
+void burst_begin(aClient *cptr)
+{
+	cptr->serv->burst_start = profile_clock();
+	cptr->serv->burst_sent = cptr->serv->burst_received = 0;
+	cptr->serv->burst_bytes = sent_bytes(cptr) + DBufLength(&cptr->sendQ);
+	set_cork(cptr, 1);
+}
+
+void burst_end(aClient *cptr)
+{
+	set_cork(cptr, 0);
+	cptr->serv->flags.burst_queued = 1;
+	if (DBufLength(&cptr->sendQ) == 0)
+		burst_drained(cptr);
+}
+
+void burst_drained(aClient *cptr)
+{
+	cptr->serv->flags.burst_queued = 0;
+	cptr->serv->burst_sent = profile_clock() - cptr->serv->burst_start;
+	cptr->serv->burst_bytes = sent_bytes(cptr) - cptr->serv->burst_bytes;
+}
+
 /*
 ** set_sock_opts
 */
@@ -957,25 +1206,13 @@ void set_sock_opts(int fd, aClient *cptr)
 	    sizeof(opt)) < 0)
 		report_error("setsockopt(SO_USELOOPBACK) %s:%s", cptr);
 #endif
-#ifdef	SO_RCVBUF
-	opt = 8192;
-	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (OPT_TYPE *)&opt,
-	    sizeof(opt)) < 0)
-		report_error("setsockopt(SO_RCVBUF) %s:%s", cptr);
-#endif
-#ifdef	SO_SNDBUF
-# ifdef	_SEQUENT_
-/* seems that Sequent freezes up if the receving buffer is a different size
- * to the sending buffer (maybe a tcp window problem too).
- */
-	opt = 8192;
-# else
-	opt = 8192;
-# endif
-	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (OPT_TYPE *)&opt,
-	    sizeof(opt)) < 0)
-		report_error("setsockopt(SO_SNDBUF) %s:%s", cptr);
-#endif
+	/* Not on listeners: a connection accepted from one starts with its
+	 * buffer sizes, and a small receive buffer at that time also limits
+	 * the TCP window scaling for the rest of the connection, whatever we
+	 * set later on (see set_class_sock_opts()).
+	 */
+	if (cptr)
+		set_sock_bufs(fd, cptr, SOCKBUF_DEFAULT, SOCKBUF_DEFAULT);
 #if defined(IP_OPTIONS) && defined(IPPROTO_IP) && !defined(INET6)
 	{
 		char *s = readbuf, *t = readbuf + sizeof(readbuf) / 2;
@@ -1094,108 +1331,15 @@ void set_non_blocking(int fd, aClient *cptr)
  * The client is added to the linked list of clients but isnt added to any
  * hash tables yuet since it doesnt have a name.
  */
-aClient *add_connection(ConfigItem_listen *cptr, int fd)
+aClient *add_connection(ConfigItem_listen *cptr, int fd, struct SOCKADDR_IN *addr, IntakeLookup *lookup)
 {
 	aClient *acptr;
-	ConfigItem_ban *bconf;
-	int i, j;
-	acptr = make_client(NULL, &me);
-
-	/* Removed preliminary access check. Full check is performed in
-	 * m_server and m_user instead. Also connection time out help to
-	 * get rid of unwanted connections.
-	 */
-	{
-		struct SOCKADDR_IN addr;
-		aClient *acptr2;
-		int  len = sizeof(struct SOCKADDR_IN);
 
-		if (getpeername(fd, (struct SOCKADDR *)&addr, &len) == -1)
-		{
-			/* On Linux 2.4 and FreeBSD the socket may just have been disconnected
-			 * so it's not a serious error and can happen quite frequently -- Syzop
-			 */
-			if (ERRNO != P_ENOTCONN)
-				report_error("Failed in connecting to %s :%s", acptr);
-add_con_refuse:
-			ircstp->is_ref++;
-			acptr->fd = -2;
-			free_client(acptr);
-			fd_close(fd);
-			--OpenFiles;
-			return NULL;
-		}
-		/* don't want to add "Failed in connecting to" here.. */
-		/* Copy ascii address to 'sockhost' just in case. Then we
-		 * have something valid to put into error messages...
-		 */
-		get_sockhost(acptr, Inet_si2p(&addr));
-		bcopy((char *)&addr.SIN_ADDR, (char *)&acptr->ip, sizeof(struct IN_ADDR));
-		j = 1;
-
-		list_for_each_entry(acptr2, &unknown_list, lclient_node)
-#ifndef INET6
-			if (acptr2->ip.S_ADDR == acptr->ip.S_ADDR)
-#else
-			if (!bcmp(acptr2->ip.S_ADDR, acptr->ip.S_ADDR, sizeof(acptr->ip.S_ADDR)))
-#endif
-			{
-				j++;
-				if (j > MAXUNKNOWNCONNECTIONSPERIP)
-				{
-					ircsnprintf(zlinebuf, sizeof(zlinebuf),
-						"ERROR :Closing Link: [%s] (Too many unknown connections from your IP)"
-						"\r\n",
-						Inet_ia2p(&acptr->ip));
-					set_non_blocking(fd, acptr);
-					set_sock_opts(fd, acptr);
-					send(fd, zlinebuf, strlen(zlinebuf), 0);
-					goto add_con_refuse;
-				}
-			}
-
-		if ((bconf = Find_ban(acptr, Inet_ia2p(&acptr->ip), CONF_BAN_IP))) {
-			if (bconf)
-			{
-				ircsnprintf(zlinebuf, sizeof(zlinebuf),
-					"ERROR :Closing Link: [%s] (You are not welcome on "
-					"this server: %s. Email %s for more information.)\r\n",
-					Inet_ia2p(&acptr->ip),
-					bconf->reason ? bconf->reason : "no reason",
-					KLINE_ADDRESS);
-				set_non_blocking(fd, acptr);
-				set_sock_opts(fd, acptr);
-				send(fd, zlinebuf, strlen(zlinebuf), 0);
-				goto add_con_refuse;
-			}
-		}
-		else if (find_tkline_match_zap(acptr) != -1)
-		{
-			set_non_blocking(fd, acptr);
-			set_sock_opts(fd, acptr);
-			send(fd, zlinebuf, strlen(zlinebuf), 0);
-			goto add_con_refuse;
-		}
-		else
-		{
-			int val;
-			if (!(val = throttle_can_connect(acptr, &acptr->ip)))
-			{
-				ircsnprintf(zlinebuf, sizeof(zlinebuf),
-					"ERROR :Closing Link: [%s] (Throttled: Reconnecting too fast) -"
-						"Email %s for more information.\r\n",
-						Inet_ia2p(&acptr->ip),
-						KLINE_ADDRESS);
-				set_non_blocking(fd, acptr);
-				set_sock_opts(fd, acptr);
-				send(fd, zlinebuf, strlen(zlinebuf), 0);
-				goto add_con_refuse;
-			}
-			else if (val == 1)
-				add_throttling_bucket(&acptr->ip);
-		}
-		acptr->port = ntohs(addr.SIN_PORT);
-	}
+	/* The address was checked by check_peer_address() already */
+	acptr = make_client(NULL, &me);
+	get_sockhost(acptr, Inet_si2p(addr));
+	bcopy((char *)&addr->SIN_ADDR, (char *)&acptr->ip, sizeof(struct IN_ADDR));
+	acptr->port = ntohs(addr->SIN_PORT);
 
 	acptr->fd = fd;
 	acptr->listener = cptr;
@@ -1203,7 +1347,9 @@ add_con_refuse:
 		acptr->listener->clients++;
 	add_client_to_list(acptr);
 
+#ifndef HAVE_ACCEPT4
 	set_non_blocking(acptr->fd, acptr);
+#endif
 	set_sock_opts(acptr->fd, acptr);
 	IRCstats.unknown++;
 
@@ -1218,6 +1364,7 @@ add_con_refuse:
 		acptr->flags |= FLAGS_SSL;
 		SSL_set_fd(acptr->ssl, fd);
 		SSL_set_nonblocking(acptr->ssl);
+		ssl_want_ktls(acptr);
 		if (!ircd_SSL_accept(acptr, fd)) {
 			Debug((DEBUG_DEBUG, "Failed SSL accept handshake in instance 1: %s", acptr->sockhost));
 			SSL_set_shutdown(acptr->ssl, SSL_RECEIVED_SHUTDOWN);
@@ -1227,13 +1374,25 @@ add_con_refuse:
 	  	}
 	}
 	else
-		start_of_normal_client_handshake(acptr);
+		start_of_normal_client_handshake(acptr, lookup);
 	return acptr;
+
+add_con_refuse:
+	ircstp->is_ref++;
+	acptr->fd = -2;
+	free_client(acptr);
+	fd_close(fd);
+	--OpenFiles;
+	return NULL;
 }
 
 static int dns_special_flag = 0; /* This is for an "interesting" race condition / fuck up issue.. very ugly. */
 
-void	start_of_normal_client_handshake(aClient *acptr)
+/*
+ * The DNS and ident lookups are started here, unless an intake worker
+ * did them already and passed the results in 'lookup'.
+ */
+void	start_of_normal_client_handshake(aClient *acptr, IntakeLookup *lookup)
 {
 struct hostent *he;
 
@@ -1242,7 +1401,9 @@ struct hostent *he;
 
 	RunHook(HOOKTYPE_HANDSHAKE, acptr);
 
-	if (!DONT_RESOLVE)
+	if (lookup && (lookup->flags & LOOKUP_DNS))
+		acptr->hostp = unrealdns_intake(acptr, lookup);
+	else if (!DONT_RESOLVE)
 	{
 		if (SHOWCONNECTINFO && !acptr->serv && !IsServersOnlyListener(acptr->listener))
 			sendto_one(acptr, "%s", REPORT_DO_DNS);
@@ -1266,8 +1427,13 @@ struct hostent *he;
 	}
 
 doauth:
-	start_auth(acptr);
-	fd_setselect(acptr->fd, FD_SELECT_READ, read_packet, acptr);
+	if (lookup && (lookup->flags & LOOKUP_IDENT))
+		ident_intake(acptr, lookup);
+	else
+		start_auth(acptr);
+	if (ioth_attach(acptr))
+		return;
+	fd_setselect(acptr->fd, FD_SELECT_READ | FD_SELECT_EDGE, read_packet, acptr);
 }
 
 void proceed_normal_client_handshake(aClient *acptr, struct hostent *he)
@@ -1320,12 +1486,83 @@ static int parse_client_queued(aClient *cptr)
 	return 0;
 }
 
+/*
+ * read_packet_data
+ *	Take 'length' bytes that were read from cptr: queue them, parse
+ *	what can be parsed and do the excess flood check.
+ *	Returns -1 if the client is gone.
+ */
+int  read_packet_data(aClient *cptr, char *buf, int length)
+{
+	time_t now = TStime();
+	Hook *h;
+
+	cptr->lasttime = now;
+	if (cptr->lasttime > cptr->since)
+		cptr->since = cptr->lasttime;
+	cptr->flags &= ~(FLAGS_PINGSENT | FLAGS_NONL);
+
+	for (h = Hooks[HOOKTYPE_RAWPACKET_IN]; h; h = h->next)
+	{
+		int v = (*(h->func.intfunc))(cptr, buf, length);
+		if (v < 0)
+			return -1;
+		if (v == 0)
+			return 0; /* dropped by a hook */
+	}
+
+	dbuf_put(&cptr->recvQ, buf, length);
+
+	/* parse some of what we have */
+	if (!(DoingDNS(cptr) || DoingAuth(cptr)))
+		if (parse_client_queued(cptr) == FLUSH_BUFFER)
+			return -1;
+
+	/* excess flood check */
+	if (IsPerson(cptr) && DBufLength(&cptr->recvQ) > get_recvq(cptr))
+	{
+		sendto_snomask(SNO_FLOOD,
+		    "*** Flood -- %s!%s@%s (%d) exceeds %d recvQ",
+		    cptr->name[0] ? cptr->name : "*",
+		    cptr->user ? cptr->user->username : "*",
+		    cptr->user ? cptr->user->realhost : "*",
+		    DBufLength(&cptr->recvQ), get_recvq(cptr));
+		exit_client(cptr, cptr, cptr, "Excess Flood");
+		return -1;
+	}
+	return 0;
+}
+
+/* What fd_setrecv() received for a registered plaintext connection */
+static void read_packet_recv(int fd, char *buf, int length, void *data)
+{
+	aClient *cptr = data;
+
+	if (length <= 0)
+	{
+		SET_ERRNO(length < 0 ? -length : 0);
+		exit_client(cptr, cptr, cptr, "Read error");
+		return;
+	}
+	(void)read_packet_data(cptr, buf, length);
+}
+
+/*
+ * Once registered, a plaintext connection is read with completions if
+ * the backend can (io_uring): the data comes with the event, no recv()
+ * per read.  Not before, STARTTLS and the I/O threads want the socket.
+ */
+static void read_packet_switch(aClient *cptr)
+{
+	if (IsRegistered(cptr) && !(IsSSL(cptr) && cptr->ssl) &&
+	    fd_setrecv(cptr->fd, read_packet_recv, cptr))
+		fd_setselect(cptr->fd, FD_SELECT_READ, NULL, cptr);
+}
+
 void read_packet(int fd, int revents, void *data)
 {
 	aClient *cptr = data;
 	int length = 0;
-	time_t now = TStime();
-	Hook *h;
 
 	SET_ERRNO(0);
 
@@ -1333,8 +1570,12 @@ void read_packet(int fd, int revents, void *data)
 	{
 		if (IsSSL(cptr) && cptr->ssl != NULL)
 		{
-			fd_setselect(fd, FD_SELECT_READ, read_packet, cptr);
-			fd_setselect(fd, FD_SELECT_WRITE, NULL, cptr);
+			/* The last SSL_read() had to write first, back to reading */
+			if (fd_table[fd].write_callback == read_packet)
+			{
+				fd_setselect(fd, FD_SELECT_READ, read_packet, cptr);
+				fd_setselect(fd, FD_SELECT_WRITE, NULL, cptr);
+			}
 
 			length = SSL_read(cptr->ssl, readbuf, sizeof(readbuf));
 
@@ -1347,10 +1588,10 @@ void read_packet(int fd, int revents, void *data)
 				case SSL_ERROR_WANT_WRITE:
 					fd_setselect(fd, FD_SELECT_READ, NULL, cptr);
 					fd_setselect(fd, FD_SELECT_WRITE, read_packet, cptr);
+					SET_ERRNO(P_EAGAIN);
 					break;
 				case SSL_ERROR_WANT_READ:
-					fd_setselect(fd, FD_SELECT_READ, read_packet, cptr);
-					fd_setselect(fd, FD_SELECT_WRITE, NULL, cptr);
+					SET_ERRNO(P_EAGAIN);
 					break;
 				case SSL_ERROR_SYSCALL:
 					break;
@@ -1370,47 +1611,26 @@ void read_packet(int fd, int revents, void *data)
 		if (length <= 0)
 		{
 			if (length < 0 && (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN || ERRNO == P_EINTR))
+			{
+				read_packet_switch(cptr);
 				return;
+			}
 
 			exit_client(cptr, cptr, cptr, "Read error");
 			return;
 		}
 
-		cptr->lasttime = now;
-		if (cptr->lasttime > cptr->since)
-			cptr->since = cptr->lasttime;
-		cptr->flags &= ~(FLAGS_PINGSENT | FLAGS_NONL);
-
-		for (h = Hooks[HOOKTYPE_RAWPACKET_IN]; h; h = h->next)
-		{
-			int v = (*(h->func.intfunc))(cptr, readbuf, length);
-			if (v <= 0)
-				return;
-		}
-
-		dbuf_put(&cptr->recvQ, readbuf, length);
-
-		/* parse some of what we have */
-		if (!(DoingDNS(cptr) || DoingAuth(cptr)))
-			if (parse_client_queued(cptr) == FLUSH_BUFFER)
-				return;
+		if (read_packet_data(cptr, readbuf, length) < 0)
+			return;
 
-		/* excess flood check */
-		if (IsPerson(cptr) && DBufLength(&cptr->recvQ) > get_recvq(cptr))
+		/* bail on short read! Not for SSL: more records may be waiting,
+		 * read until SSL_read() wants more, as FD_SELECT_EDGE promises.
+		 */
+		if (length < sizeof(readbuf) && !(IsSSL(cptr) && cptr->ssl))
 		{
-			sendto_snomask(SNO_FLOOD,
-			    "*** Flood -- %s!%s@%s (%d) exceeds %d recvQ",
-			    cptr->name[0] ? cptr->name : "*",
-			    cptr->user ? cptr->user->username : "*",
-			    cptr->user ? cptr->user->realhost : "*",
-			    DBufLength(&cptr->recvQ), get_recvq(cptr));
-			exit_client(cptr, cptr, cptr, "Excess Flood");
+			read_packet_switch(cptr);
 			return;
 		}
-
-		/* bail on short read! */
-		if (length < sizeof(readbuf))
-			return;
 	}
 }
 
@@ -1490,6 +1710,7 @@ int  connect_server(ConfigItem_link *aconf, aClient *by, struct hostent *hp)
 	}
 	set_non_blocking(cptr->fd, cptr);
 	set_sock_opts(cptr->fd, cptr);
+	set_class_sock_opts(cptr, aconf->class, aconf);
 
 	if (connect(cptr->fd, svp, len) < 0 && errno != EINPROGRESS)
 	{
@@ -1566,6 +1787,7 @@ static struct SOCKADDR *connect_inet(ConfigItem_link *aconf, aClient *cptr, int
 	 */
 	snprintf(buf, sizeof buf, "Outgoing connection: %s", get_client_name(cptr, TRUE));
 	cptr->fd = fd_socket(AFINET, SOCK_STREAM, 0, buf);
+	fd_settype(cptr->fd, FD_TYPE_SERVER);
 	if (cptr->fd < 0)
 	{
 		if (ERRNO == P_EMFILE)
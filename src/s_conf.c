@@ -225,6 +225,8 @@ static OperFlag _ListenerFlags[] = {
 	{ LISTENER_CLIENTSONLY,  "clientsonly"},
 	{ LISTENER_DEFER_ACCEPT, "defer-accept"},
 	{ LISTENER_JAVACLIENT, 	 "java"},
+	{ LISTENER_KTLS,	 "ktls"},
+	{ LISTENER_METRICS,	 "metrics"},
 	{ LISTENER_SERVERSONLY,  "serversonly"},
 	{ LISTENER_SSL, 	 "ssl"},
 	{ LISTENER_NORMAL, 	 "standard"},
@@ -233,12 +235,21 @@ static OperFlag _ListenerFlags[] = {
 /* This MUST be alphabetized */
 static OperFlag _LinkFlags[] = {
 	{ CONNECT_AUTO,	"autoconnect" },
+	{ CONNECT_CORK,	"cork" },
+	{ CONNECT_KTLS,	"ktls" },
+	{ CONNECT_NODELAY, "nodelay" },
 	{ CONNECT_NODNSCACHE, "nodnscache" },
 	{ CONNECT_NOHOSTCHECK, "nohostcheck" },
 	{ CONNECT_QUARANTINE, "quarantine"},
 	{ CONNECT_SSL,	"ssl"		  },
 };
 
+/* This MUST be alphabetized */
+static OperFlag _ClassFlags[] = {
+	{ CLASS_OPT_CORK,	"cork" },
+	{ CLASS_OPT_NODELAY,	"nodelay" },
+};
+
 /* This MUST be alphabetized */
 static OperFlag _LogFlags[] = {
 	{ LOG_CHGCMDS, "chg-commands" },
@@ -1222,6 +1233,7 @@ void	free_iConf(aConfiguration *i)
 	ircfree(i->x_server_key_pem);
 	ircfree(i->x_server_cipher_list);
 	ircfree(i->trusted_ca_file);
+	ircfree(i->ssl_ticket_key_file);
 	ircfree(i->restrict_usermodes);
 	ircfree(i->restrict_channelmodes);
 	ircfree(i->restrict_extendedbans);
@@ -1253,6 +1265,8 @@ void config_setdefaultsettings(aConfiguration *i)
 	i->oper_snomask = strdup(SNO_DEFOPER);
 	i->ident_read_timeout = 30;
 	i->ident_connect_timeout = 10;
+	i->ident_max_queries = 256;
+	i->ident_cache_time = 60;
 	i->nick_count = 3; i->nick_period = 60; /* nickflood protection: max 3 per 60s */
 #ifdef NO_FLOOD_AWAY
 	i->away_count = 4; i->away_period = 120; /* awayflood protection: max 4 per 120s */
@@ -1266,6 +1280,7 @@ void config_setdefaultsettings(aConfiguration *i)
 	i->spamfilter_detectslow_warn = 250;
 	i->spamfilter_detectslow_fatal = 500;
 	i->maxdccallow = 10;
+	i->whowas_history_length = NICKNAMEHISTORYLENGTH;
 	i->channel_command_prefix = strdup("`!.");
 	i->check_target_nick_bans = 1;
 	i->maxbans = 60;
@@ -1284,6 +1299,10 @@ void config_setdefaultsettings(aConfiguration *i)
 	i->max_ts_delta = 30;
 	i->ratelimit_time_simple = 1;
 	i->ratelimit_time = 10;
+	i->ssl_session_cache_size = 20000;
+	i->ssl_session_timeout = 3600; /* 1h */
+	i->ssl_ticket_key_file = strdup("ssl.tickets");
+	i->ssl_ticket_key_rotate = 43200; /* 12h */
 }
 
 /* 1: needed for set::options::allow-part-if-shunned,
@@ -2072,6 +2091,8 @@ int	config_run()
 	}
 
 	check_tkls();
+	whowas_resize(WHOWAS_HISTORY_LENGTH);
+	ssl_session_settings();
 
 	/* initialize conf_files with defaults if the block isn't set: */
 	if(!conf_files)
@@ -2515,6 +2536,7 @@ int	AllowClient(aClient *cptr, struct hostent *hp, char *sockhost, char *usernam
 		{
 			cptr->class = aconf->class;
 			cptr->class->clients++;
+			set_class_sock_opts(cptr, cptr->class, NULL);
 		}
 		else
 		{
@@ -3374,6 +3396,7 @@ int	_conf_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 {
 	ConfigEntry *cep, *cep2;
 	ConfigItem_class *class;
+	OperFlag *ofp;
 	unsigned char isnew = 0;
 
 	if (!(class = Find_class(ce->ce_vardata)))
@@ -3391,6 +3414,7 @@ int	_conf_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 	ircstrdup(class->name, ce->ce_vardata);
 
 	class->connfreq = 60; /* default */
+	class->sndbuf = class->rcvbuf = class->sndbuf_max = class->send_batch = 0;
 
 	for (cep = ce->ce_entries; cep; cep = cep->ce_next)
 	{
@@ -3404,10 +3428,19 @@ int	_conf_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			class->sendq = atol(cep->ce_vardata);
 		else if (!strcmp(cep->ce_varname, "recvq"))
 			class->recvq = atol(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "sndbuf"))
+			class->sndbuf = atol(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "rcvbuf"))
+			class->rcvbuf = atol(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "sndbuf-max"))
+			class->sndbuf_max = atol(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "send-batch"))
+			class->send_batch = atol(cep->ce_vardata);
 		else if (!strcmp(cep->ce_varname, "options"))
 		{
 			for (cep2 = cep->ce_entries; cep2; cep2 = cep2->ce_next)
-				;
+				if ((ofp = config_binary_flags_search(_ClassFlags, cep2->ce_varname, ARRAY_SIZEOF(_ClassFlags))))
+					class->options |= ofp->flag;
 		}
 	}
 	if (isnew)
@@ -3420,7 +3453,7 @@ int	_test_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 	ConfigEntry 	*cep, *cep2;
 	int		errors = 0;
 	char has_pingfreq = 0, has_connfreq = 0, has_maxclients = 0, has_sendq = 0;
-	char has_recvq = 0;
+	char has_recvq = 0, has_sndbuf = 0, has_rcvbuf = 0, has_sndbuf_max = 0, has_send_batch = 0;
 
 	if (!ce->ce_vardata)
 	{
@@ -3439,6 +3472,7 @@ int	_test_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 		{
 			for (cep2 = cep->ce_entries; cep2; cep2 = cep2->ce_next)
 			{
+				if (!config_binary_flags_search(_ClassFlags, cep2->ce_varname, ARRAY_SIZEOF(_ClassFlags)))
 				{
 					config_error("%s:%d: Unknown option '%s' in class::options",
 						cep2->ce_fileptr->cf_filename, cep2->ce_varlinenum, cep2->ce_varname);
@@ -3546,6 +3580,49 @@ int	_test_class(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 				errors++;
 			}
 		}
+		/* class::sndbuf, class::rcvbuf, class::sndbuf-max */
+		else if (!strcmp(cep->ce_varname, "sndbuf") || !strcmp(cep->ce_varname, "rcvbuf") ||
+		         !strcmp(cep->ce_varname, "sndbuf-max"))
+		{
+			char *has = !strcmp(cep->ce_varname, "sndbuf") ? &has_sndbuf :
+			            !strcmp(cep->ce_varname, "rcvbuf") ? &has_rcvbuf : &has_sndbuf_max;
+			char name[32];
+			long l;
+			if (*has)
+			{
+				ircsnprintf(name, sizeof(name), "class::%s", cep->ce_varname);
+				config_warn_duplicate(cep->ce_fileptr->cf_filename, 
+					cep->ce_varlinenum, name);
+				continue;
+			}
+			*has = 1;
+			l = atol(cep->ce_vardata);
+			if ((l < 1024) || (l > 67108864))
+			{
+				config_error("%s:%i: class::%s with illegal value (must be between 1024 and 64M)",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum, cep->ce_varname);
+				errors++;
+			}
+		}
+		/* class::send-batch */
+		else if (!strcmp(cep->ce_varname, "send-batch"))
+		{
+			long l;
+			if (has_send_batch)
+			{
+				config_warn_duplicate(cep->ce_fileptr->cf_filename, 
+					cep->ce_varlinenum, "class::send-batch");
+				continue;
+			}
+			has_send_batch = 1;
+			l = atol(cep->ce_vardata);
+			if ((l < 0) || (l > 65536))
+			{
+				config_error("%s:%i: class::send-batch with illegal value (must be between 0 and 64k)",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+		}
 		/* Unknown */
 		else
 		{
@@ -4141,6 +4218,20 @@ int	_test_listen(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 					errors++;
 					continue;
 				}
+				if (!strcmp(cepp->ce_varname, "metrics") && !strcmp(ip, "*"))
+				{
+					config_warn("%s:%i: listen::options::metrics on '*', the metrics page "
+						"will be reachable by anyone, consider binding it to 127.0.0.1",
+						cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+				}
+#ifndef SSL_OP_ENABLE_KTLS
+				if (!strcmp(cepp->ce_varname, "ktls"))
+				{
+					config_warn("%s:%i: listen::options::ktls: OpenSSL is too old for kernel TLS, "
+						"connections will use normal SSL",
+						cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+				}
+#endif
 			}
 		}
 		else
@@ -5107,7 +5198,7 @@ int _conf_spamfilter(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 {
 	ConfigEntry *cep;
 	ConfigEntry *cepp;
-	aTKline *nl = MyMallocEx(sizeof(aTKline));
+	aTKline *nl = make_tkl();
 	char *word = NULL, *reason = NULL, *bantime = NULL;
 	int action = 0, target = 0;
 	char has_reason = 0, has_bantime = 0;
@@ -5573,6 +5664,10 @@ int	_conf_link(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			link->leafdepth = atol(cep->ce_vardata);
 		else if (!strcmp(cep->ce_varname, "ciphers"))
 			link->ciphers = strdup(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "sndbuf"))
+			link->sndbuf = atol(cep->ce_vardata);
+		else if (!strcmp(cep->ce_varname, "rcvbuf"))
+			link->rcvbuf = atol(cep->ce_vardata);
 	}
 	AddListItem(link, conf_link);
 	return 0;
@@ -5589,6 +5684,7 @@ int	_test_link(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 	char has_options = 0;
 	char has_autoconnect = 0;
 	char has_hostname_wildcards = 0;
+	char has_sndbuf = 0, has_rcvbuf = 0;
 	if (!ce->ce_vardata)
 	{
 		config_error("%s:%i: link without servername",
@@ -5647,6 +5743,14 @@ int	_test_link(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 				{
 					has_autoconnect = 1;
 				}
+#ifndef SSL_OP_ENABLE_KTLS
+				if (ofp->flag == CONNECT_KTLS)
+				{
+					config_warn("%s:%i: link::options::ktls: OpenSSL is too old for kernel TLS, "
+						"the link will use normal SSL",
+						cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+				}
+#endif
 			}
 			continue;
 		}
@@ -5831,6 +5935,27 @@ int	_test_link(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			}
 			has_ciphers = 1;
 		}
+		else if (!strcmp(cep->ce_varname, "sndbuf") || !strcmp(cep->ce_varname, "rcvbuf"))
+		{
+			char *has = !strcmp(cep->ce_varname, "sndbuf") ? &has_sndbuf : &has_rcvbuf;
+			char name[32];
+			long l;
+			if (*has)
+			{
+				ircsnprintf(name, sizeof(name), "link::%s", cep->ce_varname);
+				config_warn_duplicate(cep->ce_fileptr->cf_filename, 
+					cep->ce_varlinenum, name);
+				continue;
+			}
+			*has = 1;
+			l = atol(cep->ce_vardata);
+			if ((l < 1024) || (l > 67108864))
+			{
+				config_error("%s:%i: link::%s with illegal value (must be between 1024 and 64M)",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum, cep->ce_varname);
+				errors++;
+			}
+		}
 		else
 		{
 			config_error_unknown(cep->ce_fileptr->cf_filename, cep->ce_varlinenum,
@@ -6072,7 +6197,7 @@ int     _conf_ban(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 	ca = MyMallocEx(sizeof(ConfigItem_ban));
 	if (!strcmp(ce->ce_vardata, "nick"))
 	{
-		aTKline *nl = MyMallocEx(sizeof(aTKline));
+		aTKline *nl = make_tkl();
 		nl->type = TKL_NICK;
 		for (cep = ce->ce_entries; cep; cep = cep->ce_next)
 		{
@@ -6275,6 +6400,12 @@ int	_conf_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			if (loop.ircd_booted)
 				IsupportSetValue(IsupportFind("SILENCE"), cep->ce_vardata);
 		}
+		else if (!strcmp(cep->ce_varname, "io-threads")) {
+			tempiConf.io_threads = atoi(cep->ce_vardata);
+		}
+		else if (!strcmp(cep->ce_varname, "intake-workers")) {
+			tempiConf.intake_workers = atoi(cep->ce_vardata);
+		}
 		else if (!strcmp(cep->ce_varname, "auto-join")) {
 			ircstrdup(tempiConf.auto_join_chans, cep->ce_vardata);
 		}
@@ -6374,6 +6505,9 @@ int	_conf_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 		else if (!strcmp(cep->ce_varname, "maxdccallow")) {
 			tempiConf.maxdccallow = atoi(cep->ce_vardata);
 		}
+		else if (!strcmp(cep->ce_varname, "whowas-history-length")) {
+			tempiConf.whowas_history_length = atoi(cep->ce_vardata);
+		}
 		else if (!strcmp(cep->ce_varname, "network-name")) {
 			char *tmp;
 			ircstrdup(tempiConf.network.x_ircnetwork, cep->ce_vardata);
@@ -6539,6 +6673,10 @@ int	_conf_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 					tempiConf.ident_connect_timeout = config_checkval(cepp->ce_vardata,CFG_TIME);
 				if (!strcmp(cepp->ce_varname, "read-timeout"))
 					tempiConf.ident_read_timeout = config_checkval(cepp->ce_vardata,CFG_TIME);
+				if (!strcmp(cepp->ce_varname, "max-queries"))
+					tempiConf.ident_max_queries = atoi(cepp->ce_vardata);
+				if (!strcmp(cepp->ce_varname, "cache-time"))
+					tempiConf.ident_cache_time = config_checkval(cepp->ce_vardata,CFG_TIME);
 			}
 		}
 		else if (!strcmp(cep->ce_varname, "spamfilter"))
@@ -6653,6 +6791,22 @@ int	_conf_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 				{
 					tempiConf.ssl_renegotiate_timeout = config_checkval(cepp->ce_vardata, CFG_TIME);
 				}
+				else if (!strcmp(cepp->ce_varname, "session-cache-size"))
+				{
+					tempiConf.ssl_session_cache_size = atoi(cepp->ce_vardata);
+				}
+				else if (!strcmp(cepp->ce_varname, "session-timeout"))
+				{
+					tempiConf.ssl_session_timeout = config_checkval(cepp->ce_vardata, CFG_TIME);
+				}
+				else if (!strcmp(cepp->ce_varname, "ticket-key-file"))
+				{
+					ircstrdup(tempiConf.ssl_ticket_key_file, cepp->ce_vardata);
+				}
+				else if (!strcmp(cepp->ce_varname, "ticket-key-rotate"))
+				{
+					tempiConf.ssl_ticket_key_rotate = config_checkval(cepp->ce_vardata, CFG_TIME);
+				}
 				else if (!strcmp(cepp->ce_varname, "options"))
 				{
 					tempiConf.ssl_options = 0;
@@ -6861,6 +7015,30 @@ int	_test_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			CheckNull(cep);
 			CheckDuplicate(cep, silence_limit, "silence-limit");
 		}
+		else if (!strcmp(cep->ce_varname, "io-threads")) {
+			int v;
+			CheckNull(cep);
+			CheckDuplicate(cep, io_threads, "io-threads");
+			v = atoi(cep->ce_vardata);
+			if ((v < 0) || (v > 64))
+			{
+				config_error("%s:%i: set::io-threads must be between 0 and 64",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+		}
+		else if (!strcmp(cep->ce_varname, "intake-workers")) {
+			int v;
+			CheckNull(cep);
+			CheckDuplicate(cep, intake_workers, "intake-workers");
+			v = atoi(cep->ce_vardata);
+			if ((v < 0) || (v > 32))
+			{
+				config_error("%s:%i: set::intake-workers must be between 0 and 32",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->ce_varname, "auto-join")) {
 			CheckNull(cep);
 			CheckDuplicate(cep, auto_join, "auto-join");
@@ -6965,6 +7143,16 @@ int	_test_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 			CheckNull(cep);
 			CheckDuplicate(cep, maxdccallow, "maxdccallow");
 		}
+		else if (!strcmp(cep->ce_varname, "whowas-history-length")) {
+			CheckNull(cep);
+			CheckDuplicate(cep, whowas_history_length, "whowas-history-length");
+			if ((atoi(cep->ce_vardata) < 1) || (atoi(cep->ce_vardata) > 1000000))
+			{
+				config_error("%s:%i: set::whowas-history-length must be between 1 and 1000000",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->ce_varname, "network-name")) {
 			char *p;
 			CheckNull(cep);
@@ -7387,6 +7575,30 @@ int	_test_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 					is_ok = 1;
 					CheckDuplicate(cepp, ident_read_timeout, "ident::read-timeout");
 				}
+				else if (!strcmp(cepp->ce_varname, "max-queries"))
+				{
+					int v = atoi(cepp->ce_vardata);
+					CheckDuplicate(cepp, ident_max_queries, "ident::max-queries");
+					if ((v < 1) || (v > 16384))
+					{
+						config_error("%s:%i: set::ident::max-queries value out of range (%d), should be between 1 and 16384.",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum, v);
+						errors++;
+					}
+					continue;
+				}
+				else if (!strcmp(cepp->ce_varname, "cache-time"))
+				{
+					int v = config_checkval(cepp->ce_vardata,CFG_TIME);
+					CheckDuplicate(cepp, ident_cache_time, "ident::cache-time");
+					if ((v < 0) || (v > 3600))
+					{
+						config_error("%s:%i: set::ident::cache-time value out of range (%d), should be between 0 and 3600.",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum, v);
+						errors++;
+					}
+					continue;
+				}
 				if (is_ok)
 				{
 					int v = config_checkval(cepp->ce_vardata,CFG_TIME);
@@ -7541,6 +7753,50 @@ int	_test_set(struct config_ops *ops, ConfigFile *conf, ConfigEntry *ce)
 				{
 					CheckDuplicate(cep, renegotiate_bytes, "ssl::renegotiate-bytes");
 				}
+				else if (!strcmp(cepp->ce_varname, "session-cache-size"))
+				{
+					CheckNull(cepp);
+					CheckDuplicate(cep, ssl_session_cache_size, "ssl::session-cache-size");
+					if (atoi(cepp->ce_vardata) < 0)
+					{
+						config_error("%s:%i: set::ssl::session-cache-size must be 0 or more",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+					}
+				}
+				else if (!strcmp(cepp->ce_varname, "session-timeout"))
+				{
+					CheckNull(cepp);
+					CheckDuplicate(cep, ssl_session_timeout, "ssl::session-timeout");
+					if (config_checkval(cepp->ce_vardata, CFG_TIME) < 1)
+					{
+						config_error("%s:%i: set::ssl::session-timeout must be at least 1 second",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+					}
+				}
+				else if (!strcmp(cepp->ce_varname, "ticket-key-file"))
+				{
+					/* "" is fine: do not keep the keys */
+					if (!cepp->ce_vardata)
+					{
+						config_error("%s:%i: missing parameter", cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+						continue;
+					}
+					CheckDuplicate(cep, ssl_ticket_key_file, "ssl::ticket-key-file");
+				}
+				else if (!strcmp(cepp->ce_varname, "ticket-key-rotate"))
+				{
+					CheckNull(cepp);
+					CheckDuplicate(cep, ssl_ticket_key_rotate, "ssl::ticket-key-rotate");
+					if (config_checkval(cepp->ce_vardata, CFG_TIME) < 60)
+					{
+						config_error("%s:%i: set::ssl::ticket-key-rotate must be at least 1 minute",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+					}
+				}
 				else if (!strcmp(cepp->ce_varname, "server-cipher-list"))
 				{
 					CheckNull(cepp);
@@ -8467,7 +8723,10 @@ int	rehash_internal(aClient *cptr, aClient *sptr, int sig)
 	}
 	loop.ircd_rehashing = 1; /* double checking.. */
 	if (init_conf(configfile, 1) == 0)
+	{
 		run_configuration();
+		intake_rehash();
+	}
 	if (sig == 1)
 		reread_motdsandrules();
 	unload_all_unused_snomasks();
@@ -52,6 +52,44 @@
 /***************************************************************************************
  * Backend-independent functions.  fd_setselect() and friends                          *
  ***************************************************************************************/
+MODVAR struct loop_stats loopstats;
+
+void loophist_add(LoopHistogram *hist, unsigned long long value)
+{
+	unsigned long long v = value;
+	int i = 0;
+
+	while (v && i < LOOPHIST_BUCKETS - 1)
+	{
+		v >>= 1;
+		i++;
+	}
+	hist->bucket[i]++;
+	hist->count++;
+	hist->sum += value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+/* Time a wait for events, fd_select() of each backend goes through here */
+#define LOOPSTAT_WAIT(call) do { \
+	unsigned long long wait_start = profile_clock(); \
+	call; \
+	loopstats.lastwait = profile_clock() - wait_start; \
+	loophist_add(&loopstats.wait, loopstats.lastwait / 1000); \
+	loophist_add(&loopstats.ready, num > 0 ? num : 0); \
+} while(0)
+
+/* Run an I/O callback.  The callback may close the fd, so look at the type first. */
+static void fd_callback(IOCallbackFunc iocb, int fd, int evflags, FDEntry *fde)
+{
+	int type = fde->type;
+	unsigned long long start = profile_clock();
+
+	iocb(fd, evflags, fde->data);
+	loophist_add(&loopstats.callback[type], (profile_clock() - start) / 1000);
+}
+
 void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 {
 	FDEntry *fde;
@@ -68,6 +106,9 @@ void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 	fde = &fd_table[fd];
 	fde->data = data;
 
+	if (flags & FD_SELECT_EDGE)
+		fde->edge = 1;
+
 	if (flags & FD_SELECT_READ)
 	{
 		fde->read_callback = iocb;
@@ -86,6 +127,14 @@ void fd_setselect(int fd, int flags, IOCallbackFunc iocb, void *data)
 	fd_refresh(fd);
 }
 
+#ifndef BACKEND_IOURING
+/* Only io_uring receives for the caller, see fd_setrecv() there */
+int  fd_setrecv(int fd, IORecvFunc rcb, void *data)
+{
+	return 0;
+}
+#endif
+
 /***************************************************************************************
  * select() backend.                                                                   *
  ***************************************************************************************/
@@ -142,7 +191,7 @@ void fd_select(time_t delay)
 	to.tv_sec = delay % 1000;
 	to.tv_usec = delay * 1000;
 
-	num = select(highest_fd + 1, &work_read_fds, &work_write_fds, NULL, &to);
+	LOOPSTAT_WAIT(num = select(highest_fd + 1, &work_read_fds, &work_write_fds, NULL, &to));
 	if (num <= 0)
 		return;
 
@@ -179,7 +228,7 @@ void fd_select(time_t delay)
 			}
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fd, evflags, fde);
 
 			fde->read_oneshot = 0;
 		}
@@ -194,7 +243,7 @@ void fd_select(time_t delay)
 			}
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fd, evflags, fde);
 
 			fde->write_oneshot = 0;
 		}
@@ -264,7 +313,7 @@ void fd_select(time_t delay)
 	ts.tv_sec = delay / 1000;
 	ts.tv_nsec = delay % 1000 * 1000000;
 
-	num = kevent(kqueue_fd, NULL, 0, kqueue_events, MAXCONNECTIONS * 2, &ts);
+	LOOPSTAT_WAIT(num = kevent(kqueue_fd, NULL, 0, kqueue_events, MAXCONNECTIONS * 2, &ts));
 	if (num <= 0)
 		return;
 
@@ -286,7 +335,7 @@ void fd_select(time_t delay)
 				fde->read_callback = NULL;
 
 			if (iocb != NULL)
-				iocb(fd, FD_SELECT_READ, fde->data);
+				fd_callback(iocb, fd, FD_SELECT_READ, fde);
 
 			fde->read_oneshot = 0;
 		}
@@ -298,7 +347,7 @@ void fd_select(time_t delay)
 				fde->write_callback = NULL;
 
 			if (iocb != NULL)
-				iocb(fd, FD_SELECT_WRITE, fde->data);
+				fd_callback(iocb, fd, FD_SELECT_WRITE, fde);
 
 			fde->write_oneshot = 0;
 		}
@@ -314,19 +363,53 @@ void fd_select(time_t delay)
 
 #include <sys/epoll.h>
 
+/*
+ * fd_refresh() only puts the fd on a change list; fd_select() brings
+ * the epoll set up to date in one go right before it waits.  An fd
+ * that changed several times since then costs at most one epoll_ctl(),
+ * and none if it ends up as it was (a oneshot write that was armed and
+ * fired in the same pass, a TLS read that briefly wanted to write).
+ *
+ * Oneshots are done here, not with EPOLLONESHOT, which would disable
+ * the whole fd and need another epoll_ctl() to get reads back.
+ *
+ * Fds set up with FD_SELECT_EDGE (their read callback reads until
+ * EAGAIN) are registered edge triggered, and an event no longer wanted
+ * is left registered instead of being taken out right away.  Once an
+ * edge was used up by a oneshot, or came while nobody wanted it,
+ * epoll_stale remembers it: if it is wanted again an EPOLL_CTL_MOD makes
+ * the kernel look at the fd once more, otherwise it is taken out so a
+ * slow reader ACKing our data does not wake us up over and over.
+ */
 static int epoll_fd = -1;
 static struct epoll_event epfds[MAXCONNECTIONS + 1];
+static int epoll_changes[MAXCONNECTIONS + 1];
+static int epoll_nchanges = 0;
+static unsigned char epoll_dirty[MAXCONNECTIONS + 1];
+static unsigned int epoll_stale[MAXCONNECTIONS + 1];
 
 void fd_refresh(int fd)
+{
+	if (!epoll_dirty[fd])
+	{
+		epoll_dirty[fd] = 1;
+		epoll_changes[epoll_nchanges++] = fd;
+	}
+}
+
+static void epoll_apply(int fd)
 {
 	struct epoll_event ep_event;
 	FDEntry *fde = &fd_table[fd];
 	unsigned int pflags = 0;
-	unsigned int i;
 	int op = -1;
 
-	if (epoll_fd == -1)
-		epoll_fd = epoll_create(MAXCONNECTIONS);
+	if (!fde->is_open)
+	{
+		/* close() already took it out of the epoll set */
+		fde->backend_flags = 0;
+		return;
+	}
 
 	if (fde->read_callback)
 		pflags |= EPOLLIN;
@@ -334,16 +417,25 @@ void fd_refresh(int fd)
 	if (fde->write_callback)
 		pflags |= EPOLLOUT;
 
-	if (fde->read_oneshot || fde->write_oneshot)
-		pflags |= EPOLLONESHOT;
+	if (fde->edge && pflags)
+	{
+		/* Keep what is registered, unless its edge was used up */
+		pflags |= fde->backend_flags & ~epoll_stale[fd];
+		pflags |= EPOLLET;
+		if (pflags == fde->backend_flags && !(pflags & epoll_stale[fd]))
+		{
+			epoll_stale[fd] = 0;
+			return;
+		}
+	}
 
 	if (pflags == 0 && fde->backend_flags == 0)
 		return;
 	else if (pflags == 0)
 		op = EPOLL_CTL_DEL;
-	else if (fde->backend_flags == 0 && pflags != 0)
+	else if (fde->backend_flags == 0)
 		op = EPOLL_CTL_ADD;
-	else if (fde->backend_flags != pflags)
+	else if (fde->backend_flags != pflags || (pflags & epoll_stale[fd]))
 		op = EPOLL_CTL_MOD;
 
 	if (op == -1)
@@ -354,25 +446,44 @@ void fd_refresh(int fd)
 
 	if (epoll_ctl(epoll_fd, op, fd, &ep_event) != 0)
 	{
-		if (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN)
-			return;
+		/* The fd was closed and a new one got its number in the meantime */
+		if (op == EPOLL_CTL_MOD && ERRNO == ENOENT)
+			op = EPOLL_CTL_ADD;
+		else if (op == EPOLL_CTL_ADD && ERRNO == EEXIST)
+			op = EPOLL_CTL_MOD;
+		else
+			op = -1;
+		if (op == -1 || epoll_ctl(epoll_fd, op, fd, &ep_event) != 0)
+		{
+			if (ERRNO == P_EWOULDBLOCK || ERRNO == P_EAGAIN)
+				return;
 
-		ircd_log(LOG_ERROR, "[BUG?] epoll returned %d", errno);
-		return;
+			ircd_log(LOG_ERROR, "[BUG?] epoll returned %d", errno);
+			return;
+		}
 	}
 
 	fde->backend_flags = pflags;
+	epoll_stale[fd] = 0;
 }
 
 void fd_select(time_t delay)
 {
-	int num, p, revents, fd;
+	int num, p, revents, fd, i;
 	struct epoll_event *epfd;
 
 	if (epoll_fd == -1)
 		epoll_fd = epoll_create(MAXCONNECTIONS);
 
-	num = epoll_wait(epoll_fd, epfds, MAXCONNECTIONS, delay);
+	for (i = 0; i < epoll_nchanges; i++)
+	{
+		fd = epoll_changes[i];
+		epoll_dirty[fd] = 0;
+		epoll_apply(fd);
+	}
+	epoll_nchanges = 0;
+
+	LOOPSTAT_WAIT(num = epoll_wait(epoll_fd, epfds, MAXCONNECTIONS, delay));
 	if (num <= 0)
 		return;
 
@@ -397,29 +508,548 @@ void fd_select(time_t delay)
 		if (revents & (EPOLLOUT | EPOLLHUP | EPOLLERR))
 			evflags |= FD_SELECT_WRITE;
 
+		/* Clear oneshots before the callback, it may set up a new one */
 		if (evflags & FD_SELECT_READ)
 		{
 			iocb = fde->read_callback;
-			if (fde->read_oneshot)
+			if (fde->read_oneshot || !iocb)
+			{
 				fde->read_callback = NULL;
+				fde->read_oneshot = 0;
+				epoll_stale[fd] |= EPOLLIN;
+				fd_refresh(fd);
+			}
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fd, evflags, fde);
+		}
 
-			fde->read_oneshot = 0;
+		if (evflags & FD_SELECT_WRITE)
+		{
+			iocb = fde->write_callback;
+			if (fde->write_oneshot || !iocb)
+			{
+				fde->write_callback = NULL;
+				fde->write_oneshot = 0;
+				epoll_stale[fd] |= EPOLLOUT;
+				fd_refresh(fd);
+			}
+
+			if (iocb != NULL)
+				fd_callback(iocb, fd, evflags, fde);
+		}
+	}
+}
+
+#endif
+
+/***************************************************************************************
+ * io_uring backend.                                                                   *
+ ***************************************************************************************/
+#ifdef BACKEND_IOURING
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+
+/*
+ * Readiness through io_uring: every fd we want events for has one
+ * oneshot IORING_OP_POLL_ADD outstanding.  fd_refresh() and the re-arm
+ * after an event only queue submission entries, and all of them go to
+ * the kernel together with the wait, in one io_uring_enter() per loop
+ * iteration however many fds changed.  Arming a poll checks the fd
+ * right away, so an fd that still has data after its callback (flood
+ * control, a sendQ that did not fit) fires again in the next pass, as
+ * with the level triggered backends.
+ *
+ * Connections that take plaintext are read with completions instead
+ * (fd_setrecv()): one multishot IORING_OP_RECV per fd, which takes a
+ * buffer from the RECV_BUFS we gave the kernel, and its completion
+ * brings the data along.  The callback gets the buffer, and it goes
+ * back to the kernel right after.  When they run out the receive ends
+ * with -ENOBUFS, the data waits in the socket, and the receive starts
+ * again once buffers were given back.  This needs Linux 6.0 (and its
+ * headers to build), before that fd_setrecv() says no and the caller
+ * reads on readiness.
+ *
+ * fd_sendmsgs() writes a batch of sockets with one io_uring_enter(),
+ * on a ring of its own so its completions don't mix with the events.
+ *
+ * user_data is the fd plus a generation number.  Changing or dropping
+ * the poll of an fd starts a new generation, so completions of the old
+ * poll that were already on their way are recognized and ignored.
+ * Receives have a generation of their own, and RING_RECV set.
+ */
+#define RING_ENTRIES	4096
+#define RING_NOFD	(~0ULL)			/* POLL_REMOVE, cancels and timeouts */
+#define RING_RECV	0x80000000U		/* the completion is a receive */
+#define RING_DATA(fd)	(((unsigned long long)ring_gen[fd] << 32) | (unsigned int)(fd))
+#define RING_RDATA(fd)	(((unsigned long long)ring_rgen[fd] << 32) | RING_RECV | (unsigned int)(fd))
+#define RECV_BUFS	4096			/* a power of 2 */
+#define RECV_BUFSIZE	2048
+#define RECV_GROUP	0
+#define SEND_ENTRIES	256
+
+typedef struct {
+	int  fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, sq_entries;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+} Ring;
+
+static Ring ring = { -1 };			/* events and receives */
+static Ring sring = { -1 };			/* fd_sendmsgs() */
+static unsigned int ring_gen[MAXCONNECTIONS + 1];
+static unsigned int ring_rgen[MAXCONNECTIONS + 1];
+static unsigned char ring_recv[MAXCONNECTIONS + 1];	/* a receive is running */
+#ifdef IORING_RECV_MULTISHOT
+static struct io_uring_buf_ring *recv_ring;	/* NULL: no completion receives */
+static char *recv_bufs;
+#endif
+
+static void ring_init(Ring *r, unsigned int entries, unsigned int cq_entries)
+{
+	struct io_uring_params p;
+	unsigned char *sq, *cq;
+	size_t sqlen, cqlen;
+	unsigned int i, *array;
+
+	bzero(&p, sizeof(p));
+	if (cq_entries)
+	{
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+	}
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+	{
+		ircd_log(LOG_ERROR, "io_uring_setup() failed: %s -- this ircd was built with "
+			"--enable-io_uring, which needs Linux 5.6 or later", strerror(errno));
+		fprintf(stderr, "io_uring_setup() failed: %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sqlen = cqlen = MAX(sqlen, cqlen);
+	sq = mmap(NULL, sqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else
+		cq = mmap(NULL, cqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED)
+	{
+		ircd_log(LOG_ERROR, "io_uring: mapping the rings failed: %s", strerror(errno));
+		fprintf(stderr, "io_uring: mapping the rings failed: %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* Slot i of the submission queue is always sqes[i] */
+	array = (unsigned int *)(sq + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+}
+
+static int ring_enter(Ring *r, unsigned int wait, unsigned int flags)
+{
+	unsigned int submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+	return syscall(__NR_io_uring_enter, r->fd, submit, wait, flags, NULL, 0);
+}
+
+/*
+ * A cleared submission entry.  The kernel only looks at the queue in
+ * io_uring_enter(), so it can be published before it is filled in.
+ */
+static struct io_uring_sqe *ring_get_sqe(Ring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+
+	tail = *r->sq_tail;
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+		ring_enter(r, 0, 0);	/* full, hand it over now */
+
+	sqe = &r->sqes[tail & *r->sq_mask];
+	bzero(sqe, sizeof(*sqe));
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+#ifdef IORING_RECV_MULTISHOT
+/* Give buffer 'bid' (back) to the kernel */
+static void recv_putbuf(int bid)
+{
+	struct io_uring_buf *buf;
+	unsigned short tail = recv_ring->tail;
+
+	buf = &recv_ring->bufs[tail & (RECV_BUFS - 1)];
+	buf->addr = (unsigned long)(recv_bufs + bid * RECV_BUFSIZE);
+	buf->len = RECV_BUFSIZE;
+	buf->bid = bid;
+	__atomic_store_n(&recv_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* The buffers for completion receives, if the kernel can do them */
+static void recv_init(void)
+{
+	struct io_uring_buf_reg reg;
+	struct utsname u;
+	size_t len = RECV_BUFS * sizeof(struct io_uring_buf);
+	int  major = 0, i;
+
+	/* Multishot receives came with 6.0 */
+	if (uname(&u) < 0 || sscanf(u.release, "%d", &major) != 1 || major < 6)
+	{
+		ircd_log(LOG_ERROR, "io_uring: completion receives need Linux 6.0, reading on readiness");
+		return;
+	}
+
+	recv_ring = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if (recv_ring == MAP_FAILED)
+	{
+		recv_ring = NULL;
+		return;
+	}
+	bzero(&reg, sizeof(reg));
+	reg.ring_addr = (unsigned long)recv_ring;
+	reg.ring_entries = RECV_BUFS;
+	reg.bgid = RECV_GROUP;
+	if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		ircd_log(LOG_ERROR, "io_uring: registering the receive buffers failed: %s, reading on readiness",
+			strerror(errno));
+		munmap(recv_ring, len);
+		recv_ring = NULL;
+		return;
+	}
+	recv_bufs = MyMalloc(RECV_BUFS * RECV_BUFSIZE);
+	for (i = 0; i < RECV_BUFS; i++)
+		recv_putbuf(i);
+}
+#endif
+
+static void ring_setup(void)
+{
+	ring_init(&ring, RING_ENTRIES, MAX(RING_ENTRIES, MAXCONNECTIONS) * 2);
+#ifdef IORING_RECV_MULTISHOT
+	recv_init();
+#else
+	ircd_log(LOG_ERROR, "io_uring: built without completion receives (kernel headers before 6.0), reading on readiness");
+#endif
+}
+
+static struct io_uring_sqe *ring_sqe(void)
+{
+	if (ring.fd == -1)
+		ring_setup();
+	return ring_get_sqe(&ring);
+}
+
+void fd_refresh(int fd)
+{
+	FDEntry *fde = &fd_table[fd];
+	struct io_uring_sqe *sqe;
+	unsigned int pflags = 0;
+
+	if (fde->read_callback)
+		pflags |= POLLIN;
+
+	if (fde->write_callback)
+		pflags |= POLLOUT;
+
+	if (pflags == fde->backend_flags)
+		return;
+
+	if (fde->backend_flags)
+	{
+		sqe = ring_sqe();
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = RING_DATA(fd);
+		sqe->user_data = RING_NOFD;
+		ring_gen[fd]++;
+	}
+
+	if (pflags)
+	{
+		sqe = ring_sqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = pflags;
+		sqe->user_data = RING_DATA(fd);
+	}
+
+	fde->backend_flags = pflags;
+}
+
+/* Submit everything and wait, returns the number of completions there are */
+static int ring_wait(time_t delay)
+{
+	static struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+
+	if (delay > 0)
+	{
+		/* Ends after 'delay' or after the first other completion */
+		ts.tv_sec = delay / 1000;
+		ts.tv_nsec = delay % 1000 * 1000000;
+		sqe = ring_sqe();
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (unsigned long)&ts;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = RING_NOFD;
+	}
+
+	if (ring.fd == -1)
+		ring_setup();
+	ring_enter(&ring, delay > 0 ? 1 : 0, IORING_ENTER_GETEVENTS);
+
+	return __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) - *ring.cq_head;
+}
+
+#ifdef IORING_RECV_MULTISHOT
+static void recv_start(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ring_sqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RECV_GROUP;
+	sqe->user_data = RING_RDATA(fd);
+	ring_recv[fd] = 1;
+}
+
+static void recv_stop(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ring_recv[fd])
+	{
+		sqe = ring_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = RING_RDATA(fd);
+		sqe->user_data = RING_NOFD;
+		ring_recv[fd] = 0;
+	}
+	ring_rgen[fd]++;
+}
+
+/*
+ * From now on, call rcb(fd, buf, length, data) with what arrives on fd
+ * instead of a read callback: length > 0 bytes in buf, 0 at EOF or
+ * -errno.  The buffer is only valid during the call.  A NULL rcb stops
+ * it.  Returns 0 if we can't, the caller reads on readiness then.
+ */
+int  fd_setrecv(int fd, IORecvFunc rcb, void *data)
+{
+	FDEntry *fde = &fd_table[fd];
+
+	if (ring.fd == -1)
+		ring_setup();
+	if (!recv_ring)
+		return 0;
+
+	if (!rcb)
+		recv_stop(fd);
+	else
+	{
+		fde->data = data;
+		if (!ring_recv[fd])
+			recv_start(fd);
+	}
+	fde->recv_callback = rcb;
+	return 1;
+}
+
+/* A receive completed */
+static void recv_done(int fd, struct io_uring_cqe *cqe)
+{
+	FDEntry *fde = &fd_table[fd];
+	IORecvFunc rcb = fde->recv_callback;
+	unsigned long long start;
+	char *buf = NULL;
+	int  bid = -1, type = fde->type;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = recv_bufs + bid * RECV_BUFSIZE;
+	}
+
+	if ((cqe->user_data >> 32) == ring_rgen[fd] && rcb)
+	{
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			ring_recv[fd] = 0;
+
+		/* Out of buffers, the data waits in the socket until we start again */
+		if (cqe->res != -ENOBUFS)
+		{
+			start = profile_clock();
+			rcb(fd, buf, cqe->res, fde->data);
+			loophist_add(&loopstats.callback[type], (profile_clock() - start) / 1000);
+		}
+
+		if (fde->is_open && fde->recv_callback && !ring_recv[fd])
+			recv_start(fd);
+	}
+
+	if (bid >= 0)
+		recv_putbuf(bid);
+}
+#else
+int  fd_setrecv(int fd, IORecvFunc rcb, void *data)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Write a batch of sockets: msgs[i] to fds[i], res[i] gets what
+ * sendmsg() returned, or -errno.  They go to the kernel in one
+ * io_uring_enter() (per SEND_ENTRIES).  MSG_DONTWAIT makes a full
+ * socket fail with -EAGAIN instead of waiting for room, so all of them
+ * complete right away.
+ */
+void fd_sendmsgs(int *fds, struct msghdr *msgs, int *res, int n)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int  done, i, k, got;
+
+	if (sring.fd == -1)
+		ring_init(&sring, SEND_ENTRIES, 0);
+
+	for (done = 0; done < n; done += k)
+	{
+		k = MIN(n - done, (int)sring.sq_entries);
+		for (i = done; i < done + k; i++)
+		{
+			sqe = ring_get_sqe(&sring);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = fds[i];
+			sqe->addr = (unsigned long)&msgs[i];
+			sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+			sqe->user_data = i;
+		}
+		for (got = 0; got < k; )
+		{
+			if (ring_enter(&sring, k - got, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			{
+				/* Can't happen, but don't wait for nothing: writev() the rest */
+				for (i = done + got; i < done + k; i++)
+					res[i] = writev(fds[i], msgs[i].msg_iov, msgs[i].msg_iovlen) < 0 ? -errno : 0;
+				break;
+			}
+			head = *sring.cq_head;
+			tail = __atomic_load_n(sring.cq_tail, __ATOMIC_ACQUIRE);
+			for (; head != tail; head++, got++)
+			{
+				cqe = &sring.cqes[head & *sring.cq_mask];
+				res[cqe->user_data] = cqe->res;
+			}
+			__atomic_store_n(sring.cq_head, head, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+void fd_select(time_t delay)
+{
+	struct io_uring_cqe cqe;
+	unsigned int head, tail;
+	int num, fd, evflags;
+	FDEntry *fde;
+	IOCallbackFunc iocb;
+
+	LOOPSTAT_WAIT(num = ring_wait(delay));
+	if (num <= 0)
+		return;
+
+	head = *ring.cq_head;
+	tail = head + num;
+	for (; head != tail; head++)
+	{
+		cqe = ring.cqes[head & *ring.cq_mask];
+		__atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+		fd = cqe.user_data & ~RING_RECV;
+		if (cqe.user_data == RING_NOFD || fd > MAXCONNECTIONS)
+			continue;
+#ifdef IORING_RECV_MULTISHOT
+		if (cqe.user_data & RING_RECV)
+		{
+			recv_done(fd, &cqe);
+			continue;
+		}
+#endif
+		if ((cqe.user_data >> 32) != ring_gen[fd])
+			continue;
+
+		/* The poll is done, whatever happens below */
+		fde = &fd_table[fd];
+		fde->backend_flags = 0;
+
+		evflags = 0;
+		if (cqe.res > 0)
+		{
+			if (cqe.res & (POLLIN | POLLHUP | POLLERR))
+				evflags |= FD_SELECT_READ;
+
+			if (cqe.res & (POLLOUT | POLLHUP | POLLERR))
+				evflags |= FD_SELECT_WRITE;
+		}
+
+		/* Clear oneshots before the callback, it may set up a new one */
+		if (evflags & FD_SELECT_READ)
+		{
+			iocb = fde->read_callback;
+			if (fde->read_oneshot)
+			{
+				fde->read_callback = NULL;
+				fde->read_oneshot = 0;
+			}
+
+			if (iocb != NULL)
+				fd_callback(iocb, fd, evflags, fde);
 		}
 
 		if (evflags & FD_SELECT_WRITE)
 		{
 			iocb = fde->write_callback;
 			if (fde->write_oneshot)
+			{
 				fde->write_callback = NULL;
+				fde->write_oneshot = 0;
+			}
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
-
-			fde->write_oneshot = 0;
+				fd_callback(iocb, fd, evflags, fde);
 		}
+
+		/* Poll again if anyone is still interested */
+		if (fde->is_open && !fde->backend_flags)
+			fd_refresh(fd);
 	}
 }
 
@@ -470,7 +1100,7 @@ void fd_select(time_t delay)
 	int num, p, revents, fd;
 	struct pollfd *pfd;
 
-	num = poll(pollfds, nfds + 1, delay);
+	LOOPSTAT_WAIT(num = poll(pollfds, nfds + 1, delay));
 	if (num <= 0)
 		return;
 
@@ -502,7 +1132,7 @@ void fd_select(time_t delay)
 				fde->read_callback = NULL;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fd, evflags, fde);
 
 			fde->read_oneshot = 0;
 		}
@@ -514,7 +1144,7 @@ void fd_select(time_t delay)
 				fde->write_callback = NULL;
 
 			if (iocb != NULL)
-				iocb(fd, evflags, fde->data);
+				fd_callback(iocb, fd, evflags, fde);
 
 			fde->write_oneshot = 0;
 		}
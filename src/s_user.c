@@ -42,6 +42,7 @@ Computing Center and Jarkko Oikarinen";
 #include <fcntl.h>
 #include "h.h"
 #include "proto.h"
+#include "inet.h"
 
 void send_umode_out(aClient *, aClient *, long);
 void send_umode_out_nickv2(aClient *, aClient *, long);
@@ -69,6 +70,7 @@ void iNAH_host(aClient *sptr, char *host)
 		sptr->user->virthost = NULL;
 	}
 	sptr->user->virthost = strdup(host);
+	userindex_update(sptr);
 	if (MyConnect(sptr))
 		sendto_server(&me, 0, 0, ":%s SETHOST :%s", sptr->name, sptr->user->virthost);
 	sptr->umodes |= UMODE_SETHOST;
@@ -612,6 +614,214 @@ void send_umode_out_nickv2(aClient *cptr, aClient *sptr, long old)
 
 
 
+/*
+ * SILENCE lists are checked for every private message, so they are
+ * compiled whenever they change instead of matching every mask against
+ * a freshly built nick!user@host (and nick!user@virthost) each time:
+ *
+ * - "*!*@host" without wildcards goes in a sorted array that is
+ *   searched for the realhost and virthost of the sender;
+ * - any other nick!user@host mask is split up so its parts can be
+ *   matched against the fields of the sender directly, with the host
+ *   part a CIDR mask (matched against the IP) if it has a '/';
+ * - what is left (masks that are not nick!user@host) is matched against
+ *   the full nick!user@host like before.
+ */
+typedef struct {
+	char *host;
+	Link *lp;
+} SilenceExact;
+
+typedef struct {
+	char *nick;		/* NULL: any */
+	char *user;		/* NULL: any */
+	char *host;		/* the full mask for SILENCE_FULL */
+	int  type;
+	struct irc_netmask netmask;
+	Link *lp;
+} SilenceMask;
+
+#define SILENCE_HOST	1	/* nick!user@host mask */
+#define SILENCE_CIDR	2	/* nick!user@ip/bits */
+#define SILENCE_FULL	3	/* anything else */
+
+struct SilenceIndex {
+	SilenceExact *exact;
+	int  nexact;
+	SilenceMask *mask;
+	int  nmask;
+	char *strings;
+};
+
+void free_silence_index(anUser *user)
+{
+	struct SilenceIndex *si = user->silence_index;
+
+	MyFree(si->exact);
+	MyFree(si->mask);
+	MyFree(si->strings);
+	MyFree(si);
+	user->silence_index = NULL;
+}
+
+static int silence_exact_cmp(const void *a, const void *b)
+{
+	return strcasecmp(((SilenceExact *)a)->host, ((SilenceExact *)b)->host);
+}
+
+static void build_silence_index(anUser *user)
+{
+	struct SilenceIndex *si;
+	SilenceMask *m;
+	Link *lp;
+	char *s, *nick, *host;
+	int  n = 0;
+	size_t len = 0;
+
+	if (user->silence_index)
+		free_silence_index(user);
+	if (!user->silence)
+		return;
+
+	for (lp = user->silence; lp; lp = lp->next)
+	{
+		n++;
+		len += strlen(lp->value.cp) + 1;
+	}
+	si = MyMallocEx(sizeof(struct SilenceIndex));
+	si->exact = MyMalloc(sizeof(SilenceExact) * n);
+	si->mask = MyMalloc(sizeof(SilenceMask) * n);
+	si->strings = s = MyMalloc(len);
+
+	for (lp = user->silence; lp; lp = lp->next)
+	{
+		strcpy(s, lp->value.cp);
+		nick = s;
+		s += strlen(s) + 1;
+
+		if ((host = strchr(nick, '!')) && (host = strchr(host + 1, '@')))
+		{
+			*host++ = '\0';
+			*strchr(nick, '!') = '\0';
+			m = &si->mask[si->nmask];
+			m->nick = strcmp(nick, "*") ? nick : NULL;
+			m->user = strcmp(nick + strlen(nick) + 1, "*") ? nick + strlen(nick) + 1 : NULL;
+			if (!m->nick && !m->user && !strpbrk(host, "*?/"))
+			{
+				si->exact[si->nexact].host = host;
+				si->exact[si->nexact++].lp = lp;
+				continue;
+			}
+			m->host = host;
+			m->type = SILENCE_HOST;
+			if (strchr(host, '/') &&
+			    (m->netmask.type = parse_netmask(host, &m->netmask)) != HM_HOST)
+				m->type = SILENCE_CIDR;
+		} else {
+			m = &si->mask[si->nmask];
+			m->nick = m->user = NULL;
+			m->host = nick;
+			m->type = SILENCE_FULL;
+		}
+		m->lp = lp;
+		si->nmask++;
+	}
+	qsort(si->exact, si->nexact, sizeof(SilenceExact), silence_exact_cmp);
+	user->silence_index = si;
+}
+
+static int silence_match_ip(aClient *sptr, SilenceMask *m)
+{
+	struct IN_ADDR addr;
+#ifdef INET6
+	struct in_addr v4;
+#endif
+
+	if (MyConnect(sptr))
+		addr = sptr->ip;
+	else if (!sptr->user->ip_str)
+		return 0;
+#ifdef INET6
+	else if (inet_pton(AF_INET6, sptr->user->ip_str, &addr) != 1)
+	{
+		/* A remote IPv4 address, make it ::ffff:a.b.c.d like ours */
+		if (inet_pton(AF_INET, sptr->user->ip_str, &v4) != 1)
+			return 0;
+		memset(&addr, 0, sizeof(addr));
+		addr.s6_addr[10] = addr.s6_addr[11] = 0xff;
+		memcpy(&addr.s6_addr[12], &v4, sizeof(v4));
+	}
+#else
+	else if (inet_pton(AF_INET, sptr->user->ip_str, &addr) != 1)
+		return 0;
+#endif
+	if (m->netmask.type == HM_IPV4)
+		return match_ipv4(&addr, &m->netmask.mask, m->netmask.bits);
+#ifdef INET6
+	if (m->netmask.type == HM_IPV6)
+		return match_ipv6(&addr, &m->netmask.mask, m->netmask.bits);
+#endif
+	return 0;
+}
+
+/** Returns the entry of acptr's silence list that sptr matches, if any */
+Link *find_silence(aClient *acptr, aClient *sptr)
+{
+	struct SilenceIndex *si = acptr->user->silence_index;
+	anUser *user = sptr->user;
+	SilenceExact key, *e;
+	SilenceMask *m;
+	char sender[HOSTLEN + NICKLEN + USERLEN + 5];
+	char senderx[HOSTLEN + NICKLEN + USERLEN + 5];
+	int  i, rendered = 0;
+
+	if (!si)
+		return NULL;
+
+	key.host = user->realhost;
+	if ((e = bsearch(&key, si->exact, si->nexact, sizeof(SilenceExact), silence_exact_cmp)))
+		return e->lp;
+	/* The virthost counts regardless of +x, see _is_silenced() */
+	if (user->virthost)
+	{
+		key.host = user->virthost;
+		if ((e = bsearch(&key, si->exact, si->nexact, sizeof(SilenceExact), silence_exact_cmp)))
+			return e->lp;
+	}
+
+	for (i = 0, m = si->mask; i < si->nmask; i++, m++)
+	{
+		switch (m->type)
+		{
+			case SILENCE_HOST:
+			case SILENCE_CIDR:
+				if ((m->nick && match(m->nick, sptr->name)) ||
+				    (m->user && match(m->user, user->username)))
+					continue;
+				if (!match(m->host, user->realhost) ||
+				    (user->virthost && !match(m->host, user->virthost)))
+					return m->lp;
+				if (m->type == SILENCE_CIDR && silence_match_ip(sptr, m))
+					return m->lp;
+				break;
+			case SILENCE_FULL:
+				if (!rendered)
+				{
+					ircsnprintf(sender, sizeof(sender), "%s!%s@%s",
+					    sptr->name, user->username, user->realhost);
+					ircsnprintf(senderx, sizeof(senderx), "%s!%s@%s",
+					    sptr->name, user->username,
+					    user->virthost ? user->virthost : user->realhost);
+					rendered = 1;
+				}
+				if (!match(m->host, sender) || !match(m->host, senderx))
+					return m->lp;
+				break;
+		}
+	}
+	return NULL;
+}
+
 int  del_silence(aClient *sptr, char *mask)
 {
 	Link **lp;
@@ -624,6 +834,7 @@ int  del_silence(aClient *sptr, char *mask)
 			*lp = tmp->next;
 			MyFree(tmp->value.cp);
 			free_link(tmp);
+			build_silence_index(sptr->user);
 			return 0;
 		}
 	return -1;
@@ -657,6 +868,7 @@ int add_silence(aClient *sptr, char *mask, int senderr)
 	lp->value.cp = (char *)MyMalloc(strlen(mask) + 1);
 	(void)strcpy(lp->value.cp, mask);
 	sptr->user->silence = lp;
+	build_silence_index(sptr->user);
 	return 0;
 }
 
@@ -56,6 +56,7 @@ void vsendto_prefix_one(struct Client *to, struct Client *from,
 
 MODVAR int  current_serial;
 MODVAR int  sendanyways = 0;
+MODVAR unsigned long long sendq_bytes = 0;	/* everything ever put on a sendQ, for /STATS p */
 /*
 ** dead_link
 **	An error has been detected. The link *must* be closed,
@@ -66,7 +67,7 @@ MODVAR int  sendanyways = 0;
 **	notice will be the quit message. notice will also be
 **	sent to failops in case 'to' is a server.
 */
-static int dead_link(aClient *to, char *notice)
+int  dead_link(aClient *to, char *notice)
 {
 	
 	to->flags |= FLAGS_DEADSOCKET;
@@ -98,6 +99,148 @@ static void send_queued_write(int fd, int revents, void *data)
 		return;
 
 	send_queued(to);
+
+	/* Continue a /LIST in progress now that there is room again */
+	if (!IsDead(to) && DoList(to) && IsSendable(to))
+		send_list(to, 64);
+}
+
+/*
+** send_queued_wait
+**	Call send_queued_write() once the socket is writable, even if
+**	nothing is queued. Used by /LIST to send the next batch.
+*/
+void send_queued_wait(aClient *to)
+{
+	if (IsIOThread(to))
+		return; /* IOMSG_DRAINED does it */
+	if (!IsDead(to) && to->fd >= 0)
+		fd_setselect(to->fd, FD_SELECT_WRITE | FD_SELECT_ONESHOT, send_queued_write, to);
+}
+
+/*
+** SSL records
+**	Queued data for an SSL connection is gathered into records of up
+**	to 16k, instead of one SSL_write() (and one record, with its own
+**	header, MAC and syscall) per 512 byte dbuf block. A client that
+**	was idle for a second first gets a few small records that each
+**	fit in one TCP segment, so an interactive reply can be decrypted
+**	as soon as it arrives; if the burst goes on, records grow to the
+**	full size. Servers always get full size records.
+**
+**	To have something to gather, output for an established SSL
+**	connection is not written right away: the client goes on
+**	flush_list and send_queued_flush() writes everything just
+**	before the main loop waits for I/O again, or as soon as a full
+**	record is queued. Clients on an I/O thread (iothread.c) go there
+**	too, so their output is handed over in batches of the same size,
+**	and so do plaintext connections in a class with a send-batch, until
+**	that many bytes are queued.
+**
+**	When SSL_write() could not finish, OpenSSL wants the retry to
+**	offer at least the same bytes again. That is what we do: they are
+**	still at the front of the sendQ, and the size only goes down after
+**	the sendQ ran empty. The buffer may move between tries, see
+**	SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER in ssl.c.
+*/
+#define SSL_RECORD_MAX		16384
+#define SSL_RECORD_SMALL	1300
+#define SSL_RECORD_SLOWSTART	(4 * SSL_RECORD_SMALL)
+
+static char sslrecord[SSL_RECORD_MAX + 1];
+static LIST_HEAD(flush_list);
+
+static char *ssl_gather(aClient *to, int *lenp)
+{
+	struct list_head *n;
+	dbufbuf *block;
+	int  limit = SSL_RECORD_MAX, len = 0, chunk;
+
+	if (!IsServer(to))
+	{
+		/* Idle for a while, start small again */
+		if (to->ssl_drained && (TStime() - to->ssl_drained >= 1))
+			to->ssl_burst = 0;
+		if (to->ssl_burst < SSL_RECORD_SLOWSTART)
+			limit = SSL_RECORD_SMALL;
+	}
+
+	list_for_each(n, &to->sendQ.dbuf_list)
+	{
+		block = container_of(n, dbufbuf, dbuf_node);
+		chunk = MIN(block->size, limit - len);
+		memcpy(sslrecord + len, block->data, chunk);
+		len += chunk;
+		if (len == limit)
+			break;
+	}
+	*lenp = len;
+	return sslrecord;
+}
+
+/* Should output for 'to' wait on flush_list? */
+static int send_held(aClient *to)
+{
+	if ((to->ssl && !IsSSLHandshake(to)) || IsIOThread(to))
+		return DBufLength(&to->sendQ) < SSL_RECORD_MAX;
+#ifdef BACKEND_IOURING
+	/* Plaintext goes out with the others, see send_queued_batch() */
+	if (!to->ssl)
+		return DBufLength(&to->sendQ) < MAX(SSL_RECORD_MAX, to->class ? to->class->send_batch : 0);
+#endif
+	return to->class && !to->ssl && (DBufLength(&to->sendQ) < to->class->send_batch);
+}
+
+/*
+** sendq_iov
+**	Plaintext sockets, and SSL ones where the kernel does the record
+**	layer (kTLS, see ssl_check_ktls()), are written straight from the
+**	sendQ blocks with writev(). With kTLS the kernel cuts the records
+**	itself, so there is nothing to gather or copy here.
+*/
+#define SENDQ_IOV	64
+
+static int sendq_iov(aClient *to, struct iovec *iov, int *lenp)
+{
+	struct list_head *n;
+	dbufbuf *block;
+	int  cnt = 0, len = 0;
+
+	list_for_each(n, &to->sendQ.dbuf_list)
+	{
+		block = container_of(n, dbufbuf, dbuf_node);
+		iov[cnt].iov_base = block->data;
+		iov[cnt].iov_len = block->size;
+		len += block->size;
+		if (++cnt == SENDQ_IOV)
+			break;
+	}
+	*lenp = len;
+	return cnt;
+}
+
+/*
+** sndbuf_grow
+**	class::sndbuf-max: a connection that keeps filling its socket
+**	buffer gets a bigger one, twice the size each time, up to the max.
+**	Writes by an I/O thread don't count.
+*/
+#define SNDBUF_FULL_GROW	4	/* full writes in a row before it grows */
+
+static void sndbuf_grow(aClient *to)
+{
+	int  size;
+
+	if (!to->class || (to->sndbuf >= to->class->sndbuf_max))
+		return;
+	if (++to->sndbuf_full < SNDBUF_FULL_GROW)
+		return;
+	to->sndbuf_full = 0;
+	size = MIN(to->sndbuf * 2, to->class->sndbuf_max);
+#ifdef SO_SNDBUF
+	if (setsockopt(to->fd, SOL_SOCKET, SO_SNDBUF, (OPT_TYPE *)&size, sizeof(size)) == 0)
+		to->sndbuf = size;
+#endif
 }
 
 /*
@@ -108,9 +251,12 @@ static void send_queued_write(int fd, int revents, void *data)
 */
 int  send_queued(aClient *to)
 {
+	struct iovec iov[SENDQ_IOV];
 	char *msg;
-	int  len, rlen;
-	dbufbuf *block;
+	int  len, rlen, cnt;
+
+	if (!list_empty(&to->flush_node))
+		list_del_init(&to->flush_node);
 
 	/*
 	   ** Once socket is marked dead, we cannot start writing to it,
@@ -126,13 +272,35 @@ int  send_queued(aClient *to)
 		return -1;
 	}
 
+	if (IsIOThread(to))
+	{
+		/* The thread writes it, up to its window */
+		while (DBufLength(&to->sendQ) > 0)
+		{
+			cnt = sendq_iov(to, iov, &len);
+			if (!(rlen = ioth_queue(to, iov, cnt, len)))
+				break;
+			(void)dbuf_delete(&to->sendQ, rlen);
+		}
+		to->lastsq = DBufLength(&to->sendQ) / 1024;
+		return 0;
+	}
+
 	while (DBufLength(&to->sendQ) > 0)
 	{
-		block = container_of(to->sendQ.dbuf_list.next, dbufbuf, dbuf_node);
-		len = block->size;
+		if (to->ssl && !IsKTLS(to))
+		{
+			msg = ssl_gather(to, &len);
+			rlen = deliver_it(to, msg, len);
+		}
+		else
+		{
+			cnt = sendq_iov(to, iov, &len);
+			rlen = deliver_iov(to, iov, cnt);
+		}
 
 		/* Returns always len > 0 */
-		if ((rlen = deliver_it(to, block->data, len)) < 0)
+		if (rlen < 0)
 		{
 			char buf[256];
 			snprintf(buf, 256, "Write error: %s", STRERROR(ERRNO));
@@ -140,17 +308,125 @@ int  send_queued(aClient *to)
 		}
 		(void)dbuf_delete(&to->sendQ, rlen);
 		to->lastsq = DBufLength(&to->sendQ) / 1024;
-		if (rlen < block->size)
+		if (to->ssl)
+			to->ssl_burst += rlen;
+		if (rlen < len)
 		{
 			/* incomplete write due to EWOULDBLOCK, reschedule */
+			sndbuf_grow(to);
 			fd_setselect(to->fd, FD_SELECT_WRITE | FD_SELECT_ONESHOT, send_queued_write, to);
 			break;
 		}
 	}
+	if (to->ssl)
+		to->ssl_drained = DBufLength(&to->sendQ) ? 0 : TStime();
+	if (DBufLength(&to->sendQ) == 0)
+	{
+		to->sndbuf_full = 0;
+		if (IsServer(to) && to->serv && to->serv->flags.burst_queued)
+			burst_drained(to);
+	}
 
 	return (IsDead(to)) ? -1 : 0;
 }
 
+/*
+** send_queued_flush
+**	Write the output that was held back for SSL connections (and
+**	plaintext ones with io_uring) and hand over that for I/O threads,
+**	called from the main loop before waiting for I/O.
+*/
+#ifdef BACKEND_IOURING
+/*
+** send_queued_batch
+**	With io_uring the plaintext sockets on flush_list are written
+**	together, SEND_BATCH of them per io_uring_enter() instead of one
+**	writev() each (fd_sendmsgs()). What a socket did not take is
+**	handled as in send_queued(). The rest of flush_list gets
+**	send_queued() as usual.
+*/
+#define SEND_BATCH	256
+
+static aClient *batch_client[SEND_BATCH];
+static struct iovec batch_iov[SEND_BATCH][SENDQ_IOV];
+static struct msghdr batch_msg[SEND_BATCH];
+static int batch_fd[SEND_BATCH], batch_len[SEND_BATCH], batch_res[SEND_BATCH];
+
+static void send_queued_batch(void)
+{
+	aClient *to;
+	int  i, n;
+
+	while (!list_empty(&flush_list))
+	{
+		for (n = 0; n < SEND_BATCH && !list_empty(&flush_list); )
+		{
+			to = list_first_entry(&flush_list, aClient, flush_node);
+			if (IsDead(to) || IsIOThread(to) || to->fd < 0 || (to->ssl && !IsKTLS(to)) ||
+			    !(IsServer(to) || IsPerson(to) || IsHandshake(to) || IsUnknown(to)))
+			{
+				send_queued(to);
+				continue;
+			}
+			list_del_init(&to->flush_node);
+			if (DBufLength(&to->sendQ) == 0)
+				continue;
+			bzero(&batch_msg[n], sizeof(struct msghdr));
+			batch_msg[n].msg_iov = batch_iov[n];
+			batch_msg[n].msg_iovlen = sendq_iov(to, batch_iov[n], &batch_len[n]);
+			batch_fd[n] = to->fd;
+			batch_client[n++] = to;
+		}
+		if (!n)
+			break;
+
+		fd_sendmsgs(batch_fd, batch_msg, batch_res, n);
+
+		for (i = 0; i < n; i++)
+		{
+			to = batch_client[i];
+			if (IsDead(to))
+				continue;
+			if (batch_res[i] == -EAGAIN || batch_res[i] == -ENOBUFS)
+				batch_res[i] = 0;
+			if (batch_res[i] < 0)
+			{
+				char buf[256];
+				snprintf(buf, 256, "Write error: %s", STRERROR(-batch_res[i]));
+				dead_link(to, buf);
+				continue;
+			}
+			count_sent(to, batch_res[i]);
+			(void)dbuf_delete(&to->sendQ, batch_res[i]);
+			to->lastsq = DBufLength(&to->sendQ) / 1024;
+			if (batch_res[i] < batch_len[i])
+			{
+				/* The socket is full, wait for room as send_queued() does */
+				sndbuf_grow(to);
+				fd_setselect(to->fd, FD_SELECT_WRITE | FD_SELECT_ONESHOT, send_queued_write, to);
+			}
+			else if (DBufLength(&to->sendQ) > 0)
+				send_queued(to);	/* more than SENDQ_IOV blocks */
+			else
+			{
+				to->sndbuf_full = 0;
+				if (IsServer(to) && to->serv && to->serv->flags.burst_queued)
+					burst_drained(to);
+			}
+		}
+	}
+}
+#endif
+
+void send_queued_flush(void)
+{
+#ifdef BACKEND_IOURING
+	send_queued_batch();
+#endif
+	while (!list_empty(&flush_list))
+		send_queued(list_first_entry(&flush_list, aClient, flush_node));
+}
+
 /*
  *  send message to single client
  */
@@ -235,9 +511,17 @@ void sendbufto_one(aClient *to, char *msg, unsigned int quick)
 		sendto_ops("%s", tmp_msg); /* recursion? */
 		return;
 	}
-        for(h = Hooks[HOOKTYPE_PACKET]; h; h = h->next) {
-		(*(h->func.intfunc))(&me, to, &msg, &len);
-		if(!msg) return;
+	if (Hooks[HOOKTYPE_PACKET])
+	{
+		HOOKSTAT_BEGIN(HOOKTYPE_PACKET);
+		for(h = Hooks[HOOKTYPE_PACKET]; h; h = h->next) {
+			(*(h->func.intfunc))(&me, to, &msg, &len);
+			if(!msg)
+				break;
+		}
+		HOOKSTAT_END(HOOKTYPE_PACKET);
+		if (!msg)
+			return;
 	}
 	if (DBufLength(&to->sendQ) > get_sendq(to))
 	{
@@ -250,6 +534,7 @@ void sendbufto_one(aClient *to, char *msg, unsigned int quick)
 	}
 
 	dbuf_put(&to->sendQ, msg, len);
+	sendq_bytes += len;
 
 	/*
 	 * Update statistics. The following is slightly incorrect
@@ -259,7 +544,12 @@ void sendbufto_one(aClient *to, char *msg, unsigned int quick)
 	to->sendM += 1;
 	me.sendM += 1;
 
-	if (DBufLength(&to->sendQ) > 0)
+	if (send_held(to))
+	{
+		if (list_empty(&to->flush_node))
+			list_add_tail(&to->flush_node, &flush_list);
+	}
+	else if (DBufLength(&to->sendQ) > 0)
 		send_queued(to);
 }
 
@@ -627,6 +917,51 @@ void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
 	return;
 }
 
+/*
+ * channel_local_members
+ *
+ * Collect the local members of a channel into *list (grown as needed,
+ * *max is its size) and return how many there are. Together with
+ * sendto_local_members() this replaces a sendto_channel_butserv() walk
+ * over all members for every line, when a lot of lines go to the same
+ * channel in a row and the local members do not change in between.
+ */
+int channel_local_members(aChannel *chptr, aClient ***list, int *max)
+{
+	Member *lp;
+	int n = 0;
+
+	for (lp = chptr->members; lp; lp = lp->next)
+	{
+		if (!MyConnect(lp->cptr))
+			continue;
+		if (n == *max)
+		{
+			*max = *max ? *max * 2 : 64;
+			*list = MyRealloc(*list, sizeof(aClient *) * *max);
+		}
+		(*list)[n++] = lp->cptr;
+	}
+	return n;
+}
+
+void sendto_local_members(aClient **list, int count, aClient *from, char *pattern, ...)
+{
+	va_list vl;
+	int sendlen, i;
+
+	if (!count)
+		return;
+
+	*sendbuf = '\0';
+	va_start(vl, pattern);
+	sendlen = vmakebuf_local_withprefix(sendbuf, sizeof sendbuf, from, pattern, vl);
+	va_end(vl);
+
+	for (i = 0; i < count; i++)
+		sendbufto_one(list[i], sendbuf, sendlen);
+}
+
 void sendto_channel_butserv_butone(aChannel *chptr, aClient *from, aClient *one, char *pattern, ...)
 {
 	va_list vl;
@@ -50,6 +50,8 @@ extern int errno;		/* ...seems that errno.h doesn't define this everywhere */
 **	*NOTE*	I nuked 'em.  At the load of current ircd servers
 **		you can't run with stuff that blocks. And we don't.
 */
+static int deliver_done(aClient *, int);
+
 int  deliver_it(aClient *cptr, char *str, int len)
 {
 	int  retval;
@@ -100,29 +102,59 @@ int  deliver_it(aClient *cptr, char *str, int len)
 	   **
 	   ** ...now, would this work on VMS too? --msa
 	 */
+	return deliver_done(cptr, retval);
+}
+
+/*
+** deliver_iov
+**	Like deliver_it(), but writes the buffers in 'iov' with one
+**	writev(). Only for sockets that take plaintext: non-SSL ones,
+**	and SSL ones where the kernel does the encryption (FLAGS_KTLS).
+*/
+int  deliver_iov(aClient *cptr, struct iovec *iov, int cnt)
+{
+	if (IsDead(cptr) || (!IsServer(cptr) && !IsPerson(cptr)
+	    && !IsHandshake(cptr) && !IsUnknown(cptr)))
+	{
+		sendto_ops("* * * DEBUG ERROR * * * !!! Calling deliver_iov() for %s, status %d %s",
+		    cptr->name, cptr->status, IsDead(cptr) ? "DEAD" : "");
+		return -1;
+	}
+	return deliver_done(cptr, writev(cptr->fd, iov, cnt));
+}
+
+static int deliver_done(aClient *cptr, int retval)
+{
 	if (retval < 0 && (errno == EWOULDBLOCK || errno == EAGAIN ||
 	    errno == ENOBUFS))
 			retval = 0;
 
 	if (retval > 0)
-	{
-		cptr->sendB += retval;
-		me.sendB += retval;
-		if (cptr->sendB > 1023)
-		{
-			cptr->sendK += (cptr->sendB >> 10);
-			cptr->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
-		}
-		if (me.sendB > 1023)
-		{
-			me.sendK += (me.sendB >> 10);
-			me.sendB &= 0x03ff;
-		}
-	}
+		count_sent(cptr, retval);
 
 	return (retval);
 }
 
+/*
+** count_sent
+**	Add 'len' bytes to what was sent to cptr (and by us).
+*/
+void count_sent(aClient *cptr, int len)
+{
+	cptr->sendB += len;
+	me.sendB += len;
+	if (cptr->sendB > 1023)
+	{
+		cptr->sendK += (cptr->sendB >> 10);
+		cptr->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
+	}
+	if (me.sendB > 1023)
+	{
+		me.sendK += (me.sendB >> 10);
+		me.sendB &= 0x03ff;
+	}
+}
+
 char	*Inet_si2pB(struct SOCKADDR_IN *sin, char *buf, int sz)
 {
 #ifdef INET6
@@ -25,13 +25,19 @@
 #include "proto.h"
 #include "sys.h"
 #include <string.h>
+#include <fcntl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 #define SAFE_SSL_READ 1
 #define SAFE_SSL_WRITE 2
 #define SAFE_SSL_ACCEPT 3
 #define SAFE_SSL_CONNECT 4
 
-extern void start_of_normal_client_handshake(aClient *acptr);
+extern void start_of_normal_client_handshake(aClient *acptr, IntakeLookup *lookup);
 static int fatal_ssl_error(int ssl_error, int where, int my_errno, aClient *sptr);
 
 /* The SSL structures */
@@ -172,6 +178,253 @@ static void setup_dh_params(SSL_CTX *ctx)
 	SSL_CTX_set_tmp_dh(ctx, dh);
 }
 
+/*
+ * Session resumption. Sessions are kept in OpenSSL's cache
+ * (set::ssl::session-cache-size and session-timeout) and, for clients
+ * that can do it, handed out as session tickets. Tickets are encrypted
+ * with our own keys rather than OpenSSL's random per-context ones, so
+ * they stay valid over a /rehash -ssl and, through
+ * set::ssl::ticket-key-file, over a restart: right after a restart is
+ * exactly when everyone reconnects at once.
+ *
+ * A new ticket key is made every set::ssl::ticket-key-rotate. The
+ * previous keys are still accepted (and the ticket is renewed with the
+ * current one) until they are SSL_TICKET_KEYS periods old.
+ */
+#define SSL_TICKET_KEYS		3
+
+typedef struct {
+	unsigned char name[16];
+	unsigned char aes[32];
+	unsigned char hmac[32];
+	TS   created;
+} SSLTicketKey;
+
+static SSLTicketKey ticket_keys[SSL_TICKET_KEYS];	/* newest first */
+static int ticket_nkeys = 0;
+static int ticket_exidx = -1;	/* SSL ex_data: a ticket of ours was decrypted */
+
+static void ssl_tohex(unsigned char *in, int len, char *out)
+{
+	static const char hexchars[] = "0123456789abcdef";
+	int  i;
+
+	for (i = 0; i < len; i++)
+	{
+		*out++ = hexchars[in[i] >> 4];
+		*out++ = hexchars[in[i] & 0xf];
+	}
+	*out = '\0';
+}
+
+static int ssl_fromhex(char *in, unsigned char *out, int len)
+{
+	int  i, hi, lo;
+
+	if (strlen(in) != len * 2)
+		return 0;
+	for (i = 0; i < len; i++, in += 2)
+	{
+		if (!isxdigit(in[0]) || !isxdigit(in[1]))
+			return 0;
+		hi = isdigit(in[0]) ? in[0] - '0' : tolower(in[0]) - 'a' + 10;
+		lo = isdigit(in[1]) ? in[1] - '0' : tolower(in[1]) - 'a' + 10;
+		out[i] = (hi << 4) | lo;
+	}
+	return 1;
+}
+
+static void ssl_ticket_keys_save(void)
+{
+	char tmpfile[512], name[33], aes[65], hmac[65];
+	FILE *f;
+	int  fd, i;
+
+	if (!iConf.ssl_ticket_key_file || !*iConf.ssl_ticket_key_file)
+		return;
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", iConf.ssl_ticket_key_file);
+	fd = open(tmpfile, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if (fd < 0 || !(f = fdopen(fd, "w")))
+	{
+		mylog("Could not write SSL ticket keys to %s: %s", tmpfile, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	for (i = 0; i < ticket_nkeys; i++)
+	{
+		ssl_tohex(ticket_keys[i].name, sizeof(ticket_keys[i].name), name);
+		ssl_tohex(ticket_keys[i].aes, sizeof(ticket_keys[i].aes), aes);
+		ssl_tohex(ticket_keys[i].hmac, sizeof(ticket_keys[i].hmac), hmac);
+		fprintf(f, "%ld %s %s %s\n", (long)ticket_keys[i].created, name, aes, hmac);
+	}
+	if (fclose(f) != 0 || rename(tmpfile, iConf.ssl_ticket_key_file) < 0)
+		mylog("Could not write SSL ticket keys to %s: %s", iConf.ssl_ticket_key_file, strerror(errno));
+}
+
+static void ssl_ticket_keys_load(void)
+{
+	char buf[256], name[64], aes[96], hmac[96];
+	SSLTicketKey *k;
+	FILE *f;
+	long created;
+
+	ticket_nkeys = 0;
+	if (!iConf.ssl_ticket_key_file || !*iConf.ssl_ticket_key_file)
+		return;
+	if (!(f = fopen(iConf.ssl_ticket_key_file, "r")))
+		return;
+	while (ticket_nkeys < SSL_TICKET_KEYS && fgets(buf, sizeof(buf), f))
+	{
+		k = &ticket_keys[ticket_nkeys];
+		if (sscanf(buf, "%ld %63s %95s %95s", &created, name, aes, hmac) != 4 ||
+		    !ssl_fromhex(name, k->name, sizeof(k->name)) ||
+		    !ssl_fromhex(aes, k->aes, sizeof(k->aes)) ||
+		    !ssl_fromhex(hmac, k->hmac, sizeof(k->hmac)))
+		{
+			mylog("Ignoring bad line in SSL ticket key file %s", iConf.ssl_ticket_key_file);
+			continue;
+		}
+		k->created = created;
+		ticket_nkeys++;
+	}
+	fclose(f);
+}
+
+/** Make a new ticket key if the current one is due, forget expired ones */
+static void ssl_ticket_keys_rotate(void)
+{
+	SSLTicketKey k;
+	int  changed = 0;
+
+	while (ticket_nkeys > 0 &&
+	       TStime() - ticket_keys[ticket_nkeys - 1].created >= SSL_TICKET_KEYS * iConf.ssl_ticket_key_rotate)
+	{
+		ticket_nkeys--;
+		changed = 1;
+	}
+
+	if (!ticket_nkeys || (TStime() - ticket_keys[0].created >= iConf.ssl_ticket_key_rotate))
+	{
+		/* Only shift the old keys once the new one is there */
+		if (RAND_bytes(k.name, sizeof(k.name)) <= 0 ||
+		    RAND_bytes(k.aes, sizeof(k.aes)) <= 0 ||
+		    RAND_bytes(k.hmac, sizeof(k.hmac)) <= 0)
+			mylog("Could not make a new SSL ticket key");
+		else
+		{
+			k.created = TStime();
+			memmove(&ticket_keys[1], &ticket_keys[0], sizeof(SSLTicketKey) * (SSL_TICKET_KEYS - 1));
+			ticket_keys[0] = k;
+			if (ticket_nkeys < SSL_TICKET_KEYS)
+				ticket_nkeys++;
+			changed = 1;
+		}
+		memset(&k, 0, sizeof(k));
+	}
+
+	if (changed)
+		ssl_ticket_keys_save();
+}
+
+static EVENT(ssl_ticket_keys_event)
+{
+	ssl_ticket_keys_rotate();
+}
+
+/* OpenSSL 3 hands the ticket callback an EVP_MAC_CTX, HMAC_CTX is deprecated there */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX TICKET_HMAC_CTX;
+#else
+typedef HMAC_CTX TICKET_HMAC_CTX;
+#endif
+
+static int ssl_ticket_hmac_init(TICKET_HMAC_CTX *hctx, SSLTicketKey *k)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[2];
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+	params[1] = OSSL_PARAM_construct_end();
+	return EVP_MAC_init(hctx, k->hmac, sizeof(k->hmac), params);
+#else
+	return HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac), EVP_sha256(), NULL);
+#endif
+}
+
+static int ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+    EVP_CIPHER_CTX *ectx, TICKET_HMAC_CTX *hctx, int enc)
+{
+	SSLTicketKey *k;
+	int  i;
+
+	if (enc)
+	{
+		if (!ticket_nkeys)
+			return 0; /* no ticket then */
+		k = &ticket_keys[0];
+		memcpy(key_name, k->name, sizeof(k->name));
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+			return -1;
+		if (!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, k->aes, iv) ||
+		    !ssl_ticket_hmac_init(hctx, k))
+			return -1;
+		return 1;
+	}
+
+	for (i = 0; i < ticket_nkeys; i++)
+		if (!memcmp(key_name, ticket_keys[i].name, sizeof(ticket_keys[i].name)))
+			break;
+	if (i == ticket_nkeys)
+		return 0; /* unknown or expired key: full handshake */
+	k = &ticket_keys[i];
+	if (!ssl_ticket_hmac_init(hctx, k) ||
+	    !EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, k->aes, iv))
+		return -1;
+	/* Counted in ircd_SSL_accept() if the session is really resumed */
+	SSL_set_ex_data(ssl, ticket_exidx, k);
+	return (i == 0) ? 1 : 2; /* 2: accept, but issue a ticket with the current key */
+}
+
+/** Number of ticket keys in use, and when the current one was made */
+int ssl_ticket_keys_info(TS *created)
+{
+	*created = ticket_nkeys ? ticket_keys[0].created : 0;
+	return ticket_nkeys;
+}
+
+static void ssl_session_setup(SSL_CTX *ctx)
+{
+	static unsigned char sid_ctx[] = "rabbitircd";
+
+	SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+	if (ticket_exidx < 0)
+		ticket_exidx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	if (iConf.ssl_session_cache_size > 0)
+	{
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, iConf.ssl_session_cache_size);
+	}
+	else
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_timeout(ctx, iConf.ssl_session_timeout);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ssl_ticket_key_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_ticket_key_cb);
+#endif
+}
+
+/** Apply set::ssl::session-* after a rehash */
+void ssl_session_settings(void)
+{
+	if (!ctx_server)
+		return; /* booting, init_ssl() does it */
+	ssl_session_setup(ctx_server);
+	ssl_ticket_keys_rotate();
+}
+
 SSL_CTX *init_ctx_server(void)
 {
 SSL_CTX *ctx_server;
@@ -186,7 +439,9 @@ SSL_CTX *ctx_server;
 	SSL_CTX_set_options(ctx_server, SSL_OP_NO_SSLv2);
 	SSL_CTX_set_verify(ctx_server, SSL_VERIFY_PEER|SSL_VERIFY_CLIENT_ONCE
 			| (iConf.ssl_options & SSLFLAG_FAILIFNOCERT ? SSL_VERIFY_FAIL_IF_NO_PEER_CERT : 0), ssl_verify_callback);
-	SSL_CTX_set_session_cache_mode(ctx_server, SSL_SESS_CACHE_OFF);
+	ssl_session_setup(ctx_server);
+	/* send_queued() may offer a retried write from another buffer */
+	SSL_CTX_set_mode(ctx_server, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 	setup_dh_params(ctx_server);
 
@@ -241,6 +496,7 @@ SSL_CTX *ctx_client;
 	}
 	SSL_CTX_set_default_passwd_cb(ctx_client, ssl_pem_passwd_cb);
 	SSL_CTX_set_session_cache_mode(ctx_client, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_mode(ctx_client, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 	setup_dh_params(ctx_client);
 
@@ -289,6 +545,9 @@ void init_ssl(void)
 	ctx_client = init_ctx_client();
 	if (!ctx_client)
 		exit(8);
+	ssl_ticket_keys_load();
+	ssl_ticket_keys_rotate();
+	EventAddEx(NULL, "ssl_ticket_keys", 60, 0, ssl_ticket_keys_event, NULL);
 }
 
 void reinit_ssl(aClient *acptr)
@@ -341,6 +600,7 @@ int  ssl_handshake(aClient *cptr)
 	CHK_NULL(cptr->ssl);
 	SSL_set_fd((SSL *) cptr->ssl, cptr->fd);
 	set_non_blocking(cptr->fd, cptr);
+	ssl_want_ktls(cptr);
 	/* 
 	 *  if necessary, SSL_write() will negotiate a TLS/SSL session, if not already explicitly
 	 *  performed by SSL_connect() or SSL_accept(). If the peer requests a
@@ -436,6 +696,50 @@ char	*ssl_get_cipher(SSL *ssl)
 	return (buf);
 }
 
+/*
+ * Kernel TLS. With listen::options::ktls (or link::options::ktls for
+ * links we connect to) OpenSSL is asked to hand the record layer to
+ * the Linux 'tls' module once the handshake is done. That takes an
+ * OpenSSL built with kTLS, a kernel with the module, and a cipher the
+ * kernel knows (AES-GCM, and CHACHA20-POLY1305 on newer kernels); if
+ * any of that is missing the connection simply stays in user space.
+ * When the sending side was handed over, the client is marked
+ * FLAGS_KTLS and send_queued() writes its sendQ with writev() like
+ * for a plaintext socket. Reading still goes through SSL_read(), so
+ * alerts, tickets and key updates are dealt with by OpenSSL.
+ */
+static int ssl_ktls_wanted(aClient *acptr)
+{
+	if (acptr->listener)
+		return acptr->listener->options & LISTENER_KTLS;
+	return acptr->serv && acptr->serv->conf && (acptr->serv->conf->options & CONNECT_KTLS);
+}
+
+/** Call before the handshake starts */
+void ssl_want_ktls(aClient *acptr)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	if (ssl_ktls_wanted(acptr))
+		SSL_set_options(acptr->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+/** Call when the handshake is done */
+static void ssl_check_ktls(aClient *acptr)
+{
+	if (!ssl_ktls_wanted(acptr))
+		return;
+#ifdef SSL_OP_ENABLE_KTLS
+	if (BIO_get_ktls_send(SSL_get_wbio(acptr->ssl)))
+	{
+		acptr->flags |= FLAGS_KTLS;
+		ircstp->is_sslktls++;
+		return;
+	}
+#endif
+	ircstp->is_sslktlsfail++;
+}
+
 void ircd_SSL_client_handshake(int fd, int revents, void *data)
 {
 	aClient *acptr = data;
@@ -449,6 +753,7 @@ void ircd_SSL_client_handshake(int fd, int revents, void *data)
 	SSL_set_fd(acptr->ssl, acptr->fd);
 	SSL_set_connect_state(acptr->ssl);
 	SSL_set_nonblocking(acptr->ssl);
+	ssl_want_ktls(acptr);
         if (iConf.ssl_renegotiate_bytes > 0)
 	{
           BIO_set_ssl_renegotiate_bytes(SSL_get_rbio(acptr->ssl), iConf.ssl_renegotiate_bytes);
@@ -523,7 +828,28 @@ int ircd_SSL_accept(aClient *acptr, int fd) {
 	return -1;
     }
 
-    start_of_normal_client_handshake(acptr);
+    if (SSL_session_reused((SSL *)acptr->ssl))
+    {
+	ircstp->is_sslresumed++;
+	if (SSL_get_ex_data((SSL *)acptr->ssl, ticket_exidx))
+		ircstp->is_sslticket++;
+    }
+    else
+	ircstp->is_sslfull++;
+    ssl_check_ktls(acptr);
+
+    if (IsSSLStartTLSHandshake(acptr))
+    {
+	/* Lookups are done and it is on unknown_list already,
+	 * just go on reading (now over SSL).
+	 */
+	SetUnknown(acptr);
+	fd_setselect(fd, FD_SELECT_WRITE, NULL, acptr);
+	fd_setselect(fd, FD_SELECT_READ | FD_SELECT_EDGE, read_packet, acptr);
+	return 1;
+    }
+
+    start_of_normal_client_handshake(acptr, NULL);
 
     return 1;
 }
@@ -558,6 +884,7 @@ int ircd_SSL_connect(aClient *acptr, int fd) {
 	return -1;
     }
 
+    ssl_check_ktls(acptr);
     fd_setselect(fd, FD_SELECT_READ | FD_SELECT_WRITE, NULL, acptr);
     completed_connection(fd, FD_SELECT_READ | FD_SELECT_WRITE, acptr);
 
@@ -0,0 +1,505 @@
+/*
+ * RabbitIRCD, src/userindex.c
+ * Copyright (c) 2014 The RabbitIRCD Team
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The user index: every user on the network sorted by nick, by
+ * username, by hostname (real and virtual host) and by IP address, so
+ * a wildcard search can look at the users that can match instead of
+ * matching every user against the mask.
+ *
+ * Each index is a skiplist of byte string keys. Nicks, usernames and
+ * hosts are sorted on their lowercased form, so a mask's literal prefix
+ * ("foo*", "1.2.3.*") is one range. Usernames and hosts are also kept
+ * reversed, so a literal suffix ("*.example.com") is one range as well.
+ * The text form of the IP is kept with the hosts, for masks like
+ * "*.12". IPs are also sorted on their binary form, so a CIDR mask is
+ * a range too.
+ * A field the mask can't match at all (a nick never contains a '.') is
+ * not searched.
+ *
+ * Nothing here decides whether a user matches, userindex_search() only
+ * returns the candidates, the caller still does the match().
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include <stddef.h>
+
+#define UI_MAXLEVEL	20
+
+/* What a user has in the index, see anUser->uindex */
+#define UI_SLOT_NICK		0
+#define UI_SLOT_USER		1
+#define UI_SLOT_REALHOST	2
+#define UI_SLOT_VIRTHOST	3
+#define UI_SLOT_IP		4
+#define UI_SLOT_USER_REV	5
+#define UI_SLOT_REALHOST_REV	6
+#define UI_SLOT_VIRTHOST_REV	7
+#define UI_SLOT_IPSTR		8
+#define UI_SLOT_IPSTR_REV	9
+
+/* The sorted lists, the realhost and virthost slots share them */
+#define UI_LIST_NICK		0
+#define UI_LIST_USER		1
+#define UI_LIST_HOST		2
+#define UI_LIST_IP		3
+#define UI_LIST_USER_REV	4
+#define UI_LIST_HOST_REV	5
+#define UI_LISTS		6
+
+static int ui_slotlist[USERINDEX_SLOTS] = {
+	UI_LIST_NICK, UI_LIST_USER, UI_LIST_HOST, UI_LIST_HOST, UI_LIST_IP,
+	UI_LIST_USER_REV, UI_LIST_HOST_REV, UI_LIST_HOST_REV, UI_LIST_HOST, UI_LIST_HOST_REV
+};
+
+struct UserIndexNode {
+	aClient *acptr;
+	u_char *key;			/* points past next[] */
+	u_short keylen;
+	u_short level;
+	struct UserIndexNode *next[1];	/* level entries */
+};
+
+typedef struct {
+	struct UserIndexNode *head;
+	int  level;
+	int  count;
+} UserIndexList;
+
+static UserIndexList uilist[UI_LISTS];
+
+/* userindex_search() result, valid until the next call */
+static aClient **ui_result;
+static int ui_resultmax;
+
+static int ui_cmp(struct UserIndexNode *n, const u_char *key, int keylen, aClient *acptr)
+{
+	int  c = memcmp(n->key, key, MIN(n->keylen, keylen));
+
+	if (c)
+		return c;
+	if (n->keylen != keylen)
+		return (n->keylen < keylen) ? -1 : 1;
+	if (n->acptr == acptr)
+		return 0;
+	return ((char *)n->acptr < (char *)acptr) ? -1 : 1;
+}
+
+static int ui_random_level(void)
+{
+	u_int32_t r = getrandom32();
+	int  level = 1;
+
+	/* p = 1/4 */
+	while ((r & 3) == 0 && level < UI_MAXLEVEL)
+	{
+		level++;
+		r >>= 2;
+	}
+	return level;
+}
+
+/*
+ * Find the last node before (key, acptr) on every level. The first
+ * node at or after it is returned. With acptr NULL that is the first
+ * node whose key is >= key.
+ */
+static struct UserIndexNode *ui_seek(UserIndexList *l, const u_char *key, int keylen, aClient *acptr,
+    struct UserIndexNode **update)
+{
+	struct UserIndexNode *x = l->head, *n;
+	int  i;
+
+	for (i = l->level - 1; i >= 0; i--)
+	{
+		while ((n = x->next[i]) && ui_cmp(n, key, keylen, acptr) < 0)
+			x = n;
+		if (update)
+			update[i] = x;
+	}
+	return x->next[0];
+}
+
+static struct UserIndexNode *ui_insert(UserIndexList *l, aClient *acptr, const u_char *key, int keylen)
+{
+	struct UserIndexNode *update[UI_MAXLEVEL], *n;
+	int  i, level;
+
+	if (!l->head)
+	{
+		l->head = MyMallocEx(offsetof(struct UserIndexNode, next) + sizeof(struct UserIndexNode *) * UI_MAXLEVEL);
+		l->head->level = UI_MAXLEVEL;
+		l->level = 1;
+	}
+
+	ui_seek(l, key, keylen, acptr, update);
+	level = ui_random_level();
+	for (i = l->level; i < level; i++)
+		update[i] = l->head;
+	if (level > l->level)
+		l->level = level;
+
+	n = MyMalloc(offsetof(struct UserIndexNode, next) + sizeof(struct UserIndexNode *) * level + keylen);
+	n->acptr = acptr;
+	n->key = (u_char *)&n->next[level];
+	memcpy(n->key, key, keylen);
+	n->keylen = keylen;
+	n->level = level;
+	for (i = 0; i < level; i++)
+	{
+		n->next[i] = update[i]->next[i];
+		update[i]->next[i] = n;
+	}
+	l->count++;
+	return n;
+}
+
+static void ui_remove(UserIndexList *l, struct UserIndexNode *n)
+{
+	struct UserIndexNode *update[UI_MAXLEVEL];
+	int  i;
+
+	ui_seek(l, n->key, n->keylen, n->acptr, update);
+	for (i = 0; i < n->level; i++)
+		update[i]->next[i] = n->next[i];
+	while (l->level > 1 && !l->head->next[l->level - 1])
+		l->level--;
+	MyFree(n);
+	l->count--;
+}
+
+/* Lowercase s into buf, reversed if asked to, returns the length */
+static int ui_foldkey(u_char *buf, const char *s, int reverse)
+{
+	int  len = strlen(s), i;
+
+	if (len > HOSTLEN)
+		len = HOSTLEN;
+	for (i = 0; i < len; i++)
+		buf[reverse ? len - 1 - i : i] = tolower(s[i]);
+	return len;
+}
+
+/* The key of a slot, 0 if the user has nothing for it */
+static int ui_slotkey(aClient *acptr, int slot, u_char *buf)
+{
+	anUser *user = acptr->user;
+	struct irc_netmask nm;
+	int  type;
+
+	switch (slot)
+	{
+	  case UI_SLOT_NICK:
+		  return ui_foldkey(buf, acptr->name, 0);
+	  case UI_SLOT_USER:
+	  case UI_SLOT_USER_REV:
+		  return ui_foldkey(buf, user->username, slot == UI_SLOT_USER_REV);
+	  case UI_SLOT_REALHOST:
+	  case UI_SLOT_REALHOST_REV:
+		  return ui_foldkey(buf, user->realhost, slot == UI_SLOT_REALHOST_REV);
+	  case UI_SLOT_VIRTHOST:
+	  case UI_SLOT_VIRTHOST_REV:
+		  if (!user->virthost || !strcasecmp(user->virthost, user->realhost))
+			  return 0;
+		  return ui_foldkey(buf, user->virthost, slot == UI_SLOT_VIRTHOST_REV);
+	  case UI_SLOT_IPSTR:
+	  case UI_SLOT_IPSTR_REV:
+		  if (!user->ip_str || !strcasecmp(user->ip_str, user->realhost))
+			  return 0;
+		  return ui_foldkey(buf, user->ip_str, slot == UI_SLOT_IPSTR_REV);
+	  case UI_SLOT_IP:
+		  if (!user->ip_str)
+			  return 0;
+		  type = parse_netmask(user->ip_str, &nm);
+		  if (type != HM_IPV4 && type != HM_IPV6)
+			  return 0;
+		  memcpy(buf, &nm.mask, sizeof(nm.mask));
+		  return sizeof(nm.mask);
+	}
+	return 0;
+}
+
+static void ui_setslot(aClient *acptr, int slot)
+{
+	UserIndexList *l = &uilist[ui_slotlist[slot]];
+	struct UserIndexNode *n = acptr->user->uindex[slot];
+	u_char key[HOSTLEN + 1];
+	int  keylen = ui_slotkey(acptr, slot, key);
+
+	if (n)
+	{
+		if (n->keylen == keylen && !memcmp(n->key, key, keylen))
+			return;
+		ui_remove(l, n);
+		n = NULL;
+	}
+	if (keylen)
+		n = ui_insert(l, acptr, key, keylen);
+	acptr->user->uindex[slot] = n;
+}
+
+/** A user was introduced, add it to all indexes */
+void userindex_add(aClient *acptr)
+{
+	int  slot;
+
+	if (!acptr->user || acptr->user->uindex[UI_SLOT_NICK])
+		return;
+	for (slot = 0; slot < USERINDEX_SLOTS; slot++)
+		ui_setslot(acptr, slot);
+}
+
+/** A user is going away */
+void userindex_del(aClient *acptr)
+{
+	struct UserIndexNode *n;
+	int  slot;
+
+	if (!acptr->user || !acptr->user->uindex[UI_SLOT_NICK])
+		return;
+	for (slot = 0; slot < USERINDEX_SLOTS; slot++)
+	{
+		if ((n = acptr->user->uindex[slot]))
+			ui_remove(&uilist[ui_slotlist[slot]], n);
+		acptr->user->uindex[slot] = NULL;
+	}
+}
+
+/**
+ * The nick, username, host or IP of a user changed. Users that are not
+ * in the index yet (still registering) are left alone.
+ */
+void userindex_update(aClient *acptr)
+{
+	int  slot;
+
+	if (!acptr->user || !acptr->user->uindex[UI_SLOT_NICK])
+		return;
+	for (slot = 0; slot < USERINDEX_SLOTS; slot++)
+		ui_setslot(acptr, slot);
+}
+
+static void ui_addresult(aClient *acptr, int *count)
+{
+	if (acptr->serial == current_serial)
+		return;
+	acptr->serial = current_serial;
+	if (*count == ui_resultmax)
+	{
+		ui_resultmax = ui_resultmax ? ui_resultmax * 2 : 256;
+		ui_result = MyRealloc(ui_result, sizeof(aClient *) * ui_resultmax);
+	}
+	ui_result[(*count)++] = acptr;
+}
+
+/*
+ * Add every user whose key in list l starts with the first 'bits' bits
+ * of key.
+ */
+static void ui_collect(UserIndexList *l, const u_char *key, int bits, int *count)
+{
+	struct UserIndexNode *n;
+	int  full = bits / 8, rem = bits % 8;
+	u_char start[HOSTLEN + 1], m = 0;
+
+	if (!l->head)
+		return;
+	memcpy(start, key, full);
+	if (rem)
+	{
+		m = (u_char)(0xff << (8 - rem));
+		start[full] = key[full] & m;
+	}
+	for (n = ui_seek(l, start, full + (rem ? 1 : 0), NULL, NULL); n; n = n->next[0])
+	{
+		if (n->keylen < full + (rem ? 1 : 0) || memcmp(n->key, start, full))
+			break;
+		if (rem && (n->key[full] & m) != start[full])
+			break;
+		ui_addresult(n->acptr, count);
+	}
+}
+
+/* Length of the part of mask before the first wildcard */
+static int ui_literal_prefix(const char *mask)
+{
+	int  i;
+
+	for (i = 0; mask[i] && mask[i] != '*' && mask[i] != '?'; i++)
+		;
+	return i;
+}
+
+/* Length of the part of mask after the last wildcard */
+static int ui_literal_suffix(const char *mask)
+{
+	int  len = strlen(mask), i;
+
+	for (i = 0; i < len && mask[len - 1 - i] != '*' && mask[len - 1 - i] != '?'; i++)
+		;
+	return i;
+}
+
+/* The shortest string mask can match: everything but the '*'s */
+static int ui_min_length(const char *mask)
+{
+	int  len = 0;
+
+	for (; *mask; mask++)
+		if (*mask != '*')
+			len++;
+	return len;
+}
+
+/* Can some nick match mask? Not if it has a character no nick can have */
+static int ui_nickmask_possible(const char *mask)
+{
+	extern const char *illegalnickchars;
+
+	if (ui_min_length(mask) > NICKLEN)
+		return 0;
+	for (; *mask; mask++)
+		if (*mask != '*' && *mask != '?' &&
+		    ((u_char)*mask <= 32 || strchr(illegalnickchars, *mask)))
+			return 0;
+	return 1;
+}
+
+/*
+ * Collect the users whose key in the forward list starts with the
+ * mask's literal prefix, or whose key in the reversed list starts with
+ * its reversed literal suffix, whichever is longer. Returns 0 if the
+ * mask has neither.
+ */
+static int ui_collect_affix(int fwd, int rev, const char *mask, int pre, int suf, int *count)
+{
+	u_char key[HOSTLEN + 1];
+	char tmp[HOSTLEN + 1];
+
+	if (suf && suf >= pre)
+		ui_collect(&uilist[rev], key, ui_foldkey(key, mask + strlen(mask) - suf, 1) * 8, count);
+	else if (pre)
+	{
+		strlcpy(tmp, mask, pre + 1);
+		ui_collect(&uilist[fwd], key, ui_foldkey(key, tmp, 0) * 8, count);
+	}
+	else
+		return 0;
+	return 1;
+}
+
+/* IPv4 masks count their bits from the start of the IPv4 part */
+static int ui_netmask_bits(struct irc_netmask *nm, int type)
+{
+#ifdef INET6
+	if (type == HM_IPV4)
+		return nm->bits + 96;
+#endif
+	return nm->bits;
+}
+
+/* Can the string form of some IP address match mask? */
+static int ui_ipmask_possible(const char *mask)
+{
+	for (; *mask; mask++)
+		if (!isxdigit(*mask) && *mask != ':' && *mask != '.' && *mask != '*' && *mask != '?')
+			return 0;
+	return 1;
+}
+
+/**
+ * Users that might match mask on any of the given USERINDEX_ fields,
+ * without duplicates. The array stays valid until the next call.
+ * Returns NULL if the mask does not narrow the search for one of the
+ * fields (e.g. "*foo*"), the caller has to look at every user then.
+ */
+aClient **userindex_search(const char *mask, int fields, int *count)
+{
+	int  pre = ui_literal_prefix(mask), suf = ui_literal_suffix(mask);
+	int  minlen = ui_min_length(mask);
+
+	*count = 0;
+	if (pre > HOSTLEN || suf > HOSTLEN)
+		return NULL;
+
+	/* Drop the fields the mask can't match, then decide whether the
+	 * index helps for the rest before collecting anything.
+	 */
+	if ((fields & USERINDEX_NICK) && !ui_nickmask_possible(mask))
+		fields &= ~USERINDEX_NICK;
+	if ((fields & USERINDEX_USER) && minlen > USERLEN)
+		fields &= ~USERINDEX_USER;
+	if ((fields & (USERINDEX_REALHOST|USERINDEX_VIRTHOST)) && minlen > HOSTLEN)
+		fields &= ~(USERINDEX_REALHOST|USERINDEX_VIRTHOST);
+	if ((fields & USERINDEX_IP) && !ui_ipmask_possible(mask))
+		fields &= ~USERINDEX_IP;
+
+	if ((fields & USERINDEX_NICK) && !pre)
+		return NULL;
+	if ((fields & (USERINDEX_USER|USERINDEX_REALHOST|USERINDEX_VIRTHOST|USERINDEX_IP)) &&
+	    !pre && !suf)
+		return NULL;
+
+	++current_serial;
+	if (!ui_result)
+	{
+		ui_resultmax = 256;
+		ui_result = MyMalloc(sizeof(aClient *) * ui_resultmax);
+	}
+	if (fields & USERINDEX_NICK)
+		ui_collect_affix(UI_LIST_NICK, UI_LIST_NICK, mask, pre, 0, count);
+	if (fields & USERINDEX_USER)
+		ui_collect_affix(UI_LIST_USER, UI_LIST_USER_REV, mask, pre, suf, count);
+	if (fields & (USERINDEX_REALHOST|USERINDEX_VIRTHOST|USERINDEX_IP))
+		ui_collect_affix(UI_LIST_HOST, UI_LIST_HOST_REV, mask, pre, suf, count);
+	return ui_result;
+}
+
+/**
+ * Users within a CIDR mask, 'type' is what parse_netmask() returned
+ * for it. Like userindex_search(), without the NULL case.
+ */
+aClient **userindex_search_ip(struct irc_netmask *nm, int type, int *count)
+{
+	*count = 0;
+	++current_serial;
+	ui_collect(&uilist[UI_LIST_IP], (u_char *)&nm->mask, ui_netmask_bits(nm, type), count);
+	return ui_result;
+}
+
+void count_userindex_memory(int *count, u_long *memory)
+{
+	struct UserIndexNode *n;
+	int  i;
+
+	*count = 0;
+	*memory = sizeof(aClient *) * ui_resultmax;
+	for (i = 0; i < UI_LISTS; i++)
+	{
+		if (!uilist[i].head)
+			continue;
+		*memory += offsetof(struct UserIndexNode, next) + sizeof(struct UserIndexNode *) * UI_MAXLEVEL;
+		for (n = uilist[i].head->next[0]; n; n = n->next[0])
+			*memory += offsetof(struct UserIndexNode, next) + sizeof(struct UserIndexNode *) * n->level + n->keylen;
+		*count += uilist[i].count;
+	}
+}
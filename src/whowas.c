@@ -28,8 +28,38 @@
 #include "msg.h"
 #include <string.h>
 
+/*
+ * The history lives in one ring arena: every entry is a single variable
+ * length record (see aWhowas in struct.h) appended at the head, and the
+ * oldest records are dropped from the tail to make room. When the end of
+ * the arena is reached, writing continues at the start and 'wrap' marks
+ * where the old records end:
+ *
+ *   not wrapped:  [ free | tail .. head | free ]
+ *   wrapped:      [ 0 .. head | free | tail .. wrap | unused ]
+ *
+ * The arena is sized for set::whowas-history-length records of average
+ * size, so with unusually long hosts/realnames it may hold a bit less.
+ * Lookups go through a hash of the nicks, chains are newest first.
+ */
+
 /* externally defined functions */
-unsigned int hash_whowas_name(char *);	/* defined in hash.c */
+unsigned hash_nick_name(const char *);	/* defined in hash.c */
+
+#define WHOWAS_ALIGN(x)		(((x) + 7) & ~7)
+#define WHOWAS_RECORD_AVG	(sizeof(aWhowas) + 96)
+#define WHOWAS_RECORD_MAX	WHOWAS_ALIGN(sizeof(aWhowas) + NICKLEN + USERLEN + \
+				    2 * HOSTLEN + REALLEN + 5)
+#define WHOWAS_HASH_MIN		256
+
+static char *ww_arena = NULL;
+static size_t ww_size = 0;
+static size_t ww_head = 0, ww_tail = 0, ww_wrap = 0;
+static size_t ww_used = 0;
+static int ww_count = 0, ww_max = 0;
+
+static aWhowas **ww_hash = NULL;
+static unsigned int ww_hashmask = 0;
 
 /* internally defined function */
 static void add_whowas_to_clist(aWhowas **, aWhowas *);
@@ -37,51 +67,87 @@ static void del_whowas_from_clist(aWhowas **, aWhowas *);
 static void add_whowas_to_list(aWhowas **, aWhowas *);
 static void del_whowas_from_list(aWhowas **, aWhowas *);
 
-aWhowas MODVAR WHOWAS[NICKNAMEHISTORYLENGTH];
-aWhowas MODVAR *WHOWASHASH[WW_MAX];
+#define WHOWAS_BUCKET(name)	(&ww_hash[hash_nick_name(name) & ww_hashmask])
 
-MODVAR int  whowas_next = 0;
-#define AllocCpy(x,y) x = (char *) MyMalloc(strlen(y) + 1); strcpy(x,y)
-#define SafeFree(x) if (x) { MyFree((x)); (x) = NULL; }
+/* Drop the oldest record */
+static void ww_evict(void)
+{
+	aWhowas *old = (aWhowas *)(ww_arena + ww_tail);
 
-void add_history(aClient *cptr, int online)
+	if (old->online)
+		del_whowas_from_clist(&(old->online->user->whowas), old);
+	del_whowas_from_list(WHOWAS_BUCKET(WHOWAS_NAME(old)), old);
+
+	ww_tail += old->len;
+	ww_used -= old->len;
+	if (ww_wrap && ww_tail == ww_wrap)
+		ww_tail = ww_wrap = 0;
+	if (--ww_count == 0)
+		ww_head = ww_tail = ww_wrap = 0;
+}
+
+/* Make room for a record of len bytes at the head and return it */
+static aWhowas *ww_alloc(size_t len)
 {
 	aWhowas *new;
 
-	new = &WHOWAS[whowas_next];
+	while (ww_count >= ww_max)
+		ww_evict();
 
-	if (new->hashv != -1)
+	for (;;)
 	{
-		SafeFree(new->name);
-		SafeFree(new->hostname);
-		SafeFree(new->virthost);
-		SafeFree(new->realname);
-		SafeFree(new->username);
-		new->servername = NULL;
-
-		if (new->online)
-			del_whowas_from_clist(&(new->online->user->whowas), new);
-		del_whowas_from_list(&WHOWASHASH[new->hashv], new);
+		if (ww_count == 0)
+			ww_head = ww_tail = ww_wrap = 0;
+		if (!ww_wrap)
+		{
+			if (ww_head + len <= ww_size)
+				break;
+			ww_wrap = ww_head;
+			ww_head = 0;
+			continue;
+		}
+		if (ww_head + len <= ww_tail)
+			break;
+		ww_evict();
 	}
-	new->hashv = hash_whowas_name(cptr->name);
+
+	new = (aWhowas *)(ww_arena + ww_head);
+	ww_head += len;
+	ww_used += len;
+	ww_count++;
+	return new;
+}
+
+void add_history(aClient *cptr, int online)
+{
+	aWhowas *new;
+	char *virthost = cptr->user->virthost ? cptr->user->virthost : "";
+	size_t nl, ul, hl, vl, rl, len;
+
+	nl = strlen(cptr->name) + 1;
+	ul = strlen(cptr->user->username) + 1;
+	hl = strlen(cptr->user->realhost) + 1;
+	vl = strlen(virthost) + 1;
+	rl = strlen(cptr->info) + 1;
+	len = WHOWAS_ALIGN(offsetof(aWhowas, data) + nl + ul + hl + vl + rl);
+
+	new = ww_alloc(len);
+	new->len = len;
 	new->logoff = TStime();
 	new->umodes = cptr->umodes;
-	AllocCpy(new->name, cptr->name);
-	AllocCpy(new->username, cptr->user->username);
-	AllocCpy(new->hostname, cptr->user->realhost);
-	if (cptr->user->virthost)
-	{
-		AllocCpy(new->virthost, cptr->user->virthost);
-	}
-	else
-		new->virthost = strdup("");
-	new->servername = cptr->user->server;
-	AllocCpy(new->realname, cptr->info);
+	new->username_off = nl;
+	new->hostname_off = new->username_off + ul;
+	new->virthost_off = new->hostname_off + hl;
+	new->realname_off = new->virthost_off + vl;
+	memcpy(WHOWAS_NAME(new), cptr->name, nl);
+	memcpy(WHOWAS_USERNAME(new), cptr->user->username, ul);
+	memcpy(WHOWAS_HOSTNAME(new), cptr->user->realhost, hl);
+	memcpy(WHOWAS_VIRTHOST(new), virthost, vl);
+	memcpy(WHOWAS_REALNAME(new), cptr->info, rl);
 
 	/* Its not string copied, a pointer to the scache hash is copied
 	   -Dianora
 	 */
-	/*  strlcpy(new->servername, cptr->user->server,HOSTLEN); */
 	new->servername = cptr->user->server;
 
 	if (online)
@@ -90,11 +156,11 @@ void add_history(aClient *cptr, int online)
 		add_whowas_to_clist(&(cptr->user->whowas), new);
 	}
 	else
+	{
 		new->online = NULL;
-	add_whowas_to_list(&WHOWASHASH[new->hashv], new);
-	whowas_next++;
-	if (whowas_next == NICKNAMEHISTORYLENGTH)
-		whowas_next = 0;
+		new->cnext = new->cprev = NULL;
+	}
+	add_whowas_to_list(WHOWAS_BUCKET(WHOWAS_NAME(new)), new);
 }
 
 void off_history(aClient *cptr)
@@ -112,14 +178,11 @@ void off_history(aClient *cptr)
 aClient *get_history(char *nick, time_t timelimit)
 {
 	aWhowas *temp;
-	int  blah;
 
 	timelimit = TStime() - timelimit;
-	blah = hash_whowas_name(nick);
-	temp = WHOWASHASH[blah];
-	for (; temp; temp = temp->next)
+	for (temp = *WHOWAS_BUCKET(nick); temp; temp = temp->next)
 	{
-		if (mycmp(nick, temp->name))
+		if (mycmp(nick, WHOWAS_NAME(temp)))
 			continue;
 		if (temp->logoff < timelimit)
 			continue;
@@ -128,37 +191,90 @@ aClient *get_history(char *nick, time_t timelimit)
 	return NULL;
 }
 
-void count_whowas_memory(int *wwu, u_long *wwum)
+aWhowas *whowas_bucket(char *nick)
 {
-	aWhowas *tmp;
-	int  i;
-	int  u = 0;
-	u_long um = 0;
-	/* count the number of used whowas structs in 'u' */
-	/* count up the memory used of whowas structs in um */
+	return *WHOWAS_BUCKET(nick);
+}
 
-	for (i = 0, tmp = &WHOWAS[0]; i < NICKNAMEHISTORYLENGTH; i++, tmp++)
-		if (tmp->hashv != -1)
-		{
-			u++;
-			um += sizeof(aWhowas);
-		}
-	*wwu = u;
-	*wwum = um;
-	return;
+void count_whowas_memory(int *entries, u_long *used, u_long *allocated)
+{
+	*entries = ww_count;
+	*used = ww_used;
+	*allocated = ww_size + sizeof(aWhowas *) * (ww_hashmask + 1);
 }
 
-void initwhowas()
+/*
+ * Change the depth of the history to max entries, keeping the newest
+ * ones. The records are packed into a new arena and rehashed, so every
+ * pointer to them (hash chains, client lists) is fixed up here.
+ */
+void whowas_resize(int max)
 {
+	char *arena;
+	aWhowas **hash, *old, *new;
+	size_t size, p, o;
+	unsigned int hashsize;
 	int  i;
 
-	for (i = 0; i < NICKNAMEHISTORYLENGTH; i++)
+	if (max < 1)
+		max = 1;
+	size = max * WHOWAS_RECORD_AVG;
+	if (size < 2 * WHOWAS_RECORD_MAX)
+		size = 2 * WHOWAS_RECORD_MAX;
+	if (ww_arena && max == ww_max && size == ww_size)
+		return;
+	for (hashsize = WHOWAS_HASH_MIN; hashsize < (unsigned int)max; hashsize <<= 1)
+		;
+
+	ww_max = max;
+	while (ww_count > ww_max || ww_used > size)
+		ww_evict();
+
+	arena = MyMalloc(size);
+	hash = MyMallocEx(sizeof(aWhowas *) * hashsize);
+
+	/* Copy oldest first, leaving a forwarding pointer in the old next */
+	for (i = 0, p = ww_tail, o = 0; i < ww_count; i++)
+	{
+		if (ww_wrap && p == ww_wrap)
+			p = 0;
+		old = (aWhowas *)(ww_arena + p);
+		new = (aWhowas *)(arena + o);
+		memcpy(new, old, old->len);
+		old->next = new;
+		p += old->len;
+		o += new->len;
+	}
+
+	for (i = 0, o = 0; i < ww_count; i++)
 	{
-		bzero((char *)&WHOWAS[i], sizeof(aWhowas));
-		WHOWAS[i].hashv = -1;
+		new = (aWhowas *)(arena + o);
+		if (new->cnext)
+			new->cnext = new->cnext->next;
+		if (new->cprev)
+			new->cprev = new->cprev->next;
+		else if (new->online)
+			new->online->user->whowas = new;
+		add_whowas_to_list(&hash[hash_nick_name(WHOWAS_NAME(new)) & (hashsize - 1)], new);
+		o += new->len;
 	}
-	for (i = 0; i < WW_MAX; i++)
-		WHOWASHASH[i] = NULL;
+
+	if (ww_arena)
+		MyFree(ww_arena);
+	if (ww_hash)
+		MyFree(ww_hash);
+	ww_arena = arena;
+	ww_size = size;
+	ww_hash = hash;
+	ww_hashmask = hashsize - 1;
+	ww_tail = ww_wrap = 0;
+	ww_head = o;
+}
+
+void initwhowas()
+{
+	/* Until the config is loaded, then set::whowas-history-length */
+	whowas_resize(NICKNAMEHISTORYLENGTH);
 }
 
 static void add_whowas_to_clist(aWhowas ** bucket, aWhowas * whowas)